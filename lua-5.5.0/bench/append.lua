@@ -0,0 +1,55 @@
+-- $Id: bench/append.lua $
+-- See Copyright Notice in file lua.h
+
+-- Building large arrays by appending. 'worst' is the slowest single
+-- append that made the array part grow. Usage: lua append.lua [n]
+
+local N = tonumber(arg and arg[1]) or 10000000
+local clock = os.clock
+
+local function run (name, f)
+  collectgarbage(); collectgarbage()
+  local t0 = clock()
+  local worst = f()
+  print(string.format("%-24s total %.3f s  worst resize %.1f ms",
+                      name, clock() - t0, worst * 1000))
+end
+
+local function pow2 (i) return i & (i - 1) == 0 end
+
+-- time the appends that may grow the array part (at powers of 2)
+local function build (t, n)
+  local worst = 0
+  for i = 1, n do
+    if pow2(i - 1) then
+      local c = clock()
+      t[#t + 1] = i
+      c = clock() - c
+      if c > worst then worst = c end
+    else
+      t[#t + 1] = i
+    end
+  end
+  assert(#t == n)
+  return worst
+end
+
+run("t[#t+1] = i", function () return build({}, N) end)
+
+run("t[i] = i", function ()
+  local t = {}
+  for i = 1, N do t[i] = i end
+  return 0
+end)
+
+run("table.insert(t, i)", function ()
+  local t, ins = {}, table.insert
+  for i = 1, N do ins(t, i) end
+  return 0
+end)
+
+run("with 100k hash keys", function ()
+  local t = {}
+  for i = 1, 100000 do t["k" .. i] = i end
+  return build(t, N // 10)
+end)
@@ -0,0 +1,59 @@
+-- $Id: bench/fields.lua $
+-- See Copyright Notice in file lua.h
+
+-- Field accesses through the inline caches of OP_GETFIELD, OP_SETFIELD,
+-- OP_GETTABUP, OP_SETTABUP and OP_SELF. Compare a normal build with one
+-- made with MYCFLAGS=-DLUA_USE_ICACHE=0. Usage: lua fields.lua [scale]
+
+local N = tonumber(arg and arg[1]) or 1
+
+local function time (name, f)
+  local best = math.huge
+  for _ = 1, 3 do
+    collectgarbage()
+    local t0 = os.clock()
+    f()
+    best = math.min(best, os.clock() - t0)
+  end
+  print(string.format("%-28s %.3f", name, best))
+end
+
+-- a record with many fields: several share a chain in the hash part
+local function newrec ()
+  return {x = 1, y = 2, z = 3, w = 4, name = "r", id = 7, mass = 1.5,
+          vx = 0.5, vy = 0.25, vz = 0.125, tag = "t", flags = 0,
+          parent = false, left = false, right = false, color = 0}
+end
+
+time("record fields", function ()
+  local r = newrec()
+  for _ = 1, 2000000 * N do
+    r.x = r.vx + r.mass * r.vy
+    r.y = r.vz + r.color + r.flags
+    r.z = r.x + r.y + r.id
+  end
+end)
+
+-- methods found through __index of a class with many methods
+local Class = {}
+Class.__index = Class
+for i = 1, 40 do Class["m" .. i] = function (self) return self.v end end
+function Class:get () return self.v end
+function Class:add (d) self.v = self.v + d end
+
+time("methods via __index", function ()
+  local o = setmetatable({v = 0}, Class)
+  for _ = 1, 2000000 * N do
+    o:add(1)
+    o:add(o:get())
+    o:m17()
+  end
+end)
+
+-- globals (GETTABUP/SETTABUP on a full _ENV)
+counter = 0
+time("globals", function ()
+  for _ = 1, 3000000 * N do
+    counter = counter + math.pi * string.len("x")
+  end
+end)
@@ -0,0 +1,53 @@
+-- $Id: bench/rehash.lua $
+-- See Copyright Notice in file lua.h
+
+-- Latency of incremental rehashes. Fills a table with 'n' string keys
+-- and reports the slowest single insertion; then, for tables caught in
+-- the middle of a rehash, the slowest first call to 'next' and the
+-- slowest 'table.clone'. Usage: lua rehash.lua [n]
+
+local N = tonumber(arg and arg[1]) or 4000000
+local clock = os.clock
+local stats = debug.tablestats
+
+local keys = {}
+for i = 1, N do keys[i] = "key" .. i end
+collectgarbage(); collectgarbage("stop")
+
+local t = {}
+local worst, total = 0, clock()
+local mid = {}   -- sizes where a rehash is in progress
+for i = 1, N do
+  local c = clock()
+  t[keys[i]] = i
+  c = clock() - c
+  if c > worst then worst = c end
+  local p = i - 256   -- a rehash starts when a power of 2 is passed
+  if p >= 65536 and p & (p - 1) == 0 and stats(t).oldsize > 0 then
+    mid[#mid + 1] = i
+  end
+end
+total = clock() - total
+print(string.format("insert %d keys      total %.3f s  worst %.2f ms",
+                    N, total, worst * 1000))
+
+-- rebuild a table up to each size caught above and time its traversal
+local worstnext, worstclone = 0, 0
+for _, n in ipairs(mid) do
+  local u = {}
+  for i = 1, n do u[keys[i]] = i end
+  assert(stats(u).oldsize > 0)
+  local c = clock()
+  next(u)
+  c = clock() - c
+  if c > worstnext then worstnext = c end
+  c = clock()
+  table.clone(u)
+  c = clock() - c
+  if c > worstclone then worstclone = c end
+  collectgarbage()
+end
+print(string.format("first next (%d tables)    worst %.2f ms",
+                    #mid, worstnext * 1000))
+print(string.format("table.clone               worst %.2f ms",
+                    worstclone * 1000))
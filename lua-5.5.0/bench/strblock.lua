@@ -0,0 +1,56 @@
+-- $Id: bench/strblock.lua $
+-- See Copyright Notice in file lua.h
+
+-- Throughput (MB/s, best of 3) of the string functions that work on
+-- blocks of bytes, for subjects of 1 KB to 100 MB. Each size processes
+-- about 64 MB in total (at least one call). The "find (' ')" case looks
+-- for a pattern whose first byte is common in the subject.
+-- Usage: lua strblock.lua [maxsize]
+
+local maxsize = tonumber(arg and arg[1]) or 100 << 20
+local clock = os.clock
+local TOTAL = 1 << 26
+
+local base =
+  "The quick brown fox jumps over the lazy dog. Lorem Ipsum 0123456789! "
+
+local sizes = {}
+for _, s in ipairs{1 << 10, 1 << 16, 1 << 20, 100 << 20} do
+  if s <= maxsize then sizes[#sizes + 1] = s end
+end
+
+local cases = {
+  {"lower", string.lower},
+  {"upper", string.upper},
+  {"reverse", string.reverse},
+  {"find", function (s) return s:find("lazy dog!", 1, true) end},
+  {"find (' ')", function (s)
+    return s:find(" over the lazy cat", 1, true)
+  end},
+  {"rep \"ab\"", function (s) return ("ab"):rep(#s // 2) end},
+}
+
+local head = {string.format("%-12s", "size")}
+for i, s in ipairs(sizes) do
+  head[i + 1] = string.format("%9s", s < 1 << 20 and (s >> 10) .. " KB"
+                                      or (s >> 20) .. " MB")
+end
+print(table.concat(head))
+
+for _, c in ipairs(cases) do
+  local name, f = c[1], c[2]
+  local line = {string.format("%-12s", name)}
+  for i, size in ipairs(sizes) do
+    local s = base:rep(size // #base + 1):sub(1, size)
+    local iters = math.max(1, TOTAL // size)
+    local best = math.huge
+    for _ = 1, 3 do
+      local t0 = clock()
+      for _ = 1, iters do f(s) end
+      best = math.min(best, clock() - t0)
+    end
+    line[i + 1] = string.format("%9.0f", size * iters / best / 1e6)
+    s = nil; collectgarbage()
+  end
+  print(table.concat(line))
+end
@@ -0,0 +1,85 @@
+-- $Id: bench/strhash.lua $
+-- See Copyright Notice in file lua.h
+
+-- String hashing: cost of interning new strings, of using new strings
+-- as table keys (long strings are hashed there), and how well the hash
+-- spreads typical key sets over a table.
+-- Compare against a build with -DLUA_USE_WORDHASH=0.
+-- Usage: lua strhash.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+local clock = os.clock
+local sub = string.sub
+
+local function best (f)
+  local b = math.huge
+  for _ = 1, 3 do
+    collectgarbage(); collectgarbage()
+    local t0 = clock()
+    f()
+    b = math.min(b, clock() - t0)
+  end
+  return b
+end
+
+-- a source text whose substrings are (almost all) distinct
+local src = {}
+for i = 1, 4096 do src[i] = string.format("%07x", i * 2654435761 % 2^28) end
+src = table.concat(src)
+local maxoff = #src - 400
+
+local NMAKE = math.floor(2e6 * scale)
+local NSET = math.floor(1.2e6 * scale)
+
+print("interning (best of 3, seconds)")
+for _, len in ipairs{4, 16, 40, 100, 400} do
+  local make = best(function ()
+    local o = 0
+    for _ = 1, NMAKE do
+      local _ = sub(src, o + 1, o + len)
+      o = (o + 7) % maxoff
+    end
+  end)
+  local tab = best(function ()
+    local t, o = {}, 0
+    for i = 1, NSET do
+      t[sub(src, o + 1, o + len)] = i
+      local _ = t[sub(src, o + 2, o + len + 1)]
+      o = (o + 7) % maxoff
+    end
+  end)
+  print(string.format("  len %3d   make %.3f   table %.3f", len, make, tab))
+end
+
+print("collisions (avgchain / keys not in their main position)")
+local function collide (name, fill)
+  local t = {}
+  fill(t)
+  local s = debug.tablestats(t)
+  print(string.format("  %-26s %.3f / %.1f%%", name, s.avgchain,
+                      s.notmain * 100 / s.hashlive))
+end
+
+collide('"k1".."k100000"', function (t)
+  for i = 1, 100000 do t["k" .. i] = true end
+end)
+
+collide('"%08d"', function (t)
+  for i = 1, 100000 do t[string.format("%08d", i)] = true end
+end)
+
+collide("all 65536 2-byte strings", function (t)
+  for a = 0, 255 do
+    for b = 0, 255 do t[string.char(a, b)] = true end
+  end
+end)
+
+collide("random 12-byte strings", function (t)
+  math.randomseed(42)
+  local rnd, char = math.random, string.char
+  for _ = 1, 100000 do
+    t[char(rnd(0, 255), rnd(0, 255), rnd(0, 255), rnd(0, 255),
+           rnd(0, 255), rnd(0, 255), rnd(0, 255), rnd(0, 255),
+           rnd(0, 255), rnd(0, 255), rnd(0, 255), rnd(0, 255))] = true
+  end
+end)
@@ -0,0 +1,73 @@
+-- $Id: bench/strtab.lua $
+-- See Copyright Notice in file lua.h
+
+-- Pauses caused by resizing the short-string table, with millions of
+-- strings "str1".."strN": the slowest single string creation with the
+-- collector stopped and running, and the throughput of creating and
+-- finding the strings. Usage: lua strtab.lua [n]
+
+local N = tonumber(arg and arg[1]) or 3000000
+local clock = os.clock
+
+-- slowest call of 'f(i)' for i = 1, n
+local function worst (n, f)
+  local w = 0
+  for i = 1, n do
+    local c = clock()
+    f(i)
+    c = clock() - c
+    if c > w then w = c end
+  end
+  return w
+end
+
+local function report (name, w)
+  print(string.format("%-30s %.2f ms", name, w * 1000))
+end
+
+-- with the collector stopped, any pause comes from growing the string
+-- table ('keep' is preallocated so it never grows)
+collectgarbage(); collectgarbage("stop")
+local keep = table.create(N)
+report("worst create (gc stopped)",
+       worst(N, function (i) keep[i] = "str" .. i end))
+keep = nil
+collectgarbage("restart"); collectgarbage()
+
+-- with the collector running, pauses include its steps; the longest
+-- ones mark 'keep' and are not related to the string table
+collectgarbage("incremental")
+keep = table.create(N)
+report("worst create (gc running)",
+       worst(N, function (i) keep[i] = "str" .. i end))
+keep = nil
+local junk   -- strings die and the table shrinks while this runs
+report("worst after drop (gc running)", worst(N, function (i)
+  junk = (i % 16 == 0) and "new" .. i or {i}
+end))
+junk = nil
+
+-- best of 5, with the collector stopped while timing
+local function best (f)
+  local b = math.huge
+  for _ = 1, 5 do
+    collectgarbage("restart"); collectgarbage(); collectgarbage("stop")
+    local t0 = clock()
+    f()
+    b = math.min(b, clock() - t0)
+  end
+  collectgarbage("restart")
+  return b
+end
+
+local create = best(function ()
+  local t = table.create(N)
+  for i = 1, N do t[i] = "str" .. i end
+end)
+keep = table.create(N)
+for i = 1, N do keep[i] = "str" .. i end
+local find = best(function ()   -- the strings exist already
+  for i = 1, N do local _ = "str" .. i end
+end)
+print(string.format("%-30s create %.3f s  find %.3f s", "best of 5",
+                    create, find))
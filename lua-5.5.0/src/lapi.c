@@ -860,6 +860,7 @@ LUA_API const char *lua_tolstring(lua_State *L, int idx, size_t *len)
     luaC_checkGC(L);         /* 转换可能创建新字符串,检查 GC */
     o = index2value(L, idx); /* 前面的调用可能重新分配栈 */
   }
+  luaS_flat(L, tsvalue(o), 1); /* Rope 视图需要独立的结尾 '\0' */
   lua_unlock(L);
   if (len != NULL)
     return getlstr(tsvalue(o), *len); /* 获取字符串和长度 */
@@ -1494,6 +1495,37 @@ LUA_API void lua_createtable(lua_State *L, int narray, int nrec)
   lua_unlock(L);
 }
 
+/*
+** 压入表的浅拷贝 (见 lua.h)
+**
+** 说明:
+** - 与 lua_createtable 一样,新表先压栈再分配各部分,
+**   以免分配内存时触发的紧急回收把它当作垃圾
+*/
+LUA_API void lua_clonetable(lua_State *L, int idx)
+{
+  Table *src;
+  Table *t;
+  lua_lock(L);
+  src = gettable(L, idx);
+  t = luaH_new(L);             /* 创建新表 */
+  sethvalue2s(L, L->top.p, t); /* 压栈 */
+  api_incr_top(L);
+  luaH_copy(L, t, src);        /* 整块复制数组部分和哈希部分 */
+  luaC_checkGC(L);
+  lua_unlock(L);
+}
+
+/*
+** 清空表但保留其内存 (见 lua.h)
+*/
+LUA_API void lua_cleartable(lua_State *L, int idx)
+{
+  lua_lock(L);
+  luaH_clear(L, gettable(L, idx));
+  lua_unlock(L);
+}
+
 /*
 ** 获取元表
 **
@@ -1687,6 +1719,122 @@ LUA_API void lua_seti(lua_State *L, int idx, lua_Integer n)
   lua_unlock(L);
 }
 
+/*
+** 检查区间 [i, e] 是否非空且整个落在表 t 的数组部分内
+*/
+#define inarray(t, i, e) \
+  (1 <= (i) && (i) <= (e) && l_castS2U(e) <= (t)->asize)
+
+/*
+** 批量获取数组部分的一段 (见 lua.h)
+**
+** 说明:
+** - 只有表没有 __index 元方法时才可行: 否则空槽位会触发元方法
+** - 空槽位压入 nil(栈上不能出现空值)
+*/
+LUA_API int lua_getrange(lua_State *L, int idx, lua_Integer i, lua_Integer e)
+{
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttistable(o))
+  {
+    Table *t = hvalue(o);
+    if (inarray(t, i, e) && fasttm(L, t->metatable, TM_INDEX) == NULL)
+    {
+      unsigned k;
+      api_check(L, e - i < L->ci->top.p - L->top.p, "stack overflow");
+      for (k = cast_uint(i) - 1; k < cast_uint(e); k++)
+      {
+        lu_byte tag = *getArrTag(t, k);
+        if (tagisempty(tag))
+          setnilvalue(s2v(L->top.p));
+        else
+          farr2val(t, k, tag, s2v(L->top.p));
+        L->top.p++;
+      }
+      res = 1;
+    }
+  }
+  lua_unlock(L);
+  return res;
+}
+
+/*
+** 批量移动数组部分的一段 (见 lua.h)
+**
+** 说明:
+** - 源表不能有 __index,目标表不能有 __newindex,两段都必须在数组部分内;
+**   此时逐个的 get/set 都是原始访问,不会调用元方法也不会重哈希
+** - 实际复制(包括写屏障和长度提示)由 luaH_movearray 完成
+*/
+LUA_API int lua_moverange(lua_State *L, int from, lua_Integer f,
+                          lua_Integer e, int to, lua_Integer t)
+{
+  const TValue *o1, *o2;
+  int res = 0;
+  lua_lock(L);
+  o1 = index2value(L, from);
+  o2 = index2value(L, to);
+  if (ttistable(o1) && ttistable(o2))
+  {
+    Table *src = hvalue(o1);
+    Table *dst = hvalue(o2);
+    if (inarray(src, f, e))
+    {
+      unsigned n = cast_uint(e - f) + 1u; /* 元素个数 */
+      if (n <= dst->asize && 1 <= t &&
+          l_castS2U(t) - 1u <= dst->asize - n &&
+          fasttm(L, src->metatable, TM_INDEX) == NULL &&
+          fasttm(L, dst->metatable, TM_NEWINDEX) == NULL)
+      {
+        luaH_movearray(L, src, cast_uint(f) - 1, dst, cast_uint(t) - 1, n);
+        res = 1;
+      }
+    }
+  }
+  lua_unlock(L);
+  return res;
+}
+
+/*
+** 对数组部分的一段排序 (见 lua.h)
+**
+** 说明:
+** - 整段都在数组部分内且没有空槽位时,lua_geti/lua_seti 不会调用元方法,
+**   默认的 '<' 比较同类型的数字或字符串时也不会,所以不必检查元表
+** - 空槽位和混合类型由 luaH_sortarray 拒绝
+** - vidx 处的表同样要求整段在数组部分内且没有空槽位,所以也不会调用元方法
+*/
+LUA_API int lua_sortrange(lua_State *L, int idx, lua_Integer i, lua_Integer e,
+                          int vidx)
+{
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttistable(o))
+  {
+    Table *t = hvalue(o);
+    Table *c = NULL; /* 随之重排的表 */
+    if (vidx != 0)
+    {
+      const TValue *v = index2value(L, vidx);
+      if (!ttistable(v) || !inarray(hvalue(v), i, e))
+      {
+        lua_unlock(L);
+        return 0;
+      }
+      c = hvalue(v);
+    }
+    if (inarray(t, i, e))
+      res = luaH_sortarray(L, t, cast_uint(i) - 1, cast_uint(e - i) + 1u, c);
+  }
+  lua_unlock(L);
+  return res;
+}
+
 /*
 ** 原始设置的辅助函数
 **
@@ -2183,6 +2331,163 @@ LUA_API int lua_gc(lua_State *L, int what, ...)
   return res;
 }
 
+/*
+** JIT 控制
+**
+** 参数:
+**   L    - Lua 状态机
+**   mode - 1 开启, 0 关闭, -1 只查询
+**
+** 返回: 之前是否开启; 不支持 JIT 时总是 0
+**
+** 说明:
+** - 关闭后已编译的机器码保留,但不再执行,也不再编译新函数
+*/
+LUA_API int lua_jit(lua_State *L, int mode)
+{
+#if LUA_USE_JIT
+  int res;
+  lua_lock(L);
+  res = G(L)->jitmode;
+  if (mode >= 0)
+    G(L)->jitmode = cast_byte(mode != 0);
+  lua_unlock(L);
+  return res;
+#else
+  UNUSED(L);
+  UNUSED(mode);
+  return 0;
+#endif
+}
+
+/*
+** 操作码统计(插桩构建，见 LUA_USE_OPSTATS)
+**
+** lua_opstat: 把操作码 op 的 LUA_OPSTATSIZE 项统计写入 stats,
+**             返回操作码名称; op 超出范围或未插桩时返回 NULL
+** lua_resetopstats: 清零全部统计
+** lua_opcounts: 为索引处的 Lua 函数压入每条指令的执行次数序列,
+**               成功返回 1; 不是 Lua 函数或没有逐指令计数时返回 0
+*/
+#if LUA_USE_OPSTATS
+#include "lopcodes.h"
+#include "lopnames.h"
+#endif
+
+LUA_API const char *lua_opstat(lua_State *L, int op, lua_Unsigned *stats)
+{
+#if LUA_USE_OPSTATS
+  const OpStats *os = &G(L)->opstats;
+  const char *name = NULL;
+  lua_lock(L);
+  if (0 <= op && op < NUM_OPCODES)
+  {
+    int b;
+    stats[0] = os->count[op];
+    stats[1] = os->samples[op];
+    stats[2] = os->cycles[op];
+    for (b = 0; b < LUA_OPSTATBUCKETS; b++)
+      stats[3 + b] = os->hist[op][b];
+    name = opnames[op];
+  }
+  lua_unlock(L);
+  return name;
+#else
+  UNUSED(L);
+  UNUSED(op);
+  UNUSED(stats);
+  return NULL;
+#endif
+}
+
+LUA_API void lua_resetopstats(lua_State *L)
+{
+#if LUA_USE_OPSTATS
+  lua_lock(L);
+  luaV_resetopstats(G(L));
+  lua_unlock(L);
+#else
+  UNUSED(L);
+#endif
+}
+
+LUA_API int lua_opcounts(lua_State *L, int idx)
+{
+#if LUA_USE_OPSTATS >= 2
+  const TValue *o;
+  int res = 0;
+  lua_lock(L);
+  o = index2value(L, idx);
+  if (ttisLclosure(o) && clLvalue(o)->p->opcount != NULL)
+  {
+    const Proto *p = clLvalue(o)->p;
+    Table *t = luaH_new(L);
+    int i;
+    sethvalue2s(L, L->top.p, t);
+    api_incr_top(L);
+    luaH_resize(L, t, cast_uint(p->sizecode), 0);
+    for (i = 0; i < p->sizecode; i++)
+    {
+      TValue v;
+      setivalue(&v, l_castU2S(p->opcount[i]));
+      luaH_setint(L, t, i + 1, &v);
+    }
+    luaC_checkGC(L);
+    res = 1;
+  }
+  lua_unlock(L);
+  return res;
+#else
+  UNUSED(L);
+  UNUSED(idx);
+  return 0;
+#endif
+}
+
+/*
+** 表的内部统计(见 lua.h 中的 LUA_TS* 各项)
+**
+** idx 为 0 时汇总所有存活的表: 遍历回收器的对象链表(带终结器的表
+** 在 'finobj' 和 'tobefnz' 中),跳过已死但尚未清扫的对象
+*/
+LUA_API int lua_tablestats(lua_State *L, int idx, lua_Unsigned *stats)
+{
+  int n = 0;
+  int i;
+  lua_lock(L);
+  for (i = 0; i < LUA_TSSIZE; i++)
+    stats[i] = 0;
+  if (idx != 0)
+  {
+    luaH_stats(gettable(L, idx), stats);
+    n = 1;
+  }
+  else
+  {
+    global_State *g = G(L);
+    GCObject *lists[3];
+    int l;
+    lists[0] = g->allgc;
+    lists[1] = g->finobj;
+    lists[2] = g->tobefnz;
+    for (l = 0; l < 3; l++)
+    {
+      GCObject *o;
+      for (o = lists[l]; o != NULL; o = o->next)
+      {
+        if (o->tt == LUA_VTABLE && !isdead(g, o))
+        {
+          luaH_stats(gco2t(o), stats);
+          n++;
+        }
+      }
+    }
+    stats[LUA_TSFLAGS] = 0; /* 对汇总没有意义 */
+  }
+  lua_unlock(L);
+  return n;
+}
+
 /*
 ** ============================================================================
 ** 杂项函数
@@ -2243,6 +2548,41 @@ LUA_API int lua_next(lua_State *L, int idx)
   return more;
 }
 
+/*
+** 用游标遍历表
+**
+** 参数:
+**   L      - Lua 状态机
+**   idx    - 表的索引
+**   cursor - 遍历位置,开始时为 0,每次调用后更新
+**
+** 返回: 如果还有下一个元素返回 1(压入键和值),否则返回 0(不压入任何值)
+**
+** 说明:
+** - 与 lua_next 遍历顺序相同,但不需要在栈上保留键:
+**   lua_next 每一步都要重新哈希当前键来找到它的位置,
+**   这里直接从游标处继续扫描
+** - 遍历中可以把已有的字段设为 nil,但不能添加新键
+*/
+LUA_API int lua_nextat(lua_State *L, int idx, lua_Unsigned *cursor)
+{
+  Table *t;
+  unsigned pos;
+  int more;
+  lua_lock(L);
+  api_check(L, L->top.p + 2 <= L->ci->top.p, "stack overflow");
+  t = gettable(L, idx);
+  pos = (*cursor <= UINT_MAX) ? cast_uint(*cursor) : UINT_MAX;
+  more = luaH_nextat(L, t, &pos, L->top.p);
+  if (more)
+  {
+    L->top.p += 2; /* 压入键和值 */
+    *cursor = pos;
+  }
+  lua_unlock(L);
+  return more;
+}
+
 /*
 ** 标记变量为 to-be-closed
 **
@@ -2375,6 +2715,25 @@ void lua_setwarnf(lua_State *L, lua_WarnFunction f, void *ud)
   lua_unlock(L);
 }
 
+/*
+** 设置原始的'next'函数
+**
+** 参数:
+**   L - Lua 状态机
+**   f - 与'lua_next'语义相同的迭代函数(NULL 表示没有)
+**
+** 说明:
+** - 迭代函数为 'f'、状态为表的泛型 for 循环不再调用 'f',
+**   而是在虚拟机中直接完成每一步(见 lvm.c)
+** - 基础库用它注册 'next'
+*/
+LUA_API void lua_setnextf(lua_State *L, lua_CFunction f)
+{
+  lua_lock(L);
+  G(L)->nextf = f;
+  lua_unlock(L);
+}
+
 /*
 ** 发出警告
 **
@@ -469,7 +469,7 @@ LUALIB_API lua_Integer luaL_optinteger (lua_State *L, int arg,
 ** =======================================================
 */
 
-/* userdata to box arbitrary data */
+/* userdata to box arbitrary data ('luaL_BuffBox' starts like it) */
 typedef struct UBox {
   void *box;
   size_t bsize;
@@ -672,6 +672,38 @@ LUALIB_API char *luaL_buffinitsize (lua_State *L, luaL_Buffer *B, size_t sz) {
   return prepbuffsize(B, sz, -1);
 }
 
+
+/*
+** Initializes 'B' to append to the reusable buffer at index 'idx'
+** (see 'luaL_BuffBox'). A copy of that userdata is pushed as the box of
+** 'B', so that the buffer grows it in place and its memory survives
+** the buffer. No Lua code may run while 'B' is in use (metamethods,
+** finalizers in collection steps), as it could change the reusable
+** buffer under 'B'.
+*/
+LUALIB_API void luaL_buffinitbox (lua_State *L, luaL_Buffer *B, int idx) {
+  luaL_BuffBox *bb = (luaL_BuffBox *)lua_touserdata(L, idx);
+  lua_pushvalue(L, idx);  /* box for the buffer */
+  B->L = L;
+  B->b = (char *)bb->box;  /* never 'B->init.b', so 'buffonstack' holds */
+  B->n = bb->n;
+  B->size = bb->bsize;
+}
+
+
+/*
+** Finishes a buffer started by 'luaL_buffinitbox': keeps its contents
+** in the reusable buffer and removes the box copy from the stack.
+*/
+LUALIB_API void luaL_buffsavebox (luaL_Buffer *B) {
+  lua_State *L = B->L;
+  luaL_BuffBox *bb = (luaL_BuffBox *)lua_touserdata(L, -1);
+  checkbufferlevel(B, -1);
+  lua_assert(bb->box == (void *)B->b && bb->bsize == B->size);
+  bb->n = B->n;
+  lua_pop(L, 1);  /* remove box */
+}
+
 /* }====================================================== */
 
 
@@ -144,6 +144,14 @@ typedef struct luaL_Buffer luaL_Buffer;
 ** 这允许在Lua启动前就注册某些模块的加载方式
 */
 
+/* key, in the registry, for the function that empties the pattern cache */
+/* 注册表中,清空已编译模式缓存的函数的键 */
+#define LUA_PATCACHE "_PATCACHE"
+/*
+** 说明: 由字符串库在打开时注册(见lstrlib.c)
+** os.setlocale改变区域设置后调用它,因为编译好的字符类依赖于区域设置
+*/
+
 /*
 ** ========================================================================
 ** 库注册结构体
@@ -1667,6 +1675,67 @@ LUALIB_API char *(luaL_buffinitsize)(lua_State * L, luaL_Buffer *B, size_t sz);
 ** - LUAL_BUFFERSIZE通常定义为较小的值(如512字节)
 */
 
+/*
+** A reusable buffer is a userdata with metatable 'LUA_BUFFERHANDLE' and
+** initial structure 'luaL_BuffBox'. Its first two fields are those of
+** the box of a 'luaL_Buffer', so a buffer can keep filling it across
+** calls (see 'luaL_buffinitbox').
+** 可复用缓冲区是一个userdata,其元表为'LUA_BUFFERHANDLE',
+** 初始结构为'luaL_BuffBox'。其前两个字段与'luaL_Buffer'的盒子相同,
+** 因此缓冲区可以跨调用继续填充它(见'luaL_buffinitbox')
+*/
+
+#define LUA_BUFFERHANDLE "string.buffer"
+/*
+** 宏: LUA_BUFFERHANDLE
+** 功能: 可复用缓冲区(string.buffer)元表的名称
+*/
+
+typedef struct luaL_BuffBox
+{
+  void *box;    /* contents 内容(NULL表示尚未分配) */
+  size_t bsize; /* capacity 容量 */
+  size_t n;     /* number of bytes in use 已用字节数 */
+} luaL_BuffBox;
+/*
+** 结构体: luaL_BuffBox
+** 功能: 跨调用保留容量的字节缓冲区
+**
+** 说明:
+** - box/bsize 的布局与 lauxlib.c 中的 UBox 相同,luaL_Buffer 可以
+**   直接把它当作自己的盒子来扩展,追加时不产生中间字符串
+** - 清空时只需把 n 置0,容量保留,稳定状态下的序列化无需分配内存
+** - 内存由 lua_getallocf 得到的分配函数管理,__gc 时释放
+*/
+
+LUALIB_API void(luaL_buffinitbox)(lua_State *L, luaL_Buffer *B, int idx);
+/*
+** 函数: luaL_buffinitbox
+** 功能: 初始化缓冲区,使其在可复用缓冲区之后继续追加
+**
+** 参数:
+** - L: Lua状态机
+** - B: 缓冲区指针
+** - idx: 可复用缓冲区(luaL_BuffBox)在栈中的索引
+**
+** 说明:
+** - 把该userdata的副本压入栈顶,作为B的盒子
+** - 之后可以像普通缓冲区一样使用B(luaL_addlstring等)
+** - 必须用 luaL_buffsavebox 结束,不能用 luaL_pushresult
+** - 使用B期间不能运行Lua代码(元方法、垃圾回收步骤中的终结器等),
+**   否则它们可能改动同一个可复用缓冲区,使B中的指针失效
+*/
+
+LUALIB_API void(luaL_buffsavebox)(luaL_Buffer *B);
+/*
+** 函数: luaL_buffsavebox
+** 功能: 结束由 luaL_buffinitbox 开始的缓冲区
+**
+** 说明:
+** - 把内容长度记录回可复用缓冲区,并弹出栈顶的盒子副本
+** - 若中途发生错误,可复用缓冲区保持原有内容(可能已扩容)
+*/
+
 /* }====================================================== */
 
 /*
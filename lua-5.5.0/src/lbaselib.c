@@ -554,6 +554,7 @@ LUAMOD_API int luaopen_base (lua_State *L) {
   /* set global _VERSION */
   lua_pushliteral(L, LUA_VERSION);
   lua_setfield(L, -2, "_VERSION");
+  lua_setnextf(L, luaB_next);  /* 'for' loops do not call 'next' */
   return 1;
 }
 
@@ -1968,4 +1968,73 @@ void luaK_finish (FuncState *fs) {
       default: break;
     }
   }
+  luaK_fuse(p->code, fs->pc);
 }
+
+
+#if LUA_USE_SUPERINSTR
+
+/*
+** Superinstruction for the pair of instructions 'op1' 'op2', or
+** OP_EXTRAARG if there is none. The pairs are the ones executed most
+** often in sequence by common programs (field chains 'a.b.c', method
+** calls, calls whose last argument is a constant or a local, getters
+** and setters).
+*/
+static OpCode fusedop (OpCode op1, OpCode op2) {
+  switch (op2) {
+    case OP_CALL:
+      switch (op1) {
+        case OP_MOVE: return OP_MOVE_CALL;
+        case OP_LOADI: return OP_LOADI_CALL;
+        case OP_LOADK: return OP_LOADK_CALL;
+        case OP_SELF: return OP_SELF_CALL;
+        default: return OP_EXTRAARG;
+      }
+    case OP_GETFIELD:
+      switch (op1) {
+        case OP_GETUPVAL: return OP_GETUPVAL_GETFIELD;
+        case OP_GETTABUP: return OP_GETTABUP_GETFIELD;
+        case OP_GETFIELD: return OP_GETFIELD_GETFIELD;
+        case OP_GETTABLE: return OP_GETTABLE_GETFIELD;
+        default: return OP_EXTRAARG;
+      }
+    case OP_SELF:
+      return (op1 == OP_GETTABLE) ? OP_GETTABLE_SELF : OP_EXTRAARG;
+    case OP_RETURN1:
+      switch (op1) {
+        case OP_GETFIELD: return OP_GETFIELD_RETURN1;
+        case OP_LOADI: return OP_LOADI_RETURN1;
+        default: return OP_EXTRAARG;
+      }
+    case OP_RETURN0:
+      return (op1 == OP_SETFIELD) ? OP_SETFIELD_RETURN0 : OP_EXTRAARG;
+    default: return OP_EXTRAARG;
+  }
+}
+
+
+/*
+** Replace the first instruction of each pair with a superinstruction
+** in the 'n' instructions of 'code'. Only the opcode changes, and the
+** second instruction is kept, so it can still be a jump target. (Pairs
+** can overlap: in 'a.b.c', the second OP_GETFIELD starts a pair too.)
+** Called for new functions and for functions loaded from dumps, which
+** always contain only base opcodes.
+*/
+void luaK_fuse (Instruction *code, int n) {
+  int i;
+  for (i = 0; i + 1 < n; i++) {
+    OpCode op = fusedop(GET_OPCODE(code[i]), GET_OPCODE(code[i + 1]));
+    if (op != OP_EXTRAARG)
+      SET_OPCODE(code[i], op);
+  }
+}
+
+#else
+
+void luaK_fuse (Instruction *code, int n) {
+  UNUSED(code); UNUSED(n);
+}
+
+#endif
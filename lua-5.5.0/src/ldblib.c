@@ -449,6 +449,129 @@ static int db_traceback (lua_State *L) {
 }
 
 
+/*
+** debug.jit([on]): returns whether native code was enabled, after
+** enabling or disabling it if 'on' is given. Always false when Lua
+** was built without the JIT compiler.
+*/
+static int db_jit (lua_State *L) {
+  int mode = lua_isnoneornil(L, 1) ? -1 : lua_toboolean(L, 1);
+  lua_pushboolean(L, lua_jit(L, mode));
+  return 1;
+}
+
+
+/*
+** debug.opstats(): returns a table with the statistics of each opcode
+** that has run, indexed by opcode name: fields 'count', 'samples',
+** 'cycles' (sum of the cycles of all samples) and 'hist' (entry 'i' is
+** the number of samples taking from 2^(i-1) to 2^i - 1 cycles; the last
+** entry also counts all longer samples).
+** debug.opstats(f): returns a sequence with the number of executions of
+** each instruction of the Lua function 'f'.
+** Both fail when Lua was not built with LUA_USE_OPSTATS (or, for the
+** second form, with LUA_USE_OPSTATS < 2).
+*/
+static int db_opstats (lua_State *L) {
+  lua_Unsigned stats[LUA_OPSTATSIZE];
+  const char *name;
+  int op;
+  if (lua_opstat(L, 0, stats) == NULL) {
+    luaL_pushfail(L);
+    lua_pushliteral(L, "Lua was built without opcode statistics");
+    return 2;
+  }
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    if (lua_opcounts(L, 1))
+      return 1;
+    luaL_pushfail(L);
+    lua_pushliteral(L, "no instruction counts for this function");
+    return 2;
+  }
+  lua_newtable(L);
+  for (op = 0; (name = lua_opstat(L, op, stats)) != NULL; op++) {
+    int b;
+    if (stats[0] == 0)
+      continue;  /* opcode never ran */
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, l_castU2S(stats[0]));
+    lua_setfield(L, -2, "count");
+    lua_pushinteger(L, l_castU2S(stats[1]));
+    lua_setfield(L, -2, "samples");
+    lua_pushinteger(L, l_castU2S(stats[2]));
+    lua_setfield(L, -2, "cycles");
+    lua_createtable(L, LUA_OPSTATBUCKETS, 0);
+    for (b = 0; b < LUA_OPSTATBUCKETS; b++) {
+      lua_pushinteger(L, l_castU2S(stats[3 + b]));
+      lua_rawseti(L, -2, b + 1);
+    }
+    lua_setfield(L, -2, "hist");
+    lua_setfield(L, -2, name);
+  }
+  return 1;
+}
+
+
+static int db_resetopstats (lua_State *L) {
+  lua_resetopstats(L);
+  return 0;
+}
+
+
+static void setstat (lua_State *L, const char *name, lua_Unsigned v) {
+  lua_pushinteger(L, l_castU2S(v));
+  lua_setfield(L, -2, name);
+}
+
+
+/*
+** debug.tablestats(t): returns a table with the layout of table 't':
+** 'asize' and 'sizenode' (sizes of its array and hash parts), 'live'
+** (entries in both parts), 'hashlive', 'dead' (removed entries still
+** taking nodes), 'lenhint', 'maxchain' and 'avgchain' (longest and
+** average search for a key in the hash part, in nodes or, with open
+** addressing, in groups), 'notmain' (keys not in their main positions),
+** 'oldsize' (nodes of an old hash part still being rehashed), 'bytes',
+** and 'mtflags' (the cache of absent metamethods of its metatable).
+** debug.tablestats(): the same fields (but 'mtflags') summed over all
+** live tables, plus 'tables' and 'withmeta' (how many have metatables);
+** 'maxchain' is the longest chain in any table.
+*/
+static int db_tablestats (lua_State *L) {
+  lua_Unsigned s[LUA_TSSIZE];
+  int all = lua_isnoneornil(L, 1);
+  int n;
+  if (all)
+    n = lua_tablestats(L, 0, s);
+  else {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    n = lua_tablestats(L, 1, s);
+  }
+  lua_createtable(L, 0, 14);
+  setstat(L, "asize", s[LUA_TSASIZE]);
+  setstat(L, "sizenode", s[LUA_TSNODES]);
+  setstat(L, "live", s[LUA_TSALIVE] + s[LUA_TSHLIVE]);
+  setstat(L, "hashlive", s[LUA_TSHLIVE]);
+  setstat(L, "dead", s[LUA_TSHDEAD]);
+  setstat(L, "lenhint", s[LUA_TSLENHINT]);
+  setstat(L, "maxchain", s[LUA_TSMAXCHAIN]);
+  lua_pushnumber(L, (s[LUA_TSHLIVE] == 0) ? 0 :
+                    (lua_Number)s[LUA_TSCHAINS] / (lua_Number)s[LUA_TSHLIVE]);
+  lua_setfield(L, -2, "avgchain");
+  setstat(L, "notmain", s[LUA_TSNOTMAIN]);
+  setstat(L, "oldsize", s[LUA_TSOLDNODES]);
+  setstat(L, "bytes", s[LUA_TSBYTES]);
+  if (all) {
+    setstat(L, "tables", (lua_Unsigned)n);
+    setstat(L, "withmeta", s[LUA_TSMETA]);
+  }
+  else if (s[LUA_TSMETA] != 0)
+    setstat(L, "mtflags", s[LUA_TSFLAGS]);
+  return 1;
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -458,6 +581,9 @@ static const luaL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"jit", db_jit},
+  {"opstats", db_opstats},
+  {"resetopstats", db_resetopstats},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
   {"setuservalue", db_setuservalue},
@@ -465,6 +591,7 @@ static const luaL_Reg dblib[] = {
   {"setlocal", db_setlocal},
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
+  {"tablestats", db_tablestats},
   {"traceback", db_traceback},
   {NULL, NULL}
 };
@@ -444,11 +444,11 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
   int pc;
   int setreg = -1;  /* keep last instruction that changed 'reg' */
   int jmptarget = 0;  /* any code before this address is conditional */
-  if (testMMMode(GET_OPCODE(p->code[lastpc])))
+  if (testMMMode(GET_BASEOPCODE(p->code[lastpc])))
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOPCODE(i);
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
     switch (op) {
@@ -512,7 +512,7 @@ static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
     Instruction i = p->code[pc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOPCODE(i);
     switch (op) {
       case OP_MOVE: {
         int b = GETARG_B(i);  /* move from 'b' to 'a' */
@@ -573,7 +573,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
     Instruction i = p->code[lastpc];
-    OpCode op = GET_OPCODE(i);
+    OpCode op = GET_BASEOPCODE(i);
     switch (op) {
       case OP_GETTABUP: {
         int k = GETARG_C(i);  /* key index */
@@ -616,7 +616,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
   Instruction i = p->code[pc];  /* calling instruction */
-  switch (GET_OPCODE(i)) {
+  switch (GET_BASEOPCODE(i)) {
     case OP_CALL:
     case OP_TAILCALL:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
@@ -18,6 +18,7 @@
 #include "lapi.h"
 #include "lgc.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -168,11 +169,29 @@ static void dumpString (DumpState *D, TString *ts) {
 }
 
 
+/*
+** Dump the code of a function with its original opcodes, undoing any
+** quickening done by the interpreter. Runs of plain instructions are
+** dumped as blocks.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
+  int i;
+  int first = 0;  /* first instruction not dumped yet */
   dumpInt(D, f->sizecode);
   dumpAlign(D, sizeof(f->code[0]));
   lua_assert(f->code != NULL);
-  dumpVector(D, f->code, cast_uint(f->sizecode));
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction inst = f->code[i];
+    if (isquickop(GET_OPCODE(inst))) {
+      if (i > first)
+        dumpVector(D, f->code + first, cast_uint(i - first));
+      SET_OPCODE(inst, getbaseop(GET_OPCODE(inst)));
+      dumpVar(D, inst);
+      first = i + 1;
+    }
+  }
+  if (i > first)
+    dumpVector(D, f->code + first, cast_uint(i - first));
 }
 
 
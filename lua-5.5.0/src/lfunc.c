@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -263,10 +264,49 @@ Proto *luaF_newproto (lua_State *L) {
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
+#if LUA_USE_ICACHE
+  f->icache = NULL;
+#endif
+#if LUA_USE_OPSTATS >= 2
+  f->opcount = NULL;
+#endif
+#if LUA_USE_JIT
+  f->jit = NULL;
+  f->jitcount = LUAI_JITTHRESHOLD;
+#endif
   return f;
 }
 
 
+#if LUA_USE_ICACHE
+/*
+** Create the inline caches of a prototype, one entry for each
+** instruction. Entries are only hints for 'luaV_execute' (they are
+** always checked before use), so any initial value would do.
+*/
+void luaF_initicache (lua_State *L, Proto *f) {
+  int i;
+  f->icache = luaM_newvectorchecked(L, f->sizecode, l_uint32);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+}
+#endif
+
+
+#if LUA_USE_OPSTATS >= 2
+/*
+** Create the instruction counters of a prototype (see 'vmcount' in
+** lvm.c).
+*/
+void luaF_initopcount (lua_State *L, Proto *f) {
+  int i;
+  f->opcount = luaM_newvectorchecked(L, f->sizecode, lua_Unsigned);
+  for (i = 0; i < f->sizecode; i++)
+    f->opcount[i] = 0;
+}
+#endif
+
+
 lu_mem luaF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
@@ -278,6 +318,14 @@ lu_mem luaF_protosize (Proto *p) {
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
     sz += cast_uint(p->sizeabslineinfo) * sizeof(AbsLineInfo);
   }
+#if LUA_USE_ICACHE
+  if (p->icache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(l_uint32);
+#endif
+#if LUA_USE_OPSTATS >= 2
+  if (p->opcount != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(lua_Unsigned);
+#endif
   return sz;
 }
 
@@ -292,6 +340,17 @@ void luaF_freeproto (lua_State *L, Proto *f) {
   luaM_freearray(L, f->k, cast_sizet(f->sizek));
   luaM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
   luaM_freearray(L, f->upvalues, cast_sizet(f->sizeupvalues));
+#if LUA_USE_ICACHE
+  if (f->icache != NULL)
+    luaM_freearray(L, f->icache, cast_sizet(f->sizecode));
+#endif
+#if LUA_USE_OPSTATS >= 2
+  if (f->opcount != NULL)
+    luaM_freearray(L, f->opcount, cast_sizet(f->sizecode));
+#endif
+#if LUA_USE_JIT
+  luaJ_free(f);
+#endif
   luaM_free(L, f);
 }
 
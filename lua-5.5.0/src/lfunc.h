@@ -226,6 +226,27 @@ LUAI_FUNC Proto *luaF_newproto(lua_State *L);
 ** 此函数是创建任何Lua函数的第一步。编译器在编译Lua函数时会调用它。
 */
 
+#if LUA_USE_ICACHE
+LUAI_FUNC void luaF_initicache(lua_State *L, Proto *f);
+/*
+** 为函数原型创建内联缓存(每条指令一项)
+** 参数:
+**   L: Lua执行状态指针
+**   f: 代码已经定型的原型(sizecode不再改变)
+**
+** 由解析器(close_func)和加载器(loadFunction)调用。
+** 缓存项只是提示，使用前总会校验，因此初值为0即可。
+*/
+#endif
+
+#if LUA_USE_OPSTATS >= 2
+LUAI_FUNC void luaF_initopcount(lua_State *L, Proto *f);
+/*
+** 为函数原型创建每条指令的执行计数器(初值为0)
+** 与luaF_initicache一样，由解析器和加载器在代码定型后调用
+*/
+#endif
+
 LUAI_FUNC CClosure *luaF_newCclosure(lua_State *L, int nupvals);
 /*
 ** 创建一个新的C闭包
@@ -33,6 +33,13 @@
 */
 #define GCSWEEPMAX	20
 
+/*
+** Maximum number of buckets of the string table to merge in each step,
+** while the table is too big (see 'luaS_shrink'). Merging a bucket
+** costs much less than sweeping an object.
+*/
+#define GCSTRMERGE	1024
+
 
 /*
 ** Cost (in work units) of running one finalizer.
@@ -110,6 +117,29 @@ static void entersweep (lua_State *L);
 #define gnodelast(h)	gnode(h, cast_sizet(sizenode(h)))
 
 
+/*
+** Gets into '*first' and '*limit' the nodes of part 'p' of the hash of
+** table 'h': part 0 is its hash part, and part 1 is the old hash part
+** of a table in an incremental rehash (see 'luaH_oldhash'). Returns 0
+** if there is no such part. The collector must visit both parts, as
+** entries are split between them.
+*/
+static int hashpart (Table *h, int p, Node **first, Node **limit) {
+  if (p == 0) {
+    *first = gnode(h, 0);
+    *limit = gnodelast(h);
+    return 1;
+  }
+  else if (p == 1 && isrehashing(h)) {
+    unsigned size = luaH_oldhash(h, first);
+    *limit = *first + size;
+    return 1;
+  }
+  else
+    return 0;
+}
+
+
 static l_mem objsize (GCObject *o) {
   lu_mem res;
   switch (o->tt) {
@@ -485,18 +515,21 @@ static void genlink (global_State *g, GCObject *o) {
 ** to check table age in generational mode.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   int hasclears = (h->asize > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else {
-      lua_assert(!keyisnil(n));
-      markkey(g, n);
-      if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* a white value? */
-        hasclears = 1;  /* table will have to be cleared */
+  for (p = 0; hashpart(h, p, &n, &limit); p++) {
+    for (; n < limit; n++) {  /* traverse hash part */
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else {
+        lua_assert(!keyisnil(n));
+        markkey(g, n);
+        if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* white value? */
+          hasclears = 1;  /* table will have to be cleared */
+      }
     }
   }
   if (g->gcstate == GCSpropagate)
@@ -542,22 +575,26 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
   unsigned int i;
-  unsigned int nsize = sizenode(h);
+  Node *first, *limit;
+  int p;
   int marked = traversearray(g, h);  /* traverse array part */
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
-  for (i = 0; i < nsize; i++) {
-    Node *n = inv ? gnode(h, nsize - 1 - i) : gnode(h, i);
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
-      hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
-        hasww = 1;  /* white-white entry */
-    }
-    else if (valiswhite(gval(n))) {  /* value not marked yet? */
-      marked = 1;
-      reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+  for (p = 0; hashpart(h, p, &first, &limit); p++) {
+    unsigned int nsize = cast_uint(limit - first);
+    for (i = 0; i < nsize; i++) {
+      Node *n = inv ? first + (nsize - 1 - i) : first + i;
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
+        hasclears = 1;  /* table must be cleared */
+        if (valiswhite(gval(n)))  /* value not marked yet? */
+          hasww = 1;  /* white-white entry */
+      }
+      else if (valiswhite(gval(n))) {  /* value not marked yet? */
+        marked = 1;
+        reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+      }
     }
   }
   /* link table into proper list */
@@ -574,15 +611,18 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 
 
 static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   traversearray(g, h);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else {
-      lua_assert(!keyisnil(n));
-      markkey(g, n);
-      markvalue(g, gval(n));
+  for (p = 0; hashpart(h, p, &n, &limit); p++) {
+    for (; n < limit; n++) {  /* traverse hash part */
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else {
+        lua_assert(!keyisnil(n));
+        markkey(g, n);
+        markvalue(g, gval(n));
+      }
     }
   }
   genlink(g, obj2gco(h));
@@ -606,6 +646,11 @@ static int getmode (global_State *g, Table *h) {
 
 
 static l_mem traversetable (global_State *g, Table *h) {
+  l_mem work = 1 + 2*cast(l_mem, sizenode(h)) + h->asize;
+  if (isrehashing(h)) {
+    Node *old;
+    work += 2*cast(l_mem, luaH_oldhash(h, &old));
+  }
   markobjectN(g, h->metatable);
   switch (getmode(g, h)) {
     case 0:  /* not weak */
@@ -624,7 +669,7 @@ static l_mem traversetable (global_State *g, Table *h) {
         linkgclist(h, g->allweak);  /* must clear collected entries */
       break;
   }
-  return cast(l_mem, 1 + 2*sizenode(h) + h->asize);
+  return work;
 }
 
 
@@ -789,13 +834,15 @@ static void convergeephemerons (global_State *g) {
 static void clearbykeys (global_State *g, GCObject *l) {
   for (; l; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *limit = gnodelast(h);
-    Node *n;
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (iscleared(g, gckeyN(n)))  /* unmarked key? */
-        setempty(gval(n));  /* remove entry */
-      if (isempty(gval(n)))  /* is entry empty? */
-        clearkey(n);  /* clear its key */
+    Node *n, *limit;
+    int p;
+    for (p = 0; hashpart(h, p, &n, &limit); p++) {
+      for (; n < limit; n++) {
+        if (iscleared(g, gckeyN(n)))  /* unmarked key? */
+          setempty(gval(n));  /* remove entry */
+        if (isempty(gval(n)))  /* is entry empty? */
+          clearkey(n);  /* clear its key */
+      }
     }
   }
 }
@@ -808,7 +855,8 @@ static void clearbykeys (global_State *g, GCObject *l) {
 static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
+    int p;
     unsigned int i;
     unsigned int asize = h->asize;
     for (i = 0; i < asize; i++) {
@@ -816,11 +864,13 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, o))  /* value was collected? */
         *getArrTag(h, i) = LUA_VEMPTY;  /* remove entry */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
-        setempty(gval(n));  /* remove entry */
-      if (isempty(gval(n)))  /* is entry empty? */
-        clearkey(n);  /* clear its key */
+    for (p = 0; hashpart(h, p, &n, &limit); p++) {
+      for (; n < limit; n++) {
+        if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
+          setempty(gval(n));  /* remove entry */
+        if (isempty(gval(n)))  /* is entry empty? */
+          clearkey(n);  /* clear its key */
+      }
     }
   }
 }
@@ -873,6 +923,11 @@ static void freeobj (lua_State *L, GCObject *o) {
       TString *ts = gco2ts(o);
       if (ts->shrlen == LSTRMEM)  /* must free external string? */
         (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+      else if (ts->shrlen == LSTRROPE) {  /* view of a rope? */
+        size_t freed = luaS_freerope(L, ts);
+        assert_code(newmem -= cast(l_mem, freed));
+        UNUSED(freed);
+      }
       luaM_freemem(L, ts, luaS_sizelngstr(ts->u.lnglen, ts->shrlen));
       break;
     }
@@ -930,13 +985,12 @@ static GCObject **sweeptolive (lua_State *L, GCObject **p) {
 */
 
 /*
-** If possible, shrink string table.
+** If possible, shrink string table (a little, as this runs in each
+** step).
 */
 static void checkSizes (lua_State *L, global_State *g) {
-  if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
-      luaS_resize(L, g->strt.size / 2);
-  }
+  if (!g->gcemergency)
+    luaS_shrink(L, GCSTRMERGE);
 }
 
 
@@ -1721,6 +1775,7 @@ static void incstep (lua_State *L, global_State *g) {
     else
       work2do -= stres;
   } while (fast || work2do > 0);
+  checkSizes(L, g);
   if (g->gcstate == GCSpause)
     setpause(g);  /* pause until next cycle */
   else
@@ -1796,6 +1851,8 @@ void luaC_fullgc (lua_State *L, int isemergency) {
       g->gckind = KGC_GENMAJOR;
       break;
   }
+  if (!isemergency)  /* a full collection also shrinks the whole table */
+    luaS_shrink(L, INT_MAX);
   g->gcemergency = 0;
 }
 
@@ -667,12 +667,18 @@ static int g_write (lua_State *L, FILE *f, int arg) {
   for (; nargs--; arg++) {  /* for each argument */
     char buff[LUA_N2SBUFFSZ];
     const char *s;
+    luaL_BuffBox *bb;
     size_t numbytes;  /* bytes written in one call to 'fwrite' */
     size_t len = lua_numbertocstring(L, arg, buff);  /* try as a number */
     if (len > 0) {  /* did conversion work (value was a number)? */
       s = buff;
       len--;
     }
+    else if ((bb = (luaL_BuffBox *)luaL_testudata(L, arg,
+                                         LUA_BUFFERHANDLE)) != NULL) {
+      s = (bb->n > 0) ? (const char *)bb->box : "";  /* string buffer */
+      len = bb->n;
+    }
     else  /* must be a string */
       s = luaL_checklstring(L, arg, &len);
     numbytes = fwrite(s, sizeof(char), len, f);
@@ -0,0 +1,1703 @@
+/*
+** $Id: ljit.c $
+** Baseline JIT compiler for x86-64
+** See Copyright Notice in lua.h
+*/
+
+#define ljit_c
+#define LUA_CORE
+
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE		/* for MAP_ANONYMOUS */
+#endif
+
+#include "lprefix.h"
+
+
+#include "lua.h"
+
+#include "ljit.h"
+
+#if LUA_USE_JIT
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lvm.h"
+
+
+/*
+** A function is compiled as a whole, each instruction into a fixed
+** template. The native code runs on the same stack and 'CallInfo' as
+** the interpreter and keeps the interpreter state in callee-saved
+** registers: 'base' in rbx, 'L' in r12, 'ci' in r13, 'k' in r14, and
+** the closure in r15. It leaves (returning to 'luaJ_enter') whenever
+** it reaches an instruction it does not handle (calls, returns,
+** closures, etc.) or finds operands of unexpected types, storing in
+** 'savedpc' the instruction where the interpreter must continue.
+** Slow paths call C helpers, with 'savedpc' already pointing to the
+** next instruction as the interpreter would have it; errors and
+** yields inside them unwind the native frames with 'longjmp', and a
+** resumed coroutine finishes the instruction through 'luaV_finishOp'
+** and continues in the interpreter.
+*/
+
+
+/* the compiled code of a function */
+typedef struct JitCode {
+  size_t size;  /* size of the whole mapping */
+  l_uint32 entry[1];  /* offset of native code for each instruction */
+} JitCode;
+
+typedef const Instruction *(*JitFunction) (lua_State *L, CallInfo *ci,
+                                            const lu_byte *target);
+
+/* generic type for the C helpers called by native code */
+typedef void (*JitHelper) (void);
+
+#define helper(f)	cast(JitHelper, f)
+
+
+/* maximum size of a function to be compiled */
+#define MAXJITCODE	(1 << 16)
+
+/* code size reserved for each instruction */
+#define INSTRSIZE	256
+
+/* size of an exit stub */
+#define STUBSIZE	16
+
+/* maximum number of pending jumps per instruction */
+#define FIXPERINSTR	8
+
+/* value of 'jitcount' for functions that failed to compile */
+#define JITNEVER	(~(l_uint32)0)
+
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+       R8, R9, R10, R11, R12, R13, R14, R15 };
+
+#define RBASE	RBX
+#define RL	R12
+#define RCI	R13
+#define RK	R14
+#define RCL	R15
+
+/* SSE registers */
+#define XMM0	0
+#define XMM1	1
+
+/* condition codes */
+enum { CC_O, CC_NO, CC_B, CC_AE, CC_E, CC_NE, CC_BE, CC_A,
+       CC_S, CC_NS, CC_P, CC_NP, CC_L, CC_GE, CC_LE, CC_G };
+
+#define ccnot(cc)	((cc) ^ 1)
+
+
+/* offsets of the fields the native code uses */
+#define SLOT(r)		(cast_int(r) * cast_int(sizeof(StackValue)))
+#define KSLOT(c)	(cast_int(c) * cast_int(sizeof(TValue)))
+#define VAL		cast_int(offsetof(TValue, value_))
+#define TT		cast_int(offsetof(TValue, tt_))
+#define CIFUNC		cast_int(offsetof(CallInfo, func.p))
+#define CISAVEDPC	cast_int(offsetof(CallInfo, u.l.savedpc))
+#define CITRAP		cast_int(offsetof(CallInfo, u.l.trap))
+#define CLPROTO		cast_int(offsetof(LClosure, p))
+#define CLUPVALS	cast_int(offsetof(LClosure, upvals))
+#define PROTOK		cast_int(offsetof(Proto, k))
+#define UVVALUE		cast_int(offsetof(UpVal, v.p))
+#define TMARKED		cast_int(offsetof(Table, marked))
+#define TLSIZENODE	cast_int(offsetof(Table, lsizenode))
+#define TASIZE		cast_int(offsetof(Table, asize))
+#define TARRAY		cast_int(offsetof(Table, array))
+#define TNODE		cast_int(offsetof(Table, node))
+#define NKEYTT		cast_int(offsetof(Node, u.key_tt))
+#define NKEYVAL		cast_int(offsetof(Node, u.key_val))
+
+
+/* a jump waiting for the position of its target */
+typedef struct Fixup {
+  l_uint32 pos;  /* position of the 32-bit displacement */
+  int target;  /* target instruction */
+  int toexit;  /* true if jump goes to the exit stub of 'target' */
+} Fixup;
+
+
+typedef struct JitState {
+  lu_byte *code;  /* code being generated */
+  size_t pos;  /* current position in 'code' */
+  size_t limit;  /* size of 'code' */
+  Proto *p;
+  l_uint32 *label;  /* position of each instruction */
+  l_uint32 *stub;  /* position of the exit stub of each instruction */
+  Fixup *fix;  /* pending jumps */
+  int nfix;  /* number of pending jumps */
+  int sizefix;  /* size of 'fix' */
+  size_t epilogue;  /* position of the common exit code */
+} JitState;
+
+
+/*
+** {==================================================================
+** x86-64 encoding
+** ===================================================================
+*/
+
+static void emit (JitState *J, int b) {
+  if (J->pos < J->limit)
+    J->code[J->pos] = cast_byte(b);
+  J->pos++;
+}
+
+
+static void emit32 (JitState *J, l_uint32 v) {
+  emit(J, cast_int(v & 0xff));
+  emit(J, cast_int((v >> 8) & 0xff));
+  emit(J, cast_int((v >> 16) & 0xff));
+  emit(J, cast_int(v >> 24));
+}
+
+
+static void emit64 (JitState *J, size_t v) {
+  emit32(J, cast(l_uint32, v & 0xffffffffu));
+  emit32(J, cast(l_uint32, v >> 32));
+}
+
+
+/* emit prefix, REX, and opcode (one or two bytes) */
+static void emitopx (JitState *J, int pre, int w, int op, int r, int x,
+                     int b) {
+  int rex = (w << 3) | ((r & 8) >> 1) | ((x & 8) >> 2) | ((b & 8) >> 3);
+  if (pre)
+    emit(J, pre);
+  if (rex)
+    emit(J, 0x40 | rex);
+  if (op > 0xff)
+    emit(J, op >> 8);
+  emit(J, op & 0xff);
+}
+
+
+#define emitop(J,pre,w,op,r,b)	emitopx(J, pre, w, op, r, 0, b)
+
+
+/* instruction with operands 'r' and the memory at [b + d] */
+static void emitmem (JitState *J, int pre, int w, int op, int r,
+                     int b, int d) {
+  emitop(J, pre, w, op, r, b);
+  if (-128 <= d && d < 128) {
+    emit(J, 0x40 | ((r & 7) << 3) | (b & 7));
+    if ((b & 7) == RSP) emit(J, 0x24);
+    emit(J, d & 0xff);
+  }
+  else {
+    emit(J, 0x80 | ((r & 7) << 3) | (b & 7));
+    if ((b & 7) == RSP) emit(J, 0x24);
+    emit32(J, cast(l_uint32, d));
+  }
+}
+
+
+/* instruction with operands 'r' and the memory at [b + x*scale + d] */
+static void emitmemx (JitState *J, int w, int op, int r, int b, int x,
+                      int scale, int d) {
+  int ss = (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+  lua_assert((x & 7) != RSP);
+  emitopx(J, 0, w, op, r, x, b);
+  emit(J, 0x84 | ((r & 7) << 3));  /* disp32 with SIB */
+  emit(J, (ss << 6) | ((x & 7) << 3) | (b & 7));
+  emit32(J, cast(l_uint32, d));
+}
+
+
+/* instruction with register operands 'r' and 'rm' */
+static void emitreg (JitState *J, int pre, int w, int op, int r, int rm) {
+  emitop(J, pre, w, op, r, rm);
+  emit(J, 0xc0 | ((r & 7) << 3) | (rm & 7));
+}
+
+
+#define ld64(J,r,b,d)	emitmem(J, 0, 1, 0x8b, r, b, d)
+#define st64(J,b,d,r)	emitmem(J, 0, 1, 0x89, r, b, d)
+#define mov64(J,d,s)	emitreg(J, 0, 1, 0x89, s, d)
+#define ldtag(J,r,b,d)	emitmem(J, 0, 0, 0x0fb6, r, b, (d) + TT)
+#define sttag(J,b,d,r)	emitmem(J, 0, 0, 0x88, r, b, (d) + TT)
+#define ldsd(J,x,b,d)	emitmem(J, 0xf2, 0, 0x0f10, x, b, d)
+#define stsd(J,b,d,x)	emitmem(J, 0xf2, 0, 0x0f11, x, b, d)
+#define cvtsd(J,x,b,d)	emitmem(J, 0xf2, 1, 0x0f2a, x, b, d)
+#define ucomisd(J,x,b,d)  emitmem(J, 0x66, 0, 0x0f2e, x, b, d)
+#define ucomisdr(J,x,y)	emitreg(J, 0x66, 0, 0x0f2e, x, y)
+#define movqx(J,x,r)	emitreg(J, 0x66, 1, 0x0f6e, x, r)
+#define testeax(J)	emitreg(J, 0, 0, 0x85, RAX, RAX)
+
+/* opcodes of integer operations 'reg op= mem' */
+#define OPADD	0x03
+#define OPSUB	0x2b
+#define OPIMUL	0x0faf
+#define OPCMP	0x3b
+
+/* opcodes of float operations (with prefix 0xf2) */
+#define OPADDSD	0x0f58
+#define OPSUBSD	0x0f5c
+#define OPMULSD	0x0f59
+#define OPDIVSD	0x0f5e
+
+
+/* set the tag of the value at [b + d] */
+static void settag (JitState *J, int b, int d, int tag) {
+  emitmem(J, 0, 0, 0xc6, 0, b, d + TT);
+  emit(J, tag);
+}
+
+
+/* compare the tag of the value at [b + d] with 'tag' */
+static void cmptag (JitState *J, int b, int d, int tag) {
+  emitmem(J, 0, 0, 0x80, 7, b, d + TT);
+  emit(J, tag);
+}
+
+
+static int fitsint32 (lua_Integer v) {
+  return (-0x7fffffff - 1 <= v && v <= 0x7fffffff);
+}
+
+
+/* r = v */
+static void movimm (JitState *J, int r, size_t v) {
+  lua_Integer iv = l_castU2S(v);
+  if (fitsint32(iv)) {  /* sign-extended 32-bit immediate */
+    emitreg(J, 0, 1, 0xc7, 0, r);
+    emit32(J, cast(l_uint32, v));
+  }
+  else {
+    emit(J, 0x48 | ((r & 8) >> 3));
+    emit(J, 0xb8 | (r & 7));
+    emit64(J, v);
+  }
+}
+
+
+/* xmm register 'x' = v */
+static void movfimm (JitState *J, int x, lua_Number v) {
+  size_t bits;
+  lua_assert(sizeof(bits) == sizeof(v));
+  memcpy(&bits, &v, sizeof(v));
+  movimm(J, RAX, bits);
+  movqx(J, x, RAX);
+}
+
+
+static void push (JitState *J, int r) {
+  if (r & 8) emit(J, 0x41);
+  emit(J, 0x50 | (r & 7));
+}
+
+
+static void pop (JitState *J, int r) {
+  if (r & 8) emit(J, 0x41);
+  emit(J, 0x58 | (r & 7));
+}
+
+
+/*
+** Jumps. Local (forward) jumps inside a template return the position
+** of their displacement, to be patched by 'here'; jumps to other
+** instructions or to exit stubs are recorded as fixups.
+*/
+static size_t jcc (JitState *J, int cc) {
+  emit(J, 0x0f); emit(J, 0x80 | cc); emit32(J, 0);
+  return J->pos - 4;
+}
+
+
+static size_t jmp (JitState *J) {
+  emit(J, 0xe9); emit32(J, 0);
+  return J->pos - 4;
+}
+
+
+static void patch (JitState *J, size_t pos, size_t target) {
+  if (pos + 4 <= J->limit) {
+    l_uint32 rel = cast(l_uint32, target - (pos + 4));
+    memcpy(J->code + pos, &rel, 4);
+  }
+}
+
+
+#define here(J,p)	patch(J, p, (J)->pos)
+
+
+static void addfix (JitState *J, size_t pos, int target, int toexit) {
+  if (J->nfix < J->sizefix) {
+    Fixup *f = &J->fix[J->nfix];
+    f->pos = cast(l_uint32, pos);
+    f->target = target;
+    f->toexit = toexit;
+  }
+  J->nfix++;  /* overflow is checked at the end */
+}
+
+
+/* jump to instruction 'n' */
+static void jmplabel (JitState *J, int n) {
+  addfix(J, jmp(J), n, 0);
+}
+
+
+static void jcclabel (JitState *J, int cc, int n) {
+  addfix(J, jcc(J, cc), n, 0);
+}
+
+
+/* leave native code, to continue in the interpreter at instruction 'n' */
+static void jccexit (JitState *J, int cc, int n) {
+  addfix(J, jcc(J, cc), n, 1);
+}
+
+
+/* call C function 'f' */
+static void callf (JitState *J, JitHelper f) {
+  movimm(J, RAX, cast_sizet(f));
+  emitreg(J, 0, 0, 0xff, 2, RAX);  /* call rax */
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Helpers
+** ===================================================================
+*/
+
+/*
+** All helpers receive the state, the 'CallInfo' of the running
+** function, and the instruction. 'savedpc' already points to the next
+** instruction; 'hsavestate' completes the interpreter's 'savestate'
+** for helpers that can raise errors or call metamethods.
+*/
+
+#define hbase(ci)	((ci)->func.p + 1)
+#define hRA(ci,i)	(hbase(ci) + GETARG_A(i))
+#define hRB(ci,i)	s2v(hbase(ci) + GETARG_B(i))
+#define hRC(ci,i)	s2v(hbase(ci) + GETARG_C(i))
+#define hK(ci)		(ci_func(ci)->p->k)
+#define hRKC(ci,i)  \
+	(TESTARG_k(i) ? hK(ci) + GETARG_C(i) : s2v(hbase(ci) + GETARG_C(i)))
+
+#define hsavestate(L,ci)	((L)->top.p = (ci)->top.p)
+
+
+/* field accesses, refreshing the inline cache used by native code */
+#if LUA_USE_ICACHE
+
+#define hicache(ci)  \
+	(ci_func(ci)->p->icache + pcRel((ci)->u.l.savedpc, ci_func(ci)->p))
+
+#define hgetfield(ci,t,key,res,tag)  \
+	(tag = (!ttistable(t) ? LUA_VNOTABLE  \
+	       : luaH_getshortstric(hvalue(t), key, res, hicache(ci))))
+
+#define hsetfield(ci,t,key,val,hres)  \
+	(hres = (!ttistable(t) ? HNOTATABLE  \
+	        : luaH_psetshortstric(hvalue(t), key, val, hicache(ci))))
+
+#define hselfindex(L,ci,rb,key,res,tag)  \
+	luaV_selfindex(L, rb, key, res, tag, hicache(ci))
+
+#else
+
+#define hgetfield(ci,t,key,res,tag)  \
+	luaV_fastget(t, key, res, luaH_getshortstr, tag)
+
+#define hsetfield(ci,t,key,val,hres)  \
+	luaV_fastset(t, key, val, hres, luaH_psetshortstr)
+
+#define hselfindex(L,ci,rb,key,res,tag)	0
+
+#endif
+
+
+static void h_setupval (lua_State *L, CallInfo *ci, Instruction i) {
+  UpVal *uv = ci_func(ci)->upvals[GETARG_B(i)];
+  TValue *ra = s2v(hRA(ci, i));
+  setobj(L, uv->v.p, ra);
+  luaC_barrier(L, uv, ra);
+}
+
+
+static void h_gettabup (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *upval = ci_func(ci)->upvals[GETARG_B(i)]->v.p;
+  TValue *rc = hK(ci) + GETARG_C(i);
+  lu_byte tag;
+  hgetfield(ci, upval, tsvalue(rc), s2v(hRA(ci, i)), tag);
+  if (tagisempty(tag)) {
+    hsavestate(L, ci);
+    luaV_finishget(L, upval, rc, hRA(ci, i), tag);
+  }
+}
+
+
+static void h_gettable (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *rb = hRB(ci, i);
+  TValue *rc = hRC(ci, i);
+  StkId ra = hRA(ci, i);
+  lu_byte tag;
+  if (ttisinteger(rc)) {
+    luaV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
+  }
+  else
+    luaV_fastget(rb, rc, s2v(ra), luaH_get, tag);
+  if (tagisempty(tag)) {
+    hsavestate(L, ci);
+    luaV_finishget(L, rb, rc, ra, tag);
+  }
+}
+
+
+static void h_geti (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *rb = hRB(ci, i);
+  StkId ra = hRA(ci, i);
+  int c = GETARG_C(i);
+  lu_byte tag;
+  luaV_fastgeti(rb, c, s2v(ra), tag);
+  if (tagisempty(tag)) {
+    TValue key;
+    setivalue(&key, c);
+    hsavestate(L, ci);
+    luaV_finishget(L, rb, &key, ra, tag);
+  }
+}
+
+
+static void h_getfield (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *rb = hRB(ci, i);
+  TValue *rc = hK(ci) + GETARG_C(i);
+  StkId ra = hRA(ci, i);
+  lu_byte tag;
+  hgetfield(ci, rb, tsvalue(rc), s2v(ra), tag);
+  if (tagisempty(tag)) {
+    hsavestate(L, ci);
+    luaV_finishget(L, rb, rc, ra, tag);
+  }
+}
+
+
+static void h_self (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *rb = hRB(ci, i);
+  TValue *rc = hK(ci) + GETARG_C(i);
+  StkId ra = hRA(ci, i);
+  lu_byte tag;
+  setobj2s(L, ra + 1, rb);
+  hgetfield(ci, rb, tsvalue(rc), s2v(ra), tag);
+  if (tagisempty(tag) &&
+      !hselfindex(L, ci, rb, tsvalue(rc), s2v(ra), tag)) {
+    hsavestate(L, ci);
+    luaV_finishget(L, rb, rc, ra, tag);
+  }
+}
+
+
+static void h_settabup (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *upval = ci_func(ci)->upvals[GETARG_A(i)]->v.p;
+  TValue *rb = hK(ci) + GETARG_B(i);
+  TValue *rc = hRKC(ci, i);
+  int hres;
+  hsetfield(ci, upval, tsvalue(rb), rc, hres);
+  if (hres == HOK)
+    luaV_finishfastset(L, upval, rc);
+  else {
+    hsavestate(L, ci);
+    luaV_finishset(L, upval, rb, rc, hres);
+  }
+}
+
+
+static void h_settable (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *ra = s2v(hRA(ci, i));
+  TValue *rb = hRB(ci, i);
+  TValue *rc = hRKC(ci, i);
+  int hres;
+  if (ttisinteger(rb)) {
+    luaV_fastseti(ra, ivalue(rb), rc, hres);
+  }
+  else {
+    luaV_fastset(ra, rb, rc, hres, luaH_pset);
+  }
+  if (hres == HOK)
+    luaV_finishfastset(L, ra, rc);
+  else {
+    hsavestate(L, ci);
+    luaV_finishset(L, ra, rb, rc, hres);
+  }
+}
+
+
+static void h_seti (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *ra = s2v(hRA(ci, i));
+  TValue *rc = hRKC(ci, i);
+  int b = GETARG_B(i);
+  int hres;
+  luaV_fastseti(ra, b, rc, hres);
+  if (hres == HOK)
+    luaV_finishfastset(L, ra, rc);
+  else {
+    TValue key;
+    setivalue(&key, b);
+    hsavestate(L, ci);
+    luaV_finishset(L, ra, &key, rc, hres);
+  }
+}
+
+
+static void h_setfield (lua_State *L, CallInfo *ci, Instruction i) {
+  TValue *ra = s2v(hRA(ci, i));
+  TValue *rb = hK(ci) + GETARG_B(i);
+  TValue *rc = hRKC(ci, i);
+  int hres;
+  hsetfield(ci, ra, tsvalue(rb), rc, hres);
+  if (hres == HOK)
+    luaV_finishfastset(L, ra, rc);
+  else {
+    hsavestate(L, ci);
+    luaV_finishset(L, ra, rb, rc, hres);
+  }
+}
+
+
+static void h_len (lua_State *L, CallInfo *ci, Instruction i) {
+  hsavestate(L, ci);
+  luaV_objlen(L, hRA(ci, i), hRB(ci, i));
+}
+
+
+/*
+** Arithmetic without metamethods, for the operators the native code
+** does not inline. Returns false if the operands are not numbers (so
+** that the interpreter deals with coercions and metamethods).
+*/
+static int h_arith (lua_State *L, CallInfo *ci, Instruction i) {
+  StkId ra = hRA(ci, i);
+  TValue *rb = hRB(ci, i);
+  TValue imm;
+  const TValue *p1 = rb;
+  const TValue *p2;
+  int op;
+  switch (GET_BASEOPCODE(i)) {
+    case OP_UNM: case OP_BNOT:
+      p2 = rb;
+      break;
+    case OP_SHLI:  /* 'sC << R[B]' */
+      setivalue(&imm, GETARG_sC(i));
+      p1 = &imm; p2 = rb;
+      break;
+    case OP_SHRI:
+      setivalue(&imm, GETARG_sC(i));
+      p2 = &imm;
+      break;
+    case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK:
+      p2 = hK(ci) + GETARG_C(i);
+      break;
+    default:
+      p2 = hRC(ci, i);
+      break;
+  }
+  switch (GET_BASEOPCODE(i)) {
+    case OP_MOD: case OP_MODK: op = LUA_OPMOD; break;
+    case OP_POW: case OP_POWK: op = LUA_OPPOW; break;
+    case OP_DIV: case OP_DIVK: op = LUA_OPDIV; break;
+    case OP_IDIV: case OP_IDIVK: op = LUA_OPIDIV; break;
+    case OP_BAND: case OP_BANDK: op = LUA_OPBAND; break;
+    case OP_BOR: case OP_BORK: op = LUA_OPBOR; break;
+    case OP_BXOR: case OP_BXORK: op = LUA_OPBXOR; break;
+    case OP_SHL: case OP_SHLI: op = LUA_OPSHL; break;
+    case OP_SHR: case OP_SHRI: op = LUA_OPSHR; break;
+    case OP_UNM: op = LUA_OPUNM; break;
+    case OP_BNOT: op = LUA_OPBNOT; break;
+    default: lua_assert(0); return 0;
+  }
+  hsavestate(L, ci);  /* in case of division by 0 */
+  return luaO_rawarith(L, op, p1, p2, s2v(ra));
+}
+
+
+static int h_eq (lua_State *L, CallInfo *ci, Instruction i) {
+  hsavestate(L, ci);
+  return luaV_equalobj(L, s2v(hRA(ci, i)), hRB(ci, i));
+}
+
+
+static int h_lt (lua_State *L, CallInfo *ci, Instruction i) {
+  hsavestate(L, ci);
+  return luaV_lessthan(L, s2v(hRA(ci, i)), hRB(ci, i));
+}
+
+
+static int h_le (lua_State *L, CallInfo *ci, Instruction i) {
+  hsavestate(L, ci);
+  return luaV_lessequal(L, s2v(hRA(ci, i)), hRB(ci, i));
+}
+
+
+static int h_eqk (lua_State *L, CallInfo *ci, Instruction i) {
+  UNUSED(L);
+  return luaV_rawequalobj(s2v(hRA(ci, i)), hK(ci) + GETARG_B(i));
+}
+
+
+static int h_forprep (lua_State *L, CallInfo *ci, Instruction i) {
+  hsavestate(L, ci);
+  return luaV_forprep(L, hRA(ci, i));
+}
+
+
+static int h_floatforloop (lua_State *L, CallInfo *ci, Instruction i) {
+  UNUSED(L);
+  return luaV_floatforloop(hRA(ci, i));
+}
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Code generation
+** ===================================================================
+*/
+
+/* kinds of helper calls */
+#define HPURE	0	/* helper does not move the stack nor run Lua code */
+#define HLUA	1	/* helper may reallocate the stack or call Lua */
+
+
+/* exit if the interpreter must stop at 'n' (hooks, stack moves) */
+static void checktrap (JitState *J, int n) {
+  emitmem(J, 0, 0, 0x83, 7, RCI, CITRAP);  /* cmp dword [ci.trap], 0 */
+  emit(J, 0);
+  jccexit(J, CC_NE, n);
+}
+
+
+/*
+** Call helper 'f' for instruction 'n'. For helpers that may run Lua
+** code, reload 'base' afterwards; the caller must then check 'trap'.
+*/
+static void callhelper (JitState *J, int n, JitHelper f, int kind) {
+  Instruction i = J->p->code[n];
+  movimm(J, RAX, cast_sizet(J->p->code + n + 1));
+  st64(J, RCI, CISAVEDPC, RAX);
+  mov64(J, RDI, RL);
+  mov64(J, RSI, RCI);
+  emit(J, 0xba); emit32(J, cast(l_uint32, i));  /* mov edx, i */
+  callf(J, f);
+  if (kind == HLUA) {
+    ld64(J, RBASE, RCI, CIFUNC);
+    emitreg(J, 0, 1, 0x81, 0, RBASE);  /* add rbx, sizeof(StackValue) */
+    emit32(J, cast(l_uint32, sizeof(StackValue)));
+  }
+}
+
+
+/* copy the value at [sb + sd] to [db + dd] (uses rcx and rdx) */
+static void copyvalue (JitState *J, int db, int dd, int sb, int sd) {
+  ld64(J, RCX, sb, sd + VAL);
+  st64(J, db, dd + VAL, RCX);
+  ldtag(J, RDX, sb, sd);
+  sttag(J, db, dd, RDX);
+}
+
+
+/*
+** Set the flags for 'l_isfalse' of the value at [b + d]; returns the
+** two jumps taken when the value is false. (Uses eax.)
+*/
+static void jumpiffalse (JitState *J, int b, int d, size_t *j1, size_t *j2) {
+  ldtag(J, RAX, b, d);
+  emit(J, 0x3c); emit(J, LUA_VFALSE);  /* cmp al, LUA_VFALSE */
+  *j1 = jcc(J, CC_E);
+  emit(J, 0xa8); emit(J, 0x0f);  /* test al, 0x0f (nil variants) */
+  *j2 = jcc(J, CC_E);
+}
+
+
+/*
+** Finish a conditional instruction 'n' whose condition is in the flags
+** ('cc'): as in 'docondjump', skip the following jump if the condition
+** is different from 'k'; otherwise go to that jump.
+*/
+static void condjump (JitState *J, int n, int cc, int k) {
+  jcclabel(J, k ? ccnot(cc) : cc, n + 2);
+  jmplabel(J, n + 1);
+}
+
+
+/* same, after a helper that may have run Lua code */
+static void condjumptrap (JitState *J, int n, int cc, int k) {
+  size_t skip = jcc(J, k ? ccnot(cc) : cc);
+  checktrap(J, n + 1);
+  jmplabel(J, n + 1);
+  here(J, skip);
+  checktrap(J, n + 2);
+  jmplabel(J, n + 2);
+}
+
+
+/*
+** An operand of an arithmetic or comparison: a register (at offset
+** 'd' from 'base') or a known value.
+*/
+typedef struct Operand {
+  int d;
+  const TValue *k;  /* known value, or NULL for registers */
+} Operand;
+
+
+static Operand reg (int r) {
+  Operand o;
+  o.d = SLOT(r); o.k = NULL;
+  return o;
+}
+
+
+static Operand known (const TValue *k) {
+  Operand o;
+  o.d = 0; o.k = k;
+  return o;
+}
+
+
+/* load operand 'o' converted to a float into 'x', or exit at 'n' */
+static void loadnum (JitState *J, int x, Operand o, int n) {
+  if (o.k != NULL)
+    movfimm(J, x, ttisinteger(o.k) ? cast_num(ivalue(o.k)) : fltvalue(o.k));
+  else {
+    size_t isint, done;
+    cmptag(J, RBASE, o.d, LUA_VNUMFLT);
+    isint = jcc(J, CC_NE);
+    ldsd(J, x, RBASE, o.d + VAL);
+    done = jmp(J);
+    here(J, isint);
+    cmptag(J, RBASE, o.d, LUA_VNUMINT);
+    jccexit(J, CC_NE, n);
+    cvtsd(J, x, RBASE, o.d + VAL);
+    here(J, done);
+  }
+}
+
+
+/*
+** Arithmetic 'R[A] := b op c' for instruction 'n', where 'op' is an
+** integer opcode (or 0 for none) and 'fop' the float one. Integer
+** operands give an integer result; other numbers are converted to
+** floats; anything else leaves to the interpreter, which deals with
+** strings and metamethods. On success, skip the OP_MMBIN that follows.
+*/
+static void arith (JitState *J, int n, int a, Operand b, Operand c,
+                   int op, int fop) {
+  int skip = n + 1;
+  int intpath;
+  size_t notint[2];
+  int nnot = 0;
+  int i;
+  if (n + 1 < J->p->sizecode) {
+    OpCode next = GET_BASEOPCODE(J->p->code[n + 1]);
+    if (next == OP_MMBIN || next == OP_MMBINI || next == OP_MMBINK)
+      skip = n + 2;
+  }
+  intpath = (op != 0 && (b.k == NULL || ttisinteger(b.k)) &&
+                        (c.k == NULL || ttisinteger(c.k)));
+  if (intpath) {
+    if (b.k == NULL) {
+      cmptag(J, RBASE, b.d, LUA_VNUMINT);
+      notint[nnot++] = jcc(J, CC_NE);
+    }
+    if (c.k == NULL) {
+      cmptag(J, RBASE, c.d, LUA_VNUMINT);
+      notint[nnot++] = jcc(J, CC_NE);
+    }
+    if (b.k == NULL)
+      ld64(J, RAX, RBASE, b.d + VAL);
+    else
+      movimm(J, RAX, l_castS2U(ivalue(b.k)));
+    if (c.k == NULL)
+      emitmem(J, 0, 1, op, RAX, RBASE, c.d + VAL);
+    else {
+      movimm(J, RCX, l_castS2U(ivalue(c.k)));
+      emitreg(J, 0, 1, op, RAX, RCX);
+    }
+    st64(J, RBASE, SLOT(a) + VAL, RAX);
+    settag(J, RBASE, SLOT(a), LUA_VNUMINT);
+    jmplabel(J, skip);
+    for (i = 0; i < nnot; i++)
+      here(J, notint[i]);
+  }
+  loadnum(J, XMM0, b, n);
+  loadnum(J, XMM1, c, n);
+  emitreg(J, 0xf2, 0, fop, XMM0, XMM1);
+  stsd(J, RBASE, SLOT(a) + VAL, XMM0);
+  settag(J, RBASE, SLOT(a), LUA_VNUMFLT);
+  jmplabel(J, skip);
+}
+
+
+/* arithmetic done by 'h_arith' */
+static void arithhelper (JitState *J, int n) {
+  int skip = n + 1;
+  OpCode next = (n + 1 < J->p->sizecode) ? GET_BASEOPCODE(J->p->code[n + 1])
+                                          : OP_EXTRAARG;
+  if (next == OP_MMBIN || next == OP_MMBINI || next == OP_MMBINK)
+    skip = n + 2;
+  callhelper(J, n, helper(h_arith), HPURE);
+  testeax(J);
+  jccexit(J, CC_E, n);  /* not numbers? let the interpreter do it */
+  jmplabel(J, skip);
+}
+
+
+/*
+** Comparisons 'R[A] < R[B]' and 'R[A] <= R[B]' ('cc' is the integer
+** condition, 'fcc' the float one for 'R[B] > R[A]').
+*/
+static void order (JitState *J, int n, Instruction i, int cc, int fcc,
+                   JitHelper h) {
+  int ra = SLOT(GETARG_A(i));
+  int rb = SLOT(GETARG_B(i));
+  int k = GETARG_k(i);
+  size_t notint1, notint2, notflt1, notflt2;
+  cmptag(J, RBASE, ra, LUA_VNUMINT);
+  notint1 = jcc(J, CC_NE);
+  cmptag(J, RBASE, rb, LUA_VNUMINT);
+  notint2 = jcc(J, CC_NE);
+  ld64(J, RAX, RBASE, ra + VAL);
+  emitmem(J, 0, 1, OPCMP, RAX, RBASE, rb + VAL);
+  condjump(J, n, cc, k);
+  here(J, notint1);
+  here(J, notint2);
+  cmptag(J, RBASE, ra, LUA_VNUMFLT);
+  notflt1 = jcc(J, CC_NE);
+  cmptag(J, RBASE, rb, LUA_VNUMFLT);
+  notflt2 = jcc(J, CC_NE);
+  ldsd(J, XMM0, RBASE, rb + VAL);
+  ucomisd(J, XMM0, RBASE, ra + VAL);
+  condjump(J, n, fcc, k);
+  here(J, notflt1);
+  here(J, notflt2);
+  callhelper(J, n, h, HLUA);
+  testeax(J);
+  condjumptrap(J, n, CC_NE, k);
+}
+
+
+/*
+** Comparisons with an immediate: 'cc' is the integer condition; for
+** floats, compare 'x' against 'y' with condition 'fcc' (with xmm0
+** holding R[A] and xmm1 the immediate).
+*/
+static void orderI (JitState *J, int n, Instruction i, int cc, int fcc,
+                    int swap) {
+  int ra = SLOT(GETARG_A(i));
+  int im = GETARG_sB(i);
+  int k = GETARG_k(i);
+  size_t notint;
+  cmptag(J, RBASE, ra, LUA_VNUMINT);
+  notint = jcc(J, CC_NE);
+  emitmem(J, 0, 1, 0x81, 7, RBASE, ra + VAL);  /* cmp qword, imm32 */
+  emit32(J, cast(l_uint32, im));
+  condjump(J, n, cc, k);
+  here(J, notint);
+  cmptag(J, RBASE, ra, LUA_VNUMFLT);
+  jccexit(J, CC_NE, n);  /* metamethods are for the interpreter */
+  ldsd(J, XMM0, RBASE, ra + VAL);
+  movfimm(J, XMM1, cast_num(im));
+  if (swap)
+    ucomisdr(J, XMM1, XMM0);
+  else
+    ucomisdr(J, XMM0, XMM1);
+  condjump(J, n, fcc, k);
+}
+
+
+/* float equality of xmm0 and xmm1 (unordered values are different) */
+static void floateq (JitState *J, int n, int k) {
+  ucomisdr(J, XMM0, XMM1);
+  if (k) {  /* skip jump if different */
+    jcclabel(J, CC_P, n + 2);
+    jcclabel(J, CC_NE, n + 2);
+  }
+  else {  /* skip jump if equal */
+    size_t unord = jcc(J, CC_P);
+    jcclabel(J, CC_E, n + 2);
+    here(J, unord);
+  }
+  jmplabel(J, n + 1);
+}
+
+
+static void eqI (JitState *J, int n, Instruction i) {
+  int ra = SLOT(GETARG_A(i));
+  int im = GETARG_sB(i);
+  int k = GETARG_k(i);
+  size_t notint, notflt;
+  cmptag(J, RBASE, ra, LUA_VNUMINT);
+  notint = jcc(J, CC_NE);
+  emitmem(J, 0, 1, 0x81, 7, RBASE, ra + VAL);  /* cmp qword, imm32 */
+  emit32(J, cast(l_uint32, im));
+  condjump(J, n, CC_E, k);
+  here(J, notint);
+  cmptag(J, RBASE, ra, LUA_VNUMFLT);
+  notflt = jcc(J, CC_NE);
+  ldsd(J, XMM0, RBASE, ra + VAL);
+  movfimm(J, XMM1, cast_num(im));
+  floateq(J, n, k);
+  here(J, notflt);  /* not a number: condition is false */
+  jmplabel(J, k ? n + 2 : n + 1);
+}
+
+
+static void eqK (JitState *J, int n, Instruction i) {
+  int ra = SLOT(GETARG_A(i));
+  const TValue *kv = J->p->k + GETARG_B(i);
+  int k = GETARG_k(i);
+  switch (ttypetag(kv)) {
+    case LUA_VNIL: case LUA_VFALSE: case LUA_VTRUE: {
+      cmptag(J, RBASE, ra, ttypetag(kv));
+      condjump(J, n, CC_E, k);
+      break;
+    }
+    case LUA_VSHRSTR: {
+      size_t notstr;
+      cmptag(J, RBASE, ra, ctb(LUA_VSHRSTR));
+      notstr = jcc(J, CC_NE);
+      movimm(J, RCX, cast_sizet(gcvalue(kv)));
+      emitmem(J, 0, 1, OPCMP, RCX, RBASE, ra + VAL);
+      condjump(J, n, CC_E, k);
+      here(J, notstr);
+      jmplabel(J, k ? n + 2 : n + 1);
+      break;
+    }
+    case LUA_VNUMINT: {
+      size_t notint;
+      cmptag(J, RBASE, ra, LUA_VNUMINT);
+      notint = jcc(J, CC_NE);
+      movimm(J, RCX, l_castS2U(ivalue(kv)));
+      emitmem(J, 0, 1, OPCMP, RCX, RBASE, ra + VAL);
+      condjump(J, n, CC_E, k);
+      here(J, notint);
+    }  /* FALLTHROUGH */
+    default: {
+      callhelper(J, n, helper(h_eqk), HPURE);
+      testeax(J);
+      condjump(J, n, CC_NE, k);
+      break;
+    }
+  }
+}
+
+
+/* conditional jump on the truth of R[A] ('OP_TEST') */
+static void test (JitState *J, int n, Instruction i) {
+  int k = GETARG_k(i);
+  int iffalse = k ? n + 2 : n + 1;
+  size_t f1, f2;
+  jumpiffalse(J, RBASE, SLOT(GETARG_A(i)), &f1, &f2);
+  jmplabel(J, k ? n + 1 : n + 2);
+  here(J, f1);
+  here(J, f2);
+  jmplabel(J, iffalse);
+}
+
+
+static void testset (JitState *J, int n, Instruction i) {
+  int ra = SLOT(GETARG_A(i));
+  int rb = SLOT(GETARG_B(i));
+  int k = GETARG_k(i);
+  size_t f1, f2;
+  jumpiffalse(J, RBASE, rb, &f1, &f2);
+  if (k)
+    copyvalue(J, RBASE, ra, RBASE, rb);
+  jmplabel(J, k ? n + 1 : n + 2);
+  here(J, f1);
+  here(J, f2);
+  if (!k)
+    copyvalue(J, RBASE, ra, RBASE, rb);
+  jmplabel(J, k ? n + 2 : n + 1);
+}
+
+
+static void not (JitState *J, Instruction i) {
+  int ra = SLOT(GETARG_A(i));
+  size_t f1, f2, done;
+  jumpiffalse(J, RBASE, SLOT(GETARG_B(i)), &f1, &f2);
+  settag(J, RBASE, ra, LUA_VFALSE);
+  done = jmp(J);
+  here(J, f1);
+  here(J, f2);
+  settag(J, RBASE, ra, LUA_VTRUE);
+  here(J, done);
+}
+
+
+static void forloop (JitState *J, int n, Instruction i) {
+  int ra = SLOT(GETARG_A(i));
+  int target = n + 1 - GETARG_Bx(i);
+  size_t isflt, done1, done2;
+  cmptag(J, RBASE, ra + SLOT(1), LUA_VNUMINT);
+  isflt = jcc(J, CC_NE);
+  ld64(J, RAX, RBASE, ra + VAL);  /* iteration counter */
+  emitreg(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  done1 = jcc(J, CC_E);
+  emitreg(J, 0, 1, 0x83, 5, RAX);  /* sub rax, 1 */
+  emit(J, 1);
+  st64(J, RBASE, ra + VAL, RAX);
+  ld64(J, RAX, RBASE, ra + SLOT(2) + VAL);
+  emitmem(J, 0, 1, OPADD, RAX, RBASE, ra + SLOT(1) + VAL);
+  st64(J, RBASE, ra + SLOT(2) + VAL, RAX);
+  checktrap(J, target);
+  jmplabel(J, target);
+  here(J, isflt);
+  callhelper(J, n, helper(h_floatforloop), HPURE);
+  testeax(J);
+  done2 = jcc(J, CC_E);
+  checktrap(J, target);
+  jmplabel(J, target);
+  here(J, done1);
+  here(J, done2);
+}
+
+
+/*
+** {======================================================
+** Table accesses
+** =======================================================
+*/
+
+/* jumps to the slow path of a table access */
+typedef struct Misses {
+  size_t j[8];
+  int n;
+} Misses;
+
+
+static void miss (JitState *J, Misses *m, int cc) {
+  lua_assert(m->n < 8);
+  m->j[m->n++] = jcc(J, cc);
+}
+
+
+/* check that [b + d] is a table and load it into rax */
+static void loadtable (JitState *J, Misses *m, int b, int d) {
+  cmptag(J, b, d, ctb(LUA_VTABLE));
+  miss(J, m, CC_NE);
+  ld64(J, RAX, b, d + VAL);
+}
+
+
+/*
+** Slow path of a table access: the helper does the whole access
+** again, with metamethods and all.
+*/
+static void slowpath (JitState *J, int n, Misses *m, JitHelper h) {
+  size_t done = jmp(J);
+  int i;
+  for (i = 0; i < m->n; i++)
+    here(J, m->j[i]);
+  callhelper(J, n, h, HLUA);
+  checktrap(J, n + 1);
+  here(J, done);
+}
+
+
+/* test whether the value whose tag is in cl is empty */
+static void testempty (JitState *J) {
+  emitreg(J, 0, 0, 0xf6, 0, RCX);  /* test cl, 0x0f */
+  emit(J, 0x0f);
+}
+
+
+#if LUA_USE_ICACHE
+
+/*
+** Load into rdx the node of table rax remembered by the inline cache
+** of instruction 'n' (as in 'luaH_icnode') and check that it holds the
+** short string 'key'.
+*/
+static void icnode (JitState *J, int n, Misses *m, TString *key) {
+  ldtag(J, RCX, RAX, TLSIZENODE - TT);  /* ecx = t->lsizenode */
+  emit(J, 0xba); emit32(J, 1);  /* mov edx, 1 */
+  emitreg(J, 0, 0, 0xd3, 4, RDX);  /* shl edx, cl */
+  emitreg(J, 0, 0, 0x83, 5, RDX);  /* sub edx, 1 */
+  emit(J, 1);
+  movimm(J, RSI, cast_sizet(J->p->icache + n));
+  emitmem(J, 0, 0, 0x23, RDX, RSI, 0);  /* and edx, [icache] */
+  emitreg(J, 0, 1, 0x69, RDX, RDX);  /* imul rdx, rdx, sizeof(Node) */
+  emit32(J, cast(l_uint32, sizeof(Node)));
+  emitmem(J, 0, 1, OPADD, RDX, RAX, TNODE);
+  emitmem(J, 0, 0, 0x80, 7, RDX, NKEYTT);  /* cmp byte [key_tt], tag */
+  emit(J, ctb(LUA_VSHRSTR));
+  miss(J, m, CC_NE);
+  movimm(J, RCX, cast_sizet(key));
+  emitmem(J, 0, 1, OPCMP, RCX, RDX, NKEYVAL);
+  miss(J, m, CC_NE);
+}
+
+
+/* R[A] := t[key], with table at [b + d] */
+static void getfield (JitState *J, int n, int b, int d, TString *key,
+                      JitHelper h) {
+  int ra = SLOT(GETARG_A(J->p->code[n]));
+  Misses m;
+  m.n = 0;
+  loadtable(J, &m, b, d);
+  icnode(J, n, &m, key);
+  ldtag(J, RCX, RDX, 0);
+  testempty(J);
+  miss(J, &m, CC_E);
+  ld64(J, RSI, RDX, VAL);
+  st64(J, RBASE, ra + VAL, RSI);
+  sttag(J, RBASE, ra, RCX);
+  slowpath(J, n, &m, h);
+}
+
+
+/*
+** t[key] := value, with table at [b + d] and value at [vb + vd] (or
+** 'kv' if known). As in 'fastsetfield', only for keys already present;
+** values that may need a barrier go to the slow path.
+*/
+static void setfield (JitState *J, int n, int b, int d, TString *key,
+                      int vb, int vd, const TValue *kv, JitHelper h) {
+  Misses m;
+  m.n = 0;
+  loadtable(J, &m, b, d);
+  icnode(J, n, &m, key);
+  ldtag(J, RCX, RDX, 0);
+  testempty(J);
+  miss(J, &m, CC_E);
+  if (kv == NULL || iscollectable(kv)) {
+    size_t notcol = 0;
+    if (kv == NULL) {
+      emitmem(J, 0, 0, 0xf6, 0, vb, vd + TT);  /* test byte [tag], bit */
+      emit(J, BIT_ISCOLLECTABLE);
+      notcol = jcc(J, CC_E);
+    }
+    emitmem(J, 0, 0, 0xf6, 0, RAX, TMARKED);  /* test byte [marked], bit */
+    emit(J, bitmask(BLACKBIT));
+    miss(J, &m, CC_NE);  /* black table needs a barrier */
+    if (kv == NULL)
+      here(J, notcol);
+  }
+  ld64(J, RSI, vb, vd + VAL);
+  st64(J, RDX, VAL, RSI);
+  ldtag(J, RCX, vb, vd);
+  sttag(J, RDX, 0, RCX);
+  slowpath(J, n, &m, h);
+}
+
+#endif
+
+
+/*
+** R[A] := R[B][key] for integer keys in the array part: 'rc' is the
+** register with the key or -1 for a constant key 'c'.
+*/
+static void getarray (JitState *J, int n, int rc, lua_Integer c,
+                      JitHelper h) {
+  Instruction i = J->p->code[n];
+  int ra = SLOT(GETARG_A(i));
+  Misses m;
+  m.n = 0;
+  loadtable(J, &m, RBASE, SLOT(GETARG_B(i)));
+  ld64(J, RDX, RAX, TARRAY);
+  if (rc >= 0) {
+    cmptag(J, RBASE, SLOT(rc), LUA_VNUMINT);
+    miss(J, &m, CC_NE);
+    ld64(J, RSI, RBASE, SLOT(rc) + VAL);
+    emitreg(J, 0, 1, 0x83, 5, RSI);  /* sub rsi, 1 */
+    emit(J, 1);
+    emitmem(J, 0, 0, 0x8b, RCX, RAX, TASIZE);  /* mov ecx, asize */
+    emitreg(J, 0, 1, 0x39, RCX, RSI);  /* cmp rsi, rcx */
+    miss(J, &m, CC_AE);
+    emitmemx(J, 0, 0x0fb6, RCX, RDX, RSI, 1, sizeof(unsigned));
+    testempty(J);
+    miss(J, &m, CC_E);
+    emitreg(J, 0, 1, 0xf7, 3, RSI);  /* neg rsi */
+    emitmemx(J, 1, 0x8b, RDI, RDX, RSI, 8, -cast_int(sizeof(Value)));
+  }
+  else {
+    int u = cast_int(c) - 1;
+    emitmem(J, 0, 0, 0x81, 7, RAX, TASIZE);  /* cmp dword [asize], u */
+    emit32(J, cast(l_uint32, u));
+    miss(J, &m, CC_BE);
+    ldtag(J, RCX, RDX, cast_int(sizeof(unsigned)) + u - TT);
+    testempty(J);
+    miss(J, &m, CC_E);
+    ld64(J, RDI, RDX, -cast_int(sizeof(Value)) * (u + 1));
+  }
+  st64(J, RBASE, ra + VAL, RDI);
+  sttag(J, RBASE, ra, RCX);
+  slowpath(J, n, &m, h);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** Compile instruction 'n'. Returns false for instructions left to the
+** interpreter, which are compiled as plain exits.
+*/
+static int compileop (JitState *J, int n) {
+  Proto *p = J->p;
+  Instruction i = p->code[n];
+  OpCode op = GET_BASEOPCODE(i);
+  int ra = SLOT(GETARG_A(i));
+  switch (op) {
+    case OP_MOVE: {
+      copyvalue(J, RBASE, ra, RBASE, SLOT(GETARG_B(i)));
+      break;
+    }
+    case OP_LOADI: {
+      emitmem(J, 0, 1, 0xc7, 0, RBASE, ra + VAL);  /* mov qword, imm32 */
+      emit32(J, cast(l_uint32, GETARG_sBx(i)));
+      settag(J, RBASE, ra, LUA_VNUMINT);
+      break;
+    }
+    case OP_LOADF: {
+      movfimm(J, XMM0, cast_num(GETARG_sBx(i)));
+      stsd(J, RBASE, ra + VAL, XMM0);
+      settag(J, RBASE, ra, LUA_VNUMFLT);
+      break;
+    }
+    case OP_LOADK: {
+      copyvalue(J, RBASE, ra, RK, KSLOT(GETARG_Bx(i)));
+      break;
+    }
+    case OP_LOADFALSE: {
+      settag(J, RBASE, ra, LUA_VFALSE);
+      break;
+    }
+    case OP_LFALSESKIP: {
+      settag(J, RBASE, ra, LUA_VFALSE);
+      jmplabel(J, n + 2);
+      break;
+    }
+    case OP_LOADTRUE: {
+      settag(J, RBASE, ra, LUA_VTRUE);
+      break;
+    }
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      if (b >= 8)
+        return 0;
+      do {
+        settag(J, RBASE, ra, LUA_VNIL);
+        ra += SLOT(1);
+      } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: {
+      ld64(J, RAX, RCL, CLUPVALS + GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      ld64(J, RAX, RAX, UVVALUE);
+      copyvalue(J, RBASE, ra, RAX, 0);
+      break;
+    }
+    case OP_SETUPVAL: {
+      callhelper(J, n, helper(h_setupval), HPURE);
+      break;
+    }
+#if LUA_USE_ICACHE
+    case OP_GETTABUP: {
+      ld64(J, RAX, RCL, CLUPVALS + GETARG_B(i) * cast_int(sizeof(UpVal *)));
+      ld64(J, RAX, RAX, UVVALUE);
+      getfield(J, n, RAX, 0, tsvalue(p->k + GETARG_C(i)), helper(h_gettabup));
+      break;
+    }
+    case OP_GETFIELD: {
+      getfield(J, n, RBASE, SLOT(GETARG_B(i)), tsvalue(p->k + GETARG_C(i)),
+               helper(h_getfield));
+      break;
+    }
+    case OP_SELF: {
+      int rb = SLOT(GETARG_B(i));
+      copyvalue(J, RBASE, ra + SLOT(1), RBASE, rb);
+      getfield(J, n, RBASE, rb, tsvalue(p->k + GETARG_C(i)), helper(h_self));
+      break;
+    }
+    case OP_SETTABUP: {
+      int c = GETARG_C(i);
+      int k = TESTARG_k(i);
+      ld64(J, RAX, RCL, CLUPVALS + GETARG_A(i) * cast_int(sizeof(UpVal *)));
+      ld64(J, RAX, RAX, UVVALUE);
+      setfield(J, n, RAX, 0, tsvalue(p->k + GETARG_B(i)),
+               k ? RK : RBASE, k ? KSLOT(c) : SLOT(c), k ? p->k + c : NULL,
+               helper(h_settabup));
+      break;
+    }
+    case OP_SETFIELD: {
+      int c = GETARG_C(i);
+      int k = TESTARG_k(i);
+      setfield(J, n, RBASE, ra, tsvalue(p->k + GETARG_B(i)),
+               k ? RK : RBASE, k ? KSLOT(c) : SLOT(c), k ? p->k + c : NULL,
+               helper(h_setfield));
+      break;
+    }
+#endif
+    case OP_GETTABLE: {
+      getarray(J, n, GETARG_C(i), 0, helper(h_gettable));
+      break;
+    }
+    case OP_GETI: {
+      if (GETARG_C(i) == 0)
+        return 0;
+      getarray(J, n, -1, GETARG_C(i), helper(h_geti));
+      break;
+    }
+#if !LUA_USE_ICACHE
+    case OP_GETTABUP: case OP_GETFIELD: case OP_SELF:
+    case OP_SETTABUP: case OP_SETFIELD:
+#endif
+    case OP_SETTABLE: case OP_SETI: case OP_LEN: {
+      JitHelper h;
+      switch (op) {
+        case OP_GETTABUP: h = helper(h_gettabup); break;
+        case OP_GETTABLE: h = helper(h_gettable); break;
+        case OP_GETI: h = helper(h_geti); break;
+        case OP_GETFIELD: h = helper(h_getfield); break;
+        case OP_SETTABUP: h = helper(h_settabup); break;
+        case OP_SETTABLE: h = helper(h_settable); break;
+        case OP_SETI: h = helper(h_seti); break;
+        case OP_SETFIELD: h = helper(h_setfield); break;
+        case OP_SELF: h = helper(h_self); break;
+        default: h = helper(h_len); break;
+      }
+      callhelper(J, n, h, HLUA);
+      checktrap(J, n + 1);
+      break;
+    }
+    case OP_ADD: {
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), reg(GETARG_C(i)),
+               OPADD, OPADDSD);
+      break;
+    }
+    case OP_SUB: {
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), reg(GETARG_C(i)),
+               OPSUB, OPSUBSD);
+      break;
+    }
+    case OP_MUL: {
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), reg(GETARG_C(i)),
+               OPIMUL, OPMULSD);
+      break;
+    }
+    case OP_DIV: {
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), reg(GETARG_C(i)),
+               0, OPDIVSD);
+      break;
+    }
+    case OP_ADDI: {
+      TValue v;
+      setivalue(&v, GETARG_sC(i));
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), known(&v),
+               OPADD, OPADDSD);
+      break;
+    }
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_DIVK: {
+      const TValue *kc = p->k + GETARG_C(i);
+      int iop = (op == OP_ADDK) ? OPADD : (op == OP_SUBK) ? OPSUB
+              : (op == OP_MULK) ? OPIMUL : 0;
+      int fop = (op == OP_ADDK) ? OPADDSD : (op == OP_SUBK) ? OPSUBSD
+              : (op == OP_MULK) ? OPMULSD : OPDIVSD;
+      arith(J, n, GETARG_A(i), reg(GETARG_B(i)), known(kc), iop, fop);
+      break;
+    }
+    case OP_MODK: case OP_POWK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK: case OP_SHLI: case OP_SHRI:
+    case OP_MOD: case OP_POW: case OP_IDIV:
+    case OP_BAND: case OP_BOR: case OP_BXOR: case OP_SHL: case OP_SHR:
+    case OP_BNOT: {
+      arithhelper(J, n);
+      break;
+    }
+    case OP_UNM: {
+      int rb = SLOT(GETARG_B(i));
+      size_t notint;
+      cmptag(J, RBASE, rb, LUA_VNUMINT);
+      notint = jcc(J, CC_NE);
+      ld64(J, RAX, RBASE, rb + VAL);
+      emitreg(J, 0, 1, 0xf7, 3, RAX);  /* neg rax */
+      st64(J, RBASE, ra + VAL, RAX);
+      settag(J, RBASE, ra, LUA_VNUMINT);
+      jmplabel(J, n + 1);
+      here(J, notint);
+      arithhelper(J, n);
+      break;
+    }
+    case OP_NOT: {
+      not(J, i);
+      break;
+    }
+    case OP_JMP: {
+      int target = n + 1 + GETARG_sJ(i);
+      if (target <= n)  /* backward jump? */
+        checktrap(J, target);
+      jmplabel(J, target);
+      break;
+    }
+    case OP_EQ: {
+      int rb = SLOT(GETARG_B(i));
+      size_t notint1, notint2;
+      cmptag(J, RBASE, ra, LUA_VNUMINT);
+      notint1 = jcc(J, CC_NE);
+      cmptag(J, RBASE, rb, LUA_VNUMINT);
+      notint2 = jcc(J, CC_NE);
+      ld64(J, RAX, RBASE, ra + VAL);
+      emitmem(J, 0, 1, OPCMP, RAX, RBASE, rb + VAL);
+      condjump(J, n, CC_E, GETARG_k(i));
+      here(J, notint1);
+      here(J, notint2);
+      callhelper(J, n, helper(h_eq), HLUA);
+      testeax(J);
+      condjumptrap(J, n, CC_NE, GETARG_k(i));
+      break;
+    }
+    case OP_LT: {
+      order(J, n, i, CC_L, CC_A, helper(h_lt));
+      break;
+    }
+    case OP_LE: {
+      order(J, n, i, CC_LE, CC_AE, helper(h_le));
+      break;
+    }
+    case OP_EQK: {
+      eqK(J, n, i);
+      break;
+    }
+    case OP_EQI: {
+      eqI(J, n, i);
+      break;
+    }
+    case OP_LTI: {  /* R[A] < im  <=>  im > R[A] */
+      orderI(J, n, i, CC_L, CC_A, 1);
+      break;
+    }
+    case OP_LEI: {
+      orderI(J, n, i, CC_LE, CC_AE, 1);
+      break;
+    }
+    case OP_GTI: {
+      orderI(J, n, i, CC_G, CC_A, 0);
+      break;
+    }
+    case OP_GEI: {
+      orderI(J, n, i, CC_GE, CC_AE, 0);
+      break;
+    }
+    case OP_TEST: {
+      test(J, n, i);
+      break;
+    }
+    case OP_TESTSET: {
+      testset(J, n, i);
+      break;
+    }
+    case OP_FORLOOP: {
+      forloop(J, n, i);
+      break;
+    }
+    case OP_FORPREP: {
+      callhelper(J, n, helper(h_forprep), HPURE);
+      testeax(J);
+      jcclabel(J, CC_NE, n + GETARG_Bx(i) + 2);  /* skip the loop? */
+      break;
+    }
+    default:
+      return 0;
+  }
+  return 1;
+}
+
+
+/*
+** Function entry: save callee-saved registers, load the state of
+** the running function, and jump to the target in rdx.
+*/
+static void prologue (JitState *J) {
+  push(J, RBX); push(J, R12); push(J, R13); push(J, R14); push(J, R15);
+  mov64(J, RL, RDI);
+  mov64(J, RCI, RSI);
+  ld64(J, RBASE, RCI, CIFUNC);
+  ld64(J, RCL, RBASE, VAL);  /* closure */
+  emitreg(J, 0, 1, 0x81, 0, RBASE);  /* add rbx, sizeof(StackValue) */
+  emit32(J, cast(l_uint32, sizeof(StackValue)));
+  ld64(J, RK, RCL, CLPROTO);
+  ld64(J, RK, RK, PROTOK);
+  emitreg(J, 0, 0, 0xff, 4, RDX);  /* jmp rdx */
+}
+
+
+/* function exit, with the 'pc' to continue at in rax */
+static void epilogue (JitState *J) {
+  J->epilogue = J->pos;
+  st64(J, RCI, CISAVEDPC, RAX);
+  pop(J, R15); pop(J, R14); pop(J, R13); pop(J, R12); pop(J, RBX);
+  emit(J, 0xc3);  /* ret */
+}
+
+
+/* code to leave native code before instruction 'n' */
+static void exitstub (JitState *J, int n) {
+  movimm(J, RAX, cast_sizet(J->p->code + n));
+  patch(J, jmp(J), J->epilogue);
+}
+
+
+/* size of the header of a 'JitCode'; the prologue comes right after it */
+#define headersize(p)  \
+	((offsetof(JitCode, entry) + sizeof(l_uint32) * cast_sizet((p)->sizecode)  \
+	  + 15) & ~cast_sizet(15))
+
+
+static size_t roundpage (size_t size) {
+  size_t page = 4096;
+  return (size + page - 1) & ~(page - 1);
+}
+
+
+/*
+** Generate the code of 'p' into a fresh mapping. Return NULL if the
+** function cannot be compiled. (Compilation does not use the Lua
+** allocator, so it never raises errors nor runs the collector.)
+*/
+static JitCode *compile (Proto *p) {
+  JitState J;
+  JitCode *jc;
+  size_t header, mapsize, scratchsize;
+  lu_byte *scratch;
+  int n;
+  int nstubs = 0;
+  int ok = 1;
+  if (p->sizecode > MAXJITCODE)
+    return NULL;
+  header = headersize(p);
+  mapsize = roundpage(header + 256 +
+                      cast_sizet(p->sizecode) * (INSTRSIZE + STUBSIZE));
+  jc = cast(JitCode *, mmap(NULL, mapsize, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (jc == MAP_FAILED)
+    return NULL;
+  J.sizefix = p->sizecode * FIXPERINSTR;
+  scratchsize = roundpage(sizeof(l_uint32) * 2 * cast_sizet(p->sizecode) +
+                          sizeof(Fixup) * cast_sizet(J.sizefix));
+  scratch = cast(lu_byte *, mmap(NULL, scratchsize, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  if (scratch == MAP_FAILED) {
+    munmap(jc, mapsize);
+    return NULL;
+  }
+  J.p = p;
+  J.code = cast(lu_byte *, jc);
+  J.pos = header;
+  J.limit = mapsize;
+  J.label = cast(l_uint32 *, scratch);
+  J.stub = J.label + p->sizecode;
+  J.fix = cast(Fixup *, J.stub + p->sizecode);
+  J.nfix = 0;
+  /* fresh mappings are zeroed, so 'stub' and 'entry' start empty */
+  prologue(&J);
+  epilogue(&J);
+  for (n = 0; n < p->sizecode; n++) {
+    J.label[n] = cast(l_uint32, J.pos);
+    if (compileop(&J, n))
+      jc->entry[n] = J.label[n];
+    else
+      exitstub(&J, n);
+  }
+  /* exit stubs */
+  for (n = 0; n < J.nfix && n < J.sizefix; n++) {
+    Fixup *f = &J.fix[n];
+    if (f->toexit && J.stub[f->target] == 0) {
+      J.stub[f->target] = cast(l_uint32, J.pos);
+      exitstub(&J, f->target);
+      nstubs++;
+    }
+  }
+  if (J.pos > J.limit || J.nfix > J.sizefix)
+    ok = 0;  /* buffers overflowed */
+  else {
+    for (n = 0; n < J.nfix; n++) {
+      Fixup *f = &J.fix[n];
+      lua_assert(0 <= f->target && f->target < p->sizecode);
+      patch(&J, f->pos, f->toexit ? J.stub[f->target] : J.label[f->target]);
+    }
+  }
+  munmap(scratch, scratchsize);
+  if (ok) {
+    size_t used = roundpage(J.pos);
+    if (used < mapsize) {  /* give back unused pages */
+      munmap(cast(lu_byte *, jc) + used, mapsize - used);
+      mapsize = used;
+    }
+    jc->size = mapsize;
+    if (mprotect(jc, mapsize, PROT_READ | PROT_EXEC) == 0)
+      return jc;
+  }
+  munmap(jc, mapsize);
+  return NULL;
+}
+
+/* }================================================================== */
+
+
+/*
+** Called by the interpreter when the counter of a function reaches
+** zero or when the function already has native code.
+*/
+const Instruction *luaJ_enter (lua_State *L, CallInfo *ci) {
+  Proto *p = ci_func(ci)->p;
+  const Instruction *pc = ci->u.l.savedpc;
+  JitCode *jc = cast(JitCode *, p->jit);
+  l_uint32 off;
+  if (jc == NULL) {  /* counter reached zero */
+    if (!G(L)->jitmode) {
+      p->jitcount = LUAI_JITTHRESHOLD;  /* try again later */
+      return pc;
+    }
+    jc = compile(p);
+    if (jc == NULL) {
+      p->jitcount = JITNEVER;  /* do not try again soon */
+      return pc;
+    }
+    p->jit = jc;
+  }
+  if (!G(L)->jitmode || L->hookmask || ci->u.l.trap)
+    return pc;
+  off = jc->entry[pc - p->code];
+  if (off == 0)  /* no native code for this instruction? */
+    return pc;
+  else {
+    JitFunction f = cast(JitFunction, cast(lu_byte *, jc) + headersize(p));
+    return f(L, ci, cast(lu_byte *, jc) + off);
+  }
+}
+
+
+void luaJ_free (Proto *p) {
+  if (p->jit != NULL) {
+    JitCode *jc = cast(JitCode *, p->jit);
+    munmap(jc, jc->size);
+  }
+}
+
+#endif
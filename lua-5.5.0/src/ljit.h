@@ -0,0 +1,55 @@
+/*
+** $Id: ljit.h $
+** x86-64 基线JIT编译器
+** 参见 lua.h 中的版权声明
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+#include "lobject.h"
+#include "lstate.h"
+
+/*
+** ===================================================================
+** 文件概要
+** ===================================================================
+**
+** 热点函数(被调用或循环回跳达到一定次数)被整体编译为x86-64机器码,
+** 每条指令对应一段固定模板。机器码与解释器共用同一个CallInfo和栈:
+** 遇到未编译的指令(调用、返回、闭包创建等)或类型不符时,机器码把
+** 'savedpc'指向该指令后返回,由解释器接着执行;解释器在函数入口、调用
+** 返回处和循环回跳处再调用luaJ_enter回到机器码。
+**
+** 慢路径(表访问、元方法等)调用C辅助函数,错误和让出(yield)照常经由
+** longjmp穿过机器码栈帧,因此只支持以C方式编译的Lua。
+**
+** ===================================================================
+*/
+
+/*
+** 函数被调用、返回或循环回跳多少次后被编译
+*/
+#if !defined(LUAI_JITTHRESHOLD)
+#define LUAI_JITTHRESHOLD	64
+#endif
+
+#if LUA_USE_JIT
+
+LUAI_FUNC const Instruction *luaJ_enter(lua_State *L, CallInfo *ci);
+/*
+** 尝试从'ci->u.l.savedpc'处以机器码继续执行函数'ci'
+** 返回值: 解释器接下来要执行的指令
+**
+** 计数器耗尽时先编译函数;JIT被关闭、有调试钩子或该位置没有机器码时
+** 直接返回原位置
+*/
+
+LUAI_FUNC void luaJ_free(Proto *p);
+/*
+** 释放函数原型的机器码(由luaF_freeproto调用)
+*/
+
+#endif
+
+#endif
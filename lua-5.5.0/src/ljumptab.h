@@ -109,6 +109,29 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_GETVARG,
 &&L_OP_ERRNNIL,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_ADDII,
+&&L_OP_ADDFF,
+&&L_OP_SUBII,
+&&L_OP_SUBFF,
+&&L_OP_MULII,
+&&L_OP_MULFF,
+&&L_OP_EQII,
+&&L_OP_LTII,
+&&L_OP_LTFF,
+&&L_OP_LEII,
+&&L_OP_LEFF,
+&&L_OP_MOVE_CALL,
+&&L_OP_LOADI_CALL,
+&&L_OP_LOADK_CALL,
+&&L_OP_SELF_CALL,
+&&L_OP_GETUPVAL_GETFIELD,
+&&L_OP_GETTABUP_GETFIELD,
+&&L_OP_GETFIELD_GETFIELD,
+&&L_OP_GETTABLE_GETFIELD,
+&&L_OP_GETTABLE_SELF,
+&&L_OP_GETFIELD_RETURN1,
+&&L_OP_LOADI_RETURN1,
+&&L_OP_SETFIELD_RETURN0
 
 };
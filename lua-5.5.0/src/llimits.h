@@ -900,6 +900,164 @@ typedef unsigned long l_uint32;
 #define l_likely(x) luai_likely(x)
 #define l_unlikely(x) luai_unlikely(x)
 
+/*
+** By default, field accesses in the interpreter (OP_GETFIELD, OP_SELF,
+** etc.) go through per-instruction inline caches. Define
+** LUA_USE_ICACHE as 0 to turn them off.
+** 默认情况下，解释器中的字段访问(OP_GETFIELD、OP_SELF等)经过逐指令的
+** 内联缓存。将LUA_USE_ICACHE定义为0可关闭它。
+**
+** 缓存项记录该指令上次找到键的节点下标(见lvm.c)
+*/
+#if !defined(LUA_USE_ICACHE)
+#define LUA_USE_ICACHE 1
+#endif
+
+/*
+** By default, the interpreter rewrites arithmetic and comparison
+** instructions (OP_ADD, OP_LT, etc.) into variants specialized for the
+** operand types it sees (OP_ADDII, OP_LTFF, etc.). Define
+** LUA_USE_QUICKEN as 0 to turn that off.
+** 默认情况下，解释器把算术和比较指令(OP_ADD、OP_LT等)改写为针对所见
+** 操作数类型特化的变体(OP_ADDII、OP_LTFF等)。将LUA_USE_QUICKEN定义为0
+** 可关闭它。
+**
+** 类型不符时指令退回通用操作码(见lvm.c)
+*/
+#if !defined(LUA_USE_QUICKEN)
+#define LUA_USE_QUICKEN 1
+#endif
+
+/*
+** By default, the compiler fuses frequent pairs of instructions (such
+** as OP_SELF followed by OP_CALL) into superinstructions, which the
+** interpreter runs with a single dispatch. Define LUA_USE_SUPERINSTR
+** as 0 to turn that off.
+** 默认情况下，编译器把常见的指令对(如OP_SELF后跟OP_CALL)融合为超级指令，
+** 解释器只需一次分派即可执行。将LUA_USE_SUPERINSTR定义为0可关闭它。
+**
+** 只改写指令对中第一条的操作码(见lcode.c中的luaK_fuse)
+*/
+#if !defined(LUA_USE_SUPERINSTR)
+#define LUA_USE_SUPERINSTR 1
+#endif
+
+/*
+** Define LUA_USE_OPSTATS as 1 to build an instrumented interpreter that
+** counts how many times each opcode runs and samples how many cycles
+** it takes ('debug.opstats'), or as 2 to also count the executions of
+** each instruction of each function ('luac -c'). Native code is not
+** instrumented, so these builds have no JIT.
+** 将LUA_USE_OPSTATS定义为1可构建插桩的解释器，统计每个操作码的执行次数并
+** 抽样其耗费的周期数('debug.opstats')；定义为2时还统计每个函数中每条指令的
+** 执行次数('luac -c')。机器码不插桩，因此这种构建没有JIT。
+**
+** 插桩在每次取指时进行(见lvm.c中的vmcount)，会明显拖慢解释器
+*/
+#if !defined(LUA_USE_OPSTATS)
+#define LUA_USE_OPSTATS 0
+#endif
+
+/*
+** Define LUA_USE_JIT as 1 to compile hot Lua functions to native code
+** (see ljit.c). It is only available for C builds on x86-64 POSIX
+** systems; 'lua_jit' turns it on and off at run time.
+** 将LUA_USE_JIT定义为1可把热点Lua函数编译为机器码(见ljit.c)。仅支持在
+** x86-64 POSIX系统上以C方式构建;运行时可用'lua_jit'开关。
+**
+** 机器码只覆盖常见指令,其余指令交回解释器执行
+*/
+#if !defined(LUA_USE_JIT)
+#define LUA_USE_JIT 0
+#endif
+
+#if LUA_USE_JIT && (!defined(__x86_64__) || !defined(LUA_USE_POSIX) || \
+                    defined(__cplusplus) || LUA_USE_OPSTATS)
+#undef LUA_USE_JIT
+#define LUA_USE_JIT 0
+#endif
+
+/*
+** By default, a concatenation whose first operand is a long string
+** produces a view of a growable buffer (a rope), so that repeated
+** appends ('s = s .. x') do not copy the prefix each time. Define
+** LUA_USE_ROPES as 0 to turn that off.
+** 默认情况下，第一个操作数为长字符串的连接产生可增长缓冲区(rope)中的
+** 视图，因此反复追加('s = s .. x')不必每次都复制前缀。将LUA_USE_ROPES
+** 定义为0可关闭它。
+**
+** 视图的内容总是连续的，只有结尾的'\0'是延迟的(见lobject.h中的Rope)
+*/
+#if !defined(LUA_USE_ROPES)
+#define LUA_USE_ROPES 1
+#endif
+
+/*
+** By default, strings are hashed a machine word at a time (see
+** lstring.c). Define LUA_USE_WORDHASH as 0 to hash them a byte at a
+** time, as in standard Lua.
+** 默认情况下，字符串按机器字逐字哈希(见lstring.c)。将LUA_USE_WORDHASH
+** 定义为0可改为标准Lua的逐字节哈希。
+**
+** 两种哈希都以每个状态的随机种子开始，字符串表和表的键都用它
+*/
+#if !defined(LUA_USE_WORDHASH)
+#define LUA_USE_WORDHASH 1
+#endif
+
+/*
+** By default, the string library compiles each pattern once into a
+** list of items with precomputed character sets and keeps the result
+** in a small per-state cache (see lstrlib.c). Define LUA_USE_PATCACHE
+** as 0 to interpret patterns directly on every call.
+** 默认情况下，字符串库把每个模式只编译一次，得到带预计算字符集的项
+** 列表，并保存在每个状态的小缓存中(见lstrlib.c)。将LUA_USE_PATCACHE
+** 定义为0可改为每次调用都直接解释模式。
+**
+** 格式错误的模式不编译，仍由解释器在匹配到错误处时报告
+*/
+#if !defined(LUA_USE_PATCACHE)
+#define LUA_USE_PATCACHE 1
+#endif
+
+/*
+** By default, 'string.format' compiles each format once into a list
+** of directives, kept in a small per-state cache, and formats integers
+** and strings without 'sprintf' (see lstrlib.c). Define
+** LUA_USE_FMTCACHE as 0 to parse formats on every call.
+** 默认情况下，'string.format'把每个格式串只编译一次，得到指令列表并
+** 保存在每个状态的小缓存中，整数和字符串不经'sprintf'直接格式化(见
+** lstrlib.c)。将LUA_USE_FMTCACHE定义为0可改为每次调用都重新解析格式串。
+**
+** 浮点数转换仍使用'sprintf'
+*/
+#if !defined(LUA_USE_FMTCACHE)
+#define LUA_USE_FMTCACHE 1
+#endif
+
+/*
+** By default, floats are converted to and from decimal numerals with
+** Ryu and Eisel-Lemire (see lnum.c), giving the same results as the
+** generic code, which uses 'sprintf' and 'strtod'. Define
+** LUA_USE_FASTNUM as 0 to always use the generic code. It needs IEEE
+** doubles and 64-bit integers.
+** 默认情况下，浮点数与十进制数字串之间的转换使用Ryu和Eisel-Lemire算法
+** (见lnum.c)，结果与使用'sprintf'和'strtod'的通用代码相同。将
+** LUA_USE_FASTNUM定义为0可始终使用通用代码。它需要IEEE双精度浮点数和
+** 64位整数。
+**
+** 少数情况(如16位的最短数字串)仍交给通用代码
+*/
+#if !defined(LUA_USE_FASTNUM)
+#define LUA_USE_FASTNUM 1
+#endif
+
+#if LUA_USE_FASTNUM && (LUA_FLOAT_TYPE != LUA_FLOAT_DOUBLE || \
+                        defined(LUA_USE_C89))
+#undef LUA_USE_FASTNUM
+#define LUA_USE_FASTNUM 0
+#endif
+
 /*
 ** {==================================================================
 ** "Abstraction Layer" for basic report of messages and errors
@@ -0,0 +1,44 @@
+/*
+** $Id: lnum.h $
+** 浮点数与十进制数字串之间的快速转换
+** 参见 lua.h 中的版权声明
+*/
+
+#ifndef lnum_h
+#define lnum_h
+
+#include "llimits.h"
+
+/*
+** ===================================================================
+** 文件概要
+** ===================================================================
+**
+** 浮点数转字符串用Ryu求出能读回原值的最短数字串，字符串转浮点数用
+** Eisel-Lemire算法，两者共用一张128位精度的5的幂表。
+**
+** 结果与lobject.c中的通用代码逐字节相同(先试"%.15g"，读回不等时用
+** "%.17g")。最短数字串为16位(此时"%.17g"会多出一位)、次正规数、无穷大、
+** NaN、十六进制、过长或带locale小数点的数字串，这两个函数都返回0或NULL，
+** 交给通用代码处理。
+**
+** ===================================================================
+*/
+
+#if LUA_USE_FASTNUM
+
+/*
+** 按'tostring'的格式把浮点数写入'buff'，返回长度；返回0表示交给
+** 通用代码
+*/
+LUAI_FUNC int luaN_float2str (lua_Number x, char *buff);
+
+/*
+** 把普通十进制数字串转为浮点数，返回结尾'\0'的地址；返回NULL表示
+** 交给通用代码
+*/
+LUAI_FUNC const char *luaN_str2float (const char *s, lua_Number *result);
+
+#endif
+
+#endif
@@ -80,6 +80,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lmem.h"
+#include "lnum.h"
 #include "lobject.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -882,6 +883,13 @@ static const char *l_str2dloc(const char *s, lua_Number *result, int mode)
 static const char *l_str2d(const char *s, lua_Number *result)
 {
   const char *endptr;
+#if LUA_USE_FASTNUM
+  /*
+  ** 先试快速路径(见lnum.c),它只接受普通的十进制数字串
+  */
+  if ((endptr = luaN_str2float(s, result)) != NULL) /* plain decimal? 普通十进制? */
+    return endptr;
+#endif
   /*
   ** strpbrk在s中查找第一个出现的".xXnN"字符
   ** 返回指向该字符的指针,或NULL(如果未找到)
@@ -1194,14 +1202,24 @@ int luaO_utf8esc(char *buff, l_uint32 x)
 */
 static int tostringbuffFloat(lua_Number n, char *buff)
 {
+#if LUA_USE_FASTNUM
+  /*
+  ** 先试最短数字串(见lnum.c),结果与下面的代码相同
+  */
+  int len = luaN_float2str(n, buff);
+  if (len > 0) /* done? 完成? */
+    return len;
+#else
+  int len;
+#endif
   /* first conversion 第一次转换 */
   /*
   ** l_sprintf是sprintf的包装宏
   ** LUA_NUMBER_FMT是格式字符串(如"%.14g")
   ** LUAI_UACNUMBER可能添加类型转换以避免参数传递问题
   */
-  int len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT,
-                      (LUAI_UACNUMBER)n);
+  len = l_sprintf(buff, LUA_N2SBUFFSZ, LUA_NUMBER_FMT,
+                  (LUAI_UACNUMBER)n);
   /*
   ** 读回检查: 将字符串转回数字,看是否相等
   */
@@ -632,6 +632,9 @@ typedef struct GCObject
 #define LSTRREG -1 /* 常规长字符串(由Lua管理) */
 #define LSTRFIX -2 /* 固定的外部长字符串(不会被GC) */
 #define LSTRMEM -3 /* 外部长字符串,带释放函数 */
+#define LSTRROPE -4 /* 共享追加缓冲区(Rope)中的视图 */
+#define LSTRCAT -5  /* 常规长字符串,由连接产生(再被追加时转为Rope) */
+#define LSTRAPP -6  /* 常规长字符串,由追加到LSTRCAT产生(再被追加时转为Rope) */
 
 /*
 ** ============================================================================
@@ -659,7 +662,8 @@ typedef struct TString
 /* 测试是否为短字符串(shrlen非负) */
 #define strisshr(ts) ((ts)->shrlen >= 0)
 /* 测试是否为外部字符串 */
-#define isextstr(ts) (ttislngstring(ts) && tsvalue(ts)->shrlen != LSTRREG)
+#define isextstr(ts) (ttislngstring(ts) && \
+  (tsvalue(ts)->shrlen == LSTRFIX || tsvalue(ts)->shrlen == LSTRMEM))
 
 /*
 ** 从TString获取实际字符串(字节数组)
@@ -677,6 +681,32 @@ typedef struct TString
 /* 获取字符串(自动判断类型) */
 #define getstr(ts) (strisshr(ts) ? rawgetshrstr(ts) : (ts)->contents)
 
+/*
+** 共享追加缓冲区(Rope)
+**
+** 连接的第一个操作数本身是连接结果时(见lvm.c中的luaV_concat),结果以它的
+** 内容开头。大多数连接结果(如'p .. i'形式的键)不会再被追加,所以第一次追加
+** (对LSTRCAT)只产生大小正好的常规字符串(LSTRAPP)。对LSTRAPP再追加,或从
+** 缓冲区中最长的视图继续追加时,结果才不再独占内容,而是指向一个容量按倍数
+** 增长的缓冲区,'ud'字段指向该缓冲区。若第一个操作数正是缓冲区中最长的视图
+** 且容量足够,新结果直接在其后追加,不必复制前缀,因此循环中的's = s .. x'
+** 是线性的。
+**
+** 所有视图的内容都是连续的;只有结尾的'\0'是延迟的:较短的视图后面紧跟
+** 的是后来追加的字节。需要'\0'的地方(lua_tolstring等)先调用luaS_flatten
+** 为该视图建立独立的副本(见lstring.c)。
+*/
+typedef struct Rope
+{
+  size_t size;  /* 缓冲区容量(含结尾'\0') */
+  size_t used;  /* 最长视图的长度;为MAX_SIZE时不再追加 */
+  size_t nref;  /* 指向该缓冲区的字符串个数 */
+  char data[1]; /* 内容 */
+} Rope;
+
+/* 获取视图所在的缓冲区 */
+#define getrope(ts) check_exp((ts)->shrlen == LSTRROPE, cast(Rope *, (ts)->ud))
+
 /*
 ** 从TString获取字符串长度
 ** cast_sizet将signed/unsigned转换为size_t
@@ -937,6 +967,16 @@ typedef struct Proto
   LocVar *locvars;          /* 局部变量信息(调试) */
   TString *source;          /* 源文件名(调试) */
   GCObject *gclist;         /* GC链表 */
+#if LUA_USE_ICACHE
+  l_uint32 *icache;         /* 逐指令的内联缓存(大小为sizecode) */
+#endif
+#if LUA_USE_OPSTATS >= 2
+  lua_Unsigned *opcount;    /* 每条指令的执行次数(大小为sizecode) */
+#endif
+#if LUA_USE_JIT
+  void *jit;                /* 编译出的机器码(见ljit.c)，或NULL */
+  l_uint32 jitcount;        /* 距离编译还剩的调用与循环次数 */
+#endif
 } Proto;
 
 /* ============================================================================
@@ -106,6 +106,39 @@ LUAI_DDEF const lu_byte luaP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 0, 0, 0, 0, iABx)		/* OP_ERRNNIL */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_EQII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVE_CALL */
+ ,opmode(0, 0, 0, 0, 1, iAsBx)		/* OP_LOADI_CALL */
+ ,opmode(0, 0, 0, 0, 1, iABx)		/* OP_LOADK_CALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SELF_CALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETUPVAL_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUP_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELD_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABLE_GETFIELD */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABLE_SELF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELD_RETURN1 */
+ ,opmode(0, 0, 0, 0, 1, iAsBx)		/* OP_LOADI_RETURN1 */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_SETFIELD_RETURN0 */
+};
+
+
+/* base opcode of each quickened opcode and superinstruction (ORDER OP) */
+LUAI_DDEF const lu_byte luaP_baseops[NUM_OPCODES - OP_EXTRAARG - 1] = {
+  OP_ADD, OP_ADD, OP_SUB, OP_SUB, OP_MUL, OP_MUL,
+  OP_EQ, OP_LT, OP_LT, OP_LE, OP_LE,
+  OP_MOVE, OP_LOADI, OP_LOADK, OP_SELF, OP_GETUPVAL, OP_GETTABUP,
+  OP_GETFIELD, OP_GETTABLE, OP_GETTABLE, OP_GETFIELD, OP_LOADI,
+  OP_SETFIELD
 };
 
 
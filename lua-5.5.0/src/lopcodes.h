@@ -344,11 +344,53 @@ OP_ERRNNIL,/*	A Bx	raise error if R[A] ~= nil (K[Bx - 1] is global name)*/
 
 OP_VARARGPREP,/* 	(adjust varargs)				*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+/* quickened opcodes: created only by the interpreter (see below) */
+
+OP_ADDII,/*	A B C	R[A] := R[B] + R[C] (integers)			*/
+OP_ADDFF,/*	A B C	R[A] := R[B] + R[C] (floats)			*/
+OP_SUBII,/*	A B C	R[A] := R[B] - R[C] (integers)			*/
+OP_SUBFF,/*	A B C	R[A] := R[B] - R[C] (floats)			*/
+OP_MULII,/*	A B C	R[A] := R[B] * R[C] (integers)			*/
+OP_MULFF,/*	A B C	R[A] := R[B] * R[C] (floats)			*/
+
+OP_EQII,/*	A B k	if ((R[A] == R[B]) ~= k) then pc++ (integers)	*/
+OP_LTII,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (integers)	*/
+OP_LTFF,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++ (floats)	*/
+OP_LEII,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (integers)	*/
+OP_LEFF,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++ (floats)	*/
+
+/* superinstructions: OP_X_Y does OP_X and then the OP_Y that follows it
+   (created by 'luaK_fuse'; see below) */
+
+OP_MOVE_CALL,
+OP_LOADI_CALL,
+OP_LOADK_CALL,
+OP_SELF_CALL,
+OP_GETUPVAL_GETFIELD,
+OP_GETTABUP_GETFIELD,
+OP_GETFIELD_GETFIELD,
+OP_GETTABLE_GETFIELD,
+OP_GETTABLE_SELF,
+OP_GETFIELD_RETURN1,
+OP_LOADI_RETURN1,
+OP_SETFIELD_RETURN0
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_SETFIELD_RETURN0) + 1)
+
+/* quickened opcodes and superinstructions come after all opcodes that
+   can appear in a dump */
+#define isquickop(o)	((o) > OP_EXTRAARG)
+
+/* opcode that a quickened opcode stands for (other opcodes map to
+   themselves) */
+#define getbaseop(o)  \
+	(isquickop(o) ? cast(OpCode, luaP_baseops[(o) - OP_EXTRAARG - 1]) : (o))
+
+#define GET_BASEOPCODE(i)	getbaseop(GET_OPCODE(i))
 
 
 
@@ -409,6 +451,19 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) The interpreter may rewrite an OP_ADD, OP_SUB, OP_MUL, OP_EQ,
+  OP_LT, or OP_LE into a quickened opcode specialized for the types
+  of its operands, and back when the types change. A quickened opcode
+  has the same arguments and modes of its base opcode. Everything
+  outside the interpreter that looks at code (debug information,
+  'lua_dump', etc.) should use GET_BASEOPCODE.
+
+  (*) A superinstruction replaces only the opcode of the first
+  instruction of a pair; the second instruction stays in place. So,
+  jumps into the pair, line information, and error positions are not
+  affected. A superinstruction has the same arguments and modes of its
+  first instruction, which is its base opcode.
+
 ===========================================================================*/
 
 
@@ -424,6 +479,8 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
 LUAI_DDEC(const lu_byte luaP_opmodes[NUM_OPCODES];)
 
+LUAI_DDEC(const lu_byte luaP_baseops[NUM_OPCODES - OP_EXTRAARG - 1];)
+
 #define getOpMode(m)	(cast(enum OpMode, luaP_opmodes[m] & 7))
 #define testAMode(m)	(luaP_opmodes[m] & (1 << 3))
 #define testTMode(m)	(luaP_opmodes[m] & (1 << 4))
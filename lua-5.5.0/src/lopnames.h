@@ -98,6 +98,29 @@ static const char *const opnames[] = {
   "ERRNNIL",
   "VARARGPREP",
   "EXTRAARG",
+  "ADDII",
+  "ADDFF",
+  "SUBII",
+  "SUBFF",
+  "MULII",
+  "MULFF",
+  "EQII",
+  "LTII",
+  "LTFF",
+  "LEII",
+  "LEFF",
+  "MOVE_CALL",
+  "LOADI_CALL",
+  "LOADK_CALL",
+  "SELF_CALL",
+  "GETUPVAL_GETFIELD",
+  "GETTABUP_GETFIELD",
+  "GETFIELD_GETFIELD",
+  "GETTABLE_GETFIELD",
+  "GETTABLE_SELF",
+  "GETFIELD_RETURN1",
+  "LOADI_RETURN1",
+  "SETFIELD_RETURN0",
   NULL
 };
 
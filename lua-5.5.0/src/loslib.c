@@ -388,7 +388,14 @@ static int os_setlocale (lua_State *L) {
      "numeric", "time", NULL};
   const char *l = luaL_optstring(L, 1, NULL);
   int op = luaL_checkoption(L, 2, "all", catnames);
-  lua_pushstring(L, setlocale(cat[op], l));
+  const char *res = setlocale(cat[op], l);
+  if (l != NULL && res != NULL) {  /* locale changed? */
+    if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_PATCACHE) == LUA_TFUNCTION)
+      lua_call(L, 0, 0);  /* drop compiled patterns (classes may change) */
+    else
+      lua_pop(L, 1);
+  }
+  lua_pushstring(L, res);
   return 1;
 }
 
@@ -843,6 +843,12 @@ static void close_func (LexState *ls) {
   luaM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   luaM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+#if LUA_USE_ICACHE
+  luaF_initicache(L, f);
+#endif
+#if LUA_USE_OPSTATS >= 2
+  luaF_initopcount(L, f);
+#endif
   ls->fs = fs->prev;
   L->top.p--;  /* pop kcache table */
   luaC_checkGC(L);
@@ -0,0 +1,388 @@
+/*
+** $Id: lprofile.c $
+** Sampling profiler
+** See Copyright Notice in lua.h
+*/
+
+#define lprofile_c
+#define LUA_LIB
+
+#include "lprefix.h"
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lauxlib.h"
+#include "lualib.h"
+#include "llimits.h"
+
+
+/*
+** A profiling timer (SIGPROF) fires every 'interval' microseconds of
+** CPU time. As in the stand-alone interpreter's handling of SIGINT, the
+** C signal handler does not touch the Lua state; it only counts the
+** tick and sets a hook. When the hook runs, at the next safe point
+** (call, return, or instruction), it walks the stack, builds its folded
+** representation ("main (f.lua);g (f.lua:3);sort [C]"), and adds the
+** pending ticks to that stack's entry in a table kept in the registry.
+** Because the hook also fires at returns, time spent inside a C function
+** is charged to that function.
+**
+** The hook is set only in the main thread, so time spent running a
+** coroutine is charged to the 'resume' that started it.
+*/
+
+
+#if !defined(LUAI_PROFINTERVAL)
+#define LUAI_PROFINTERVAL	1000	/* default sampling interval (in us) */
+#endif
+
+#if !defined(LUAI_PROFDEPTH)
+#define LUAI_PROFDEPTH		128	/* maximum frames kept in a stack */
+#endif
+
+
+/* key, in the registry, for table with the aggregated stacks */
+static const char *const PROFKEY = "_PROFILE";
+
+
+/*
+** {======================================================
+** Profiling timer
+** =======================================================
+*/
+
+#if defined(LUA_USE_POSIX)	/* { */
+
+#include <signal.h>
+#include <sys/time.h>
+
+static lua_State *volatile profL = NULL;  /* main thread being profiled */
+
+/*
+** Ticks since the profiler started (modulo TICKMASK + 1). Only the
+** signal handler writes it; the hook reads it once per sample and
+** keeps in 'recorded' how many ticks it has already charged, so that
+** a tick arriving at any moment is charged by the next sample.
+*/
+#define TICKMASK	INT_MAX
+static volatile sig_atomic_t ticks = 0;
+static unsigned recorded = 0;
+
+/*
+** Hook replaced by the profiler's hook, saved when the profiler starts
+** (not in the signal handler): each sample restores it. (So, a hook set
+** while the profiler runs lasts only until the next sample.)
+*/
+static lua_Hook oldhook = NULL;
+static int oldmask = 0;
+static int oldcount = 0;
+
+static struct sigaction oldaction;  /* previous handler for SIGPROF */
+
+
+static void record (lua_State *L, int n);
+
+
+/*
+** Hook set by the signal handler. It restores the previous hook and
+** charges the ticks not yet recorded to the current stack.
+*/
+static void profhook (lua_State *L, lua_Debug *ar) {
+  unsigned n = (cast_uint(ticks) - recorded) & TICKMASK;
+  (void)ar;  /* unused arg. */
+  recorded = (recorded + n) & TICKMASK;
+  lua_sethook(L, oldhook, oldmask, oldcount);  /* restore previous hook */
+  if (profL != NULL && n > 0)
+    record(L, cast_int(n));
+}
+
+
+/*
+** Handler for SIGPROF. Like 'laction' in lua.c, it only counts the tick
+** and sets a hook; ticks accumulate until the hook runs.
+*/
+static void profaction (int i) {
+  lua_State *L = profL;
+  (void)i;  /* unused arg. */
+  if (L == NULL) return;
+  ticks = (ticks < TICKMASK) ? ticks + 1 : 0;
+  lua_sethook(L, profhook, LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
+}
+
+
+static int settimer (long usec) {
+  struct itimerval it;
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  return setitimer(ITIMER_PROF, &it, NULL) == 0;
+}
+
+
+static int startprof (lua_State *L, long usec) {
+  if (profL == NULL) {  /* not running yet? */
+    struct sigaction sa;
+    sa.sa_handler = profaction;
+    sa.sa_flags = SA_RESTART;  /* do not interrupt I/O */
+    sigemptyset(&sa.sa_mask);
+    oldhook = lua_gethook(L);
+    oldmask = lua_gethookmask(L);
+    oldcount = lua_gethookcount(L);
+    ticks = 0;
+    recorded = 0;
+    if (sigaction(SIGPROF, &sa, &oldaction) != 0)
+      return 0;
+  }
+  profL = L;
+  if (!settimer(usec)) {
+    settimer(0);
+    sigaction(SIGPROF, &oldaction, NULL);
+    profL = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+
+static void stopprof (void) {
+  lua_State *L = profL;
+  settimer(0);
+  sigaction(SIGPROF, &oldaction, NULL);
+  profL = NULL;
+  if (lua_gethook(L) == profhook)  /* pending sample? */
+    lua_sethook(L, oldhook, oldmask, oldcount);  /* discard it */
+}
+
+
+#define isprofiling(L)		(profL != NULL && profL == (L))
+#define isbusy(L)		(profL != NULL && profL != (L))
+#define profresult(L)		luaL_fileresult(L, 0, NULL)
+
+#else				/* }{ */
+
+#define startprof(L,usec)	((void)(L), (void)(usec), 0)
+#define stopprof()		((void)0)
+#define isprofiling(L)		((void)(L), 0)
+#define isbusy(L)		((void)(L), 0)
+#define profresult(L)  \
+	(luaL_pushfail(L), lua_pushliteral(L, "profiler not supported"), 2)
+
+#endif				/* } */
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Stack recording
+** =======================================================
+*/
+
+/*
+** Adds to the buffer the name of the function at the given level
+*/
+static void addframe (lua_State *L, luaL_Buffer *b, lua_Debug *ar) {
+  lua_getinfo(L, "Sn", ar);
+  if (*ar->what == 'C')
+    lua_pushfstring(L, "%s [C]", (ar->name != NULL) ? ar->name : "?");
+  else if (*ar->what == 'm')  /* main chunk? */
+    lua_pushfstring(L, "main (%s)", ar->short_src);
+  else if (ar->name != NULL)
+    lua_pushfstring(L, "%s (%s:%d)", ar->name, ar->short_src,
+                                     ar->linedefined);
+  else
+    lua_pushfstring(L, "<%s:%d>", ar->short_src, ar->linedefined);
+  luaL_addvalue(b);
+}
+
+
+/*
+** Adds 'n' samples to the current stack of 'L'. Frames are listed from
+** the outermost to the innermost; stacks deeper than LUAI_PROFDEPTH
+** keep only their innermost frames.
+*/
+static void record (lua_State *L, int n) {
+  lua_Debug ar;
+  luaL_Buffer b;
+  int depth;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    return;  /* library not open in this state */
+  }
+  for (depth = 0; depth < LUAI_PROFDEPTH; depth++) {
+    if (!lua_getstack(L, depth, &ar))
+      break;
+  }
+  if (depth > 0) {
+    luaL_buffinit(L, &b);
+    if (lua_getstack(L, depth, &ar))  /* more frames? */
+      luaL_addstring(&b, "(truncated);");
+    while (depth-- > 0) {
+      lua_getstack(L, depth, &ar);
+      addframe(L, &b, &ar);
+      if (depth > 0)
+        luaL_addchar(&b, ';');
+    }
+    luaL_pushresult(&b);
+    lua_pushvalue(L, -1);
+    lua_rawget(L, -3);  /* get previous count */
+    lua_pushinteger(L, lua_tointeger(L, -1) + n);
+    lua_replace(L, -2);
+    lua_rawset(L, -3);  /* stacks[stack] = count + n */
+  }
+  lua_pop(L, 1);  /* remove table of stacks */
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Library functions
+** =======================================================
+*/
+
+static lua_State *getmainthread (lua_State *L) {
+  lua_State *L1;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+  L1 = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  return L1;
+}
+
+
+static int prof_start (lua_State *L) {
+  lua_Integer usec = luaL_optinteger(L, 1, LUAI_PROFINTERVAL);
+  lua_State *L1 = getmainthread(L);
+  luaL_argcheck(L, 0 < usec && usec <= 1000000, 1, "out of range");
+  if (isbusy(L1))
+    return luaL_error(L, "profiler already running in another state");
+  if (!startprof(L1, (long)usec))
+    return profresult(L);  /* fail, message, errno */
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int prof_stop (lua_State *L) {
+  if (isprofiling(getmainthread(L)))
+    stopprof();
+  return 0;
+}
+
+
+static int prof_running (lua_State *L) {
+  lua_pushboolean(L, isprofiling(getmainthread(L)));
+  return 1;
+}
+
+
+static int prof_reset (lua_State *L) {
+  lua_Unsigned c = 0;
+  lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY);
+  while (lua_nextat(L, -1, &c)) {
+    lua_pop(L, 1);  /* remove value */
+    lua_pushnil(L);
+    lua_rawset(L, -3);  /* clear entry (allowed during traversal) */
+  }
+  return 0;
+}
+
+
+/*
+** Returns a copy of the table of stacks (the original can change at
+** any safe point while the profiler is running).
+*/
+static int prof_stacks (lua_State *L) {
+  lua_Unsigned c = 0;
+  lua_settop(L, 0);
+  lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY);
+  lua_newtable(L);
+  while (lua_nextat(L, 1, &c))
+    lua_rawset(L, 2);
+  return 1;
+}
+
+
+/*
+** Returns the stacks in folded format ("frame;frame;... count" per
+** line), as read by flame-graph tools, or writes them to a file.
+*/
+static int prof_dump (lua_State *L) {
+  const char *fname = luaL_optstring(L, 1, NULL);
+  luaL_Buffer b;
+  lua_Unsigned c = 0;
+  int i, n = 0;
+  lua_settop(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, PROFKEY);  /* index 2 */
+  lua_newtable(L);  /* index 3: lines (buffer cannot grow under 'next') */
+  while (lua_nextat(L, 2, &c)) {
+    lua_pushfstring(L, "%s %I\n", lua_tostring(L, -2),
+                                  (LUAI_UACINT)lua_tointeger(L, -1));
+    lua_rawseti(L, 3, ++n);
+    lua_pop(L, 2);  /* remove stack and count */
+  }
+  luaL_buffinit(L, &b);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 3, i);
+    luaL_addvalue(&b);
+  }
+  luaL_pushresult(&b);
+  if (fname == NULL)
+    return 1;
+  else {
+    size_t l;
+    const char *s = lua_tolstring(L, -1, &l);
+    FILE *f = fopen(fname, "w");
+    int ok;
+    if (f == NULL)
+      return luaL_fileresult(L, 0, fname);
+    ok = (fwrite(s, 1, l, f) == l);
+    ok = (fclose(f) == 0) && ok;
+    return luaL_fileresult(L, ok, fname);
+  }
+}
+
+
+/*
+** Finalizer of the table of stacks: stops the timer when the state is
+** closed, so that the signal handler never sees a dead state.
+*/
+static int prof_gc (lua_State *L) {
+  prof_stop(L);
+  return 0;
+}
+
+
+static const luaL_Reg proflib[] = {
+  {"dump", prof_dump},
+  {"reset", prof_reset},
+  {"running", prof_running},
+  {"stacks", prof_stacks},
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+
+LUAMOD_API int luaopen_profile (lua_State *L) {
+  if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, PROFKEY)) {  /* new table? */
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, prof_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+  }
+  lua_pop(L, 1);
+  luaL_newlib(L, proflib);
+  return 1;
+}
+
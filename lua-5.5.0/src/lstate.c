@@ -58,6 +58,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
  
 /*
 ** 从lua_State指针获取对应的LX结构体指针
@@ -317,6 +318,7 @@ static void preinit_thread(lua_State *L, global_State *g)
   L->status = LUA_OK;                           /* 状态码 */
   L->errfunc = 0;                               /* 错误处理函数 */
   L->oldpc = 0;                                 /* 旧的程序计数器（用于调试） */
+  L->nextpos = 0;                               /* 表遍历位置的提示 */
   L->base_ci.previous = L->base_ci.next = NULL; /* 基础CallInfo的链接 */
 }
 
@@ -352,7 +354,7 @@ static void close_state(lua_State *L)
     luaC_freeallobjects(L);            /* 收集所有对象 */
     luai_userstateclose(L);            /* 用户关闭钩子 */
   }
-  luaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size)); /* 释放字符串表 */
+  luaM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.capacity)); /* 释放字符串表 */
   freestack(L);                                                    /* 释放栈 */
   lua_assert(gettotalbytes(g) == sizeof(global_State));            /* 确保只剩全局状态本身 */
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);               /* 释放主块 */
@@ -475,13 +477,14 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud, unsigned seed)
   g->ud = ud;
   g->warnf = NULL;   /* 警告函数 */
   g->ud_warn = NULL; /* 警告函数的用户数据 */
+  g->nextf = NULL;   /* 原始的'next'函数（由基础库设置） */
   g->seed = seed;    /* 随机数种子 */
 
   /* GC初始化 */
   g->gcstp = GCSTPGC; /* 构建状态时禁止GC */
 
   /* 字符串表初始化 */
-  g->strt.size = g->strt.nuse = 0;
+  g->strt.size = g->strt.nuse = g->strt.capacity = 0;
   g->strt.hash = NULL;
 
   /* 注册表初始化 */
@@ -489,6 +492,13 @@ LUA_API lua_State *lua_newstate(lua_Alloc f, void *ud, unsigned seed)
 
   /* panic函数（未处理错误的最后手段） */
   g->panic = NULL;
+#if LUA_USE_JIT
+  g->jitmode = 1;        /* 默认开启JIT */
+#endif
+#if LUA_USE_OPSTATS
+  g->opstats.seed = seed; /* 打乱抽样间隔 */
+  luaV_resetopstats(g);   /* 清零操作码统计 */
+#endif
 
   /* GC状态初始化 */
   g->gcstate = GCSpause; /* GC暂停状态 */
@@ -428,18 +428,20 @@ struct lua_longjmp; /* defined in ldo.c */
 ** 【字段说明】
 ** hash：桶数组，每个桶是一个 TString 链表（处理哈希冲突）
 ** nuse：当前表中的字符串数量
-** size：桶的数量（哈希表的容量）
+** size：使用中的桶的数量
+** capacity：桶数组的大小（2的幂，capacity/2 <= size <= capacity）
 **
 ** 【技术细节】
 ** - 使用链地址法（chaining）处理哈希冲突
-** - 当 nuse/size 比率过高时，会进行扩容（rehash）
+** - 用线性哈希逐个桶地扩容和缩容（见lstring.c），不会一次重新哈希所有字符串
 ** - 所有字符串对象的指针可以直接比较（因为内容相同的字符串是同一个对象）
 */
 typedef struct stringtable
 {
   TString **hash; /* array of buckets (linked lists of strings) */
   int nuse;       /* number of elements */
-  int size;       /* number of buckets */
+  int size;       /* number of buckets in use */
+  int capacity;   /* size of array 'hash' (a power of 2) */
 } stringtable;
 
 /*
@@ -733,6 +735,8 @@ struct lua_State
 
   int hookcount; /* 钩子计数（用于计数钩子） */
 
+  unsigned int nextpos; /* 泛型 for 上一步遍历表后的位置（提示，见 lvm.c） */
+
   volatile l_signalT hookmask; /* 钩子掩码（指定哪些事件触发钩子） */
 
   struct
@@ -762,6 +766,34 @@ typedef struct LX
   lua_State l;                    /* Lua 线程状态 */
 } LX;
 
+#if LUA_USE_OPSTATS
+
+#include "lopcodes.h"
+
+/*
+** 操作码统计(插桩构建，见lvm.c)
+**
+** 【说明】
+** count记录每个操作码的执行次数(快速化的操作码和超级指令单独计数)；
+** 每隔若干条指令抽样一次，记录该指令到下一次取指之间的周期数，
+** 累加到cycles并计入按2的幂分桶的直方图hist：
+** 第b个桶计数周期数在[2^b, 2^(b+1))之间的样本(第一个桶也包括0)，
+** 最后一个桶收纳其余更大的样本
+*/
+typedef struct OpStats
+{
+  lua_Unsigned count[NUM_OPCODES];   /* 执行次数 */
+  lua_Unsigned samples[NUM_OPCODES]; /* 抽样次数 */
+  lua_Unsigned cycles[NUM_OPCODES];  /* 样本的周期总数 */
+  lua_Unsigned hist[NUM_OPCODES][LUA_OPSTATBUCKETS]; /* 样本周期直方图 */
+  lua_Unsigned start; /* 正在抽样的指令开始时的周期计数 */
+  int pending;        /* 正在抽样的操作码，没有时为-1 */
+  unsigned int tick;  /* 距离下一次抽样还有多少条指令 */
+  unsigned int seed;  /* 用于打乱抽样间隔的随机数状态 */
+} OpStats;
+
+#endif
+
 /*
 ================================================================================
 global_State 结构体 - 全局状态
@@ -822,6 +854,10 @@ typedef struct global_State
 
   lu_byte gcemergency; /* 如果这是紧急回收则为真 */
 
+#if LUA_USE_JIT
+  lu_byte jitmode; /* 是否执行编译出的机器码（见lua_jit） */
+#endif
+
   GCObject *allgc; /* 所有可回收对象的链表 */
 
   GCObject **sweepgc; /* 清扫在链表中的当前位置 */
@@ -873,6 +909,12 @@ typedef struct global_State
 
   void *ud_warn; /* 'warnf' 的辅助数据 */
 
+  lua_CFunction nextf; /* 原始的'next'函数，泛型for直接在VM中执行它（见lvm.c） */
+
+#if LUA_USE_OPSTATS
+  OpStats opstats; /* 操作码统计（见debug.opstats） */
+#endif
+
   LX mainth; /* 此状态的主线程 */
 } global_State;
 
@@ -50,6 +50,8 @@ int luaS_eqstr (TString *a, TString *b) {
 }
 
 
+#if !LUA_USE_WORDHASH
+
 static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
   unsigned int h = seed ^ cast_uint(l);
   for (; l > 0; l--)
@@ -57,6 +59,62 @@ static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
   return h;
 }
 
+#else
+
+/*
+** Word-at-a-time hash. Each word of the string (read with 'memcpy',
+** so it needs no alignment) goes into the state with a rotation, an
+** xor, and a multiplication by an odd constant; a final mix (as in
+** MurmurHash3) spreads all bits of the state into the low bits, which
+** are the ones that select buckets. The state starts from the seed and
+** the length, so that a partial last word can overlap the previous one
+** and words shorter than a full one can be padded with zeros. All bytes
+** are hashed, as in the byte-at-a-time version.
+*/
+typedef size_t HWord;
+
+#define HWBITS		l_numbits(HWord)
+
+/* golden-ratio constants (the shifts give 0 when 'HWord' has 32 bits) */
+#define HMUL1	((cast(HWord, 0x9E3779B9u) << 16 << 16) | 0x7F4A7C15u)
+#define HMUL2	((cast(HWord, 0xFF51AFD7u) << 16 << 16) | 0xED558CCDu)
+
+#define hmix(h,w)	(((h) << 5 | (h) >> (HWBITS - 5)) ^ (w)) * HMUL1
+
+static HWord loadword (const char *p) {
+  HWord w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static HWord load32 (const char *p) {
+  l_uint32 w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+static unsigned luaS_hash (const char *str, size_t l, unsigned seed) {
+  HWord h = (cast(HWord, seed) ^ l) * HMUL1;
+  if (l >= sizeof(HWord)) {
+    const char *last = str + l - sizeof(HWord);  /* last full word */
+    for (; str < last; str += sizeof(HWord))
+      h = hmix(h, loadword(str));
+    h = hmix(h, loadword(last));  /* may overlap the previous word */
+  }
+  else if (l >= 4)  /* 4 to 7 bytes (64-bit words only) */
+    h = hmix(h, load32(str) << 16 << 16 ^ load32(str + l - 4));
+  else if (l > 0)  /* 1 to 3 bytes */
+    h = hmix(h, cast(HWord, cast_byte(str[0])) << 16 |
+                cast(HWord, cast_byte(str[l >> 1])) << 8 |
+                cast_byte(str[l - 1]));
+  h ^= h >> (HWBITS / 2);
+  h *= HMUL2;
+  h ^= h >> (HWBITS / 2 - 3);
+  return cast_uint(h ^ (h >> (HWBITS / 2)));
+}
+
+#endif
+
 
 unsigned luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_VLNGSTR);
@@ -69,46 +127,102 @@ unsigned luaS_hashlongstr (TString *ts) {
 }
 
 
-static void tablerehash (TString **vect, int osize, int nsize) {
-  int i;
-  for (i = osize; i < nsize; i++)  /* clear new elements */
-    vect[i] = NULL;
-  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
-    TString *p = vect[i];
-    vect[i] = NULL;
-    while (p) {  /* for each string in the list */
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, nsize);  /* new position */
-      p->u.hnext = vect[h];  /* chain it into array */
-      vect[h] = p;
-      p = hnext;
+/*
+** The string table grows and shrinks by linear hashing, one bucket at
+** a time, so that no operation has to rehash all strings at once. The
+** table uses 'size' buckets of an array with 'capacity' buckets, a
+** power of 2 such that capacity/2 <= size <= capacity. A hash goes to
+** its bucket modulo 'capacity' if that bucket is in use, otherwise to
+** its bucket modulo capacity/2. Splitting bucket 'size - capacity/2'
+** moves its strings that belong to bucket 'size' there; merging does
+** the opposite. (Buckets from 'size' on are garbage.) Only when 'size'
+** reaches 'capacity' (or goes down to capacity/2) is the array itself
+** reallocated, and that moves no strings.
+*/
+l_sinline unsigned strbucket (const stringtable *tb, unsigned h) {
+  unsigned b = lmod(h, tb->capacity);
+  return (b < cast_uint(tb->size)) ? b : lmod(h, tb->capacity / 2);
+}
+
+
+/* table is too full: more than 3/4 of the buckets in use */
+#define toofull(tb)	((tb)->nuse >= (tb)->size - (tb)->size / 4)
+
+/* table is too big: less than 1/4 of the buckets in use */
+#define toobig(tb)	((tb)->nuse < (tb)->size / 4)
+
+
+/*
+** Reallocates the array of buckets. If allocation fails, keep the
+** current one. (This can degrade performance, but any non-zero size
+** should work correctly.)
+*/
+static int resizevector (lua_State *L, stringtable *tb, int ncap) {
+  TString **newvect = luaM_reallocvector(L, tb->hash, tb->capacity, ncap,
+                                         TString*);
+  if (l_unlikely(newvect == NULL))
+    return 0;
+  tb->hash = newvect;
+  tb->capacity = ncap;
+  return 1;
+}
+
+
+/*
+** Adds a bucket to the table, splitting the bucket that held its
+** strings. Returns 0 if the array cannot grow.
+*/
+static int splitbucket (lua_State *L, stringtable *tb) {
+  TString **p, **q;
+  if (tb->size == tb->capacity &&  /* array is full? */
+      (tb->capacity > MAXSTRTB / 2 || !resizevector(L, tb, tb->capacity * 2)))
+    return 0;
+  p = &tb->hash[tb->size - tb->capacity / 2];  /* bucket to be split */
+  q = &tb->hash[tb->size];  /* new bucket */
+  while (*p != NULL) {
+    TString *ts = *p;
+    if (lmod(ts->hash, tb->capacity) == cast_uint(tb->size)) {  /* moves? */
+      *p = ts->u.hnext;  /* remove it from old bucket */
+      *q = ts;  /* append it to new bucket */
+      q = &ts->u.hnext;
     }
+    else
+      p = &ts->u.hnext;
   }
+  *q = NULL;
+  tb->size++;
+  return 1;
+}
+
+
+/*
+** Removes the last bucket of the table, moving its strings to the
+** bucket it was split from.
+*/
+static void mergebucket (lua_State *L, stringtable *tb) {
+  TString **p;
+  lua_assert(tb->size > tb->capacity / 2);
+  tb->size--;
+  p = &tb->hash[tb->size - tb->capacity / 2];
+  while (*p != NULL)  /* go to the end of the list */
+    p = &(*p)->u.hnext;
+  *p = tb->hash[tb->size];
+  if (tb->size == tb->capacity / 2)  /* upper half not used anymore? */
+    resizevector(L, tb, tb->size);
 }
 
 
 /*
-** Resize the string table. If allocation fails, keep the current size.
-** (This can degrade performance, but any non-zero size should work
-** correctly.)
+** Merges up to 'n' buckets while the table is too big. The collector
+** calls it in each step (but in emergencies).
 */
-void luaS_resize (lua_State *L, int nsize) {
+void luaS_shrink (lua_State *L, int n) {
   stringtable *tb = &G(L)->strt;
-  int osize = tb->size;
-  TString **newvect;
-  if (nsize < osize)  /* shrinking table? */
-    tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
-  newvect = luaM_reallocvector(L, tb->hash, osize, nsize, TString*);
-  if (l_unlikely(newvect == NULL)) {  /* reallocation failed? */
-    if (nsize < osize)  /* was it shrinking table? */
-      tablerehash(tb->hash, nsize, osize);  /* restore to original size */
-    /* leave table as it was */
-  }
-  else {  /* allocation succeeded */
-    tb->hash = newvect;
-    tb->size = nsize;
-    if (nsize > osize)
-      tablerehash(newvect, osize, nsize);  /* rehash for new size */
+  for (; n > 0 && toobig(tb) && tb->size > MINSTRTABSIZE; n--) {
+    if (tb->size == tb->capacity / 2 &&  /* previous shrink failed? */
+        !resizevector(L, tb, tb->size))
+      break;
+    mergebucket(L, tb);
   }
 }
 
@@ -135,8 +249,9 @@ void luaS_init (lua_State *L) {
   int i, j;
   stringtable *tb = &G(L)->strt;
   tb->hash = luaM_newvector(L, MINSTRTABSIZE, TString*);
-  tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
-  tb->size = MINSTRTABSIZE;
+  for (i = 0; i < MINSTRTABSIZE; i++)  /* clear array */
+    tb->hash[i] = NULL;
+  tb->size = tb->capacity = MINSTRTABSIZE;
   /* pre-create memory-error message */
   g->memerrmsg = luaS_newliteral(L, MEMERRMSG);
   luaC_fix(L, obj2gco(g->memerrmsg));  /* it should never be collected */
@@ -149,14 +264,16 @@ void luaS_init (lua_State *L) {
 size_t luaS_sizelngstr (size_t len, int kind) {
   switch (kind) {
     case LSTRREG:  /* regular long string */
+    case LSTRCAT:  /* regular long string from a concatenation */
+    case LSTRAPP:  /* regular long string from a first append */
       /* don't need 'falloc'/'ud', but need space for content */
       return offsetof(TString, falloc) + (len + 1) * sizeof(char);
     case LSTRFIX:  /* fixed external long string */
       /* don't need 'falloc'/'ud' */
       return offsetof(TString, falloc);
-    default:  /* external long string with deallocation */
-      lua_assert(kind == LSTRMEM);
-      return sizeof(TString);
+    default:  /* external long string with deallocation or rope view */
+      lua_assert(kind == LSTRMEM || kind == LSTRROPE);
+      return sizeof(TString);  /* 'ud' points to the rope */
   }
 }
 
@@ -189,7 +306,7 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
+  TString **p = &tb->hash[strbucket(tb, ts->hash)];
   while (*p != ts)  /* find previous element */
     p = &(*p)->u.hnext;
   *p = (*p)->u.hnext;  /* remove element from its list */
@@ -203,8 +320,8 @@ static void growstrtab (lua_State *L, stringtable *tb) {
     if (tb->nuse == INT_MAX)  /* still too many? */
       luaM_error(L);  /* cannot even create a message... */
   }
-  if (tb->size <= MAXSTRTB / 2)  /* can grow string table? */
-    luaS_resize(L, tb->size * 2);
+  while (toofull(tb) && splitbucket(L, tb))
+    ;  /* add buckets (usually one) while the table is too full */
 }
 
 
@@ -216,7 +333,7 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   global_State *g = G(L);
   stringtable *tb = &g->strt;
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
+  TString **list = &tb->hash[strbucket(tb, h)];
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
   for (ts = *list; ts != NULL; ts = ts->u.hnext) {
     if (l == cast_uint(ts->shrlen) &&
@@ -228,9 +345,9 @@ static TString *internshrstr (lua_State *L, const char *str, size_t l) {
     }
   }
   /* else must create a new string */
-  if (tb->nuse >= tb->size) {  /* need to grow string table? */
+  if (toofull(tb)) {  /* need to grow string table? */
     growstrtab(L, tb);
-    list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
+    list = &tb->hash[strbucket(tb, h)];  /* bucket may have changed */
   }
   ts = createstrobj(L, sizestrshr(l), LUA_VSHRSTR, h);
   ts->shrlen = cast(ls_byte, l);
@@ -351,3 +468,119 @@ TString *luaS_normstr (lua_State *L, TString *ts) {
   }
 }
 
+
+/*
+** {==================================================================
+** Ropes
+** ===================================================================
+*/
+
+#define sizerope(n)	(offsetof(Rope, data) + (n) * sizeof(char))
+
+
+static Rope *newrope (lua_State *L, size_t size) {
+  Rope *r = cast(Rope *, luaM_newblock(L, sizerope(size)));
+  r->size = size;
+  r->used = 0;
+  r->nref = 0;
+  return r;
+}
+
+
+/*
+** Drops a reference to rope 'r', freeing it if that was the last one.
+** Returns the number of bytes freed.
+*/
+static size_t unrefrope (lua_State *L, Rope *r) {
+  lua_assert(r->nref > 0);
+  if (--r->nref > 0)
+    return 0;
+  else {
+    size_t size = sizerope(r->size);
+    luaM_freemem(L, r, size);
+    return size;
+  }
+}
+
+
+/*
+** Creates a string of length 'l' whose contents start with those of
+** 'ts', a result of a previous concatenation; the caller must fill in
+** the rest. When 'ts' is the longest view of a rope with room for 'l'
+** bytes, the new string is just a longer view of the same rope, so its
+** prefix is not copied. Most results are never appended to again
+** (think of keys built as 'prefix .. i'), so only a string that has
+** already been appended to (LSTRAPP) or the longest view of a full rope
+** goes to a new rope with room to double; other strings are copied to
+** a regular string of the exact size.
+*/
+TString *luaS_extend (lua_State *L, TString *ts, size_t l) {
+  size_t pl = ts->u.lnglen;
+  Rope *r = (ts->shrlen == LSTRROPE) ? getrope(ts) : NULL;
+  int fresh = 0;
+  struct NewExt ne;
+  lua_assert(luaS_isconcat(ts) && pl <= l);
+  if (ts->shrlen != LSTRAPP && (r == NULL || r->used != pl)) {
+    TString *ns = luaS_createlngstrobj(L, l);  /* exact size */
+    memcpy(getlngstr(ns), getlngstr(ts), pl * sizeof(char));
+    ns->shrlen = LSTRAPP;  /* a later append will make a rope */
+    return ns;
+  }
+  else if (r == NULL || l >= r->size) {  /* must copy? */
+    size_t size = (l < MAX_SIZE / 4) ? 2 * l : l + 1;
+    r = newrope(L, size);
+    memcpy(r->data, getlngstr(ts), pl * sizeof(char));
+    fresh = 1;
+  }
+  ne.kind = LSTRROPE;
+  if (luaD_rawrunprotected(L, f_newext, &ne) != LUA_OK) {  /* mem. error? */
+    if (fresh)
+      luaM_freemem(L, r, sizerope(r->size));
+    luaM_error(L);  /* re-raise memory error */
+  }
+  r->nref++;
+  r->used = l;
+  r->data[l] = '\0';  /* ending 0 (previous one is overwritten by caller) */
+  ne.ts->shrlen = LSTRROPE;
+  ne.ts->u.lnglen = l;
+  ne.ts->contents = r->data;
+  ne.ts->falloc = NULL;
+  ne.ts->ud = r;
+  return ne.ts;
+}
+
+
+/*
+** A shorter view of a rope is followed by bytes of longer views, not by
+** a '\0'. When a caller needs that '\0', the view gets a rope of its
+** own. If 'keep' is true, the caller keeps the address of the contents,
+** so their '\0' must stay there: the rope no longer grows in place.
+*/
+void luaS_flatten (lua_State *L, TString *ts, int keep) {
+  Rope *r = getrope(ts);
+  size_t l = ts->u.lnglen;
+  if (ts->contents[l] != '\0') {  /* lost its ending '\0'? */
+    Rope *nr = newrope(L, l + 1);
+    memcpy(nr->data, ts->contents, l * sizeof(char));
+    nr->data[l] = '\0';
+    nr->used = l;
+    nr->nref = 1;
+    ts->contents = nr->data;
+    ts->ud = nr;
+    unrefrope(L, r);
+  }
+  else if (keep && r->used == l)  /* rope could grow over its '\0'? */
+    r->used = MAX_SIZE;  /* no view is that long; stop growing */
+}
+
+
+/*
+** Called when a view of a rope is collected. Returns the number of
+** bytes freed besides the view itself.
+*/
+size_t luaS_freerope (lua_State *L, TString *ts) {
+  return unrefrope(L, getrope(ts));
+}
+
+/* }================================================================== */
+
@@ -377,34 +377,26 @@ LUAI_FUNC int luaS_eqstr(TString *a, TString *b);
 ** 这个函数可以比较任意两个字符串（短或长）
 */
 
-LUAI_FUNC void luaS_resize(lua_State *L, int newsize);
+LUAI_FUNC void luaS_shrink(lua_State *L, int n);
 /*
-** 【函数声明: luaS_resize】
+** 【函数声明: luaS_shrink】
 **
-** 函数原型: void luaS_resize(lua_State *L, int newsize)
+** 函数原型: void luaS_shrink(lua_State *L, int n)
 **
-** 功能: 调整字符串表（哈希表）的大小
+** 功能: 字符串表太大（使用的桶不到1/4）时，最多合并 n 个桶来缩小它
 **
 ** 参数:
-**   L       - Lua 状态机指针
-**   newsize - 新的哈希表大小（桶的数量）
+**   L - Lua 状态机指针
+**   n - 最多合并的桶数
 **
 ** 返回值: 无
 **
 ** 【设计说明】
-** 字符串表是一个哈希表，用于存储所有内化的短字符串
-** 随着字符串数量增加/减少，需要动态调整哈希表大小
-** 以保持良好的性能（避免过多的哈希冲突）
-**
-** 【调整时机】
-** - 扩容: 当字符串数量超过当前大小时
-** - 缩容: 在 GC 后，如果字符串数量明显减少
-**
-** 【哈希表基础知识】
-** 哈希表通过哈希函数将键映射到"桶"(bucket)
-** 理想情况下，每个桶只有一个元素
-** 当多个键映射到同一个桶时，产生"冲突"
-** 调整大小可以减少冲突，提高查找效率
+** 字符串表用线性哈希逐个桶地调整大小（见lstring.c）：
+** - 扩容: 插入新字符串时，表太满（超过3/4）就分裂一个桶
+** - 缩容: 回收器的每一步（紧急回收除外）合并少量的桶（见lgc.c中的
+**   GCSTRMERGE）；完整回收一次缩到底
+** 因此有大量字符串时也不会因一次重新哈希整个表而停顿
 */
 
 LUAI_FUNC void luaS_clearcache(global_State *g);
@@ -691,6 +683,45 @@ LUAI_FUNC TString *luaS_normstr(lua_State *L, TString *ts);
 ** 例如: 作为表的键时，需要使用规范化的字符串
 */
 
+LUAI_FUNC TString *luaS_extend(lua_State *L, TString *ts, size_t l);
+/*
+** 【函数声明: luaS_extend】
+**
+** 功能: 创建长度为 l、以连接结果 ts 的内容开头的字符串,
+**       其余部分由调用者填写(见 lvm.c 中的 luaV_concat)
+**
+** 若 ts 是其缓冲区中最长的视图且容量足够,直接在其后追加,不复制前缀;
+** 若 ts 是 LSTRAPP 或最长的视图,把内容复制到容量加倍的新缓冲区;
+** 否则(第一次追加)复制为大小正好的常规字符串(LSTRAPP)
+*/
+
+LUAI_FUNC void luaS_flatten(lua_State *L, TString *ts, int keep);
+/*
+** 【函数声明: luaS_flatten】
+**
+** 功能: 确保 Rope 视图 ts 的内容后面紧跟 '\0'(必要时复制出独立的缓冲区)
+**       keep 为真表示调用者会保留内容地址,此后缓冲区不再原地追加
+*/
+
+LUAI_FUNC size_t luaS_freerope(lua_State *L, TString *ts);
+/*
+** 【函数声明: luaS_freerope】
+**
+** 功能: 回收 Rope 视图时释放其对缓冲区的引用,返回额外释放的字节数
+*/
+
+/*
+** 测试字符串是否为连接结果(LSTRCAT、LSTRAPP 或 LSTRROPE),再被追加时
+** 交给 luaS_extend
+*/
+#define luaS_isconcat(ts) ((ts)->shrlen <= LSTRROPE)
+
+/*
+** 需要以 '\0' 结尾的内容时使用(对非 Rope 字符串没有作用)
+*/
+#define luaS_flat(L, ts, keep) \
+  ((ts)->shrlen == LSTRROPE ? luaS_flatten(L, ts, keep) : (void)0)
+
 #endif
 /*
 ** 【头文件保护结束】
@@ -743,7 +774,7 @@ LUAI_FUNC TString *luaS_normstr(lua_State *L, TString *ts);
 **
 **    【管理函数】
 **    - luaS_init: 初始化字符串子系统
-**    - luaS_resize: 调整字符串表大小
+**    - luaS_shrink: 逐步缩小字符串表
 **    - luaS_remove: 从字符串表移除字符串
 **    - luaS_clearcache: 清除字符串缓存
 **
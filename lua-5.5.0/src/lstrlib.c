@@ -37,6 +37,230 @@
 #endif
 
 
+/*
+** {======================================================
+** BYTE KERNELS
+** =======================================================
+*/
+
+/*
+** Loops over long strings work on blocks of BLOCKSIZE bytes: 16 with
+** SSE2 (which every x86-64 has), or a 'size_t' handled with plain
+** integer arithmetic otherwise (as the swiss table in ltable.c does).
+** A mask has MASKBPB bits for each byte of a block, the first byte in
+** the lowest bits.
+*/
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define BLOCKSIZE	16
+#define MASKBPB		1
+
+typedef __m128i Block;
+typedef unsigned int BlockMask;
+
+#define loadblock(p)	_mm_loadu_si128(cast(const __m128i *, (p)))
+#define storeblock(p,b)	_mm_storeu_si128(cast(__m128i *, (p)), (b))
+
+/* mask with the bits set for each byte of 'b' equal to 'c' */
+#define eqbytes(b,c)	cast_uint(_mm_movemask_epi8(_mm_cmpeq_epi8((b),  \
+				_mm_set1_epi8(cast_char(c)))))
+
+/* whether all bytes of 'b' are ASCII */
+#define asciiblock(b)	(_mm_movemask_epi8(b) == 0)
+
+/* flip bit 0x20 of the bytes of 'b' in 'lo'..'hi' (an ASCII block) */
+static Block flipcase (Block b, int lo, int hi) {
+  __m128i m = _mm_and_si128(
+                  _mm_cmpgt_epi8(b, _mm_set1_epi8(cast_char(lo - 1))),
+                  _mm_cmplt_epi8(b, _mm_set1_epi8(cast_char(hi + 1))));
+  return _mm_xor_si128(b, _mm_and_si128(m, _mm_set1_epi8(0x20)));
+}
+
+static Block reverseblock (Block b) {
+  b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));  /* reverse dwords */
+  b = _mm_shufflelo_epi16(b, _MM_SHUFFLE(2, 3, 0, 1));  /* and words */
+  b = _mm_shufflehi_epi16(b, _MM_SHUFFLE(2, 3, 0, 1));
+  return _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+}
+
+#else  /* portable SWAR version, using a 'size_t' as the block */
+
+#define BLOCKSIZE	sizeof(Block)
+#define MASKBPB		8
+
+typedef size_t Block;
+typedef size_t BlockMask;
+
+#define LOWBITS		(~cast(Block, 0) / 0xFF)  /* 0x0101...01 */
+#define HIGHBITS	(LOWBITS << 7)  /* 0x8080...80 */
+
+/* blocks keep the first byte in their lowest bits */
+static Block loadblock (const char *p) {
+  Block b;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(&b, p, sizeof(b));
+#else
+  int i;
+  b = 0;
+  for (i = cast_int(BLOCKSIZE) - 1; i >= 0; i--)
+    b = (b << 8) | cast_uchar(p[i]);
+#endif
+  return b;
+}
+
+static void storeblock (char *p, Block b) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(p, &b, sizeof(b));
+#else
+  size_t i;
+  for (i = 0; i < BLOCKSIZE; i++, b >>= 8)
+    p[i] = cast_char(b & 0xFF);
+#endif
+}
+
+/*
+** Mask with the high bit set for each byte of 'b' equal to 'c'. It can
+** give false positives (only for bytes above a true match), so callers
+** must check the bytes anyway.
+*/
+static BlockMask eqbytes (Block b, int c) {
+  Block x = b ^ (LOWBITS * cast_uchar(c));
+  return (x - LOWBITS) & ~x & HIGHBITS;
+}
+
+#define asciiblock(b)	(((b) & HIGHBITS) == 0)
+
+/*
+** Flip bit 0x20 of the bytes of 'b' in 'lo'..'hi' (an ASCII block).
+** Adding '0x80 - lo' to a byte sets its high bit iff it is >= 'lo',
+** without carries into the next byte.
+*/
+static Block flipcase (Block b, int lo, int hi) {
+  Block m = (b + LOWBITS * cast_uint(0x80 - lo)) ^
+            (b + LOWBITS * cast_uint(0x80 - hi - 1));
+  return b ^ ((m & HIGHBITS) >> 2);
+}
+
+static Block reverseblock (Block b) {
+#if defined(__GNUC__)
+  if (sizeof(Block) == 8)
+    return cast(Block, __builtin_bswap64(cast(unsigned long long, b)));
+  else if (sizeof(Block) == 4)
+    return cast(Block, __builtin_bswap32(cast(unsigned int, b)));
+#endif
+  {
+    Block r = 0;
+    size_t i;
+    for (i = 0; i < BLOCKSIZE; i++, b >>= 8)
+      r = (r << 8) | (b & 0xFF);
+    return r;
+  }
+}
+
+#endif
+
+
+/* index in a block of the first byte in a non-zero mask */
+#if defined(__GNUC__)
+#define firstbyte(m)  \
+	(cast_sizet(__builtin_ctzll(cast(unsigned long long, m))) / MASKBPB)
+#else
+static size_t firstbyte (BlockMask m) {
+  size_t i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i / MASKBPB;
+}
+#endif
+
+
+/*
+** Find 'p' (with 'lp' >= 2 bytes) in 's', comparing only at positions
+** where both its first and its last bytes match, which are found a
+** block at a time. ('ls' >= 'lp')
+*/
+static const char *blockfind (const char *s, size_t ls,
+                              const char *p, size_t lp) {
+  size_t i = 0;
+  size_t last = lp - 1;  /* offset of last byte of 'p' */
+  for (; ls - last >= BLOCKSIZE && i <= ls - last - BLOCKSIZE;
+         i += BLOCKSIZE) {
+    BlockMask m = eqbytes(loadblock(s + i), p[0]) &
+                  eqbytes(loadblock(s + i + last), p[last]);
+    while (m != 0) {
+      const char *init = s + i + firstbyte(m);
+      if (memcmp(init, p, lp) == 0)
+        return init;
+      m &= m - 1;  /* try next candidate */
+    }
+  }
+  for (; i <= ls - lp; i++) {  /* last positions, one by one */
+    if (s[i] == p[0] && s[i + last] == p[last] &&
+        memcmp(s + i, p, lp) == 0)
+      return s + i;
+  }
+  return NULL;  /* not found */
+}
+
+
+/*
+** Whether the current locale changes the case of ASCII characters as
+** the C locale does (it does not, e.g., in Turkish locales).
+*/
+static int asciicase (int upper) {
+  int c;
+  if (upper) {
+    for (c = 0; c < 0x80; c++) {
+      if (toupper(c) != (('a' <= c && c <= 'z') ? c - 0x20 : c))
+        return 0;
+    }
+  }
+  else {
+    for (c = 0; c < 0x80; c++) {
+      if (tolower(c) != (('A' <= c && c <= 'Z') ? c + 0x20 : c))
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* minimum length for 'changecase' to check 'asciicase' */
+#define MINCASEBLOCKS	256
+
+
+#define tocase(c,upper)  \
+	cast_char((upper) ? toupper(cast_uchar(c)) : tolower(cast_uchar(c)))
+
+
+/*
+** Copy 's' to 'd' changing the case of its characters. Blocks with only
+** ASCII characters are changed at once when the locale allows it.
+*/
+static void changecase (char *d, const char *s, size_t l, int upper) {
+  size_t i = 0;
+  if (l >= MINCASEBLOCKS && asciicase(upper)) {
+    int lo = upper ? 'a' : 'A';
+    for (; i + BLOCKSIZE <= l; i += BLOCKSIZE) {
+      Block b = loadblock(s + i);
+      if (asciiblock(b))
+        storeblock(d + i, flipcase(b, lo, lo + ('Z' - 'A')));
+      else {  /* change this block byte by byte */
+        size_t j;
+        for (j = i; j < i + BLOCKSIZE; j++)
+          d[j] = tocase(s[j], upper);
+      }
+    }
+  }
+  for (; i < l; i++)
+    d[i] = tocase(s[i], upper);
+}
+
+/* }====================================================== */
+
+
 static int str_len (lua_State *L) {
   size_t l;
   luaL_checklstring(L, 1, &l);
@@ -99,8 +323,10 @@ static int str_reverse (lua_State *L) {
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
-    p[i] = s[l - i - 1];
+  for (i = 0; i + BLOCKSIZE <= l; i += BLOCKSIZE)
+    storeblock(p + l - i - BLOCKSIZE, reverseblock(loadblock(s + i)));
+  for (; i < l; i++)
+    p[l - i - 1] = s[i];
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -108,12 +334,10 @@ static int str_reverse (lua_State *L) {
 
 static int str_lower (lua_State *L) {
   size_t l;
-  size_t i;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = cast_char(tolower(cast_uchar(s[i])));
+  changecase(p, s, l, 0);
   luaL_pushresultsize(&b, l);
   return 1;
 }
@@ -121,20 +345,26 @@ static int str_lower (lua_State *L) {
 
 static int str_upper (lua_State *L) {
   size_t l;
-  size_t i;
   luaL_Buffer b;
   const char *s = luaL_checklstring(L, 1, &l);
   char *p = luaL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = cast_char(toupper(cast_uchar(s[i])));
+  changecase(p, s, l, 1);
   luaL_pushresultsize(&b, l);
   return 1;
 }
 
 
+/* 'str_rep' stops doubling its copies at about this size */
+#define REPBLOCK	(16 * 1024)
+
+
 /*
 ** MAX_SIZE is limited both by size_t and lua_Integer.
 ** When x <= MAX_SIZE, x can be safely cast to size_t or lua_Integer.
+** After the first copy of 's' and 'sep', the result repeats what is
+** already written: copy it with doubling blocks, up to about REPBLOCK
+** bytes (so that the source stays in cache), instead of one 'memcpy'
+** per copy.
 */
 static int str_rep (lua_State *L) {
   size_t len, lsep;
@@ -148,15 +378,24 @@ static int str_rep (lua_State *L) {
     return luaL_error(L, "resulting string too large");
   else {
     size_t totallen = (cast_sizet(n) * (len + lsep)) - lsep;
+    size_t done = len;  /* bytes already written */
+    size_t blk;  /* size of the next copy (a multiple of 'len + lsep') */
     luaL_Buffer b;
     char *p = luaL_buffinitsize(L, &b, totallen);
-    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-      memcpy(p, s, len * sizeof(char)); p += len;
-      if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-        memcpy(p, sep, lsep * sizeof(char)); p += lsep;
-      }
+    memcpy(p, s, len * sizeof(char));
+    if (n > 1 && lsep > 0) {  /* empty 'memcpy' is not that cheap */
+      memcpy(p + len, sep, lsep * sizeof(char));
+      done += lsep;
+    }
+    blk = done;
+    while (done < totallen) {
+      if (blk > totallen - done)
+        blk = totallen - done;  /* last copy (without separator) */
+      memcpy(p + done, p, blk * sizeof(char));
+      done += blk;
+      if (blk < REPBLOCK)
+        blk *= 2;
     }
-    memcpy(p, s, len * sizeof(char));  /* last copy without separator */
     luaL_pushresultsize(&b, totallen);
   }
   return 1;
@@ -676,213 +915,959 @@ static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
-  else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
-    l2--;  /* 1st char will be checked by 'memchr' */
-    l1 = l1-l2;  /* 's2' cannot be found after that */
-    while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
-      init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
-        return init-1;
-      else {  /* correct 'l1' and 's1' to try again */
-        l1 -= ct_diff2sz(init - s1);
-        s1 = init;
-      }
-    }
-    return NULL;  /* not found */
-  }
+  else if (l2 == 1) return (const char *)memchr(s1, *s2, l1);
+  else return blockfind(s1, l1, s2, l2);
 }
 
 
+#if LUA_USE_PATCACHE	/* { */
+
 /*
-** get information about the i-th capture. If there are no captures
-** and 'i==0', return information about the whole match, which
-** is the range 's'..'e'. If the capture is a string, return
-** its length and put its address in '*cap'. If it is an integer
-** (a position), push it on the stack and return CAP_POSITION.
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
 */
-static ptrdiff_t get_onecapture (MatchState *ms, int i, const char *s,
-                              const char *e, const char **cap) {
-  if (i >= ms->level) {
-    if (l_unlikely(i != 0))
-      luaL_error(ms->L, "invalid capture index %%%d", i + 1);
-    *cap = s;
-    return (e - s);
-  }
-  else {
-    ptrdiff_t capl = ms->capture[i].len;
-    *cap = ms->capture[i].init;
-    if (l_unlikely(capl == CAP_UNFINISHED))
-      luaL_error(ms->L, "unfinished capture");
-    else if (capl == CAP_POSITION)
-      lua_pushinteger(ms->L,
-          ct_diff2S(ms->capture[i].init - ms->src_init) + 1);
-    return capl;
-  }
-}
-
 
 /*
-** Push the i-th capture on the stack.
+** A pattern is compiled into an array of items ending with a PI_END
+** item. Single-character classes become a character, '.', or a 256-bit
+** set (so '%a' or '[%w_.]' cost one bit test), and runs of literal
+** characters without suffixes become one PI_LIT item. 'pmatch' follows
+** 'match' step by step, with the same recursions and the same errors,
+** so both give the same results. A malformed pattern is not compiled
+** ('valid' is false) and goes to 'match', which raises the error only
+** if the bad part is ever reached.
+**
+** Compiled patterns are kept in a small cache, an upvalue of the
+** matching functions, keyed by the address and length of the pattern
+** contents. The cache is set associative: a pattern can only go to
+** the PCWAYS entries of one set, and replaces the least recently used
+** of them. A pattern is compiled only when it is seen a second time,
+** so that patterns built on the fly do not pay for compilation. (If
+** the first one was collected and its address reused, the new pattern
+** is just compiled one call earlier.) Each compiled entry keeps its
+** program as a user value of the cache, and each program keeps its
+** pattern, so that address cannot be reused while the entry exists.
+**
+** Character sets are built from the classes of the current locale, so
+** 'os.setlocale' empties the cache by calling the function stored in
+** the registry under LUA_PATCACHE.
 */
-static void push_onecapture (MatchState *ms, int i, const char *s,
-                                                    const char *e) {
-  const char *cap;
-  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
-  if (l != CAP_POSITION)
-    lua_pushlstring(ms->L, cap, cast_sizet(l));
-  /* else position was already pushed */
-}
 
+/* size of the pattern cache (a multiple of PCWAYS) */
+#if !defined(LUAI_PATCACHESIZE)
+#define LUAI_PATCACHESIZE	32
+#endif
 
-static int push_captures (MatchState *ms, const char *s, const char *e) {
-  int i;
-  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
-  luaL_checkstack(ms->L, nlevels, "too many captures");
-  for (i = 0; i < nlevels; i++)
-    push_onecapture(ms, i, s, e);
-  return nlevels;  /* number of strings pushed */
-}
+/* number of entries in each set of the cache */
+#define PCWAYS		4
 
+/* number of classes with precomputed sets (see 'classindex') */
+#define NPCLASSES	11
 
-/* check whether pattern has no special characters */
-static int nospecials (const char *p, size_t l) {
-  size_t upto = 0;
-  do {
-    if (strpbrk(p + upto, SPECIALS))
-      return 0;  /* pattern has a special character */
-    upto += strlen(p + upto) + 1;  /* may have more after \0 */
-  } while (upto <= l);
-  return 1;  /* no special chars found */
-}
 
+/* kinds of pattern items */
+#define PI_END		0	/* end of pattern */
+#define PI_OPEN		1	/* '(' */
+#define PI_POSITION	2	/* '()' */
+#define PI_CLOSE	3	/* ')' */
+#define PI_EOS		4	/* '$' at the end of the pattern */
+#define PI_BALANCE	5	/* '%bxy' */
+#define PI_FRONTIER	6	/* '%f[set]' */
+#define PI_BACKREF	7	/* '%0'-'%9' */
+#define PI_LIT		8	/* literal characters */
+#define PI_CHAR		9	/* literal character plus suffix */
+#define PI_ANY		10	/* '.' plus optional suffix */
+#define PI_SET		11	/* other class plus optional suffix */
 
-static void prepstate (MatchState *ms, lua_State *L,
-                       const char *s, size_t ls, const char *p, size_t lp) {
-  ms->L = L;
-  ms->matchdepth = MAXCCALLS;
-  ms->src_init = s;
-  ms->src_end = s + ls;
-  ms->p_end = p + lp;
-}
 
+/* how to find where a match can start */
+#define PSKIP_NONE	0	/* try every position */
+#define PSKIP_LIT	1	/* look for a literal prefix */
+#define PSKIP_SET	2	/* look for a character in a set */
 
-static void reprepstate (MatchState *ms) {
-  ms->level = 0;
-  lua_assert(ms->matchdepth == MAXCCALLS);
-}
 
+#define SETSIZE		((UCHAR_MAX + 1) / CHAR_BIT)
 
-static int str_find_aux (lua_State *L, int find) {
-  size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
-  if (init > ls) {  /* start after string's end? */
-    luaL_pushfail(L);  /* cannot find anything */
-    return 1;
-  }
-  /* explicit request or no special characters? */
-  if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
-    /* do a plain search */
-    const char *s2 = lmemfind(s + init, ls - init, p, lp);
-    if (s2) {
-      lua_pushinteger(L, ct_diff2S(s2 - s) + 1);
-      lua_pushinteger(L, cast_st2S(ct_diff2sz(s2 - s) + lp));
-      return 2;
-    }
-  }
-  else {
-    MatchState ms;
-    const char *s1 = s + init;
-    int anchor = (*p == '^');
-    if (anchor) {
-      p++; lp--;  /* skip anchor character */
-    }
-    prepstate(&ms, L, s, ls, p, lp);
-    do {
-      const char *res;
-      reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
-        if (find) {
-          lua_pushinteger(L, ct_diff2S(s1 - s) + 1);  /* start */
-          lua_pushinteger(L, ct_diff2S(res - s));   /* end */
-          return push_captures(&ms, NULL, 0) + 2;
-        }
-        else
-          return push_captures(&ms, s1, res);
-      }
-    } while (s1++ < ms.src_end && !anchor);
-  }
-  luaL_pushfail(L);  /* not found */
-  return 1;
-}
+#define testset(set,c)	((set)[(c) / CHAR_BIT] & (1u << ((c) % CHAR_BIT)))
+#define setbit(set,c)	((set)[(c) / CHAR_BIT] |= \
+                           cast_byte(1u << ((c) % CHAR_BIT)))
 
 
-static int str_find (lua_State *L) {
-  return str_find_aux(L, 1);
-}
+typedef struct PatItem {
+  lu_byte kind;  /* PI_* */
+  lu_byte suffix;  /* '*', '+', '-', '?', or 0 */
+  lu_byte c1, c2;  /* character, delimiters of '%b', or capture digit */
+  const lu_byte *data;  /* set or literal characters */
+  size_t len;  /* number of literal characters */
+} PatItem;
 
 
-static int str_match (lua_State *L) {
-  return str_find_aux(L, 0);
-}
+typedef struct PatProg {
+  int valid;  /* false if pattern is malformed */
+  int skip;  /* PSKIP_* */
+  const lu_byte *skipdata;  /* prefix or set for 'skip' */
+  size_t skiplen;  /* length of prefix */
+  size_t nitems;  /* number of items */
+  size_t ndata;  /* number of bytes in 'data' */
+  PatItem *item;  /* NULL while only counting */
+  lu_byte *data;  /* sets and literal characters */
+} PatProg;
 
 
-/* state for 'gmatch' */
-typedef struct GMatchState {
-  const char *src;  /* current position */
-  const char *p;  /* pattern */
-  const char *lastmatch;  /* end of last match */
-  MatchState ms;  /* match state */
-} GMatchState;
+typedef struct PatCache {
+  const char *key[LUAI_PATCACHESIZE];  /* contents of each pattern */
+  size_t len[LUAI_PATCACHESIZE];  /* length of each pattern */
+  lu_byte mode[LUAI_PATCACHESIZE];  /* whether '^' is an anchor */
+  const PatProg *prog[LUAI_PATCACHESIZE];  /* NULL if not compiled yet */
+  unsigned stamp[LUAI_PATCACHESIZE];  /* time of last use */
+  unsigned clock;
+  lu_byte classes[NPCLASSES][SETSIZE];  /* sets for '%a', '%c', ... */
+} PatCache;
 
 
-static int gmatch_aux (lua_State *L) {
-  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
-  const char *src;
-  gm->ms.L = L;
-  for (src = gm->src; src <= gm->ms.src_end; src++) {
-    const char *e;
-    reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
-      gm->src = gm->lastmatch = e;
-      return push_captures(&gm->ms, src, e);
+/* program for patterns that are not compiled */
+static const PatProg interpreted = {0, PSKIP_NONE, NULL, 0, 0, 0, NULL, NULL};
+
+
+/* index of class 'cl' in 'classes' (following 'match_class') */
+static int classindex (int cl) {
+  switch (tolower(cl)) {
+    case 'a' : return 0;
+    case 'c' : return 1;
+    case 'd' : return 2;
+    case 'g' : return 3;
+    case 'l' : return 4;
+    case 'p' : return 5;
+    case 's' : return 6;
+    case 'u' : return 7;
+    case 'w' : return 8;
+    case 'x' : return 9;
+    case 'z' : return 10;
+    default: return -1;
+  }
+}
+
+
+static void initclasses (PatCache *pc) {
+  static const char names[NPCLASSES + 1] = "acdglpsuwxz";
+  int k, c;
+  memset(pc->classes, 0, sizeof(pc->classes));
+  for (k = 0; k < NPCLASSES; k++) {
+    lua_assert(classindex(names[k]) == k);
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      if (match_class(c, names[k]))
+        setbit(pc->classes[k], c);
     }
   }
-  return 0;  /* not found */
 }
 
 
-static int gmatch (lua_State *L) {
-  size_t ls, lp;
-  const char *s = luaL_checklstring(L, 1, &ls);
-  const char *p = luaL_checklstring(L, 2, &lp);
-  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
-  GMatchState *gm;
-  lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
-  gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
-  if (init > ls)  /* start after string's end? */
-    init = ls + 1;  /* avoid overflows in 's + init' */
-  prepstate(&gm->ms, L, s, ls, p, lp);
-  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
-  return 1;
+/* add the characters matched by '%cl' to 'set' */
+static void addclass (const PatCache *pc, lu_byte *set, int cl) {
+  int k = classindex(cl);
+  if (k < 0)
+    setbit(set, cl);  /* 'cl' stands for itself */
+  else {
+    int i;
+    for (i = 0; i < SETSIZE; i++)
+      set[i] |= islower(cl) ? pc->classes[k][i]
+                            : cast_byte(~pc->classes[k][i]);
+  }
 }
 
 
-static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
-                                                   const char *e) {
-  size_t l;
-  lua_State *L = ms->L;
-  const char *news = lua_tolstring(L, 3, &l);
-  const char *p;
-  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
-    luaL_addlstring(b, news, ct_diff2sz(p - news));
-    p++;  /* skip ESC */
-    if (*p == L_ESC)  /* '%%' */
-      luaL_addchar(b, *p);
-    else if (*p == '0')  /* '%0' */
+/*
+** Like 'classend', but returns NULL for a malformed class.
+*/
+static const char *pclassend (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == p_end) ? NULL : p + 1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == p_end)
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p + 1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+/*
+** Add an item to the program. While counting (no 'item' array yet),
+** the item is written to 'dummy'.
+*/
+static PatItem *additem (PatProg *pg, PatItem *dummy, int kind) {
+  PatItem *it = (pg->item != NULL) ? &pg->item[pg->nitems] : dummy;
+  pg->nitems++;
+  it->kind = cast_byte(kind);
+  it->suffix = it->c1 = it->c2 = 0;
+  it->data = NULL;
+  it->len = 0;
+  return it;
+}
+
+
+/*
+** Add the set of characters matched by class 'p'..'ep' to the program.
+** A bracket class is read as in 'matchbracketclass'.
+*/
+static const lu_byte *addset (PatProg *pg, const PatCache *pc,
+                              const char *p, const char *ep) {
+  lu_byte *set = NULL;
+  if (pg->item != NULL) {
+    set = pg->data + pg->ndata;
+    memset(set, 0, SETSIZE);
+    if (*p == L_ESC)
+      addclass(pc, set, cast_uchar(*(p + 1)));
+    else {
+      int neg = 0;
+      ep--;  /* points to the ']' */
+      if (*(p+1) == '^') {
+        neg = 1;
+        p++;  /* skip the '^' */
+      }
+      while (++p < ep) {
+        if (*p == L_ESC) {
+          p++;
+          addclass(pc, set, cast_uchar(*p));
+        }
+        else if ((*(p+1) == '-') && (p+2 < ep)) {
+          int c;
+          p+=2;
+          for (c = cast_uchar(*(p-2)); c <= cast_uchar(*p); c++)
+            setbit(set, c);
+        }
+        else setbit(set, cast_uchar(*p));
+      }
+      if (neg) {
+        int i;
+        for (i = 0; i < SETSIZE; i++)
+          set[i] = cast_byte(~set[i]);
+      }
+    }
+  }
+  pg->ndata += SETSIZE;
+  return set;
+}
+
+
+/*
+** Compile pattern 'p'..'p_end' following the cases of 'match'. Return
+** false if the pattern is malformed.
+*/
+static int compilepat (PatProg *pg, const PatCache *pc,
+                       const char *p, const char *p_end) {
+  PatItem dummy;
+  PatItem *lit = NULL;  /* current run of literal characters */
+  while (p != p_end) {
+    PatItem *it;
+    const char *ep;
+    int suffix;
+    switch (*p) {
+      case '(': {
+        if (*(p + 1) == ')') {  /* position capture? */
+          additem(pg, &dummy, PI_POSITION);
+          p += 2;
+        }
+        else {
+          additem(pg, &dummy, PI_OPEN);
+          p++;
+        }
+        lit = NULL;
+        continue;
+      }
+      case ')': {
+        additem(pg, &dummy, PI_CLOSE);
+        p++; lit = NULL;
+        continue;
+      }
+      case '$': {
+        if ((p + 1) != p_end)  /* not the last char in pattern? */
+          break;  /* a plain character */
+        additem(pg, &dummy, PI_EOS);
+        p++; lit = NULL;
+        continue;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1)
+              return 0;  /* missing arguments to '%b' */
+            it = additem(pg, &dummy, PI_BALANCE);
+            it->c1 = cast_uchar(*(p + 2));
+            it->c2 = cast_uchar(*(p + 3));
+            p += 4; lit = NULL;
+            continue;
+          }
+          case 'f': {
+            p += 2;
+            if (*p != '[' || (ep = pclassend(p, p_end)) == NULL)
+              return 0;  /* malformed frontier */
+            it = additem(pg, &dummy, PI_FRONTIER);
+            it->data = addset(pg, pc, p, ep);
+            p = ep; lit = NULL;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            it = additem(pg, &dummy, PI_BACKREF);
+            it->c1 = cast_uchar(*(p + 1));
+            p += 2; lit = NULL;
+            continue;
+          }
+          default: break;  /* a class */
+        }
+        break;
+      }
+      default: break;
+    }
+    /* pattern class plus optional suffix */
+    if ((ep = pclassend(p, p_end)) == NULL)
+      return 0;  /* malformed class */
+    suffix = (*ep == '*' || *ep == '+' || *ep == '-' || *ep == '?')
+           ? cast_uchar(*ep) : 0;
+    if (*p != L_ESC && *p != '[' && *p != '.') {  /* literal character? */
+      if (suffix == 0) {  /* add it to the current run */
+        if (lit == NULL)
+          lit = additem(pg, &dummy, PI_LIT);
+        if (pg->item != NULL) {
+          if (lit->len == 0)
+            lit->data = pg->data + pg->ndata;
+          pg->data[pg->ndata] = cast_uchar(*p);
+        }
+        pg->ndata++;
+        lit->len++;
+        p = ep;
+        continue;
+      }
+      it = additem(pg, &dummy, PI_CHAR);
+      it->c1 = cast_uchar(*p);
+    }
+    else if (*p == '.')
+      it = additem(pg, &dummy, PI_ANY);
+    else {
+      it = additem(pg, &dummy, PI_SET);
+      it->data = addset(pg, pc, p, ep);
+    }
+    it->suffix = cast_byte(suffix);
+    p = (suffix != 0) ? ep + 1 : ep;
+    lit = NULL;
+  }
+  additem(pg, &dummy, PI_END);
+  return 1;
+}
+
+
+/*
+** Find what the first character of any match must be. Captures
+** consume nothing, but too many of them raise an error at every
+** position, so then every position must be tried.
+*/
+static void setskip (PatProg *pg) {
+  const PatItem *it = pg->item;
+  int ncap = 0;
+  while (it->kind == PI_OPEN || it->kind == PI_POSITION) {
+    it++; ncap++;
+  }
+  if (ncap > LUA_MAXCAPTURES)
+    return;
+  switch (it->kind) {
+    case PI_LIT: {
+      pg->skip = PSKIP_LIT;
+      pg->skipdata = it->data;
+      pg->skiplen = it->len;
+      break;
+    }
+    case PI_CHAR: case PI_BALANCE: {  /* (suffix of PI_BALANCE is 0) */
+      if (it->suffix == 0 || it->suffix == '+') {
+        pg->skip = PSKIP_LIT;
+        pg->skipdata = &it->c1;
+        pg->skiplen = 1;
+      }
+      break;
+    }
+    case PI_SET: {
+      if (it->suffix == 0 || it->suffix == '+') {
+        pg->skip = PSKIP_SET;
+        pg->skipdata = it->data;
+      }
+      break;
+    }
+    default: break;  /* anything can start a match */
+  }
+}
+
+
+/*
+** Create a userdata with the compiled form of pattern 'p' (at index
+** 'arg'), leaving it on the top of the stack.
+*/
+static const PatProg *newprog (lua_State *L, const PatCache *pc, int arg,
+                               const char *p, size_t lp) {
+  PatProg count;
+  PatProg *pg;
+  int valid;
+  size_t size = sizeof(PatProg);
+  count.item = NULL; count.data = NULL;
+  count.nitems = count.ndata = 0;
+  valid = compilepat(&count, pc, p, p + lp);
+  if (valid)
+    size += count.nitems * sizeof(PatItem) + count.ndata;
+  pg = (PatProg *)lua_newuserdatauv(L, size, 1);
+  *pg = interpreted;
+  if (valid) {
+    pg->valid = 1;
+    pg->item = (PatItem *)(pg + 1);
+    pg->data = cast(lu_byte *, pg->item + count.nitems);
+    compilepat(pg, pc, p, p + lp);
+    lua_assert(pg->nitems == count.nitems && pg->ndata == count.ndata);
+    setskip(pg);
+  }
+  lua_pushvalue(L, arg);  /* keep the pattern (and its address) alive */
+  lua_setiuservalue(L, -2, 1);
+  return pg;
+}
+
+
+/*
+** Push the compiled form of pattern 'p' (at index 'arg') and return
+** it, taking it from the cache (upvalue 1) or compiling it. A pattern
+** seen for the first time is only remembered; then this function
+** pushes nil and returns 'interpreted'. When 'anchor' is true, an
+** initial '^' is an anchor, left out of the program.
+*/
+static const PatProg *getprog (lua_State *L, int arg,
+                               const char *p, size_t lp, int anchor) {
+  PatCache *pc = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  lu_byte mode = (anchor && *p == '^');
+  int first = cast_int((point2uint(p) >> 4) % (LUAI_PATCACHESIZE / PCWAYS))
+            * PCWAYS;
+  int i, victim = first;
+  for (i = first; i < first + PCWAYS; i++) {
+    if (pc->key[i] == p && pc->len[i] == lp && pc->mode[i] == mode) {
+      pc->stamp[i] = ++pc->clock;
+      if (pc->prog[i] != NULL)  /* already compiled? */
+        lua_getiuservalue(L, lua_upvalueindex(1), i + 1);
+      else {  /* second use; compile it */
+        pc->prog[i] = newprog(L, pc, arg, p + mode, lp - mode);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, lua_upvalueindex(1), i + 1);
+      }
+      return pc->prog[i];
+    }
+    if (pc->stamp[i] < pc->stamp[victim])
+      victim = i;
+  }
+  /* first use; replace least recently used entry of the set */
+  pc->key[victim] = p;
+  pc->len[victim] = lp;
+  pc->mode[victim] = mode;
+  pc->prog[victim] = NULL;
+  pc->stamp[victim] = ++pc->clock;
+  lua_pushnil(L);
+  return &interpreted;
+}
+
+
+/*
+** Empty the cache (upvalue 1) and rebuild its classes. Called by
+** 'os.setlocale'.
+*/
+static int patflush (lua_State *L) {
+  PatCache *pc = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  int i;
+  for (i = 0; i < LUAI_PATCACHESIZE; i++) {
+    lua_pushnil(L);
+    lua_setiuservalue(L, lua_upvalueindex(1), i + 1);
+  }
+  memset(pc, 0, offsetof(PatCache, classes));
+  initclasses(pc);
+  return 0;
+}
+
+
+/*
+** Create the cache and leave it on the stack, to be the upvalue of the
+** matching functions. Register 'patflush' for 'os.setlocale'.
+*/
+static void createpatcache (lua_State *L) {
+  PatCache *pc = (PatCache *)lua_newuserdatauv(L, sizeof(PatCache),
+                                                  LUAI_PATCACHESIZE);
+  memset(pc, 0, offsetof(PatCache, classes));
+  initclasses(pc);
+  lua_pushvalue(L, -1);
+  lua_pushcclosure(L, patflush, 1);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUA_PATCACHE);
+}
+
+
+/* whether 'pskip' can skip anything */
+#define canskip(pg)	((pg)->skip != PSKIP_NONE)
+
+
+/*
+** Return the first position in 's'..'e' where a match can start, or
+** NULL if there is none.
+*/
+static const char *pskip (const PatProg *pg, const char *s, const char *e) {
+  switch (pg->skip) {
+    case PSKIP_LIT: {
+      if (s < e && cast_uchar(*s) == pg->skipdata[0])
+        return s;  /* may start here ('pmatch' checks the rest) */
+      return lmemfind(s, ct_diff2sz(e - s),
+                      cast(const char *, pg->skipdata), pg->skiplen);
+    }
+    case PSKIP_SET: {
+      while (s < e && !testset(pg->skipdata, cast_uchar(*s)))
+        s++;
+      return (s < e) ? s : NULL;
+    }
+    default: return s;
+  }
+}
+
+
+/* recursive function */
+static const char *pmatch (MatchState *ms, const char *s,
+                           const PatItem *it);
+
+
+static int psinglematch (MatchState *ms, const char *s,
+                         const PatItem *it) {
+  if (s >= ms->src_end)
+    return 0;
+  else {
+    int c = cast_uchar(*s);
+    switch (it->kind) {
+      case PI_CHAR: return (it->c1 == c);
+      case PI_ANY: return 1;
+      default: return testset(it->data, c);
+    }
+  }
+}
+
+
+/*
+** Whether 'pmatch(ms, s, it)' fails at once, without side effects. (A
+** call from depth 0 would raise an error instead.)
+*/
+#define cannotstart(ms,s,it) \
+	((it)->kind == PI_LIT && (ms)->matchdepth > 0 && \
+	 ((s) >= (ms)->src_end || cast_uchar(*(s)) != (it)->data[0]))
+
+
+static const char *pmatchbalance (MatchState *ms, const char *s,
+                                  const PatItem *it) {
+  if (s >= ms->src_end || cast_uchar(*s) != it->c1) return NULL;
+  else {
+    int cont = 1;
+    while (++s < ms->src_end) {
+      if (cast_uchar(*s) == it->c2) {
+        if (--cont == 0) return s+1;
+      }
+      else if (cast_uchar(*s) == it->c1) cont++;
+    }
+  }
+  return NULL;  /* string ends out of balance */
+}
+
+
+static const char *pmax_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  if (it->kind == PI_ANY)
+    i = ms->src_end - s;
+  else {
+    while (psinglematch(ms, s + i, it))
+      i++;
+  }
+  /* keeps trying to match with the maximum repetitions */
+  for (it++; i >= 0; i--) {
+    if (!cannotstart(ms, s + i, it)) {
+      const char *res = pmatch(ms, s + i, it);
+      if (res) return res;
+    }
+  }
+  return NULL;
+}
+
+
+static const char *pmin_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  for (;;) {
+    const char *res = cannotstart(ms, s, it + 1) ? NULL
+                                                 : pmatch(ms, s, it + 1);
+    if (res != NULL)
+      return res;
+    else if (psinglematch(ms, s, it))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pend_capture (MatchState *ms, const char *s,
+                                 const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *pmatch (MatchState *ms, const char *s,
+                           const PatItem *it) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (it->kind) {
+    case PI_END: break;
+    case PI_OPEN: {
+      s = pstart_capture(ms, s, it + 1, CAP_UNFINISHED);
+      break;
+    }
+    case PI_POSITION: {
+      s = pstart_capture(ms, s, it + 1, CAP_POSITION);
+      break;
+    }
+    case PI_CLOSE: {
+      s = pend_capture(ms, s, it + 1);
+      break;
+    }
+    case PI_EOS: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case PI_BALANCE: {
+      s = pmatchbalance(ms, s, it);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    case PI_FRONTIER: {
+      int previous = (s == ms->src_init) ? 0 : cast_uchar(*(s - 1));
+      if (!testset(it->data, previous) &&
+          testset(it->data, cast_uchar(*s))) {
+        it++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, it->c1);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    case PI_LIT: {
+      if (ct_diff2sz(ms->src_end - s) >= it->len &&
+          memcmp(s, it->data, it->len) == 0) {
+        s += it->len; it++; goto init;
+      }
+      s = NULL;  /* fail */
+      break;
+    }
+    default: {  /* single-character class plus optional suffix */
+      /* does not match at least once? */
+      if (!psinglematch(ms, s, it)) {
+        if (it->suffix == '*' || it->suffix == '?' || it->suffix == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->suffix) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = pmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = pmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = pmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/* match with the compiled pattern, if there is one */
+#define domatch(ms,s,p,pg) \
+	((pg)->valid ? pmatch(ms, s, (pg)->item) : match(ms, s, p))
+
+/* }====================================================== */
+
+#else			/* }{ */
+
+typedef struct PatProg PatProg;
+
+/* without a cache, only push a placeholder for the program */
+#define getprog(L,arg,p,lp,anchor)	(lua_pushnil(L), (const PatProg *)NULL)
+
+#define createpatcache(L)	lua_pushnil(L)
+
+#define canskip(pg)		((void)(pg), 0)
+
+#define pskip(pg,s,e)		(s)
+
+#define domatch(ms,s,p,pg)	((void)(pg), match(ms, s, p))
+
+#endif			/* } */
+
+
+/*
+** get information about the i-th capture. If there are no captures
+** and 'i==0', return information about the whole match, which
+** is the range 's'..'e'. If the capture is a string, return
+** its length and put its address in '*cap'. If it is an integer
+** (a position), push it on the stack and return CAP_POSITION.
+*/
+static ptrdiff_t get_onecapture (MatchState *ms, int i, const char *s,
+                              const char *e, const char **cap) {
+  if (i >= ms->level) {
+    if (l_unlikely(i != 0))
+      luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+    *cap = s;
+    return (e - s);
+  }
+  else {
+    ptrdiff_t capl = ms->capture[i].len;
+    *cap = ms->capture[i].init;
+    if (l_unlikely(capl == CAP_UNFINISHED))
+      luaL_error(ms->L, "unfinished capture");
+    else if (capl == CAP_POSITION)
+      lua_pushinteger(ms->L,
+          ct_diff2S(ms->capture[i].init - ms->src_init) + 1);
+    return capl;
+  }
+}
+
+
+/*
+** Push the i-th capture on the stack.
+*/
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+  const char *cap;
+  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+  if (l != CAP_POSITION)
+    lua_pushlstring(ms->L, cap, cast_sizet(l));
+  /* else position was already pushed */
+}
+
+
+static int push_captures (MatchState *ms, const char *s, const char *e) {
+  int i;
+  int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
+  luaL_checkstack(ms->L, nlevels, "too many captures");
+  for (i = 0; i < nlevels; i++)
+    push_onecapture(ms, i, s, e);
+  return nlevels;  /* number of strings pushed */
+}
+
+
+/* check whether pattern has no special characters */
+static int nospecials (const char *p, size_t l) {
+  size_t i;
+  for (i = 0; i + BLOCKSIZE <= l; i += BLOCKSIZE) {
+    Block b = loadblock(p + i);
+    BlockMask m = 0;
+    size_t k;
+    for (k = 0; k < sizeof(SPECIALS) - 1; k++)
+      m |= eqbytes(b, SPECIALS[k]);
+    if (m != 0)
+      return 0;  /* pattern has a special character */
+  }
+  for (; i < l; i++) {
+    if (memchr(SPECIALS, p[i], sizeof(SPECIALS) - 1))
+      return 0;  /* pattern has a special character */
+  }
+  return 1;  /* no special chars found */
+}
+
+
+static void prepstate (MatchState *ms, lua_State *L,
+                       const char *s, size_t ls, const char *p, size_t lp) {
+  ms->L = L;
+  ms->matchdepth = MAXCCALLS;
+  ms->src_init = s;
+  ms->src_end = s + ls;
+  ms->p_end = p + lp;
+}
+
+
+static void reprepstate (MatchState *ms) {
+  ms->level = 0;
+  lua_assert(ms->matchdepth == MAXCCALLS);
+}
+
+
+static int str_find_aux (lua_State *L, int find) {
+  size_t ls, lp;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *p = luaL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  if (init > ls) {  /* start after string's end? */
+    luaL_pushfail(L);  /* cannot find anything */
+    return 1;
+  }
+  /* explicit request or no special characters? */
+  if (find && (lua_toboolean(L, 4) || nospecials(p, lp))) {
+    /* do a plain search */
+    const char *s2 = lmemfind(s + init, ls - init, p, lp);
+    if (s2) {
+      lua_pushinteger(L, ct_diff2S(s2 - s) + 1);
+      lua_pushinteger(L, cast_st2S(ct_diff2sz(s2 - s) + lp));
+      return 2;
+    }
+  }
+  else {
+    MatchState ms;
+    const char *s1 = s + init;
+    int anchor = (*p == '^');
+    const PatProg *pg = getprog(L, 2, p, lp, 1);
+    int skip = !anchor && canskip(pg);
+    if (anchor) {
+      p++; lp--;  /* skip anchor character */
+    }
+    prepstate(&ms, L, s, ls, p, lp);
+    do {
+      const char *res;
+      if (skip && (s1 = pskip(pg, s1, ms.src_end)) == NULL)
+        break;  /* no place where a match can start */
+      reprepstate(&ms);
+      if ((res=domatch(&ms, s1, p, pg)) != NULL) {
+        if (find) {
+          lua_pushinteger(L, ct_diff2S(s1 - s) + 1);  /* start */
+          lua_pushinteger(L, ct_diff2S(res - s));   /* end */
+          return push_captures(&ms, NULL, 0) + 2;
+        }
+        else
+          return push_captures(&ms, s1, res);
+      }
+    } while (s1++ < ms.src_end && !anchor);
+  }
+  luaL_pushfail(L);  /* not found */
+  return 1;
+}
+
+
+static int str_find (lua_State *L) {
+  return str_find_aux(L, 1);
+}
+
+
+static int str_match (lua_State *L) {
+  return str_find_aux(L, 0);
+}
+
+
+/* state for 'gmatch' */
+typedef struct GMatchState {
+  const char *src;  /* current position */
+  const char *p;  /* pattern */
+  const char *lastmatch;  /* end of last match */
+  const PatProg *pg;  /* compiled pattern (an upvalue) */
+  MatchState ms;  /* match state */
+} GMatchState;
+
+
+static int gmatch_aux (lua_State *L) {
+  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
+  const char *src;
+  gm->ms.L = L;
+  for (src = gm->src; src <= gm->ms.src_end; src++) {
+    const char *e;
+    if (canskip(gm->pg) &&
+        (src = pskip(gm->pg, src, gm->ms.src_end)) == NULL)
+      break;  /* no place where a match can start */
+    reprepstate(&gm->ms);
+    if ((e = domatch(&gm->ms, src, gm->p, gm->pg)) != NULL &&
+        e != gm->lastmatch) {
+      gm->src = gm->lastmatch = e;
+      return push_captures(&gm->ms, src, e);
+    }
+  }
+  return 0;  /* not found */
+}
+
+
+static int gmatch (lua_State *L) {
+  size_t ls, lp;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  const char *p = luaL_checklstring(L, 2, &lp);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  GMatchState *gm;
+  lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
+  gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
+  if (init > ls)  /* start after string's end? */
+    init = ls + 1;  /* avoid overflows in 's + init' */
+  prepstate(&gm->ms, L, s, ls, p, lp);
+  gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
+  gm->pg = getprog(L, 2, p, lp, 0);  /* '^' is not an anchor here */
+  lua_pushcclosure(L, gmatch_aux, 4);
+  return 1;
+}
+
+
+static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
+                                                   const char *e) {
+  size_t l;
+  lua_State *L = ms->L;
+  const char *news = lua_tolstring(L, 3, &l);
+  const char *p;
+  while ((p = (char *)memchr(news, L_ESC, l)) != NULL) {
+    luaL_addlstring(b, news, ct_diff2sz(p - news));
+    p++;  /* skip ESC */
+    if (*p == L_ESC)  /* '%%' */
+      luaL_addchar(b, *p);
+    else if (*p == '0')  /* '%0' */
         luaL_addlstring(b, s, ct_diff2sz(e - s));
     else if (isdigit(cast_uchar(*p))) {  /* '%n' */
       const char *cap;
@@ -953,11 +1938,13 @@ static int str_gsub (lua_State *L) {
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
   int changed = 0;  /* change flag */
+  const PatProg *pg;
   MatchState ms;
   luaL_Buffer b;
   luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table");
+  pg = getprog(L, 2, p, lp, 1);  /* (below the buffer) */
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
@@ -965,8 +1952,16 @@ static int str_gsub (lua_State *L) {
   prepstate(&ms, L, src, srcl, p, lp);
   while (n < max_s) {
     const char *e;
+    if (!anchor && canskip(pg)) {  /* copy what cannot start a match */
+      const char *next = pskip(pg, src, ms.src_end);
+      if (next != src) {
+        if (next == NULL) next = ms.src_end;
+        luaL_addlstring(&b, src, ct_diff2sz(next - src));
+        src = next;
+      }
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if ((e = domatch(&ms, src, p, pg)) != NULL && e != lastmatch) {
       n++;
       changed = add_value(&ms, &b, src, e, tr) | changed;
       src = lastmatch = e;
@@ -1226,8 +2221,8 @@ static const char *get2digits (const char *s) {
 ** be a valid conversion specifier. 'flags' are the accepted flags;
 ** 'precision' signals whether to accept a precision.
 */
-static void checkformat (lua_State *L, const char *form, const char *flags,
-                                       int precision) {
+static int validformat (const char *form, const char *flags,
+                        int precision) {
   const char *spec = form + 1;  /* skip '%' */
   spec += strspn(spec, flags);  /* skip flags */
   if (*spec != '0') {  /* a width cannot start with '0' */
@@ -1237,7 +2232,13 @@ static void checkformat (lua_State *L, const char *form, const char *flags,
       spec = get2digits(spec);  /* skip precision */
     }
   }
-  if (!isalpha(cast_uchar(*spec)))  /* did not go to the end? */
+  return isalpha(cast_uchar(*spec));  /* went to the end? */
+}
+
+
+static void checkformat (lua_State *L, const char *form, const char *flags,
+                                       int precision) {
+  if (!validformat(form, flags, precision))
     luaL_error(L, "invalid conversion specification: '%s'", form);
 }
 
@@ -1274,27 +2275,27 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
-static int str_format (lua_State *L) {
-  int top = lua_gettop(L);
-  int arg = 1;
+/*
+** Adds to buffer 'b' the result of formatting the values after index
+** 'arg' (the format string) up to index 'top'.
+*/
+static void addformat (lua_State *L, luaL_Buffer *b, int arg, int top) {
   size_t sfl;
   const char *strfrmt = luaL_checklstring(L, arg, &sfl);
   const char *strfrmt_end = strfrmt+sfl;
   const char *flags;
-  luaL_Buffer b;
-  luaL_buffinit(L, &b);
   while (strfrmt < strfrmt_end) {
     if (*strfrmt != L_ESC)
-      luaL_addchar(&b, *strfrmt++);
+      luaL_addchar(b, *strfrmt++);
     else if (*++strfrmt == L_ESC)
-      luaL_addchar(&b, *strfrmt++);  /* %% */
+      luaL_addchar(b, *strfrmt++);  /* %% */
     else { /* format item */
       char form[MAX_FORMAT];  /* to store the format ('%...') */
       unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = luaL_prepbuffsize(&b, maxitem);  /* to put result */
+      char *buff = luaL_prepbuffsize(b, maxitem);  /* to put result */
       int nb = 0;  /* number of bytes in result */
       if (++arg > top)
-        return luaL_argerror(L, arg, "no value");
+        luaL_argerror(L, arg, "no value");
       strfrmt = getformat(L, strfrmt, form);
       switch (*strfrmt++) {
         case 'c': {
@@ -1325,7 +2326,7 @@ static int str_format (lua_State *L) {
           break;
         case 'f':
           maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = luaL_prepbuffsize(&b, maxitem);
+          buff = luaL_prepbuffsize(b, maxitem);
           /* FALLTHROUGH */
         case 'e': case 'E': case 'g': case 'G': {
           lua_Number n = luaL_checknumber(L, arg);
@@ -1346,21 +2347,21 @@ static int str_format (lua_State *L) {
         }
         case 'q': {
           if (form[2] != '\0')  /* modifiers? */
-            return luaL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
+            luaL_error(L, "specifier '%%q' cannot have modifiers");
+          addliteral(L, b, arg);
           break;
         }
         case 's': {
           size_t l;
           const char *s = luaL_tolstring(L, arg, &l);
           if (form[2] == '\0')  /* no modifiers? */
-            luaL_addvalue(&b);  /* keep entire string */
+            luaL_addvalue(b);  /* keep entire string */
           else {
             luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
             checkformat(L, form, L_FMTFLAGSC, 1);
             if (strchr(form, '.') == NULL && l >= 100) {
               /* no precision and string is too long to be formatted */
-              luaL_addvalue(&b);  /* keep entire string */
+              luaL_addvalue(b);  /* keep entire string */
             }
             else {  /* format the string into 'buff' */
               nb = l_sprintf(buff, maxitem, form, s);
@@ -1370,13 +2371,478 @@ static int str_format (lua_State *L) {
           break;
         }
         default: {  /* also treat cases 'pnLlh' */
-          return luaL_error(L, "invalid conversion '%s' to 'format'", form);
+          luaL_error(L, "invalid conversion '%s' to 'format'", form);
+        }
+      }
+      lua_assert(cast_uint(nb) < maxitem);
+      luaL_addsize(b, cast_uint(nb));
+    }
+  }
+}
+
+
+#if LUA_USE_FMTCACHE		/* { */
+
+/*
+** {------------------------------------------------------
+** Compiled formats
+** -------------------------------------------------------
+*/
+
+/*
+** A format string is compiled into a list of items: runs of literal
+** text, copied as blocks, and conversions with their flags, width,
+** and precision already parsed and their 'form' for 'l_sprintf'
+** already built (with its length modifier). Integer conversions
+** (except '%#x' and '%#o') and '%s' are done here, without
+** 'l_sprintf', which is kept for floats, '%p', and the rare flags. A
+** format with an invalid conversion is not compiled ('valid' is
+** false) and goes to 'addformat', which raises the error when it
+** gets there.
+**
+** Compiled formats are kept in a cache, an upvalue of 'format' and
+** of the 'putf' method of string buffers, which works as the pattern
+** cache: keyed by the address and length of the format, compiled
+** only when seen a second time, and each program keeps its format
+** alive as its user value.
+*/
+
+/* size of the format cache (a multiple of FCWAYS) */
+#if !defined(LUAI_FMTCACHESIZE)
+#define LUAI_FMTCACHESIZE	32
+#endif
+
+/* number of entries in each set of the cache */
+#define FCWAYS		4
+
+
+/* format flags */
+#define FF_MINUS	1	/* '-' */
+#define FF_PLUS		2	/* '+' */
+#define FF_SPACE	4	/* ' ' */
+#define FF_HASH		8	/* '#' */
+#define FF_ZERO		16	/* '0' */
+
+
+typedef struct FmtItem {
+  char conv;  /* conversion specifier, or 0 for literal text */
+  lu_byte flags;  /* FF_* */
+  signed char width;  /* minimum width */
+  signed char prec;  /* precision, or -1 if absent */
+  unsigned maxitem;  /* maximum length for 'l_sprintf' */
+  size_t off, len;  /* literal text: its position in the format */
+  char form[MAX_FORMAT];  /* conversion for 'l_sprintf' */
+} FmtItem;
+
+
+typedef struct FmtProg {
+  int valid;  /* false if the format has an invalid conversion */
+  int nitems;
+  FmtItem *item;
+} FmtProg;
+
+
+typedef struct FmtCache {
+  const char *key[LUAI_FMTCACHESIZE];  /* contents of each format */
+  size_t len[LUAI_FMTCACHESIZE];  /* length of each format */
+  const FmtProg *prog[LUAI_FMTCACHESIZE];  /* NULL if not compiled yet */
+  unsigned stamp[LUAI_FMTCACHESIZE];  /* time of last use */
+  unsigned clock;
+} FmtCache;
+
+
+/* program for a format seen only once */
+static const FmtProg notcompiled = {0, 0, NULL};
+
+
+/* read flags, width, and precision of a valid 'form' into 'it' */
+static void parseform (FmtItem *it, const char *form) {
+  const char *spec = form + 1;  /* skip '%' */
+  int n;
+  it->flags = 0;
+  for (;; spec++) {
+    switch (*spec) {
+      case '-': it->flags |= FF_MINUS; continue;
+      case '+': it->flags |= FF_PLUS; continue;
+      case ' ': it->flags |= FF_SPACE; continue;
+      case '#': it->flags |= FF_HASH; continue;
+      case '0': it->flags |= FF_ZERO; continue;
+    }
+    break;
+  }
+  for (n = 0; isdigit(cast_uchar(*spec)); spec++)
+    n = n * 10 + (*spec - '0');
+  it->width = cast(signed char, n);
+  it->prec = -1;
+  if (*spec == '.') {
+    for (n = 0, spec++; isdigit(cast_uchar(*spec)); spec++)
+      n = n * 10 + (*spec - '0');
+    it->prec = cast(signed char, n);
+  }
+}
+
+
+/*
+** Compile the format 'strfrmt' into 'fp->item' (or only count its
+** items, when 'fp->item' is NULL). Return false if the format has an
+** invalid conversion. (Like 'addformat', this code may read the '\0'
+** that ends every Lua string.)
+*/
+static int compilefmt (FmtProg *fp, const char *strfrmt, size_t sfl) {
+  const char *start = strfrmt;
+  const char *strfrmt_end = strfrmt + sfl;
+  FmtItem dummy;
+  fp->nitems = 0;
+  while (strfrmt < strfrmt_end) {
+    FmtItem *it = (fp->item != NULL) ? &fp->item[fp->nitems] : &dummy;
+    fp->nitems++;
+    if (*strfrmt != L_ESC || strfrmt[1] == L_ESC) {  /* literal text? */
+      const char *lit = strfrmt;
+      while (strfrmt < strfrmt_end && *strfrmt != L_ESC) strfrmt++;
+      it->conv = 0;
+      it->off = cast_sizet(lit - start);
+      if (strfrmt < strfrmt_end && strfrmt[1] == L_ESC) {  /* '%%'? */
+        it->len = cast_sizet(strfrmt + 1 - lit);  /* keep its first '%' */
+        strfrmt += 2;
+      }
+      else
+        it->len = cast_sizet(strfrmt - lit);
+    }
+    else {  /* conversion */
+      const char *flags;
+      int precision = 1;
+      /* spans flags, width, and precision, as 'getformat' */
+      size_t len = strspn(++strfrmt, L_FMTFLAGSF "123456789.") + 1;
+      if (len >= MAX_FORMAT - 10)
+        return 0;
+      it->form[0] = '%';
+      memcpy(it->form + 1, strfrmt, len);
+      it->form[len + 1] = '\0';
+      it->conv = strfrmt[len - 1];
+      it->maxitem = MAX_ITEM;
+      strfrmt += len;
+      switch (it->conv) {
+        case 'c': case 'p':
+          flags = L_FMTFLAGSC;
+          precision = 0;
+          break;
+        case 's':
+          flags = L_FMTFLAGSC;
+          break;
+        case 'd': case 'i':
+          flags = L_FMTFLAGSI;
+          goto intcase;
+        case 'u':
+          flags = L_FMTFLAGSU;
+          goto intcase;
+        case 'o': case 'x': case 'X':
+          flags = L_FMTFLAGSX;
+         intcase:
+          if (!validformat(it->form, flags, 1)) return 0;
+          parseform(it, it->form);
+          addlenmod(it->form, LUA_INTEGER_FRMLEN);
+          continue;
+        case 'f':
+          it->maxitem = MAX_ITEMF;  /* extra space for '%f' */
+          /* FALLTHROUGH */
+        case 'a': case 'A': case 'e': case 'E': case 'g': case 'G':
+          if (!validformat(it->form, L_FMTFLAGSF, 1)) return 0;
+          addlenmod(it->form, LUA_NUMBER_FRMLEN);
+          continue;
+        case 'q':
+          if (it->form[2] != '\0') return 0;  /* modifiers? */
+          continue;
+        default:  /* also treat cases 'pnLlh' and the final '\0' */
+          return 0;
+      }
+      if (!validformat(it->form, flags, precision)) return 0;
+      parseform(it, it->form);
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Add integer 'n' formatted by item 'it' (any integer conversion
+** without '#'), as 'l_sprintf' would do it.
+*/
+static void addint (luaL_Buffer *b, const FmtItem *it, lua_Integer n) {
+  char digits[3 * sizeof(lua_Integer)];  /* enough for octal */
+  char *d = digits + sizeof(digits);
+  lua_Unsigned u = l_castS2U(n);
+  char sign = 0;
+  int nd, zeros, pad;
+  char *buff, *p;
+  switch (it->conv) {
+    case 'd': case 'i': {
+      if (n < 0) {
+        sign = '-';
+        u = 0u - u;
+      }
+      else if (it->flags & FF_PLUS)
+        sign = '+';
+      else if (it->flags & FF_SPACE)
+        sign = ' ';
+    }  /* FALLTHROUGH */
+    case 'u': {
+      if (u != 0 || it->prec != 0)  /* a zero with precision 0 is empty */
+        do { *--d = cast_char('0' + u % 10); u /= 10; } while (u != 0);
+      break;
+    }
+    case 'o': {
+      if (u != 0 || it->prec != 0)
+        do { *--d = cast_char('0' + (u & 7)); u >>= 3; } while (u != 0);
+      break;
+    }
+    default: {
+      const char *xd = (it->conv == 'x') ? "0123456789abcdef"
+                                         : "0123456789ABCDEF";
+      if (u != 0 || it->prec != 0)
+        do { *--d = xd[u & 15]; u >>= 4; } while (u != 0);
+      break;
+    }
+  }
+  nd = cast_int(digits + sizeof(digits) - d);
+  zeros = (it->prec > nd) ? it->prec - nd : 0;
+  pad = it->width - nd - zeros - (sign != 0);
+  if (pad > 0 && it->prec < 0 &&
+      (it->flags & (FF_ZERO | FF_MINUS)) == FF_ZERO) {
+    zeros += pad;  /* pad with zeros after the sign */
+    pad = 0;
+  }
+  p = buff = luaL_prepbuffsize(b, MAX_ITEM);  /* width, precision <= 99 */
+  if (pad > 0 && !(it->flags & FF_MINUS)) {
+    memset(p, ' ', cast_sizet(pad));
+    p += pad;
+  }
+  if (sign) *p++ = sign;
+  memset(p, '0', cast_sizet(zeros));
+  memcpy(p + zeros, d, cast_sizet(nd));
+  p += zeros + nd;
+  if (pad > 0 && (it->flags & FF_MINUS)) {
+    memset(p, ' ', cast_sizet(pad));
+    p += pad;
+  }
+  luaL_addsize(b, cast_sizet(p - buff));
+}
+
+
+/*
+** Add the string for argument 'arg' formatted by item 'it' ('%s' with
+** modifiers), as 'l_sprintf' would do it.
+*/
+static void addpadded (lua_State *L, luaL_Buffer *b, const FmtItem *it,
+                       int arg) {
+  char *buff = luaL_prepbuffsize(b, MAX_ITEM);  /* to put result */
+  size_t l, pad;
+  const char *s = luaL_tolstring(L, arg, &l);
+  luaL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+  if (it->prec >= 0 && l > cast_sizet(it->prec))
+    l = cast_sizet(it->prec);  /* truncate it */
+  if (l >= 100) {  /* no precision and string is too long to be padded */
+    luaL_addvalue(b);  /* keep entire string */
+    return;
+  }
+  pad = (cast_sizet(it->width) > l) ? cast_sizet(it->width) - l : 0;
+  if (it->flags & FF_MINUS) {  /* left-justify? */
+    memcpy(buff, s, l);
+    memset(buff + l, ' ', pad);
+  }
+  else {
+    memset(buff, ' ', pad);
+    memcpy(buff + pad, s, l);
+  }
+  lua_pop(L, 1);  /* remove result from 'luaL_tolstring' */
+  luaL_addsize(b, l + pad);
+}
+
+
+/* add the result of 'l_sprintf' for item 'it' and value 'v' */
+#define addsprintf(b,it,v)  \
+  { char *buff_ = luaL_prepbuffsize(b, (it)->maxitem); \
+    int nb_ = l_sprintf(buff_, (it)->maxitem, (it)->form, v); \
+    lua_assert(cast_uint(nb_) < (it)->maxitem); \
+    luaL_addsize(b, cast_uint(nb_)); }
+
+
+/*
+** Adds to buffer 'b' the result of formatting the values after index
+** 'arg' (the format string) up to index 'top', following the compiled
+** format 'fp'.
+*/
+static void runformat (lua_State *L, luaL_Buffer *b, const FmtProg *fp,
+                       int arg, int top) {
+  const char *strfrmt = lua_tostring(L, arg);
+  const FmtItem *it = fp->item;
+  const FmtItem *end = it + fp->nitems;
+  for (; it < end; it++) {
+    if (it->conv == 0) {  /* literal text? */
+      luaL_addlstring(b, strfrmt + it->off, it->len);
+      continue;
+    }
+    if (++arg > top)
+      luaL_argerror(L, arg, "no value");
+    switch (it->conv) {
+      case 'c': {
+        int c = (int)luaL_checkinteger(L, arg);
+        if (it->form[2] == '\0')  /* no modifiers? */
+          luaL_addchar(b, cast_char(c));
+        else
+          addsprintf(b, it, c);
+        break;
+      }
+      case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+        lua_Integer n = luaL_checkinteger(L, arg);
+        if (!(it->flags & FF_HASH))
+          addint(b, it, n);
+        else
+          addsprintf(b, it, (LUAI_UACINT)n);
+        break;
+      }
+      case 'a': case 'A': {
+        char *buff = luaL_prepbuffsize(b, it->maxitem);
+        int nb = lua_number2strx(L, buff, it->maxitem, it->form,
+                                    luaL_checknumber(L, arg));
+        luaL_addsize(b, cast_uint(nb));
+        break;
+      }
+      case 'p': {
+        const void *p = lua_topointer(L, arg);
+        if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+          FmtItem str = *it;
+          str.form[strlen(str.form) - 1] = 's';  /* format it as a string */
+          addsprintf(b, &str, "(null)");
+        }
+        else
+          addsprintf(b, it, p);
+        break;
+      }
+      case 'q': {
+        addliteral(L, b, arg);
+        break;
+      }
+      case 's': {
+        if (it->form[2] == '\0') {  /* no modifiers? */
+          luaL_tolstring(L, arg, NULL);
+          luaL_addvalue(b);  /* keep entire string */
         }
+        else
+          addpadded(L, b, it, arg);
+        break;
+      }
+      default: {  /* 'e', 'E', 'f', 'g', 'G' */
+        lua_Number n = luaL_checknumber(L, arg);
+        addsprintf(b, it, (LUAI_UACNUMBER)n);
+        break;
+      }
+    }
+  }
+}
+
+
+/* compile the format 'strfrmt' (at index 'arg') and push its program */
+static const FmtProg *newfmt (lua_State *L, int arg,
+                              const char *strfrmt, size_t sfl) {
+  FmtProg count;
+  FmtProg *fp;
+  int valid;
+  size_t size = sizeof(FmtProg);
+  count.item = NULL;
+  valid = compilefmt(&count, strfrmt, sfl);
+  if (valid)
+    size += cast_sizet(count.nitems) * sizeof(FmtItem);
+  fp = (FmtProg *)lua_newuserdatauv(L, size, 1);
+  *fp = notcompiled;
+  if (valid) {
+    fp->valid = 1;
+    fp->item = (FmtItem *)(fp + 1);
+    compilefmt(fp, strfrmt, sfl);
+    lua_assert(fp->nitems == count.nitems);
+  }
+  lua_pushvalue(L, arg);  /* keep the format (and its address) alive */
+  lua_setiuservalue(L, -2, 1);
+  return fp;
+}
+
+
+/*
+** Push the compiled form of the format at index 'arg' and return it,
+** taking it from the cache (upvalue 1) or compiling it. A format seen
+** for the first time is only remembered; then this function pushes
+** nil and returns 'notcompiled'.
+*/
+static const FmtProg *getfmt (lua_State *L, int arg) {
+  FmtCache *fc = (FmtCache *)lua_touserdata(L, lua_upvalueindex(1));
+  size_t sfl;
+  const char *strfrmt = luaL_checklstring(L, arg, &sfl);
+  int first = cast_int((point2uint(strfrmt) >> 4) %
+                       (LUAI_FMTCACHESIZE / FCWAYS)) * FCWAYS;
+  int i, victim = first;
+  for (i = first; i < first + FCWAYS; i++) {
+    if (fc->key[i] == strfrmt && fc->len[i] == sfl) {
+      fc->stamp[i] = ++fc->clock;
+      if (fc->prog[i] != NULL)  /* already compiled? */
+        lua_getiuservalue(L, lua_upvalueindex(1), i + 1);
+      else {  /* second use; compile it */
+        fc->prog[i] = newfmt(L, arg, strfrmt, sfl);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, lua_upvalueindex(1), i + 1);
       }
-      lua_assert(cast_uint(nb) < maxitem);
-      luaL_addsize(&b, cast_uint(nb));
+      return fc->prog[i];
     }
+    if (fc->stamp[i] < fc->stamp[victim])
+      victim = i;
   }
+  /* first use; replace least recently used entry of the set */
+  fc->key[victim] = strfrmt;
+  fc->len[victim] = sfl;
+  fc->prog[victim] = NULL;
+  fc->stamp[victim] = ++fc->clock;
+  lua_pushnil(L);
+  return &notcompiled;
+}
+
+
+/*
+** Create the cache and leave it on the stack, to be the upvalue of the
+** formatting functions.
+*/
+static void createfmtcache (lua_State *L) {
+  FmtCache *fc = (FmtCache *)lua_newuserdatauv(L, sizeof(FmtCache),
+                                                  LUAI_FMTCACHESIZE);
+  memset(fc, 0, sizeof(FmtCache));
+}
+
+
+/* format with the compiled format, if there is one */
+#define doformat(L,b,fp,arg,top) \
+	((fp)->valid ? runformat(L, b, fp, arg, top) \
+	             : addformat(L, b, arg, top))
+
+/* }------------------------------------------------------ */
+
+#else			/* }{ */
+
+typedef struct FmtProg FmtProg;
+
+/* without a cache, only check the format and push a placeholder */
+#define getfmt(L,arg) \
+	(luaL_checkstring(L, arg), lua_pushnil(L), (const FmtProg *)NULL)
+
+#define createfmtcache(L)	lua_pushnil(L)
+
+#define doformat(L,b,fp,arg,top)	((void)(fp), addformat(L, b, arg, top))
+
+#endif			/* } */
+
+
+static int str_format (lua_State *L) {
+  int top = lua_gettop(L);
+  const FmtProg *fp = getfmt(L, 1);
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  doformat(L, &b, fp, 1, top);
   luaL_pushresult(&b);
   return 1;
 }
@@ -1608,15 +3074,16 @@ static void copywithendian (char *dest, const char *src,
 }
 
 
-static int str_pack (lua_State *L) {
-  luaL_Buffer b;
+/*
+** Adds to buffer 'b' the values after index 'arg' (the format string)
+** packed in binary form. The caller must push a mark (nil) to separate
+** the arguments from the buffer's box.
+*/
+static void addpack (lua_State *L, luaL_Buffer *b, int arg) {
   Header h;
-  const char *fmt = luaL_checkstring(L, 1);  /* format string */
-  int arg = 1;  /* current argument to pack */
+  const char *fmt = luaL_checkstring(L, arg);  /* format string */
   size_t totalsize = 0;  /* accumulate total size of result */
   initheader(L, &h);
-  lua_pushnil(L);  /* mark to separate arguments from string buffer */
-  luaL_buffinit(L, &b);
   while (*fmt != '\0') {
     unsigned ntoalign;
     size_t size;
@@ -1625,7 +3092,7 @@ static int str_pack (lua_State *L) {
                      "result too long");
     totalsize += ntoalign + size;
     while (ntoalign-- > 0)
-     luaL_addchar(&b, LUAL_PACKPADBYTE);  /* fill alignment */
+     luaL_addchar(b, LUAL_PACKPADBYTE);  /* fill alignment */
     arg++;
     switch (opt) {
       case Kint: {  /* signed integers */
@@ -1634,7 +3101,7 @@ static int str_pack (lua_State *L) {
           lua_Integer lim = (lua_Integer)1 << ((size * NB) - 1);
           luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
         }
-        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), (n < 0));
+        packint(b, (lua_Unsigned)n, h.islittle, cast_uint(size), (n < 0));
         break;
       }
       case Kuint: {  /* unsigned integers */
@@ -1642,43 +3109,43 @@ static int str_pack (lua_State *L) {
         if (size < SZINT)  /* need overflow check? */
           luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * NB)),
                            arg, "unsigned overflow");
-        packint(&b, (lua_Unsigned)n, h.islittle, cast_uint(size), 0);
+        packint(b, (lua_Unsigned)n, h.islittle, cast_uint(size), 0);
         break;
       }
       case Kfloat: {  /* C float */
         float f = (float)luaL_checknumber(L, arg);  /* get argument */
-        char *buff = luaL_prepbuffsize(&b, sizeof(f));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
         copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
-        luaL_addsize(&b, size);
+        luaL_addsize(b, size);
         break;
       }
       case Knumber: {  /* Lua float */
         lua_Number f = luaL_checknumber(L, arg);  /* get argument */
-        char *buff = luaL_prepbuffsize(&b, sizeof(f));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
         copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
-        luaL_addsize(&b, size);
+        luaL_addsize(b, size);
         break;
       }
       case Kdouble: {  /* C double */
         double f = (double)luaL_checknumber(L, arg);  /* get argument */
-        char *buff = luaL_prepbuffsize(&b, sizeof(f));
+        char *buff = luaL_prepbuffsize(b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
         copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
-        luaL_addsize(&b, size);
+        luaL_addsize(b, size);
         break;
       }
       case Kchar: {  /* fixed-size string */
         size_t len;
         const char *s = luaL_checklstring(L, arg, &len);
         luaL_argcheck(L, len <= size, arg, "string longer than given size");
-        luaL_addlstring(&b, s, len);  /* add string */
+        luaL_addlstring(b, s, len);  /* add string */
         if (len < size) {  /* does it need padding? */
           size_t psize = size - len;  /* pad size */
-          char *buff = luaL_prepbuffsize(&b, psize);
+          char *buff = luaL_prepbuffsize(b, psize);
           memset(buff, LUAL_PACKPADBYTE, psize);
-          luaL_addsize(&b, psize);
+          luaL_addsize(b, psize);
         }
         break;
       }
@@ -1689,8 +3156,8 @@ static int str_pack (lua_State *L) {
                          len < ((lua_Unsigned)1 << (size * NB)),
                          arg, "string length does not fit in given size");
         /* pack length */
-        packint(&b, (lua_Unsigned)len, h.islittle, cast_uint(size), 0);
-        luaL_addlstring(&b, s, len);
+        packint(b, (lua_Unsigned)len, h.islittle, cast_uint(size), 0);
+        luaL_addlstring(b, s, len);
         totalsize += len;
         break;
       }
@@ -1698,17 +3165,25 @@ static int str_pack (lua_State *L) {
         size_t len;
         const char *s = luaL_checklstring(L, arg, &len);
         luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
-        luaL_addlstring(&b, s, len);
-        luaL_addchar(&b, '\0');  /* add zero at the end */
+        luaL_addlstring(b, s, len);
+        luaL_addchar(b, '\0');  /* add zero at the end */
         totalsize += len + 1;
         break;
       }
-      case Kpadding: luaL_addchar(&b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
+      case Kpadding: luaL_addchar(b, LUAL_PACKPADBYTE);  /* FALLTHROUGH */
       case Kpaddalign: case Knop:
         arg--;  /* undo increment */
         break;
     }
   }
+}
+
+
+static int str_pack (lua_State *L) {
+  luaL_Buffer b;
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &b);
+  addpack(L, &b, 1);
   luaL_pushresult(&b);
   return 1;
 }
@@ -1847,17 +3322,557 @@ static int str_unpack (lua_State *L) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+/*
+** A string buffer is a 'luaL_BuffBox': its contents live in the same
+** kind of growable block that a 'luaL_Buffer' uses for its box, so its
+** methods just continue a 'luaL_Buffer' over it (see
+** 'luaL_buffinitbox'). Nothing creates a Lua string until the contents
+** are read, and 'reset' keeps the block for reuse.
+**
+** While such a 'luaL_Buffer' is in use, no Lua code may run: a
+** '__tostring' or '__name' field, or a finalizer called by a collection
+** step, could use this same string buffer and move its block under the
+** 'luaL_Buffer'. So, arguments are converted before the buffer starts,
+** and values that need Lua code ('putf', 'pack') are formatted into a
+** separate buffer, which is appended only after all of them are done.
+*/
+
+#define tobuffbox(L)	((luaL_BuffBox *)luaL_checkudata(L, 1, LUA_BUFFERHANDLE))
+
+
+static int buf_new (lua_State *L) {
+  lua_Integer sz = luaL_optinteger(L, 1, 0);
+  luaL_BuffBox *bb;
+  luaL_argcheck(L, 0 <= sz && (lua_Unsigned)sz < MAX_SIZE, 1,
+                   "out of range");
+  bb = (luaL_BuffBox *)lua_newuserdatauv(L, sizeof(luaL_BuffBox), 0);
+  bb->box = NULL;
+  bb->bsize = bb->n = 0;
+  luaL_setmetatable(L, LUA_BUFFERHANDLE);
+  if (sz > 0) {  /* preallocate? */
+    luaL_Buffer b;
+    luaL_buffinitbox(L, &b, -1);
+    luaL_prepbuffsize(&b, (size_t)sz);
+    luaL_buffsavebox(&b);
+  }
+  return 1;
+}
+
+
+/*
+** Appends the contents of buffer 'b', filled apart, to the string
+** buffer at index 1.
+*/
+static void putbuffer (lua_State *L, luaL_Buffer *b) {
+  luaL_Buffer bb;
+  luaL_buffinitbox(L, &bb, 1);
+  luaL_addlstring(&bb, luaL_buffaddr(b), luaL_bufflen(b));
+  luaL_buffsavebox(&bb);
+}
+
+
+/*
+** Appends all its arguments (strings, numbers, or string buffers)
+*/
+static int buf_put (lua_State *L) {
+  int top = lua_gettop(L);
+  int i;
+  luaL_Buffer b;
+  tobuffbox(L);
+  for (i = 2; i <= top; i++) {  /* convert numbers before starting */
+    if (lua_type(L, i) == LUA_TNUMBER)
+      lua_tolstring(L, i, NULL);  /* may run a collection step */
+  }
+  luaL_buffinitbox(L, &b, 1);
+  for (i = 2; i <= top; i++) {
+    luaL_BuffBox *other;
+    if (lua_type(L, i) == LUA_TSTRING) {
+      size_t l;
+      const char *s = lua_tolstring(L, i, &l);
+      luaL_addlstring(&b, s, l);
+    }
+    else if ((other = (luaL_BuffBox *)luaL_testudata(L, i,
+                                            LUA_BUFFERHANDLE)) != NULL) {
+      if (lua_rawequal(L, i, 1)) {  /* appending buffer to itself? */
+        size_t l = luaL_bufflen(&b);
+        char *p = luaL_prepbuffsize(&b, l);  /* may move the contents */
+        memcpy(p, luaL_buffaddr(&b), l);
+        luaL_addsize(&b, l);
+      }
+      else
+        luaL_addlstring(&b, (const char *)other->box, other->n);
+    }
+    else
+      luaL_typeerror(L, i, "string or string buffer");
+  }
+  luaL_buffsavebox(&b);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_putf (lua_State *L) {
+  int top = lua_gettop(L);
+  luaL_Buffer b;
+  const FmtProg *fp;
+  tobuffbox(L);
+  fp = getfmt(L, 2);
+  luaL_buffinit(L, &b);
+  doformat(L, &b, fp, 2, top);  /* may call '__tostring' */
+  putbuffer(L, &b);
+  lua_settop(L, 1);  /* also closes the box of 'b', if any */
+  return 1;
+}
+
+
+static int buf_pack (lua_State *L) {
+  luaL_Buffer b;
+  tobuffbox(L);
+  lua_pushnil(L);  /* mark to separate arguments from string buffer */
+  luaL_buffinit(L, &b);
+  addpack(L, &b, 2);  /* conversions may run a collection step */
+  putbuffer(L, &b);
+  lua_settop(L, 1);  /* also closes the box of 'b', if any */
+  return 1;
+}
+
+
+/*
+** Removes and returns the first 'n' bytes (default: all of them)
+*/
+static int buf_get (lua_State *L) {
+  luaL_BuffBox *bb = tobuffbox(L);
+  lua_Integer n = luaL_optinteger(L, 2, cast_st2S(bb->n));
+  size_t l = (n <= 0) ? 0 : ((lua_Unsigned)n > bb->n) ? bb->n : (size_t)n;
+  lua_pushlstring(L, (l > 0) ? (const char *)bb->box : "", l);
+  bb->n -= l;
+  if (bb->n > 0)
+    memmove(bb->box, (char *)bb->box + l, bb->n);
+  return 1;
+}
+
+
+static int buf_tostring (lua_State *L) {
+  luaL_BuffBox *bb = tobuffbox(L);
+  lua_pushlstring(L, (bb->n > 0) ? (const char *)bb->box : "", bb->n);
+  return 1;
+}
+
+
+static int buf_len (lua_State *L) {
+  luaL_BuffBox *bb = tobuffbox(L);
+  lua_pushinteger(L, cast_st2S(bb->n));
+  return 1;
+}
+
+
+static int buf_reset (lua_State *L) {
+  tobuffbox(L)->n = 0;  /* keep the block for the next contents */
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_gc (lua_State *L) {
+  luaL_BuffBox *bb = tobuffbox(L);
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  allocf(ud, bb->box, bb->bsize, 0);
+  bb->box = NULL;
+  bb->bsize = bb->n = 0;
+  return 0;
+}
+
+
+static const luaL_Reg bufmeth[] = {
+  {"get", buf_get},
+  {"len", buf_len},
+  {"pack", buf_pack},
+  {"put", buf_put},
+  {"reset", buf_reset},
+  {"tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg bufmetameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__gc", buf_gc},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+/* methods that share the format cache as their upvalue */
+static const luaL_Reg buffmtmeth[] = {
+  {"putf", buf_putf},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable for string buffers, with the format cache (on
+** the top of the stack) as upvalue of its 'putf' method.
+*/
+static void createbuffermeta (lua_State *L) {
+  luaL_newmetatable(L, LUA_BUFFERHANDLE);
+  luaL_setfuncs(L, bufmetameth, 0);
+  luaL_newlibtable(L, bufmeth);
+  luaL_setfuncs(L, bufmeth, 0);
+  lua_pushvalue(L, -3);  /* format cache */
+  luaL_setfuncs(L, buffmtmeth, 1);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** MULTI-NEEDLE SEARCH
+** =======================================================
+*/
+
+/*
+** 'string.needles' compiles a list of literal strings into an
+** Aho-Corasick automaton, so that 'findany' and 'gmatch' look for all
+** of them in one pass over the subject. The automaton is a complete
+** DFA over byte classes: bytes that appear in no needle share class 0,
+** and each other byte has its own class. A state is the offset of its
+** row in 'delta' (state number times 'nclass'), and a transition to a
+** state where some needle ends is stored negated, so the scan loop
+** only tests a sign. In a state with outputs, 'term' gives the needle
+** ending there (the first index among equal needles) and 'dict' the
+** next state with a needle in the failure chain (shorter needles that
+** also end there).
+*/
+
+#define NEEDLESHANDLE	"string.needles"
+
+typedef struct Needles {
+  int nneedles;  /* number of needles */
+  int nstates;  /* number of states */
+  int nclass;  /* number of byte classes (size of a row in 'delta') */
+  size_t maxlen;  /* length of the longest needle */
+  unsigned short cls[UCHAR_MAX + 1];  /* class of each byte */
+  size_t *len;  /* length of each needle (1-based) */
+  int *delta;  /* transitions */
+  int *term;  /* needle ending at each state, or 0 */
+  int *dict;  /* next state with a needle in the failure chain, or 0 */
+} Needles;
+
+
+#define checkneedles(L,i)	((Needles *)luaL_checkudata(L, i, NEEDLESHANDLE))
+
+
+/* first state reporting a needle at state 'st' (a state number) */
+#define firstout(nd,st)	((nd)->term[st] != 0 ? (st) : (nd)->dict[st])
+
+
+/*
+** Build the automaton for the needles in the table at index 'arg',
+** leaving it on the top of the stack.
+*/
+static Needles *newneedles (lua_State *L, int arg) {
+  lua_Integer n = luaL_len(L, arg);
+  lua_Integer i;
+  size_t total = 0;  /* total length of the needles */
+  unsigned short cls[UCHAR_MAX + 1];
+  int nclass = 1;
+  int maxst, nst, k, e;
+  int *fail, *queue;
+  int head = 0, tail = 0;
+  Needles *nd;
+  memset(cls, 0, sizeof(cls));
+  luaL_argcheck(L, n < INT_MAX, arg, "too many needles");
+  for (i = 1; i <= n; i++) {  /* check needles and build classes */
+    size_t l, j;
+    const char *p;
+    lua_geti(L, arg, i);
+    p = lua_tolstring(L, -1, &l);
+    if (l_unlikely(p == NULL || l == 0))
+      luaL_error(L, "invalid needle (%s) at index %I",
+                    (p == NULL) ? luaL_typename(L, -1) : "empty string",
+                    (LUAI_UACINT)i);
+    for (j = 0; j < l; j++) {
+      if (cls[cast_uchar(p[j])] == 0)
+        cls[cast_uchar(p[j])] = cast(unsigned short, nclass++);
+    }
+    if (l_unlikely(total > MAX_SIZE - l))
+      luaL_error(L, "needles too long");
+    total += l;
+    lua_pop(L, 1);
+  }
+  if (l_unlikely(total >= cast_sizet(INT_MAX / nclass)))
+    luaL_error(L, "needles too long");
+  maxst = cast_int(total) + 1;  /* root plus one state per byte, at most */
+  nd = (Needles *)lua_newuserdatauv(L, sizeof(Needles) +
+                     (cast_sizet(n) + 1) * sizeof(size_t) +
+                     cast_sizet(maxst) * (cast_sizet(nclass) + 2) * sizeof(int),
+                     0);
+  nd->nneedles = cast_int(n);
+  nd->nclass = k = nclass;
+  nd->maxlen = 0;
+  memcpy(nd->cls, cls, sizeof(cls));
+  nd->len = cast(size_t *, nd + 1);
+  nd->delta = cast(int *, nd->len + n + 1);
+  nd->term = nd->delta + cast_sizet(maxst) * cast_sizet(k);
+  nd->dict = nd->term + maxst;
+  fail = cast(int *, lua_newuserdatauv(L,
+                         2 * cast_sizet(maxst) * sizeof(int), 0));
+  queue = fail + maxst;
+  for (e = 0; e < k; e++) nd->delta[e] = -1;  /* root has no children yet */
+  nd->term[0] = nd->dict[0] = 0;
+  nst = 1;
+  nd->len[0] = 0;
+  for (i = 1; i <= n; i++) {  /* build the trie */
+    size_t l, j;
+    const char *p;
+    int st = 0;
+    lua_geti(L, arg, i);
+    p = lua_tolstring(L, -1, &l);
+    for (j = 0; j < l; j++) {
+      int *t = &nd->delta[st + cls[cast_uchar(p[j])]];
+      if (*t < 0) {  /* new state? */
+        *t = nst * k;
+        for (e = 0; e < k; e++) nd->delta[*t + e] = -1;
+        nd->term[nst] = nd->dict[nst] = 0;
+        nst++;
+      }
+      st = *t;
+    }
+    if (nd->term[st / k] == 0)  /* first needle with this string? */
+      nd->term[st / k] = cast_int(i);
+    nd->len[i] = l;
+    if (l > nd->maxlen) nd->maxlen = l;
+    lua_pop(L, 1);
+  }
+  nd->nstates = nst;
+  for (e = 0; e < k; e++) {  /* children of the root fail to the root */
+    int u = nd->delta[e];
+    if (u < 0)
+      nd->delta[e] = 0;
+    else {
+      fail[u / k] = 0;
+      queue[tail++] = u / k;
+    }
+  }
+  while (head < tail) {  /* complete the other states in BFS order */
+    int r = queue[head++];
+    int f = fail[r] * k;  /* already complete (it is shallower) */
+    for (e = 0; e < k; e++) {
+      int *t = &nd->delta[r * k + e];
+      if (*t < 0)
+        *t = nd->delta[f + e];
+      else {
+        int u = *t / k;
+        int fu = nd->delta[f + e] / k;
+        fail[u] = fu;
+        nd->dict[u] = firstout(nd, fu);
+        queue[tail++] = u;
+      }
+    }
+  }
+  lua_pop(L, 1);  /* pop 'fail' and 'queue' */
+  for (e = 0; e < nst * k; e++) {  /* mark transitions to outputs */
+    int u = nd->delta[e] / k;
+    if (firstout(nd, u) != 0)
+      nd->delta[e] = -nd->delta[e];
+  }
+  luaL_setmetatable(L, NEEDLESHANDLE);
+  return nd;
+}
+
+
+static int nd_new (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  newneedles(L, 1);
+  return 1;
+}
+
+
+/*
+** Find in 's' the match that starts first (the longest one, among
+** those starting at the same place), beginning at 'init'. That is,
+** the earliest result of 'find(s, needle, init, true)' over all
+** needles. Once a match is found, the scan stops where any match
+** starting before it would have ended.
+*/
+static int nd_findaux (lua_State *L, const Needles *nd,
+                       const char *s, size_t ls, size_t init) {
+  int st = 0;
+  int best = 0;  /* needle of the best match so far */
+  size_t bstart = 0;  /* its start */
+  size_t i;
+  for (i = init; i < ls; i++) {
+    st = nd->delta[st + nd->cls[cast_uchar(s[i])]];
+    if (st < 0) {  /* some needles end here? */
+      int o;
+      st = -st;
+      for (o = firstout(nd, st / nd->nclass); o != 0; o = nd->dict[o]) {
+        int j = nd->term[o];
+        size_t start = i + 1 - nd->len[j];
+        if (best == 0 || start < bstart ||
+            (start == bstart && nd->len[j] > nd->len[best])) {
+          best = j;
+          bstart = start;
+        }
+      }
+    }
+    if (best != 0 && i + 1 - bstart >= nd->maxlen)
+      break;  /* no other match can start before 'bstart' */
+  }
+  if (best == 0) {
+    luaL_pushfail(L);  /* not found */
+    return 1;
+  }
+  lua_pushinteger(L, cast_st2S(bstart) + 1);  /* start */
+  lua_pushinteger(L, cast_st2S(bstart + nd->len[best]));  /* end */
+  lua_pushinteger(L, best);  /* needle index (its "capture") */
+  return 3;
+}
+
+
+/*
+** string.findany(s, needles [, init]), where 'needles' is the result
+** of 'string.needles' or a table of strings
+*/
+static int str_findany (lua_State *L) {
+  size_t ls;
+  const char *s = luaL_checklstring(L, 1, &ls);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  const Needles *nd;
+  if (lua_istable(L, 2))
+    nd = newneedles(L, 2);
+  else
+    nd = checkneedles(L, 2);
+  if (init > ls) {  /* start after string's end? */
+    luaL_pushfail(L);  /* cannot find anything */
+    return 1;
+  }
+  return nd_findaux(L, nd, s, ls, init);
+}
+
+
+/* needles:find(s [, init]) */
+static int nd_find (lua_State *L) {
+  const Needles *nd = checkneedles(L, 1);
+  size_t ls;
+  const char *s = luaL_checklstring(L, 2, &ls);
+  size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  if (init > ls) {  /* start after string's end? */
+    luaL_pushfail(L);  /* cannot find anything */
+    return 1;
+  }
+  return nd_findaux(L, nd, s, ls, init);
+}
+
+
+/* state for 'needles:gmatch' */
+typedef struct NdMatchState {
+  size_t pos;  /* current position */
+  int st;  /* current state */
+  int out;  /* next state with a needle to report at 'pos', or 0 */
+} NdMatchState;
+
+
+static int nd_gmatch_aux (lua_State *L) {
+  size_t ls;
+  const char *s = lua_tolstring(L, lua_upvalueindex(1), &ls);
+  const Needles *nd = (const Needles *)lua_touserdata(L, lua_upvalueindex(2));
+  NdMatchState *gm = (NdMatchState *)lua_touserdata(L, lua_upvalueindex(3));
+  int o = gm->out;
+  int j;
+  while (o == 0 && gm->pos < ls) {
+    int st = nd->delta[gm->st + nd->cls[cast_uchar(s[gm->pos++])]];
+    if (st < 0) {  /* some needles end here? */
+      st = -st;
+      o = firstout(nd, st / nd->nclass);
+    }
+    gm->st = st;
+  }
+  if (o == 0)
+    return 0;  /* no more matches */
+  gm->out = nd->dict[o];
+  j = nd->term[o];
+  lua_pushinteger(L, cast_st2S(gm->pos - nd->len[j]) + 1);  /* start */
+  lua_pushinteger(L, cast_st2S(gm->pos));  /* end */
+  lua_pushinteger(L, j);  /* needle index */
+  return 3;
+}
+
+
+/*
+** needles:gmatch(s [, init]) iterates over all occurrences of all
+** needles, overlapping ones included, in the order of their ends (the
+** longer first for a common end)
+*/
+static int nd_gmatch (lua_State *L) {
+  size_t ls;
+  NdMatchState *gm;
+  size_t init;
+  checkneedles(L, 1);
+  luaL_checklstring(L, 2, &ls);
+  init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  lua_settop(L, 2);
+  lua_rotate(L, 1, 1);  /* string goes first, needles second */
+  gm = (NdMatchState *)lua_newuserdatauv(L, sizeof(NdMatchState), 0);
+  gm->pos = (init > ls) ? ls : init;  /* start after end finds nothing */
+  gm->st = gm->out = 0;
+  lua_pushcclosure(L, nd_gmatch_aux, 3);
+  return 1;
+}
+
+
+static int nd_len (lua_State *L) {
+  lua_pushinteger(L, checkneedles(L, 1)->nneedles);
+  return 1;
+}
+
+
+static const luaL_Reg ndmeth[] = {
+  {"find", nd_find},
+  {"gmatch", nd_gmatch},
+  {NULL, NULL}
+};
+
+
+static const luaL_Reg ndmetameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__len", nd_len},
+  {NULL, NULL}
+};
+
+
+static void createneedlesmeta (lua_State *L) {
+  luaL_newmetatable(L, NEEDLESHANDLE);
+  luaL_setfuncs(L, ndmetameth, 0);
+  luaL_newlibtable(L, ndmeth);
+  luaL_setfuncs(L, ndmeth, 0);
+  lua_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lua_pop(L, 1);  /* pop metatable */
+}
+
+/* }====================================================== */
+
+
 static const luaL_Reg strlib[] = {
+  {"buffer", buf_new},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
-  {"find", str_find},
-  {"format", str_format},
-  {"gmatch", gmatch},
-  {"gsub", str_gsub},
+  {"findany", str_findany},
   {"len", str_len},
   {"lower", str_lower},
-  {"match", str_match},
+  {"needles", nd_new},
   {"rep", str_rep},
   {"reverse", str_reverse},
   {"sub", str_sub},
@@ -1869,6 +3884,23 @@ static const luaL_Reg strlib[] = {
 };
 
 
+/* functions that share the pattern cache as their upvalue */
+static const luaL_Reg patlib[] = {
+  {"find", str_find},
+  {"gmatch", gmatch},
+  {"gsub", str_gsub},
+  {"match", str_match},
+  {NULL, NULL}
+};
+
+
+/* functions that share the format cache as their upvalue */
+static const luaL_Reg fmtlib[] = {
+  {"format", str_format},
+  {NULL, NULL}
+};
+
+
 static void createmetatable (lua_State *L) {
   /* table to be metatable for strings */
   luaL_newlibtable(L, stringmetamethods);
@@ -1888,7 +3920,13 @@ static void createmetatable (lua_State *L) {
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
   luaL_newlib(L, strlib);
+  createpatcache(L);
+  luaL_setfuncs(L, patlib, 1);
+  createfmtcache(L);
+  createbuffermeta(L);
+  luaL_setfuncs(L, fmtlib, 1);
   createmetatable(L);
+  createneedlesmeta(L);
   return 1;
 }
 
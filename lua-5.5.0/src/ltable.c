@@ -21,6 +21,8 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** Optionally (see LUA_USE_SWISSHASH), the hash part can use instead
+** open addressing with groups of control bytes.
 */
 
 #include <math.h>
@@ -40,6 +42,17 @@
 #include "lvm.h"
 
 
+/*
+** Define LUA_USE_SWISSHASH as 1 to use an open-addressing hash part
+** in the style of SwissTable: a search compares a whole group of
+** one-byte tags at once and visits only the nodes whose tags match,
+** instead of following a collision chain through the node array.
+*/
+#if !defined(LUA_USE_SWISSHASH)
+#define LUA_USE_SWISSHASH	0
+#endif
+
+
 /*
 ** Only hash parts with at least 2^LIMFORLAST have a 'lastfree' field
 ** that optimizes finding a free slot. That field is stored just before
@@ -56,12 +69,82 @@ typedef struct { Node *dummy; Node follows_pNode; } Limbox_aux;
 
 typedef union {
   Node *lastfree;
+  unsigned growthleft;
   char padding[offsetof(Limbox_aux, follows_pNode)];
 } Limbox;
 
 #define haslastfree(t)     ((t)->lsizenode >= LIMFORLAST)
 #define getlastfree(t)     ((cast(Limbox *, (t)->node) - 1)->lastfree)
 
+/*
+** With open addressing, that field keeps instead how many free nodes
+** can still receive new keys before the table must grow. (Smaller
+** tables can use all their nodes.)
+*/
+#define getgrowthleft(t)   ((cast(Limbox *, (t)->node) - 1)->growthleft)
+
+
+/*
+** Hash parts with at least 2^LUAI_INCRHASHBITS nodes are rehashed
+** incrementally: when such a table grows, its old hash part is kept
+** alongside the new one, and each new key moves LUAI_REHASHSTEP nodes
+** of the old part into the new one (see 'resize'). Define
+** LUAI_INCRHASHBITS as a value larger than MAXHBITS to always rehash
+** in one go. (It cannot be smaller than LIMFORLAST.)
+*/
+#if !defined(LUAI_INCRHASHBITS)
+#define LUAI_INCRHASHBITS	16
+#endif
+
+#if !defined(LUAI_REHASHSTEP)
+#define LUAI_REHASHSTEP		32
+#endif
+
+
+/*
+** Hash parts large enough to be rehashed incrementally also have, just
+** before their 'Limbox', a 'Rehash' box that keeps the old hash part
+** while it is being moved (while the table has its BITREHASH flag).
+*/
+typedef struct {
+  Node *node;  /* old hash part */
+  unsigned next;  /* its next node to be moved */
+  lu_byte lsizenode;  /* log2 of its size */
+} Rehash;
+
+typedef struct { Rehash dummy; Node follows_pNode; } Rehash_aux;
+
+typedef union {
+  Rehash r;
+  char padding[offsetof(Rehash_aux, follows_pNode)];
+} Rehashbox;
+
+#define hasrehash(t)       ((t)->lsizenode >= LUAI_INCRHASHBITS)
+#define getrehash(t)  \
+	(&(cast(Rehashbox *, cast(Limbox *, (t)->node) - 1) - 1)->r)
+
+/* size of the boxes before the nodes of a hash part of size 2^lsize */
+#define boxsize(lsize)  \
+	((lsize) < LIMFORLAST ? 0 :  \
+	 (lsize) < LUAI_INCRHASHBITS ? sizeof(Limbox) :  \
+	                               sizeof(Limbox) + sizeof(Rehashbox))
+
+
+/*
+** Makes 'ot' a table whose hash part is the old hash part of 't', so
+** that the usual functions can search or traverse it. ('ot' has no
+** array part and no flags, and it is not a real object.)
+*/
+static void oldhashpart (Table *t, Table *ot) {
+  Rehash *r = getrehash(t);
+  lua_assert(isrehashing(t));
+  ot->flags = 0;
+  ot->node = r->node;
+  ot->lsizenode = r->lsizenode;
+  ot->asize = 0;
+  ot->array = NULL;
+}
+
 
 /*
 ** MAXABITS is the largest integer such that 2^MAXABITS fits in an
@@ -119,6 +202,104 @@ typedef union {
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
+#if LUA_USE_SWISSHASH
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+/* size of a group of control bytes and number of bits per byte in a mask */
+#define GROUPSIZE	16
+#define MASKBPB		1
+
+typedef unsigned int GroupMask;
+
+/* mask with one bit set for each byte equal to 'b' in group 'c' */
+#define matchbyte(c,b)	cast_uint(_mm_movemask_epi8(_mm_cmpeq_epi8(  \
+	_mm_loadu_si128(cast(const __m128i *, (c))), _mm_set1_epi8(cast_char(b)))))
+
+#else  /* portable SWAR version, using a 'size_t' as the group */
+
+#define GROUPSIZE	sizeof(GroupMask)
+#define MASKBPB		8
+
+typedef size_t GroupMask;
+
+#define LOWBITS		(~cast(GroupMask, 0) / 0xFF)  /* 0x0101...01 */
+#define HIGHBITS	(LOWBITS << 7)  /* 0x8080...80 */
+
+static GroupMask loadgroup (const lu_byte *c) {
+  GroupMask g;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(&g, c, sizeof(g));
+#else
+  int i;
+  g = 0;
+  for (i = cast_int(GROUPSIZE) - 1; i >= 0; i--)  /* little-endian order */
+    g = (g << 8) | c[i];
+#endif
+  return g;
+}
+
+/*
+** Mask with the high bit set for each byte equal to 'b' in group 'c'.
+** It can give false positives (only for bytes above a true match), so
+** callers must check the nodes anyway.
+*/
+static GroupMask matchbyte (const lu_byte *c, lu_byte b) {
+  GroupMask x = loadgroup(c) ^ (LOWBITS * b);
+  return (x - LOWBITS) & ~x & HIGHBITS;
+}
+
+#endif
+
+
+/* index in a group of the first byte in a non-zero mask */
+#if defined(__GNUC__)
+#define firstmatch(m)  \
+	(cast_uint(__builtin_ctzll(cast(unsigned long long, m))) / MASKBPB)
+#else
+static unsigned firstmatch (GroupMask m) {
+  unsigned i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i / MASKBPB;
+}
+#endif
+
+
+/*
+** Each node has a control byte: CTRLFREE for a node that has not
+** received a key since the last rehash, or 0x80 plus the top 7 bits of
+** the hash of its key. Nodes whose values are removed keep their keys
+** (which the collector may turn into dead keys) and their control
+** bytes until the next rehash or until 'getfreepos' reuses the node,
+** as in the chained version, so there are no tombstones and
+** 'luaH_next' still finds removed keys.
+** The control bytes follow the node array, in the same block. They are
+** followed by GROUPSIZE bytes that replicate the first ones, so that a
+** group starting at any position can be read with a single load.
+*/
+#define CTRLFREE	0
+#define ctrlbyte(h)	cast_byte(0x80u | ((h) >> 25))
+#define getctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+#define ctrlsize(size)	(cast_sizet(size) + GROUPSIZE)
+
+/* maximum number of keys in a hash part with 'size' (>= 8) nodes */
+#define maxload(size)	((size) - ((size) >> 3))
+
+/* hash part for tables with empty hash parts, with its control bytes */
+static const struct {
+  Node n;
+  lu_byte ctrl[1 + GROUPSIZE];  /* all free */
+} dummy_ = {
+  {{{NULL}, LUA_VEMPTY, LUA_TDEADKEY, 0, {NULL}}},
+  {CTRLFREE}
+};
+
+#define dummynode		(&dummy_.n)
+
+#else
+
 #define dummynode		(&dummynode_)
 
 /*
@@ -132,10 +313,13 @@ static const Node dummynode_ = {
    LUA_TDEADKEY, 0, {NULL}}  /* key type, next, and key value */
 };
 
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
 
+#if !LUA_USE_SWISSHASH
 /*
 ** Hash for integers. To allow a good hash, use the remainder operator
 ** ('%'). If integer fits as a non-negative int, compute an int
@@ -149,6 +333,7 @@ static Node *hashint (const Table *t, lua_Integer i) {
   else
     return hashmod(t, ui);
 }
+#endif
 
 
 /*
@@ -181,6 +366,8 @@ static unsigned l_hashfloat (lua_Number n) {
 #endif
 
 
+#if !LUA_USE_SWISSHASH
+
 /*
 ** returns the 'main' position of an element in a table (that is,
 ** the index of its hash value).
@@ -229,6 +416,131 @@ l_sinline Node *mainpositionfromnode (const Table *t, Node *nd) {
   return mainpositionTV(t, &key);
 }
 
+#else
+
+/*
+** Open addressing uses all bits of a hash: the low ones select where
+** a search starts and the high ones go to the control bytes. So, all
+** hashes go through a final mix.
+*/
+l_sinline unsigned mixhash (unsigned h) {
+  h ^= h >> 16;
+  h *= 0x45d9f3bu;
+  h ^= h >> 16;
+  return h;
+}
+
+
+static unsigned inthash (lua_Integer i) {
+  lua_Unsigned ui = l_castS2U(i);
+  return mixhash(cast_uint(ui ^ (ui >> (l_numbits(lua_Unsigned) / 2))));
+}
+
+
+/*
+** Returns the hash of a key (the analog of 'mainpositionTV').
+*/
+static unsigned hashvalue (const TValue *key) {
+  switch (ttypetag(key)) {
+    case LUA_VNUMINT:
+      return inthash(ivalue(key));
+    case LUA_VNUMFLT:
+      return mixhash(l_hashfloat(fltvalue(key)));
+    case LUA_VSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_VLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_VFALSE:
+      return mixhash(0);
+    case LUA_VTRUE:
+      return mixhash(1);
+    case LUA_VLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_VLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/*
+** Search for a key with hash 'h' in the hash part of 't'; 'eq' is an
+** expression telling whether node 'n' holds that key. Groups of control
+** bytes are probed at positions p, p + G, p + 3G, p + 6G, ... (G times
+** the triangular numbers), modulo the size of the hash part. As that
+** size is a power of 2, the first max(1, size/G) groups cover all the
+** nodes. A group with a free node also ends the search, as the key
+** would have been inserted there.
+*/
+#define searchnode(t,h,eq) {  \
+  unsigned mask_ = cast_uint(sizenode(t)) - 1u;  \
+  const lu_byte *ctrl_ = getctrl(t);  \
+  lu_byte c_ = ctrlbyte(h);  \
+  unsigned p_ = (h) & mask_;  \
+  unsigned step_ = 0;  \
+  { Node *n = gnode(t, p_);  /* try the home node before the group */  \
+    if (eq) return gval(n); }  \
+  for (;;) {  \
+    GroupMask m_;  \
+    for (m_ = matchbyte(ctrl_ + p_, c_); m_ != 0; m_ &= m_ - 1) {  \
+      Node *n = gnode(t, (p_ + firstmatch(m_)) & mask_);  \
+      if (eq) return gval(n);  \
+    }  \
+    if (matchbyte(ctrl_ + p_, CTRLFREE) != 0 ||  \
+        (step_ += GROUPSIZE) > mask_)  \
+      return &absentkey;  \
+    p_ = (p_ + step_) & mask_;  \
+  } }
+
+
+/*
+** Claims a node for a key with hash 'h', following the same probe
+** sequence of 'searchnode'. A removed entry with the same control byte
+** met along the way is reused; besides saving space, that keeps a new
+** key ahead of any dead key equal to it (an object collected while in
+** the table whose address was recycled), so that 'luaH_next' does not
+** find the dead key first. Otherwise, claims the first free node.
+** Returns NULL if the table cannot take another key.
+*/
+static Node *getfreepos (Table *t, unsigned h) {
+  unsigned size = cast_uint(sizenode(t));
+  lu_byte *ctrl = getctrl(t);
+  lu_byte c = ctrlbyte(h);
+  unsigned p = h & (size - 1u);
+  unsigned step = 0;
+  unsigned i, j;
+  if (isdummy(t))
+    return NULL;
+  for (;;) {
+    GroupMask m;
+    for (m = matchbyte(ctrl + p, c); m != 0; m &= m - 1) {
+      i = (p + firstmatch(m)) & (size - 1u);
+      if (isempty(gval(gnode(t, i))))  /* a removed entry? */
+        goto found;  /* reuse it */
+    }
+    m = matchbyte(ctrl + p, CTRLFREE);
+    if (m != 0) {
+      if (haslastfree(t)) {
+        if (getgrowthleft(t) == 0)
+          return NULL;  /* table reached its maximum load */
+        getgrowthleft(t)--;
+      }
+      i = (p + firstmatch(m)) & (size - 1u);
+      goto found;
+    }
+    if ((step += GROUPSIZE) >= size)
+      return NULL;  /* no free node */
+    p = (p + step) & (size - 1u);
+  }
+ found:  /* (a SWAR match may be a false positive, so always set 'c') */
+  for (j = i; j < ctrlsize(size); j += size)  /* set byte and replicas */
+    ctrl[j] = c;
+  return gnode(t, i);
+}
+
+#endif
+
 
 /*
 ** Check whether key 'k1' is equal to the key in node 'n2'. This
@@ -289,6 +601,7 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 ** See explanation about 'deadok' in function 'equalkey'.
 */
 static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+#if !LUA_USE_SWISSHASH
   Node *n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
@@ -300,6 +613,36 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
       n += nx;
     }
   }
+#else
+  unsigned h = hashvalue(key);
+  searchnode(t, h, equalkey(key, n, deadok));
+#endif
+}
+
+
+/*
+** During an incremental rehash, a key absent from the hash part of a
+** table may still be in its old hash part. Searches never move entries
+** between the two parts (only new keys do that; see 'luaH_newkey'), so
+** that a slot returned by a search remains valid as usual. An entry
+** removed from the old part counts as absent: if its key is set again,
+** it goes to the new part.
+*/
+static const TValue *getold (Table *t, const TValue *key) {
+  Table ot;
+  const TValue *slot;
+  oldhashpart(t, &ot);
+  slot = getgeneric(&ot, key, 0);
+  return isempty(slot) ? &absentkey : slot;
+}
+
+
+/* 'getgeneric' for the whole table, including its old hash part */
+static const TValue *Hgetgeneric (Table *t, const TValue *key) {
+  const TValue *slot = getgeneric(t, key, 0);
+  if (l_unlikely(isabstkey(slot)) && isrehashing(t))
+    slot = getold(t, key);
+  return slot;
 }
 
 
@@ -337,7 +680,8 @@ static unsigned keyinarray (Table *t, const TValue *key) {
 
 /*
 ** returns the index of a 'key' for table traversals. First goes all
-** elements in the array part, then elements in the hash part. The
+** elements in the array part, then elements in the hash part, then,
+** during an incremental rehash, elements in the old hash part. The
 ** beginning of a traversal is signaled by 0.
 */
 static unsigned findindex (lua_State *L, Table *t, TValue *key,
@@ -349,23 +693,46 @@ static unsigned findindex (lua_State *L, Table *t, TValue *key,
     return i;  /* yes; that's the index */
   else {
     const TValue *n = getgeneric(t, key, 1);
-    if (l_unlikely(isabstkey(n)))
-      luaG_runerror(L, "invalid key to 'next'");  /* key not found */
-    i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
-    /* hash elements are numbered after array ones */
-    return (i + 1) + asize;
+    if (!isabstkey(n)) {
+      i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash */
+      /* hash elements are numbered after array ones */
+      return (i + 1) + asize;
+    }
+    else if (isrehashing(t)) {  /* maybe in the old hash part */
+      Table ot;
+      oldhashpart(t, &ot);
+      n = getgeneric(&ot, key, 1);
+      if (!isabstkey(n)) {
+        i = cast_uint(nodefromval(n) - gnode(&ot, 0));
+        /* old hash elements are numbered after the new ones */
+        return (i + 1) + asize + sizenode(t);
+      }
+    }
+    luaG_runerror(L, "invalid key to 'next'");  /* key not found */
   }
 }
 
 
-int luaH_next (lua_State *L, Table *t, StkId key) {
+/*
+** Traversal by position: '*pos' is the index (in the order used by
+** 'findindex') of the first entry not yet visited; 0 starts a new
+** traversal. Puts the next non-empty entry in 'key' and 'key + 1' and
+** moves '*pos' past it. During an incremental rehash, the traversal
+** goes through both hash parts, without moving any entry, so that the
+** first traversal of a table does not pay for the whole move. (Entries
+** move only with new keys, which are not allowed during a traversal.)
+** A position beyond the end of the table (which may have shrunk) just
+** ends the traversal.
+*/
+int luaH_nextat (lua_State *L, Table *t, unsigned *pos, StkId key) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
+  unsigned int i = *pos;
   for (; i < asize; i++) {  /* try first array part */
     lu_byte tag = *getArrTag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       setivalue(s2v(key), cast_int(i) + 1);
       farr2val(t, i, tag, s2v(key + 1));
+      *pos = i + 1;
       return 1;
     }
   }
@@ -374,19 +741,80 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
       Node *n = gnode(t, i);
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
+      *pos = (i + 1) + asize;
       return 1;
     }
   }
+  if (l_unlikely(isrehashing(t))) {  /* old hash part still there? */
+    unsigned int hsize = sizenode(t);
+    Table ot;
+    oldhashpart(t, &ot);
+    for (i -= hsize; i < sizenode(&ot); i++) {
+      Node *n = gnode(&ot, i);
+      if (!isempty(gval(n))) {  /* a non-empty entry (not moved yet)? */
+        getnodekey(L, s2v(key), n);
+        setobj2s(L, key + 1, gval(n));
+        *pos = (i + 1) + asize + hsize;
+        return 1;
+      }
+    }
+    *pos = asize + hsize + sizenode(&ot);
+    return 0;  /* no more elements */
+  }
+  *pos = asize + sizenode(t);
   return 0;  /* no more elements */
 }
 
 
-/* Extra space in Node array if it has a lastfree entry */
-#define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
+int luaH_next (lua_State *L, Table *t, StkId key) {
+  unsigned int pos;
+  pos = findindex(L, t, s2v(key), t->asize);  /* find original key */
+  return luaH_nextat(L, t, &pos, key);
+}
+
+
+/*
+** Check whether 'pos' is what 'findindex' would return for 'key', that
+** is, whether 'key' is the key of the entry just before position 'pos'.
+** (Positions in the old hash part of a table being rehashed are not
+** checked; the same key may be in both hash parts.)
+*/
+static int keyatpos (Table *t, unsigned int pos, const TValue *key) {
+  unsigned int asize = t->asize;
+  if (pos == 0 || ttisnil(key))
+    return 0;
+  else if (pos <= asize)  /* array part? */
+    return (ttisinteger(key) && l_castS2U(ivalue(key)) == pos);
+  else {
+    pos -= asize + 1;  /* index in the hash part */
+    return (pos < sizenode(t) && keyinarray(t, key) == 0 &&
+            equalkey(key, gnode(t, pos), 1));
+  }
+}
+
+
+/*
+** 'luaH_next' with a hint: '*pos' is usually the position left by the
+** previous step of the same traversal (see 'luaH_nextat'), and then
+** there is no need to find 'key' again. Any other hint is just ignored.
+*/
+int luaH_nexthint (lua_State *L, Table *t, unsigned *pos, StkId key) {
+  if (!keyatpos(t, *pos, s2v(key)))
+    *pos = findindex(L, t, s2v(key), t->asize);  /* find original key */
+  return luaH_nextat(L, t, pos, key);
+}
+
+
+/* Extra space in Node array if it has a lastfree entry (and a rehash box) */
+#define extraLastfree(t)	boxsize((t)->lsizenode)
 
 /* 'node' size in bytes */
 static size_t sizehash (Table *t) {
-  return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
+  size_t size = cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
+#if LUA_USE_SWISSHASH
+  size += ctrlsize(sizenode(t));  /* control bytes */
+#endif
+  return size;
 }
 
 
@@ -516,7 +944,8 @@ static void numusearray (const Table *t, Counters *ct) {
 /*
 ** Count keys in hash part of table 't'. As this only happens during
 ** a rehash, all nodes have been used. A node can have a nil value only
-** if it was deleted after being created.
+** if it was deleted after being created. (With open addressing, a
+** table is rehashed before its nodes run out, so some may be free.)
 */
 static void numusehash (const Table *t, Counters *ct) {
   unsigned i = sizenode(t);
@@ -524,8 +953,13 @@ static void numusehash (const Table *t, Counters *ct) {
   while (i--) {
     Node *n = &t->node[i];
     if (isempty(gval(n))) {
+#if !LUA_USE_SWISSHASH
       lua_assert(!keyisnil(n));  /* entry was deleted; key cannot be nil */
       ct->deleted = 1;
+#else
+      if (!keyisnil(n))  /* entry was deleted? (else node is still free) */
+        ct->deleted = 1;
+#endif
     }
     else {
       total++;
@@ -592,6 +1026,29 @@ static Value *resizearray (lua_State *L , Table *t,
 }
 
 
+/*
+** Makes all nodes of the (non-dummy) hash part of 't' free.
+*/
+static void inithash (Table *t) {
+  unsigned size = sizenode(t);
+  unsigned i;
+#if !LUA_USE_SWISSHASH
+  if (haslastfree(t))
+    getlastfree(t) = gnode(t, size);  /* all positions are free */
+#else
+  memset(gnode(t, size), CTRLFREE, ctrlsize(size));
+  if (extraLastfree(t) != 0)
+    getgrowthleft(t) = maxload(size);
+#endif
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    gnext(n) = 0;
+    setnilkey(n);
+    setempty(gval(n));
+  }
+}
+
+
 /*
 ** Creates an array for the hash part of a table with the given
 ** size, or reuses the dummy node if size is zero.
@@ -606,27 +1063,34 @@ static void setnodevector (lua_State *L, Table *t, unsigned size) {
     setdummy(t);  /* signal that it is using dummy node */
   }
   else {
-    int i;
     int lsize = luaO_ceillog2(size);
+#if LUA_USE_SWISSHASH
+    if (lsize >= LIMFORLAST && maxload(twoto(lsize)) < size)
+      lsize++;  /* keep load factor below its maximum */
+#endif
     if (lsize > MAXHBITS || (1 << lsize) > MAXHSIZE)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
+#if !LUA_USE_SWISSHASH
     if (lsize < LIMFORLAST)  /* no 'lastfree' field? */
       t->node = luaM_newvector(L, size, Node);
     else {
-      size_t bsize = size * sizeof(Node) + sizeof(Limbox);
+      size_t box = boxsize(lsize);
+      size_t bsize = size * sizeof(Node) + box;
       char *node = luaM_newblock(L, bsize);
-      t->node = cast(Node *, node + sizeof(Limbox));
-      getlastfree(t) = gnode(t, size);  /* all positions are free */
+      t->node = cast(Node *, node + box);
     }
+#else
+    {  /* one block with boxes (if needed), nodes, and control bytes */
+      size_t box = boxsize(lsize);
+      size_t bsize = box + size * sizeof(Node) + ctrlsize(size);
+      char *node = luaM_newblock(L, bsize);
+      t->node = cast(Node *, node + box);
+    }
+#endif
     t->lsizenode = cast_byte(lsize);
     setnodummy(t);
-    for (i = 0; i < cast_int(size); i++) {
-      Node *n = gnode(t, i);
-      gnext(n) = 0;
-      setnilkey(n);
-      setempty(gval(n));
-    }
+    inithash(t);
   }
 }
 
@@ -650,22 +1114,26 @@ static void reinserthash (lua_State *L, Table *ot, Table *t) {
 }
 
 
+/* flags that go with a hash part */
+#define HASHBITS	(BITDUMMY | BITREHASH)
+
+
 /*
 ** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
-** dummy bit must be exchanged: The 'isrealasize' is not related
-** to the hash part, and the metamethod bits do not change during
-** a resize, so the "real" table can keep their values.)
+** dummy and the rehash bits must be exchanged: The 'isrealasize' is
+** not related to the hash part, and the metamethod bits do not change
+** during a resize, so the "real" table can keep their values.)
 */
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
-  int bitdummy1 = t1->flags & BITDUMMY;
+  int bits1 = t1->flags & HASHBITS;
   t1->lsizenode = t2->lsizenode;
   t1->node = t2->node;
-  t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
+  t1->flags = cast_byte((t1->flags & ~HASHBITS) | (t2->flags & HASHBITS));
   t2->lsizenode = lsizenode;
   t2->node = node;
-  t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
+  t2->flags = cast_byte((t2->flags & ~HASHBITS) | bits1);
 }
 
 
@@ -712,17 +1180,30 @@ static void clearNewSlice (Table *t, unsigned oldasize, unsigned newasize) {
 ** Note that if the new size for the array part ('newasize') is equal to
 ** the old one ('oldasize'), this function will do nothing with that
 ** part.
+** If 'incr' is true, a large hash part is rehashed incrementally: the
+** old hash part is kept in the new one's rehash box, to be moved by
+** later insertions (see 'rehashstep'). This is done only when the
+** array part does not grow, as otherwise some keys from the old hash
+** part would have to go now to the array part. The new hash part gets
+** room for the keys inserted until the move is complete. A table
+** already in an incremental rehash is rehashed in one go, with its
+** two hash parts.
 */
-void luaH_resize (lua_State *L, Table *t, unsigned newasize,
-                                          unsigned nhsize) {
+static void resize (lua_State *L, Table *t, unsigned newasize,
+                                  unsigned nhsize, int incr) {
   Table newt;  /* to keep the new hash part */
   unsigned oldasize = t->asize;
   Value *newarray;
   if (newasize > MAXASIZE)
     luaG_runerror(L, "table overflow");
+  incr = incr && newasize <= oldasize && !isrehashing(t) &&
+         !isdummy(t) && hasrehash(t);
+  if (incr)  /* room for keys inserted while rehashing */
+    nhsize += sizenode(t) / LUAI_REHASHSTEP + 1;
   /* create new hash part with appropriate size into 'newt' */
   newt.flags = 0;
   setnodevector(L, &newt, nhsize);
+  incr = incr && hasrehash(&newt);
   if (newasize < oldasize) {  /* will array shrink? */
     /* re-insert into the new hash the elements from vanishing slice */
     exchangehashpart(t, &newt);  /* pretend table has new hash */
@@ -739,17 +1220,42 @@ void luaH_resize (lua_State *L, Table *t, unsigned newasize,
   exchangehashpart(t, &newt);  /* 't' has the new hash ('newt' has the old) */
   t->array = newarray;  /* set new array part */
   t->asize = newasize;
-  if (newarray != NULL)
+  /* keep the hint moved with the array, if still valid (see 'luaH_getn') */
+  if (newarray != NULL && (oldasize == 0 || *lenhint(t) > newasize))
     *lenhint(t) = newasize / 2u;  /* set an initial hint */
   clearNewSlice(t, oldasize, newasize);
+  if (incr) {  /* keep old hash part to be moved later */
+    Rehash *r = getrehash(t);
+    r->node = newt.node;
+    r->lsizenode = newt.lsizenode;
+    r->next = 0;
+    t->flags |= BITREHASH;
+    return;
+  }
   /* re-insert elements from old hash part into new parts */
   reinserthash(L, &newt, t);  /* 'newt' now has the old hash */
+  if (isrehashing(&newt)) {  /* was it in an incremental rehash? */
+    Table ot;
+    oldhashpart(&newt, &ot);
+    reinserthash(L, &ot, t);  /* re-insert also its old part */
+    freehash(L, &ot);
+  }
   freehash(L, &newt);  /* free old hash part */
 }
 
 
+void luaH_resize (lua_State *L, Table *t, unsigned newasize,
+                                          unsigned nhsize) {
+  resize(L, t, newasize, nhsize, 0);
+}
+
+
 void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize) {
   unsigned nsize = allocsizenode(t);
+#if LUA_USE_SWISSHASH
+  if (nsize >= twoto(LIMFORLAST))
+    nsize = maxload(nsize);  /* keep the same size */
+#endif
   luaH_resize(L, t, nasize, nsize);
 }
 
@@ -772,6 +1278,11 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
   if (ttisinteger(ek))
     countint(ivalue(ek), &ct);  /* extra key may go to array */
   numusehash(t, &ct);  /* count keys in hash part */
+  if (isrehashing(t)) {  /* keys still in the old hash part? */
+    Table ot;
+    oldhashpart(t, &ot);
+    numusehash(&ot, &ct);  /* count them too */
+  }
   if (ct.na == 0) {
     /* no new keys to enter array part; keep it with the same size */
     asize = t->asize;
@@ -788,9 +1299,46 @@ static void rehash (lua_State *L, Table *t, const TValue *ek) {
     nsize += nsize >> 2;
   }
   /* resize the table to new computed sizes */
-  luaH_resize(L, t, asize, nsize);
+  resize(L, t, asize, nsize, 1);
 }
 
+
+/*
+** Moves into the hash part of 't' the entries in the next 'n' nodes of
+** its old hash part, and frees the old part once it has been entirely
+** moved. (Moved entries are removed from the old part.) Returns 0 if
+** the hash part cannot take all those entries; then the caller should
+** rehash the table, which also re-inserts the remaining entries of the
+** old part.
+*/
+static int rehashstep (lua_State *L, Table *t, unsigned n) {
+  Rehash *r = getrehash(t);
+  Table ot;
+  unsigned size;
+  oldhashpart(t, &ot);
+  size = sizenode(&ot);
+  if (n > size - r->next)
+    n = size - r->next;
+  for (; n > 0; n--, r->next++) {
+    Node *old = gnode(&ot, r->next);
+    if (!isempty(gval(old))) {
+      /* doesn't need barrier/invalidate cache, as entry was
+         already present in the table */
+      TValue k;
+      getnodekey(L, &k, old);
+      if (!insertkey(t, &k, gval(old)))
+        return 0;  /* no space */
+      setempty(gval(old));
+    }
+  }
+  if (r->next == size) {  /* old part entirely moved? */
+    t->flags &= cast_byte(~BITREHASH);
+    freehash(L, &ot);
+  }
+  return 1;
+}
+
+
 /*
 ** }=============================================================
 */
@@ -808,24 +1356,233 @@ Table *luaH_new (lua_State *L) {
 }
 
 
+/*
+** Gives 't' a copy of the (non-dummy) hash part of 'src', with its
+** boxes and, with open addressing, its control bytes, as one block of
+** memory. Chains are kept as offsets between nodes ('gnext'), so they
+** are still valid in the copy; only 'lastfree' needs to be rebased.
+*/
+static void copyhash (lua_State *L, Table *t, Table *src) {
+  size_t box = extraLastfree(src);
+  size_t size = sizehash(src);
+  char *node = luaM_newblock(L, size);
+  memcpy(node, cast_charp(src->node) - box, size);
+  t->node = cast(Node *, node + box);
+  t->lsizenode = src->lsizenode;
+  setnodummy(t);
+#if !LUA_USE_SWISSHASH
+  if (haslastfree(t))
+    getlastfree(t) = t->node + (getlastfree(src) - src->node);
+#endif
+}
+
+
+/*
+** Makes the new (empty) table 't' a copy of 'src' with the same sizes.
+** The array part and the hash part are copied as blocks of memory.
+** During an incremental rehash of 'src', its old hash part is copied
+** too, and the copy continues that rehash where 'src' is. (Completing
+** the rehash here would also move entries under a traversal of 'src'.)
+** 't' is new (white), so it needs no barrier. The metatable is not
+** copied.
+*/
+void luaH_copy (lua_State *L, Table *t, Table *src) {
+  lua_assert(t->asize == 0 && isdummy(t));
+  if (src->asize > 0) {
+    size_t size = concretesize(src->asize);
+    Value *np = cast(Value *, luaM_newblock(L, size));
+    memcpy(np, src->array - src->asize, size);
+    t->array = np + src->asize;  /* shift pointer to end of value segment */
+    t->asize = src->asize;
+  }
+  if (!isdummy(src))
+    copyhash(L, t, src);
+  if (isrehashing(src)) {  /* copy also the old hash part */
+    Table ot, oc;
+    oldhashpart(src, &ot);
+    oc.flags = 0;
+    copyhash(L, &oc, &ot);
+    getrehash(t)->node = oc.node;  /* other fields came with the box */
+    t->flags |= BITREHASH;  /* only now the box is valid */
+  }
+}
+
+
+/*
+** Removes all entries from table 't', keeping the memory of its array
+** and hash parts for new entries. (An old hash part being rehashed has
+** nothing that must be kept, so it is freed.) Only references are
+** removed, so no barrier is needed.
+*/
+void luaH_clear (lua_State *L, Table *t) {
+  if (isrehashing(t)) {
+    Table ot;
+    oldhashpart(t, &ot);
+    t->flags &= cast_byte(~BITREHASH);
+    freehash(L, &ot);
+  }
+  if (t->asize > 0) {
+    memset(getArrTag(t, 0), LUA_VEMPTY, t->asize);
+    *lenhint(t) = 0;
+  }
+  if (!isdummy(t))
+    inithash(t);
+}
+
+
 lu_mem luaH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
   if (!isdummy(t))
     sz += sizehash(t);
+  if (isrehashing(t)) {
+    Table ot;
+    oldhashpart(t, &ot);
+    sz += sizehash(&ot);
+  }
   return sz;
 }
 
 
+
+/*
+** {=============================================================
+** Statistics (see 'lua_tablestats')
+** ==============================================================
+*/
+
+/*
+** Length of the search for the key in node 'n' of the hash part of 't':
+** the number of nodes visited from its main position in the chained
+** version, or the number of groups probed in open addressing. '*athome'
+** tells whether the key is in its main position.
+*/
+#if !LUA_USE_SWISSHASH
+
+static unsigned keychain (Table *t, Node *n, int *athome) {
+  Node *mp = mainpositionfromnode(t, n);
+  unsigned chain = 1;
+  *athome = (mp == n);
+  while (mp != n) {  /* follow the chain from 'mp' until 'n' */
+    lua_assert(gnext(mp) != 0);
+    mp += gnext(mp);
+    chain++;
+  }
+  return chain;
+}
+
+#else
+
+static unsigned keychain (Table *t, Node *n, int *athome) {
+  unsigned mask = cast_uint(sizenode(t)) - 1u;
+  unsigned i = cast_uint(n - gnode(t, 0));
+  unsigned p, step = 0, chain = 1;
+  TValue key;
+  getnodekey(cast(lua_State *, NULL), &key, n);
+  p = hashvalue(&key) & mask;
+  *athome = (i == p);
+  while (((i - p) & mask) >= GROUPSIZE) {  /* 'n' not in group at 'p'? */
+    lua_assert(step <= mask);
+    step += GROUPSIZE;  /* same probe sequence as 'searchnode' */
+    p = (p + step) & mask;
+    chain++;
+  }
+  return chain;
+}
+
+#endif
+
+
+/*
+** Adds the statistics of the nodes of hash part 't' to 's'. Removed
+** entries in the old hash part of an incremental rehash ('old') are
+** mostly the ones already moved, so they are not counted.
+*/
+static void hashstats (Table *t, lua_Unsigned *s, int old) {
+  unsigned size = sizenode(t);
+  unsigned i;
+  if (isdummy(t))
+    return;
+  for (i = 0; i < size; i++) {
+    Node *n = gnode(t, i);
+    if (isempty(gval(n))) {
+      if (!keyisnil(n) && !old)  /* a removed entry? */
+        s[LUA_TSHDEAD]++;
+    }
+    else {
+      int athome;
+      unsigned chain = keychain(t, n, &athome);
+      s[LUA_TSHLIVE]++;
+      s[LUA_TSCHAINS] += chain;
+      if (chain > s[LUA_TSMAXCHAIN])
+        s[LUA_TSMAXCHAIN] = chain;
+      if (!athome)
+        s[LUA_TSNOTMAIN]++;
+    }
+  }
+}
+
+
+/*
+** Adds the statistics of table 't' to 's'. All entries are sums, but
+** LUA_TSMAXCHAIN (a maximum) and LUA_TSFLAGS (set from the metatable
+** of 't', if any).
+*/
+void luaH_stats (Table *t, lua_Unsigned *s) {
+  unsigned i;
+  s[LUA_TSASIZE] += t->asize;
+  for (i = 0; i < t->asize; i++) {
+    if (!tagisempty(*getArrTag(t, i)))
+      s[LUA_TSALIVE]++;
+  }
+  if (t->asize > 0)
+    s[LUA_TSLENHINT] += *lenhint(t);
+  if (!isdummy(t))
+    s[LUA_TSNODES] += sizenode(t);
+  hashstats(t, s, 0);
+  if (isrehashing(t)) {  /* old hash part still being moved? */
+    Table ot;
+    oldhashpart(t, &ot);
+    s[LUA_TSOLDNODES] += sizenode(&ot);
+    hashstats(&ot, s, 1);
+  }
+  s[LUA_TSBYTES] += luaH_size(t);
+  if (t->metatable != NULL) {
+    s[LUA_TSMETA]++;
+    s[LUA_TSFLAGS] = t->metatable->flags & maskflags;
+  }
+}
+
+/* }============================================================= */
+
+
+/*
+** Old hash part of a table in an incremental rehash, for the collector.
+*/
+unsigned luaH_oldhash (Table *t, Node **old) {
+  Rehash *r = getrehash(t);
+  lua_assert(isrehashing(t));
+  *old = r->node;
+  return twoto(r->lsizenode);
+}
+
+
 /*
 ** Frees a table.
 */
 void luaH_free (lua_State *L, Table *t) {
+  if (isrehashing(t)) {
+    Table ot;
+    oldhashpart(t, &ot);
+    freehash(L, &ot);
+  }
   freehash(L, t);
   resizearray(L, t, t->asize, 0);
   luaM_free(L, t);
 }
 
 
+#if !LUA_USE_SWISSHASH
+
 static Node *getfreepos (Table *t) {
   if (haslastfree(t)) {  /* does it have 'lastfree' information? */
     /* look for a spot before 'lastfree', updating 'lastfree' */
@@ -894,6 +1651,28 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
   return 1;
 }
 
+#else
+
+/*
+** Inserts a new key into a hash table, in the first free node of its
+** probe sequence. Return 0 if could not insert key (the table reached
+** its maximum load).
+*/
+static int insertkey (Table *t, const TValue *key, TValue *value) {
+  Node *n;
+  /* table cannot already contain the key */
+  lua_assert(isabstkey(getgeneric(t, key, 0)));
+  n = getfreepos(t, hashvalue(key));
+  if (n == NULL)  /* cannot find a free place? */
+    return 0;
+  lua_assert(isempty(gval(n)));
+  setnodekey(n, key);
+  setobj2t(cast(lua_State *, 0), gval(n), value);
+  return 1;
+}
+
+#endif
+
 
 /*
 ** Insert a key in a table where there is space for that key, the
@@ -901,8 +1680,10 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
 */
 static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
   unsigned i = keyinarray(t, key);
-  if (i > 0)  /* is key in the array part? */
+  if (i > 0) {  /* is key in the array part? */
     obj2arr(t, i - 1, value);  /* set value in the array */
+    luaH_movehint(t, i - 1, value->tt_);
+  }
   else {
     int done = insertkey(t, key, value);  /* insert key in the hash part */
     lua_assert(done);  /* it cannot fail */
@@ -911,11 +1692,42 @@ static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
 }
 
 
+/*
+** Checks whether 'key' appends to a sequence that fills the array part
+** ('t[#t + 1] = v' with '#t == asize'). Such a key does not go to the
+** hash part, even if it has free space: the array part grows instead,
+** so that sequences stay in the array part and their length keeps an
+** exact hint. Tables whose hash part is larger than the array keep the
+** default behavior, to avoid rebuilding a big hash for a few integer
+** keys.
+*/
+#define isappend(t,key)  \
+  ((t)->asize > 0 && (t)->asize < MAXASIZE && ttisinteger(key) &&  \
+   l_castS2U(ivalue(key)) - 1u == (t)->asize &&  \
+   *lenhint(t) == (t)->asize && (t)->asize >= allocsizenode(t))
+
+
+/*
+** Doubles the array part of 't' for an append. Unlike 'rehash', it does
+** not count the keys in the table to compute the best size: the array
+** is full (see 'isappend'), so doubling it keeps it more than half
+** used, and the growth is geometric, so appends are amortized O(1).
+*/
+static void growarray (lua_State *L, Table *t) {
+  unsigned asize = t->asize;
+  luaH_resizearray(L, t, (asize <= MAXASIZE / 2) ? asize * 2 : MAXASIZE);
+}
+
+
 static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   if (!ttisnil(value)) {  /* do not insert nil values */
-    int done = insertkey(t, key, value);
-    if (!done) {  /* could not find a free place? */
+    if (isappend(t, key)) {  /* appending to a full array part? */
+      growarray(L, t);
+      newcheckedkey(t, key, value);  /* key now is in the array part */
+    }
+    else if ((isrehashing(t) && !rehashstep(L, t, LUAI_REHASHSTEP)) ||
+             !insertkey(t, key, value)) {  /* could not find a free place? */
       rehash(L, t, key);  /* grow table */
       newcheckedkey(t, key, value);  /* insert key in grown table */
     }
@@ -926,7 +1738,8 @@ static void luaH_newkey (lua_State *L, Table *t, const TValue *key,
 }
 
 
-static const TValue *getintfromhash (Table *t, lua_Integer key) {
+static const TValue *searchint (Table *t, lua_Integer key) {
+#if !LUA_USE_SWISSHASH
   Node *n = hashint(t, key);
   lua_assert(!ikeyinarray(t, key));
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -939,6 +1752,22 @@ static const TValue *getintfromhash (Table *t, lua_Integer key) {
     }
   }
   return &absentkey;
+#else
+  unsigned h = inthash(key);
+  lua_assert(!ikeyinarray(t, key));
+  searchnode(t, h, keyisinteger(n) && keyival(n) == key);
+#endif
+}
+
+
+static const TValue *getintfromhash (Table *t, lua_Integer key) {
+  const TValue *slot = searchint(t, key);
+  if (l_unlikely(isabstkey(slot)) && isrehashing(t)) {
+    TValue ko;
+    setivalue(&ko, key);
+    slot = getold(t, &ko);
+  }
+  return slot;
 }
 
 
@@ -969,10 +1798,8 @@ lu_byte luaH_getint (Table *t, lua_Integer key, TValue *res) {
 }
 
 
-/*
-** search function for short strings
-*/
-const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
+static const TValue *searchshortstr (Table *t, TString *key) {
+#if !LUA_USE_SWISSHASH
   Node *n = hashstr(t, key);
   lua_assert(strisshr(key));
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -985,6 +1812,29 @@ const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#else
+  unsigned h = mixhash(key->hash);
+  lua_assert(strisshr(key));
+  searchnode(t, h, keyisshrstr(n) && eqshrstr(keystrval(n), key));
+#endif
+}
+
+
+static const TValue *getoldshortstr (Table *t, TString *key) {
+  TValue ko;
+  setsvalue(cast(lua_State *, NULL), &ko, key);
+  return getold(t, &ko);
+}
+
+
+/*
+** search function for short strings
+*/
+const TValue *luaH_Hgetshortstr (Table *t, TString *key) {
+  const TValue *slot = searchshortstr(t, key);
+  if (l_unlikely(isabstkey(slot)) && isrehashing(t))
+    slot = getoldshortstr(t, key);
+  return slot;
 }
 
 
@@ -993,11 +1843,36 @@ lu_byte luaH_getshortstr (Table *t, TString *key, TValue *res) {
 }
 
 
+#if LUA_USE_ICACHE
+/*
+** Search function for short strings that refreshes an inline cache:
+** when 'key' is found, '*ic' gets the index of its node. (The fast
+** path, which checks whether the node cached in '*ic' still holds
+** 'key', is done by the interpreter; see 'luaH_icnode'.)
+*/
+static const TValue *Hgetshortstric (Table *t, TString *key,
+                                     l_uint32 *ic) {
+  const TValue *slot = searchshortstr(t, key);
+  if (!isabstkey(slot))
+    *ic = cast(l_uint32, nodefromval(slot) - t->node);
+  else if (isrehashing(t))  /* (entries in the old part are not cached) */
+    slot = getoldshortstr(t, key);
+  return slot;
+}
+
+
+lu_byte luaH_getshortstric (Table *t, TString *key, TValue *res,
+                            l_uint32 *ic) {
+  return finishnodeget(Hgetshortstric(t, key, ic), res);
+}
+#endif
+
+
 static const TValue *Hgetlongstr (Table *t, TString *key) {
   TValue ko;
   lua_assert(!strisshr(key));
   setsvalue(cast(lua_State *, NULL), &ko, key);
-  return getgeneric(t, &ko, 0);  /* for long strings, use generic case */
+  return Hgetgeneric(t, &ko);  /* for long strings, use generic case */
 }
 
 
@@ -1035,7 +1910,7 @@ lu_byte luaH_get (Table *t, const TValue *key, TValue *res) {
       /* else... */
     }  /* FALLTHROUGH */
     default:
-      slot = getgeneric(t, key, 0);
+      slot = Hgetgeneric(t, key);
       break;
   }
   return finishnodeget(slot, res);
@@ -1089,14 +1964,14 @@ static int psetint (Table *t, lua_Integer key, TValue *val) {
 
 /*
 ** This function could be just this:
-**    return finishnodeset(t, luaH_Hgetshortstr(t, key), val);
+**    return finishnodeset(t, slot, val);
 ** However, it optimizes the common case created by constructors (e.g.,
 ** {x=1, y=2}), which creates a key in a table that has no metatable,
-** it is not old/black, and it already has space for the key.
+** it is not old/black, and it already has space for the key. ('slot'
+** is the result of searching 'key' in 't'.)
 */
-
-int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
-  const TValue *slot = luaH_Hgetshortstr(t, key);
+static int psetshortstr (Table *t, TString *key, TValue *val,
+                         const TValue *slot) {
   if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
     setobj(((lua_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
@@ -1105,7 +1980,8 @@ int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
     if (ttisnil(val))  /* new value is nil? */
       return HOK;  /* done (value is already nil/absent) */
     if (isabstkey(slot) &&  /* key is absent? */
-       !(isblack(t) && iswhite(key))) {  /* and don't need barrier? */
+       !(isblack(t) && iswhite(key)) &&  /* and don't need barrier? */
+       !isrehashing(t)) {  /* and not in an incremental rehash? */
       TValue tk;  /* key as a TValue */
       setsvalue(cast(lua_State *, NULL), &tk, key);
       if (insertkey(t, &tk, val)) {  /* insert key, if there is space */
@@ -1121,6 +1997,19 @@ int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
 }
 
 
+int luaH_psetshortstr (Table *t, TString *key, TValue *val) {
+  return psetshortstr(t, key, val, luaH_Hgetshortstr(t, key));
+}
+
+
+#if LUA_USE_ICACHE
+int luaH_psetshortstric (Table *t, TString *key, TValue *val,
+                         l_uint32 *ic) {
+  return psetshortstr(t, key, val, Hgetshortstric(t, key, ic));
+}
+#endif
+
+
 int luaH_psetstr (Table *t, TString *key, TValue *val) {
   if (strisshr(key))
     return luaH_psetshortstr(t, key, val);
@@ -1141,7 +2030,7 @@ int luaH_pset (Table *t, const TValue *key, TValue *val) {
       /* else... */
     }  /* FALLTHROUGH */
     default:
-      return finishnodeset(t, getgeneric(t, key, 0), val);
+      return finishnodeset(t, Hgetgeneric(t, key), val);
   }
 }
 
@@ -1184,6 +2073,7 @@ void luaH_finishset (lua_State *L, Table *t, const TValue *key,
   else {  /* array entry */
     hres = ~hres;  /* real index */
     obj2arr(t, cast_uint(hres), value);
+    luaH_movehint(t, cast_uint(hres), value->tt_);
   }
 }
 
@@ -1205,8 +2095,10 @@ void luaH_set (lua_State *L, Table *t, const TValue *key, TValue *value) {
 */
 void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
   unsigned ik = ikeyinarray(t, key);
-  if (ik > 0)
+  if (ik > 0) {
     obj2arr(t, ik - 1, value);
+    luaH_movehint(t, ik - 1, value->tt_);
+  }
   else {
     int ok = rawfinishnodeset(getintfromhash(t, key), value);
     if (!ok) {
@@ -1218,6 +2110,472 @@ void luaH_setint (lua_State *L, Table *t, lua_Integer key, TValue *value) {
 }
 
 
+/*
+** Copies the 'n' entries of the array part of 'src' starting at (C)
+** index 'f' to the array part of 'dst' starting at index 'd', as a
+** 'memmove' (the two ranges can overlap). Both ranges must be inside
+** the array parts. The length hint of 'dst' is kept as a sequence of
+** 'luaH_movehint' in increasing order would do: it can drop by one at
+** its border or grow through the entries just written.
+*/
+void luaH_movearray (lua_State *L, Table *src, unsigned f,
+                                   Table *dst, unsigned d, unsigned n) {
+  unsigned *lh = lenhint(dst);
+  lua_assert(n > 0 && f + n <= src->asize && d + n <= dst->asize);
+  memmove(getArrVal(dst, d + n - 1), getArrVal(src, f + n - 1),
+          n * sizeof(Value));
+  memmove(getArrTag(dst, d), getArrTag(src, f), n);
+  if (src != dst && isblack(dst))  /* may have moved white values? */
+    luaC_barrierback_(L, obj2gco(dst));
+  if (d < *lh && *lh <= d + n && tagisempty(*getArrTag(dst, *lh - 1)))
+    (*lh)--;  /* border entry was removed */
+  else {
+    while (d <= *lh && *lh < d + n && !tagisempty(*getArrTag(dst, *lh)))
+      (*lh)++;  /* entries appended after the border */
+  }
+}
+
+
+/*
+** {======================================================
+** Sorting the array part
+** =======================================================
+*/
+
+/* ranges with up to this number of entries are sorted by insertion */
+#if !defined(LUAI_SORTSMALL)
+#define LUAI_SORTSMALL		24
+#endif
+
+
+/* kinds of arrays handled by 'luaH_sortarray' */
+#define SORTINT		1
+#define SORTFLT		2
+#define SORTSTR		3
+
+
+/*
+** Classifies the entries [f, f + n) of the array part of 't': all
+** integers, all floats (none of them a NaN, which has no order), or all
+** strings; anything else, including empty entries, gets 0. Ropes are
+** flattened here, so that the comparisons done while sorting do not
+** allocate.
+*/
+static int sortkind (lua_State *L, Table *t, unsigned f, unsigned n) {
+  lu_byte tag = *getArrTag(t, f);
+  int kind = (tag == LUA_VNUMINT) ? SORTINT
+           : (tag == LUA_VNUMFLT) ? SORTFLT
+           : (novariant(tag) == LUA_TSTRING) ? SORTSTR : 0;
+  unsigned k;
+  for (k = f; kind != 0 && k < f + n; k++) {
+    tag = *getArrTag(t, k);
+    switch (kind) {
+      case SORTINT:
+        if (tag != LUA_VNUMINT) kind = 0;
+        break;
+      case SORTFLT:
+        if (tag != LUA_VNUMFLT || luai_numisnan(getArrVal(t, k)->n))
+          kind = 0;
+        break;
+      default:
+        if (novariant(tag) != LUA_TSTRING) kind = 0;
+        else luaS_flat(L, gco2ts(getArrVal(t, k)->gc), 0);
+        break;
+    }
+  }
+  return kind;
+}
+
+
+/*
+** Numbers are sorted as unsigned keys with the same order. For
+** integers, the key flips the sign bit. For floats, it flips the sign
+** bit of non-negative values and all bits of negative ones; -0.0 gets
+** a key smaller than 0.0, which is harmless as they are equal for '<'.
+** Float keys need floats with the size of integers (e.g., doubles with
+** 64-bit integers); other configurations do not sort floats here.
+*/
+#define SIGNBIT		(~(~l_castS2U(0) >> 1))
+#define fltkeys		(sizeof(lua_Number) == sizeof(lua_Unsigned))
+
+typedef union {
+  lua_Number n;
+  lua_Unsigned u;
+} NumBits;
+
+
+static lua_Unsigned flt2key (lua_Number x) {
+  NumBits b;
+  b.n = x;
+  return (b.u & SIGNBIT) ? ~b.u : (b.u | SIGNBIT);
+}
+
+
+static lua_Number key2flt (lua_Unsigned k) {
+  NumBits b;
+  b.u = (k & SIGNBIT) ? (k ^ SIGNBIT) : ~k;
+  return b.n;
+}
+
+
+#define RADIXBITS	8
+#define RADIX		(1 << RADIXBITS)
+#define NDIGITS		cast_int(sizeof(lua_Unsigned) * CHAR_BIT / RADIXBITS)
+
+/* maximum size of the buffers used by a sort, per entry */
+#define SORTESIZE  \
+  (2 * sizeof(lua_Unsigned) + sizeof(Value) + 2 * sizeof(unsigned) + 1)
+
+/*
+** Test whether the buffers (and counters) to sort 'n' entries do not
+** fit in a 'size_t'. (As in 'luaM_testsize', the test with 'sizeof'
+** avoids a warning about the comparison being always false.)
+*/
+#define toomanyentries(n)  \
+  (sizeof(n) >= sizeof(size_t) && cast_sizet(n) + 1 > \
+   (MAX_SIZE - NDIGITS * RADIX * sizeof(unsigned)) / SORTESIZE)
+
+
+/*
+** LSD radix sort of the 'n' keys in 'a', using 'aux' (with room for 'n'
+** keys) and 'count' (with room for NDIGITS * RADIX counters). All
+** digits are counted in a single pass, and passes over digits that are
+** equal in all keys (such as the high digits of small integers) are
+** skipped. Returns the vector holding the sorted keys. The sort is
+** stable. If 'p' is not NULL, its entries move with the keys, using
+** 'paux'; they end in 'p' if the keys end in 'a', and in 'paux'
+** otherwise.
+*/
+static lua_Unsigned *radixsort (lua_Unsigned *a, lua_Unsigned *aux,
+                                unsigned *p, unsigned *paux,
+                                unsigned *count, unsigned n) {
+  unsigned i;
+  int d;
+  memset(count, 0, NDIGITS * RADIX * sizeof(unsigned));
+  for (i = 0; i < n; i++) {
+    lua_Unsigned k = a[i];
+    for (d = 0; d < NDIGITS; d++)
+      count[d * RADIX + cast_int((k >> (d * RADIXBITS)) & (RADIX - 1))]++;
+  }
+  for (d = 0; d < NDIGITS; d++) {
+    unsigned *c = count + d * RADIX;
+    int shift = d * RADIXBITS;
+    unsigned sum = 0;
+    int j;
+    if (c[(a[0] >> shift) & (RADIX - 1)] == n)  /* digit equal in all? */
+      continue;  /* nothing to move */
+    for (j = 0; j < RADIX; j++) {  /* counts -> first position of each */
+      unsigned temp = c[j];
+      c[j] = sum;
+      sum += temp;
+    }
+    for (i = 0; i < n; i++) {
+      unsigned pos = c[(a[i] >> shift) & (RADIX - 1)]++;
+      aux[pos] = a[i];
+      if (p != NULL)
+        paux[pos] = p[i];
+    }
+    { lua_Unsigned *temp = a; a = aux; aux = temp; }
+    { unsigned *temp = p; p = paux; paux = temp; }
+  }
+  return a;
+}
+
+
+static void sortsmallkeys (lua_Unsigned *a, unsigned n) {
+  unsigned i;
+  for (i = 1; i < n; i++) {
+    lua_Unsigned k = a[i];
+    unsigned j;
+    for (j = i; j > 0 && k < a[j - 1]; j--)
+      a[j] = a[j - 1];
+    a[j] = k;
+  }
+}
+
+
+/*
+** Sorts numbers of the given kind: copies their keys to a buffer,
+** sorts the keys, and writes the numbers back. (Tags do not change.)
+*/
+static void sortnumbers (lua_State *L, Table *t, unsigned f, unsigned n,
+                         int kind) {
+  size_t size = 2 * cast_sizet(n) * sizeof(lua_Unsigned)
+              + NDIGITS * RADIX * sizeof(unsigned);
+  lua_Unsigned *a = cast(lua_Unsigned *, luaM_malloc_(L, size, 0));
+  lua_Unsigned *res = a;
+  unsigned k;
+  for (k = 0; k < n; k++) {
+    const Value *v = getArrVal(t, f + k);
+    a[k] = (kind == SORTINT) ? l_castS2U(v->i) ^ SIGNBIT : flt2key(v->n);
+  }
+  if (n <= LUAI_SORTSMALL)
+    sortsmallkeys(a, n);
+  else
+    res = radixsort(a, a + n, NULL, NULL, cast(unsigned *, a + 2 * n), n);
+  for (k = 0; k < n; k++) {
+    Value *v = getArrVal(t, f + k);
+    if (kind == SORTINT)
+      v->i = l_castU2S(res[k] ^ SIGNBIT);
+    else
+      v->n = key2flt(res[k]);
+  }
+  luaM_freemem(L, a, size);
+}
+
+
+#define strat(t,k)	gco2ts(getArrVal(t, k)->gc)
+
+/* equal pointers are equal strings; no need to compare contents */
+#define strorder(L,a,b)	(((a) == (b)) ? 0 : luaV_strcmp(L, a, b))
+
+
+/* exchanges entries 'i' and 'j' (value and tag) of the array part */
+static void swaparr (Table *t, unsigned i, unsigned j) {
+  Value v = *getArrVal(t, i);
+  lu_byte tag = *getArrTag(t, i);
+  *getArrVal(t, i) = *getArrVal(t, j);
+  *getArrTag(t, i) = *getArrTag(t, j);
+  *getArrVal(t, j) = v;
+  *getArrTag(t, j) = tag;
+}
+
+
+static void sortsmallstr (lua_State *L, Table *t, unsigned lo, unsigned up) {
+  unsigned i;
+  for (i = lo + 1; i <= up; i++) {
+    unsigned j;
+    for (j = i; j > lo && strorder(L, strat(t, j), strat(t, j - 1)) < 0; j--)
+      swaparr(t, j, j - 1);
+  }
+}
+
+
+/* moves down entry 'lo + i' in the max-heap of 'n' entries at 'lo' */
+static void siftstr (lua_State *L, Table *t, unsigned lo, unsigned i,
+                                                         unsigned n) {
+  for (;;) {
+    unsigned c = 2 * i + 1;  /* first child */
+    if (c >= n)
+      break;
+    if (c + 1 < n && strorder(L, strat(t, lo + c), strat(t, lo + c + 1)) < 0)
+      c++;  /* second child is larger */
+    if (strorder(L, strat(t, lo + i), strat(t, lo + c)) >= 0)
+      break;
+    swaparr(t, lo + i, lo + c);
+    i = c;
+  }
+}
+
+
+static void heapsortstr (lua_State *L, Table *t, unsigned lo, unsigned up) {
+  unsigned n = up - lo + 1;
+  unsigned i;
+  for (i = n / 2; i-- > 0; )
+    siftstr(L, t, lo, i, n);
+  while (n > 1) {
+    swaparr(t, lo, lo + --n);  /* move largest to the end */
+    siftstr(L, t, lo, 0, n);
+  }
+}
+
+
+/*
+** Quicksort of the strings in entries [lo, up], with a median-of-three
+** pivot and a three-way partition: entries equal to the pivot are
+** placed between the two sides and never looked at again, so repeated
+** strings cost nothing extra. Recurses on the smaller side; after
+** 'depth' levels, falls back to a heap sort.
+*/
+static void sortstrings (lua_State *L, Table *t, unsigned lo, unsigned up,
+                                                 int depth) {
+  while (up - lo >= LUAI_SORTSMALL) {
+    unsigned mid = lo + (up - lo) / 2;
+    unsigned lt = lo, i = lo, gt = up;
+    TString *p;
+    if (depth-- == 0) {  /* too many bad partitions? */
+      heapsortstr(L, t, lo, up);
+      return;
+    }
+    if (strorder(L, strat(t, mid), strat(t, lo)) < 0)
+      swaparr(t, mid, lo);
+    if (strorder(L, strat(t, up), strat(t, mid)) < 0) {
+      swaparr(t, up, mid);
+      if (strorder(L, strat(t, mid), strat(t, lo)) < 0)
+        swaparr(t, mid, lo);
+    }
+    p = strat(t, mid);  /* pivot */
+    while (i <= gt) {  /* [lo, lt) < p; [lt, i) == p; (gt, up] > p */
+      int c = strorder(L, strat(t, i), p);
+      if (c < 0)
+        swaparr(t, lt++, i++);
+      else if (c > 0)
+        swaparr(t, i, gt--);
+      else
+        i++;
+    }
+    /* pivot itself is in [lt, gt]; both sides are smaller than before */
+    if (lt - lo < up - gt) {
+      if (lt > lo)
+        sortstrings(L, t, lo, lt - 1, depth);
+      lo = gt + 1;  /* 'gt < up', as the upper side is the larger one */
+    }
+    else {
+      if (gt < up)
+        sortstrings(L, t, gt + 1, up, depth);
+      if (lt == lo)  /* both sides empty? */
+        return;
+      up = lt - 1;
+    }
+  }
+  sortsmallstr(L, t, lo, up);
+}
+
+
+/*
+** Stable merge sort of the positions 0 .. n - 1 (relative to 'f') by
+** the strings at these positions, using 'ord' and 'aux' (each with room
+** for 'n' positions). Runs of LUAI_SORTSMALL positions are first sorted
+** by insertion. Returns the vector holding the sorted positions.
+*/
+static unsigned *mergestrings (lua_State *L, Table *t, unsigned f,
+                               unsigned n, unsigned *ord, unsigned *aux) {
+  unsigned w, i;
+  for (i = 0; i < n; i++)
+    ord[i] = i;
+  for (i = 0; i < n; i += LUAI_SORTSMALL) {
+    unsigned e = (n - i < LUAI_SORTSMALL) ? n : i + LUAI_SORTSMALL;
+    unsigned j;
+    for (j = i + 1; j < e; j++) {
+      unsigned x = ord[j];
+      unsigned m;
+      for (m = j; m > i &&
+           strorder(L, strat(t, f + x), strat(t, f + ord[m - 1])) < 0; m--)
+        ord[m] = ord[m - 1];
+      ord[m] = x;
+    }
+  }
+  for (w = LUAI_SORTSMALL; w < n; w *= 2) {  /* merge runs of 'w' */
+    for (i = 0; i < n; i += (n - i < 2 * w) ? n - i : 2 * w) {
+      unsigned mid = (n - i < w) ? n : i + w;
+      unsigned up = (n - i < 2 * w) ? n : i + 2 * w;
+      unsigned l = i, r = mid, k = i;
+      while (l < mid && r < up) {  /* take from the right only if less */
+        if (strorder(L, strat(t, f + ord[r]), strat(t, f + ord[l])) < 0)
+          aux[k++] = ord[r++];
+        else
+          aux[k++] = ord[l++];
+      }
+      while (l < mid)
+        aux[k++] = ord[l++];
+      while (r < up)
+        aux[k++] = ord[r++];
+    }
+    { unsigned *temp = ord; ord = aux; aux = temp; }
+  }
+  return ord;
+}
+
+
+/*
+** Rearranges the entries [f, f + n) of the array part of 't' so that
+** its j-th entry is the one that was at position 'ord[j]', using 'v'
+** and 'tag' to keep the old entries.
+*/
+static void permute (Table *t, unsigned f, unsigned n, const unsigned *ord,
+                     Value *v, lu_byte *tag) {
+  unsigned k;
+  for (k = 0; k < n; k++) {
+    v[k] = *getArrVal(t, f + k);
+    tag[k] = *getArrTag(t, f + k);
+  }
+  for (k = 0; k < n; k++) {
+    *getArrVal(t, f + k) = v[ord[k]];
+    *getArrTag(t, f + k) = tag[ord[k]];
+  }
+}
+
+
+/*
+** Stable sort of the entries [f, f + n) of 't' that also applies the
+** same rearrangement to the entries [f, f + n) of 'c' (which can be 't'
+** itself). It computes the sorted order of the entries ('ord[j]' is the
+** old position of the entry that goes to position j) and then permutes
+** both tables. Numbers go through a radix sort of their keys carrying
+** their positions; as -0.0 and 0.0 are equal for '<', they get the same
+** key. Strings go through a merge sort.
+*/
+static void sortstable (lua_State *L, Table *t, unsigned f, unsigned n,
+                        int kind, Table *c) {
+  size_t nkeys = (kind == SORTSTR) ? 0 : 2 * cast_sizet(n);
+  size_t ncount = (kind == SORTSTR) ? 0 : NDIGITS * RADIX;
+  size_t size = nkeys * sizeof(lua_Unsigned) + n * sizeof(Value)
+              + (2 * cast_sizet(n) + ncount) * sizeof(unsigned) + n;
+  lua_Unsigned *keys = cast(lua_Unsigned *, luaM_malloc_(L, size, 0));
+  Value *v = cast(Value *, keys + nkeys);
+  unsigned *ord = cast(unsigned *, v + n);
+  unsigned *count = ord + 2 * n;
+  lu_byte *tag = cast(lu_byte *, count + ncount);
+  unsigned *res;
+  unsigned k;
+  if (kind == SORTSTR)
+    res = mergestrings(L, t, f, n, ord, ord + n);
+  else {
+    for (k = 0; k < n; k++) {
+      const Value *o = getArrVal(t, f + k);
+      keys[k] = (kind == SORTINT) ? l_castS2U(o->i) ^ SIGNBIT
+                                  : flt2key((o->n == 0) ? 0 : o->n);
+      ord[k] = k;
+    }
+    res = (radixsort(keys, keys + n, ord, ord + n, count, n) == keys)
+          ? ord : ord + n;
+  }
+  permute(t, f, n, res, v, tag);
+  if (c != t)
+    permute(c, f, n, res, v, tag);
+  luaM_freemem(L, keys, size);
+}
+
+
+/*
+** Sorts the entries [f, f + n) of the array part of 't' in increasing
+** order, as 'table.sort' without an order function would do, when they
+** are all integers, all floats, or all strings. Otherwise, returns 0
+** and does nothing. Numbers go through a radix sort of their keys;
+** strings are sorted in place. If 'c' is not NULL, the sort is stable
+** and the entries [f, f + n) of 'c', which must be in its array part
+** and not empty, are moved along with the ones of 't'. Values only
+** change places inside each array part, so neither the collector nor
+** the length hints need to know about it.
+*/
+int luaH_sortarray (lua_State *L, Table *t, unsigned f, unsigned n,
+                    Table *c) {
+  int kind;
+  lua_assert(f + n <= t->asize && (c == NULL || f + n <= c->asize));
+  if (c != NULL) {  /* check that 'c' has no empty entries in the range */
+    unsigned k;
+    for (k = f; k < f + n; k++) {
+      if (tagisempty(*getArrTag(c, k)))
+        return 0;
+    }
+  }
+  if (n < 2)
+    return n == 0 || !tagisempty(*getArrTag(t, f));
+  kind = sortkind(L, t, f, n);
+  if (kind == 0 || (kind == SORTFLT && !fltkeys) || toomanyentries(n))
+    return 0;
+  else if (c != NULL)
+    sortstable(L, t, f, n, kind, c);
+  else if (kind == SORTSTR)
+    sortstrings(L, t, f, f + n - 1, 2 * luaO_ceillog2(n));
+  else
+    sortnumbers(L, t, f, n, kind);
+  return 1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Try to find a boundary in the hash part of table 't'. From the
 ** caller, we know that 'asize + 1' is present. We want to find a larger
@@ -1294,7 +2652,10 @@ static lua_Unsigned newhint (Table *t, unsigned hint) {
 ** If there is an array part, try to find a border there. First try
 ** to find it in the vicinity of the previous result (hint), to handle
 ** cases like 't[#t + 1] = val' or 't[#t] = nil', that move the border
-** by one entry. Otherwise, do a binary search to find the border.
+** by one entry. (Writes at the border also move the hint along; see
+** 'luaH_movehint'. So, for tables used as sequences, the hint is
+** already the border and this check is O(1).) Otherwise, do a binary
+** search to find the border.
 ** If there is no array part, or its last element is non empty, the
 ** border may be in the hash part.
 */
@@ -1349,7 +2710,11 @@ lua_Unsigned luaH_getn (lua_State *L, Table *t) {
 /* export this function for the test library */
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if !LUA_USE_SWISSHASH
   return mainpositionTV(t, key);
+#else
+  return gnode(t, hashvalue(key) & (cast_uint(sizenode(t)) - 1u));
+#endif
 }
 
 #endif
@@ -37,12 +37,28 @@
 #define setnodummy(t) ((t)->flags &= NOTBITDUMMY)
 #define setdummy(t) ((t)->flags |= BITDUMMY)
 
+/*
+** 标志位BITREHASH表示大表正在渐进式重哈希(见ltable.c中的'resize')：
+** 旧的哈希部分与新的并存，之后每插入一个新键就迁移其中一小段节点。
+** 在迁移完成前，查找会在新部分未命中时再查旧部分，遍历(next)在新部分之后
+** 接着走旧部分，GC也要遍历两部分。
+*/
+#define BITREHASH (1 << 7)
+#define isrehashing(t) ((t)->flags & BITREHASH)
+
 /* 计算哈希节点的分配大小，如果表使用虚拟节点则返回0 */
 #define allocsizenode(t) (isdummy(t) ? 0 : sizenode(t))
 
 /* 根据表项的值返回对应的节点指针，用于反向查找 */
 #define nodefromval(v) cast(Node *, (v))
 
+/*
+** 内联缓存(见lvm.c)中记录的节点：缓存项'ic'只是一个节点下标的提示，
+** 按当前哈希部分的大小取模后总在范围内(虚拟节点时取模结果为0)，
+** 因此使用前只需校验该节点中的键是否仍是要找的键。
+*/
+#define luaH_icnode(t, ic) gnode(t, (ic) & (sizenode(t) - 1u))
+
 /*
 ** 快速获取整数键的值的宏，优化了常见的整数索引操作。
 ** 先尝试在数组部分查找，如果失败则回退到完整查找。
@@ -80,6 +96,7 @@
       if (checknoTM(h->metatable, TM_NEWINDEX) || !tagisempty(*tag)) \
       {                                                              \
         fval2arr(h, u, tag, val);                                    \
+        luaH_movehint(h, cast_uint(u), *tag);                        \
         hres = HOK;                                                  \
       }                                                              \
       else                                                           \
@@ -136,6 +153,24 @@
 */
 #define lenhint(t) cast(unsigned *, (t)->array)
 
+/*
+** 写入数组部分(C索引k,新标签tt)后维护长度提示:在边界处追加
+** (t[#t+1] = v)时提示加一,在边界处删除(t[#t] = nil)时减一。
+** 这样作为序列使用的表,其提示总是精确的边界,'#t'只需校验两个槽位。
+** 出现空洞时提示只是不再精确,luaH_getn会回退到搜索并重新设置它。
+*/
+#define luaH_movehint(h, k, tt)                     \
+  {                                                 \
+    unsigned *lh_ = lenhint(h);                     \
+    if ((k) == *lh_)                                \
+    {                                               \
+      if (!tagisempty(tt))                          \
+        *lh_ = (k) + 1;                             \
+    }                                               \
+    else if ((k) + 1 == *lh_ && tagisempty(tt))     \
+      *lh_ = (k);                                   \
+  }
+
 /*
 ** 使用C索引在数组之间移动TValues
 */
@@ -163,6 +198,12 @@ LUAI_FUNC lu_byte luaH_get(Table *t, const TValue *key, TValue *res);
 /* 快速获取短字符串键的值，字符串在Lua中常用于表键 */
 LUAI_FUNC lu_byte luaH_getshortstr(Table *t, TString *key, TValue *res);
 
+#if LUA_USE_ICACHE
+/* 同luaH_getshortstr，找到键时把其节点下标记入内联缓存项'ic' */
+LUAI_FUNC lu_byte luaH_getshortstric(Table *t, TString *key, TValue *res,
+                                     l_uint32 *ic);
+#endif
+
 /* 获取字符串键的值，支持任意字符串 */
 LUAI_FUNC lu_byte luaH_getstr(Table *t, TString *key, TValue *res);
 
@@ -178,6 +219,12 @@ LUAI_FUNC int luaH_psetint(Table *t, lua_Integer key, TValue *val);
 /* 预设置短字符串键的值，优化字符串操作 */
 LUAI_FUNC int luaH_psetshortstr(Table *t, TString *key, TValue *val);
 
+#if LUA_USE_ICACHE
+/* 同luaH_psetshortstr，找到键时把其节点下标记入内联缓存项'ic' */
+LUAI_FUNC int luaH_psetshortstric(Table *t, TString *key, TValue *val,
+                                  l_uint32 *ic);
+#endif
+
 /* 预设置字符串键的值 */
 LUAI_FUNC int luaH_psetstr(Table *t, TString *key, TValue *val);
 
@@ -188,6 +235,21 @@ LUAI_FUNC int luaH_pset(Table *t, const TValue *key, TValue *val);
 LUAI_FUNC void luaH_setint(lua_State *L, Table *t, lua_Integer key,
                            TValue *value);
 
+/*
+** 把src数组部分从下标f(C下标)开始的n项整体复制到dst数组部分下标d处，
+** 相当于memmove(两段可以重叠)，并维护dst的长度提示；两段都必须在数组部分内
+*/
+LUAI_FUNC void luaH_movearray(lua_State *L, Table *src, unsigned f,
+                              Table *dst, unsigned d, unsigned n);
+
+/*
+** 按默认的 '<' 顺序对数组部分从下标f(C下标)开始的n项原地排序；
+** 只处理全是整数、全是浮点数(不含NaN)或全是字符串的情况，否则返回0且不做任何事。
+** c不为NULL时排序是稳定的，并且c中同一段(须在其数组部分内且没有空项)随之做同样的重排
+*/
+LUAI_FUNC int luaH_sortarray(lua_State *L, Table *t, unsigned f, unsigned n,
+                             Table *c);
+
 /* 通用设置操作，根据键类型分派 */
 LUAI_FUNC void luaH_set(lua_State *L, Table *t, const TValue *key,
                         TValue *value);
@@ -199,6 +261,12 @@ LUAI_FUNC void luaH_finishset(lua_State *L, Table *t, const TValue *key,
 /* 创建新表，分配初始内存 */
 LUAI_FUNC Table *luaH_new(lua_State *L);
 
+/* 把新建的空表t变成src的副本(大小相同，整块复制各部分，不复制元表) */
+LUAI_FUNC void luaH_copy(lua_State *L, Table *t, Table *src);
+
+/* 删除表的所有项，但保留其数组部分和哈希部分的内存 */
+LUAI_FUNC void luaH_clear(lua_State *L, Table *t);
+
 /* 调整表的大小，同时改变数组部分和哈希部分的大小 */
 LUAI_FUNC void luaH_resize(lua_State *L, Table *t, unsigned nasize,
                            unsigned nhsize);
@@ -209,12 +277,32 @@ LUAI_FUNC void luaH_resizearray(lua_State *L, Table *t, unsigned nasize);
 /* 获取表的总大小（节点数），用于内存管理 */
 LUAI_FUNC lu_mem luaH_size(Table *t);
 
+/* 把表的内部统计（大小、存活与已删除的项、冲突链长度等）加到数组's'上，见'lua_tablestats' */
+LUAI_FUNC void luaH_stats(Table *t, lua_Unsigned *s);
+
+/* 渐进式重哈希中的表的旧哈希部分：'*old'得到其节点数组，返回节点数 */
+LUAI_FUNC unsigned luaH_oldhash(Table *t, Node **old);
+
 /* 释放表的内存，防止内存泄漏 */
 LUAI_FUNC void luaH_free(lua_State *L, Table *t);
 
 /* 表的迭代操作，返回下一个键值对 */
 LUAI_FUNC int luaH_next(lua_State *L, Table *t, StkId key);
 
+/*
+** 按位置遍历表：'*pos'是下一个待检查的槽位（先数组部分，后哈希部分），
+** 从0开始；找到的键值对放在'key'和'key + 1'，并把'*pos'移到其后。
+** 不需要像'luaH_next'那样重新哈希当前键来定位
+*/
+LUAI_FUNC int luaH_nextat(lua_State *L, Table *t, unsigned *pos, StkId key);
+
+/*
+** 带提示的'luaH_next'：若'*pos'正是'key'之后的位置（同一遍历的上一步
+** 留下的），就不再查找'key'；否则忽略提示，照常查找。完成后'*pos'同上
+*/
+LUAI_FUNC int luaH_nexthint(lua_State *L, Table *t, unsigned *pos,
+                            StkId key);
+
 /* 获取表的长度，用于'#'操作符的实现 */
 LUAI_FUNC lua_Unsigned luaH_getn(lua_State *L, Table *t);
 
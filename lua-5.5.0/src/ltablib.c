@@ -69,6 +69,27 @@ static int tcreate (lua_State *L) {
 }
 
 
+/*
+** Shallow copy of a table, done with raw accesses; the copy has the
+** sizes of the original, but not its metatable.
+*/
+static int tclone (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_clonetable(L, 1);
+  return 1;
+}
+
+
+/*
+** Removes all entries of a table, keeping its memory for new ones.
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 static int tinsert (lua_State *L) {
   lua_Integer pos;  /* where to insert new element */
   lua_Integer e = aux_getn(L, 1, TAB_RW);
@@ -84,6 +105,8 @@ static int tinsert (lua_State *L) {
       /* check whether 'pos' is in [1, e] */
       luaL_argcheck(L, (lua_Unsigned)pos - 1u < (lua_Unsigned)e, 2,
                        "position out of bounds");
+      if (pos < e && lua_moverange(L, 1, pos, e - 1, 1, pos + 1))
+        break;  /* moved up elements in the array part */
       for (i = e; i > pos; i--) {  /* move up elements */
         lua_geti(L, 1, i - 1);
         lua_seti(L, 1, i);  /* t[i] = t[i - 1] */
@@ -107,6 +130,8 @@ static int tremove (lua_State *L) {
     luaL_argcheck(L, (lua_Unsigned)pos - 1u <= (lua_Unsigned)size, 2,
                      "position out of bounds");
   lua_geti(L, 1, pos);  /* result = t[pos] */
+  if (pos < size && lua_moverange(L, 1, pos + 1, size, 1, pos))
+    pos = size;  /* moved down elements in the array part */
   for ( ; pos < size; pos++) {
     lua_geti(L, 1, pos + 1);
     lua_seti(L, 1, pos);  /* t[pos] = t[pos + 1] */
@@ -137,7 +162,11 @@ static int tmove (lua_State *L) {
     n = e - f + 1;  /* number of elements to move */
     luaL_argcheck(L, t <= LUA_MAXINTEGER - n + 1, 4,
                   "destination wrap around");
-    if (t > e || t <= f || (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
+    if (lua_moverange(L, 1, f, e, tt, t)) {
+      /* plain array parts: elements moved in one go */
+    }
+    else if (t > e || t <= f ||
+             (tt != 1 && !lua_compare(L, 1, tt, LUA_OPEQ))) {
       for (i = 0; i < n; i++) {
         lua_geti(L, 1, f + i);
         lua_seti(L, tt, t + i);
@@ -164,6 +193,88 @@ static void addfield (lua_State *L, luaL_Buffer *b, lua_Integer i) {
 }
 
 
+/* number of elements fetched at a time by 'concatblock' */
+#define CONCATBLOCK	64
+
+/* shorter ranges are not worth the two passes of 'arrayconcat' */
+#define CONCATMIN	8
+
+
+/*
+** Fetches the elements 'i', 'i + 1', ... (up to CONCATBLOCK of them,
+** and at most up to 'last') from the array part of table 1 and computes
+** in '*len' the length of their concatenation, with separators. If 'p'
+** is not NULL, also copies that concatenation into 'p'. Returns 0 if
+** the elements are not all strings in the array part of a table
+** without an '__index' metamethod. (Numbers are left to the general
+** case, as they would be converted in both passes.)
+*/
+static int concatblock (lua_State *L, lua_Integer i, lua_Integer last,
+                        const char *sep, size_t lsep, char *p,
+                        size_t *len) {
+  lua_Unsigned d = l_castS2U(last) - l_castS2U(i);
+  int n = (d < CONCATBLOCK) ? (int)d + 1 : CONCATBLOCK;
+  int base = lua_gettop(L) + 1;
+  int k;
+  size_t total = 0;
+  if (!lua_getrange(L, 1, i, i + n - 1))
+    return 0;
+  for (k = 0; k < n; k++) {
+    size_t l;
+    const char *s;
+    if (lua_type(L, base + k) != LUA_TSTRING) {
+      lua_pop(L, n);
+      return 0;
+    }
+    s = lua_tolstring(L, base + k, &l);
+    if (i + k == last)
+      lsep = 0;  /* no separator after the last element */
+    if (l_unlikely(l + lsep > MAX_SIZE - total))
+      luaL_error(L, "resulting string too large");
+    if (p != NULL) {
+      memcpy(p + total, s, l);
+      memcpy(p + total + l, sep, lsep);
+    }
+    total += l + lsep;
+  }
+  lua_pop(L, n);
+  *len = total;
+  return 1;
+}
+
+
+/*
+** 'concat' for strings in a plain array part: a first pass checks the
+** elements and computes the length of the result; a second pass copies
+** them straight into a buffer with that size. Returns 0 (leaving
+** nothing on the stack) if some block of the range does not qualify.
+*/
+static int arrayconcat (lua_State *L, const char *sep, size_t lsep,
+                        lua_Integer i, lua_Integer last) {
+  luaL_Buffer b;
+  size_t total = 0;
+  lua_Integer k;
+  char *p;
+  luaL_checkstack(L, CONCATBLOCK + 1, NULL);  /* blocks + buffer */
+  for (k = i; k <= last; k += CONCATBLOCK) {
+    size_t len;
+    if (!concatblock(L, k, last, sep, lsep, NULL, &len))
+      return 0;
+    if (l_unlikely(len > MAX_SIZE - total))
+      luaL_error(L, "resulting string too large");
+    total += len;
+  }
+  p = luaL_buffinitsize(L, &b, total);
+  for (k = i; k <= last; k += CONCATBLOCK) {
+    size_t len;
+    concatblock(L, k, last, sep, lsep, p, &len);
+    p += len;
+  }
+  luaL_pushresultsize(&b, total);
+  return 1;
+}
+
+
 static int tconcat (lua_State *L) {
   luaL_Buffer b;
   lua_Integer last = aux_getn(L, 1, TAB_R);
@@ -171,6 +282,9 @@ static int tconcat (lua_State *L) {
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   lua_Integer i = luaL_optinteger(L, 3, 1);
   last = luaL_optinteger(L, 4, last);
+  if (i <= last && l_castS2U(last) - l_castS2U(i) >= CONCATMIN &&
+      arrayconcat(L, sep, lsep, i, last))
+    return 1;
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -211,6 +325,8 @@ static int tunpack (lua_State *L) {
   if (l_unlikely(n >= (unsigned int)INT_MAX  ||
                  !lua_checkstack(L, (int)(++n))))
     return luaL_error(L, "too many results to unpack");
+  if (lua_getrange(L, 1, i, e))  /* plain array part? */
+    return (int)n;  /* pushed all elements in one go */
   for (; i < e; i++) {  /* push arg[i..e - 1] (to avoid overflows) */
     lua_geti(L, 1, i);
   }
@@ -224,9 +340,17 @@ static int tunpack (lua_State *L) {
 
 /*
 ** {======================================================
-** Quicksort
-** (based on 'Algorithms in MODULA-3', Robert Sedgewick;
-**  Addison-Wesley, 1993.)
+** Sort
+** Without an order function, arrays of integers, floats, or strings
+** are sorted by the core ('lua_sortrange'). Other arrays use a
+** pattern-defeating quicksort (based on 'pdqsort', Orson Peters, 2021):
+** insertion sort for small ranges, median-of-three or Tukey's ninther
+** pivots, a partition that puts elements equal to the previous pivot
+** aside, detection of already partitioned ranges, and a heap sort when
+** partitions keep being too unbalanced.
+** Stable sorts and sorts by keys ('table.sortby') sort a table of
+** indices instead, comparing the keys of the indices and breaking ties
+** by the indices themselves; typed keys are again sorted by the core.
 ** =======================================================
 */
 
@@ -243,19 +367,17 @@ typedef unsigned int IdxT;
 #define seti(L,idt,idx)	lua_seti(L, idt, l_castU2S(idx))
 
 
-/*
-** Produce a "random" 'unsigned int' to randomize pivot choice. This
-** macro is used only when 'sort' detects a big imbalance in the result
-** of a partition. (If you don't want/need this "randomness", ~0 is a
-** good choice.)
-*/
-#if !defined(l_randomizePivot)
-#define l_randomizePivot(L)	luaL_makeseed(L)
-#endif					/* } */
+/* ranges with up to this number of elements are sorted by insertion */
+#define SMALLSORT	24u
 
+/* ranges larger than this use Tukey's ninther to choose their pivots */
+#define NINTHERLIMIT	128u
 
-/* arrays larger than 'RANLIMIT' may use randomized pivots */
-#define RANLIMIT	100u
+/*
+** maximum number of moves in the insertion sorts that try to finish
+** ranges that were already partitioned
+*/
+#define PARTIALLIMIT	8u
 
 
 static void set2 (lua_State *L, IdxT i, IdxT j) {
@@ -264,11 +386,19 @@ static void set2 (lua_State *L, IdxT i, IdxT j) {
 }
 
 
+/*
+** The array being sorted is at stack index 1 and the order function
+** (or nil) at index 2. In a sort by keys, the table of keys is at index
+** 3, the stable flag at index 4, and the array has indices of keys;
+** otherwise, indices 3 and 4 are nil.
+*/
+
+
 /*
 ** Return true iff value at stack index 'a' is less than the value at
-** index 'b' (according to the order of the sort).
+** index 'b' (according to the order function).
 */
-static int sort_comp (lua_State *L, int a, int b) {
+static int lessthan (lua_State *L, int a, int b) {
   if (lua_isnil(L, 2))  /* no function? */
     return lua_compare(L, a, b, LUA_OPLT);  /* a < b */
   else {  /* function */
@@ -285,120 +415,415 @@ static int sort_comp (lua_State *L, int a, int b) {
 
 
 /*
-** Does the partition: Pivot P is at the top of the stack.
-** precondition: a[lo] <= P == a[up-1] <= a[up],
-** so it only needs to do the partition from lo + 1 to up - 2.
-** Pos-condition: a[lo .. i - 1] <= a[i] == P <= a[i + 1 .. up]
-** returns 'i'.
+** Return true iff value at stack index 'a' is less than the value at
+** index 'b' (according to the order of the sort). When sorting by keys,
+** their keys are compared; in a stable sort, indices with equal keys
+** keep their relative order.
 */
-static IdxT partition (lua_State *L, IdxT lo, IdxT up) {
-  IdxT i = lo;  /* will be incremented before first use */
-  IdxT j = up - 1;  /* will be decremented before first use */
-  /* loop invariant: a[lo .. i] <= P <= a[j .. up] */
+static int sort_comp (lua_State *L, int a, int b) {
+  if (lua_type(L, 3) != LUA_TTABLE)  /* not sorting by keys? */
+    return lessthan(L, a, b);
+  else {
+    lua_Integer ia = lua_tointeger(L, a);
+    lua_Integer ib = lua_tointeger(L, b);
+    int res;
+    lua_rawgeti(L, 3, ia);
+    lua_rawgeti(L, 3, ib);
+    res = lessthan(L, -2, -1);
+    if (!res && ia < ib && lua_toboolean(L, 4))  /* stable? */
+      res = !lessthan(L, -1, -2);  /* equal keys keep their order */
+    lua_pop(L, 2);
+    return res;
+  }
+}
+
+
+static void swapidx (lua_State *L, IdxT i, IdxT j) {
+  geti(L, 1, i);
+  geti(L, 1, j);
+  set2(L, i, j);
+}
+
+
+/* a[i] < a[j]? */
+static int lessidx (lua_State *L, IdxT i, IdxT j) {
+  int res;
+  geti(L, 1, i);
+  geti(L, 1, j);
+  res = sort_comp(L, -2, -1);
+  lua_pop(L, 2);
+  return res;
+}
+
+
+/* a[i] < P, with the pivot P at the top of the stack? */
+static int ltpivot (lua_State *L, IdxT i) {
+  int res;
+  geti(L, 1, i);
+  res = sort_comp(L, -1, -2);
+  lua_pop(L, 1);
+  return res;
+}
+
+
+/* P < a[i], with the pivot P at the top of the stack? */
+static int gtpivot (lua_State *L, IdxT i) {
+  int res;
+  geti(L, 1, i);
+  res = sort_comp(L, -2, -1);
+  lua_pop(L, 1);
+  return res;
+}
+
+
+/* sort elements 'i' and 'j' */
+static void sort2 (lua_State *L, IdxT i, IdxT j) {
+  geti(L, 1, i);
+  geti(L, 1, j);
+  if (sort_comp(L, -1, -2))  /* a[j] < a[i]? */
+    set2(L, i, j);  /* swap a[i] - a[j] */
+  else
+    lua_pop(L, 2);  /* remove both values */
+}
+
+
+/* sort elements 'i', 'j', and 'k' */
+static void sort3 (lua_State *L, IdxT i, IdxT j, IdxT k) {
+  sort2(L, i, j);
+  sort2(L, j, k);
+  sort2(L, i, j);
+}
+
+
+/*
+** Insertion sort of a[lo .. up]. Gives up (returning false) once it
+** has moved more than 'limit' elements and there are still elements to
+** insert.
+*/
+static int insertionsort (lua_State *L, IdxT lo, IdxT up, IdxT limit) {
+  IdxT moved = 0;
+  IdxT i;
+  for (i = lo + 1; i <= up; i++) {
+    IdxT j = i;
+    geti(L, 1, i);  /* element to be inserted */
+    while (j > lo) {
+      geti(L, 1, j - 1);
+      if (!sort_comp(L, -2, -1)) {  /* not a[i] < a[j - 1]? */
+        lua_pop(L, 1);  /* remove a[j - 1] */
+        break;
+      }
+      seti(L, 1, j--);  /* a[j] = a[j - 1] */
+    }
+    if (j == i)  /* already in place? */
+      lua_pop(L, 1);
+    else {
+      seti(L, 1, j);  /* put element in its place */
+      moved += i - j;
+      if (moved > limit && i < up)
+        return 0;
+    }
+  }
+  return 1;
+}
+
+
+/* move down element 'lo + i' in the max-heap of 'n' elements at 'lo' */
+static void siftdown (lua_State *L, IdxT lo, IdxT i, IdxT n) {
   for (;;) {
-    /* next loop: repeat ++i while a[i] < P */
-    while ((void)geti(L, 1, ++i), sort_comp(L, -1, -2)) {
-      if (l_unlikely(i == up - 1))  /* a[up - 1] < P == a[up - 1] */
+    IdxT c = 2 * i + 1;  /* first child */
+    if (c >= n)
+      break;
+    if (c + 1 < n && lessidx(L, lo + c, lo + c + 1))
+      c++;  /* second child is larger */
+    if (!lessidx(L, lo + i, lo + c))
+      break;
+    swapidx(L, lo + i, lo + c);
+    i = c;
+  }
+}
+
+
+static void heapsort (lua_State *L, IdxT lo, IdxT up) {
+  IdxT n = up - lo + 1;
+  IdxT i;
+  for (i = n / 2; i-- > 0; )
+    siftdown(L, lo, i, n);
+  while (n > 1) {
+    swapidx(L, lo, lo + --n);  /* move largest to the end */
+    siftdown(L, lo, 0, n);
+  }
+}
+
+
+/*
+** Partitions a[lo .. up] around the pivot P = a[lo]: elements less
+** than P go to its left, the others to its right. Some element after
+** 'lo' is not less than P (ensured by the choice of the pivot). Returns
+** the final position of P and sets '*done' if no element was moved.
+** The checks against the bounds only catch invalid order functions.
+*/
+static IdxT partright (lua_State *L, IdxT lo, IdxT up, int *done) {
+  IdxT i = lo;
+  IdxT j = up + 1;
+  geti(L, 1, lo);  /* push Pivot */
+  while (ltpivot(L, ++i)) {  /* find first a[i] >= P */
+    if (l_unlikely(i == up))  /* no element >= P? */
+      luaL_error(L, "invalid order function for sorting");
+  }
+  /* a[lo + 1 .. i - 1] < P <= a[i] */
+  if (i - 1 == lo) {  /* no element less than P yet? */
+    while (i < j && !ltpivot(L, --j))  /* find last a[j] < P, if any */
+      ;
+  }
+  else {
+    while (!ltpivot(L, --j)) {  /* find last a[j] < P */
+      if (l_unlikely(j < i))  /* a[j] >= P, but a[lo + 1 .. i - 1] < P */
+        luaL_error(L, "invalid order function for sorting");
+    }
+  }
+  *done = (i >= j);
+  while (i < j) {  /* a[i] >= P > a[j]: swap them and go on */
+    swapidx(L, i, j);
+    while (ltpivot(L, ++i)) {
+      if (l_unlikely(i == up))  /* a[up] < P, but a[j] >= P */
+        luaL_error(L, "invalid order function for sorting");
+    }
+    while (!ltpivot(L, --j)) {
+      if (l_unlikely(j < i))  /* a[j] >= P, but a[i - 1] < P */
+        luaL_error(L, "invalid order function for sorting");
+    }
+  }
+  lua_pop(L, 1);  /* remove Pivot */
+  swapidx(L, lo, i - 1);  /* put Pivot at its final position */
+  return i - 1;
+}
+
+
+/*
+** Partitions a[lo .. up] around the pivot P = a[lo], putting elements
+** equal to P to its left. Used when P equals a[lo - 1], a previous
+** pivot that is not greater than any element in the range: then all
+** elements on the left of P are equal to it and already in their final
+** positions. Returns the final position of P.
+*/
+static IdxT partleft (lua_State *L, IdxT lo, IdxT up) {
+  IdxT i = lo;
+  IdxT j = up + 1;
+  geti(L, 1, lo);  /* push Pivot */
+  while (gtpivot(L, --j)) {  /* find last a[j] <= P */
+    if (l_unlikely(j == lo))  /* P < a[lo] == P? */
+      luaL_error(L, "invalid order function for sorting");
+  }
+  /* a[j] <= P < a[j + 1 .. up] */
+  if (j == up) {  /* no element greater than P yet? */
+    while (i < j && !gtpivot(L, ++i))  /* find first a[i] > P, if any */
+      ;
+  }
+  else {
+    while (!gtpivot(L, ++i)) {  /* find first a[i] > P */
+      if (l_unlikely(i > j))  /* a[i] <= P, but a[j + 1 .. up] > P */
         luaL_error(L, "invalid order function for sorting");
-      lua_pop(L, 1);  /* remove a[i] */
     }
-    /* after the loop, a[i] >= P and a[lo .. i - 1] < P  (a) */
-    /* next loop: repeat --j while P < a[j] */
-    while ((void)geti(L, 1, --j), sort_comp(L, -3, -1)) {
-      if (l_unlikely(j < i))  /* j <= i - 1 and a[j] > P, contradicts (a) */
+  }
+  while (i < j) {  /* a[i] > P >= a[j]: swap them and go on */
+    swapidx(L, i, j);
+    while (gtpivot(L, --j)) {
+      if (l_unlikely(j <= i))  /* a[j] > P, but a[i] <= P */
         luaL_error(L, "invalid order function for sorting");
-      lua_pop(L, 1);  /* remove a[j] */
     }
-    /* after the loop, a[j] <= P and a[j + 1 .. up] >= P */
-    if (j < i) {  /* no elements out of place? */
-      /* a[lo .. i - 1] <= P <= a[j + 1 .. i .. up] */
-      lua_pop(L, 1);  /* pop a[j] */
-      /* swap pivot (a[up - 1]) with a[i] to satisfy pos-condition */
-      set2(L, up - 1, i);
-      return i;
+    while (!gtpivot(L, ++i)) {
+      if (l_unlikely(i > j))  /* a[i] <= P, but a[j + 1] > P */
+        luaL_error(L, "invalid order function for sorting");
     }
-    /* otherwise, swap a[i] - a[j] to restore invariant and repeat */
-    set2(L, i, j);
   }
+  lua_pop(L, 1);  /* remove Pivot */
+  swapidx(L, lo, j);  /* put Pivot at its final position */
+  return j;
 }
 
 
 /*
-** Choose an element in the middle (2nd-3th quarters) of [lo,up]
-** "randomized" by 'rnd'
+** Swaps a few elements of a range [lo, up] of 'n' elements left badly
+** unbalanced by a partition, so that the next pivot choices see
+** different values.
 */
-static IdxT choosePivot (IdxT lo, IdxT up, unsigned int rnd) {
-  IdxT r4 = (up - lo) / 4;  /* range/4 */
-  IdxT p = (rnd ^ lo ^ up) % (r4 * 2) + (lo + r4);
-  lua_assert(lo + r4 <= p && p <= up - r4);
-  return p;
+static void breakpatterns (lua_State *L, IdxT lo, IdxT up, IdxT n) {
+  IdxT q = n / 4;
+  swapidx(L, lo, lo + q);
+  swapidx(L, up, up + 1 - q);
+  if (n > NINTHERLIMIT) {
+    swapidx(L, lo + 1, lo + q + 1);
+    swapidx(L, lo + 2, lo + q + 2);
+    swapidx(L, up - 1, up - q);
+    swapidx(L, up - 2, up - q - 1);
+  }
 }
 
 
 /*
-** Quicksort algorithm (recursive function)
+** Pattern-defeating quicksort (recursive function). 'bad' is the
+** number of highly unbalanced partitions still allowed before giving
+** up and doing a heap sort.
 */
-static void auxsort (lua_State *L, IdxT lo, IdxT up, unsigned rnd) {
-  while (lo < up) {  /* loop for tail recursion */
+static void auxsort (lua_State *L, IdxT lo, IdxT up, int bad) {
+  while (up - lo + 1 > SMALLSORT) {  /* loop for tail recursion */
+    IdxT size = up - lo + 1;
+    IdxT half = size / 2;
     IdxT p;  /* Pivot index */
-    IdxT n;  /* to be used later */
-    /* sort elements 'lo', 'p', and 'up' */
-    geti(L, 1, lo);
-    geti(L, 1, up);
-    if (sort_comp(L, -1, -2))  /* a[up] < a[lo]? */
-      set2(L, lo, up);  /* swap a[lo] - a[up] */
-    else
-      lua_pop(L, 2);  /* remove both values */
-    if (up - lo == 1)  /* only 2 elements? */
-      return;  /* already sorted */
-    if (up - lo < RANLIMIT || rnd == 0)  /* small interval or no randomize? */
-      p = (lo + up)/2;  /* middle element is a good pivot */
-    else  /* for larger intervals, it is worth a random pivot */
-      p = choosePivot(lo, up, rnd);
-    geti(L, 1, p);
-    geti(L, 1, lo);
-    if (sort_comp(L, -2, -1))  /* a[p] < a[lo]? */
-      set2(L, p, lo);  /* swap a[p] - a[lo] */
-    else {
-      lua_pop(L, 1);  /* remove a[lo] */
-      geti(L, 1, up);
-      if (sort_comp(L, -1, -2))  /* a[up] < a[p]? */
-        set2(L, p, up);  /* swap a[up] - a[p] */
-      else
-        lua_pop(L, 2);
+    IdxT ls, rs;  /* sizes of the two partitions */
+    int done;
+    if (size > NINTHERLIMIT) {  /* median of medians into a[lo] */
+      sort3(L, lo, lo + half, up);
+      sort3(L, lo + 1, lo + half - 1, up - 1);
+      sort3(L, lo + 2, lo + half + 1, up - 2);
+      sort3(L, lo + half - 1, lo + half, lo + half + 1);
+      swapidx(L, lo, lo + half);
+    }
+    else  /* median of three into a[lo] (and a[up] >= a[lo]) */
+      sort3(L, lo + half, lo, up);
+    /* all ranges but the first one follow a previous pivot */
+    if (lo > 1 && !lessidx(L, lo - 1, lo)) {  /* same pivot as before? */
+      lo = partleft(L, lo, up) + 1;  /* skip elements equal to it */
+      continue;
+    }
+    p = partright(L, lo, up, &done);
+    ls = p - lo;
+    rs = up - p;
+    if (ls < size / 8 || rs < size / 8) {  /* partition too unbalanced? */
+      if (--bad == 0) {
+        heapsort(L, lo, up);
+        return;
+      }
+      if (ls >= SMALLSORT)
+        breakpatterns(L, lo, p - 1, ls);
+      if (rs >= SMALLSORT)
+        breakpatterns(L, p + 1, up, rs);
     }
-    if (up - lo == 2)  /* only 3 elements? */
-      return;  /* already sorted */
-    geti(L, 1, p);  /* get middle element (Pivot) */
-    lua_pushvalue(L, -1);  /* push Pivot */
-    geti(L, 1, up - 1);  /* push a[up - 1] */
-    set2(L, p, up - 1);  /* swap Pivot (a[p]) with a[up - 1] */
-    p = partition(L, lo, up);
-    /* a[lo .. p - 1] <= a[p] == P <= a[p + 1 .. up] */
-    if (p - lo < up - p) {  /* lower interval is smaller? */
-      auxsort(L, lo, p - 1, rnd);  /* call recursively for lower interval */
-      n = p - lo;  /* size of smaller interval */
+    else if (done && insertionsort(L, lo, p - 1, PARTIALLIMIT)
+                  && insertionsort(L, p + 1, up, PARTIALLIMIT))
+      return;  /* range was already sorted (or nearly so) */
+    if (ls < rs) {  /* lower interval is smaller? */
+      auxsort(L, lo, p - 1, bad);  /* call recursively for lower interval */
       lo = p + 1;  /* tail call for [p + 1 .. up] (upper interval) */
     }
     else {
-      auxsort(L, p + 1, up, rnd);  /* call recursively for upper interval */
-      n = up - p;  /* size of smaller interval */
+      auxsort(L, p + 1, up, bad);  /* call recursively for upper interval */
       up = p - 1;  /* tail call for [lo .. p - 1]  (lower interval) */
     }
-    if ((up - lo) / 128 > n) /* partition too imbalanced? */
-      rnd = l_randomizePivot(L);  /* try a new randomization */
-  }  /* tail call auxsort(L, lo, up, rnd) */
+  }  /* tail call auxsort(L, lo, up, bad) */
+  insertionsort(L, lo, up, ~0u);
+}
+
+
+/* unbalanced partitions allowed when sorting 'n' elements: log2(n) */
+static int badlimit (IdxT n) {
+  int bad = 0;
+  for (; n > 1; n >>= 1)
+    bad++;
+  return bad;
+}
+
+
+/*
+** Sort by keys: the stack has the array at index 1, the order function
+** (or nil) at index 2, its keys at index 3, the stable flag at index 4,
+** and a copy of its values at index 5. If the core can sort the keys,
+** the values move with them. Otherwise, the indices 1 .. n are sorted
+** by their keys and then pick the values.
+*/
+static void sortkeys (lua_State *L, IdxT n) {
+  IdxT i;
+  if (lua_isnil(L, 2) && lua_sortrange(L, 3, 1, n, 5)) {
+    if (!lua_moverange(L, 5, 1, n, 1, 1)) {
+      for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, 5, i);
+        seti(L, 1, i);
+      }
+    }
+    return;
+  }
+  lua_createtable(L, (int)n, 0);  /* indices (index 6) */
+  for (i = 1; i <= n; i++) {
+    lua_pushinteger(L, i);
+    lua_rawseti(L, 6, i);
+  }
+  lua_pushvalue(L, 1);  /* array goes to index 7 */
+  lua_copy(L, 6, 1);  /* indices are sorted */
+  auxsort(L, 1, n, badlimit(n));
+  for (i = 1; i <= n; i++) {  /* array[i] = values[indices[i]] */
+    lua_rawgeti(L, 1, i);
+    lua_rawgeti(L, 5, lua_tointeger(L, -1));
+    seti(L, 7, i);
+    lua_pop(L, 1);  /* remove index */
+  }
+}
+
+
+/* push a table with a copy of a[1 .. n] */
+static void copyarray (lua_State *L, IdxT n) {
+  IdxT i;
+  lua_createtable(L, (int)n, 0);
+  if (!lua_moverange(L, 1, 1, n, -1, 1)) {
+    for (i = 1; i <= n; i++) {
+      geti(L, 1, i);
+      lua_rawseti(L, -2, i);
+    }
+  }
 }
 
 
 static int sort (lua_State *L) {
   lua_Integer n = aux_getn(L, 1, TAB_RW);
   if (n > 1) {  /* non-trivial interval? */
+    int stable = lua_toboolean(L, 3);
     luaL_argcheck(L, n < INT_MAX, 1, "array too big");
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
-    auxsort(L, 1, (IdxT)n, 0);
+    if (lua_isnil(L, 2) && lua_sortrange(L, 1, 1, n, stable ? 1 : 0))
+      return 0;  /* typed array sorted by the core */
+    if (!stable) {
+      lua_settop(L, 4);  /* not sorting by keys */
+      auxsort(L, 1, (IdxT)n, badlimit((IdxT)n));
+    }
+    else {  /* sort by keys, each value being its own key */
+      copyarray(L, (IdxT)n);  /* keys */
+      lua_pushboolean(L, 1);  /* stable */
+      lua_pushvalue(L, 3);  /* values */
+      sortkeys(L, (IdxT)n);
+    }
+  }
+  return 0;
+}
+
+
+/*
+** table.sortby(t, key [, stable]): sorts 't' by the keys 'key(t[i])',
+** compared with '<'. 'key' is called once for each element.
+*/
+static int sortby (lua_State *L) {
+  lua_Integer n = aux_getn(L, 1, TAB_RW);
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  if (n > 1) {  /* non-trivial interval? */
+    IdxT i;
+    luaL_argcheck(L, n < INT_MAX, 1, "array too big");
+    lua_settop(L, 3);
+    lua_createtable(L, (int)n, 0);  /* keys */
+    lua_pushboolean(L, lua_toboolean(L, 3));  /* stable */
+    lua_createtable(L, (int)n, 0);  /* values */
+    for (i = 1; i <= n; i++) {
+      geti(L, 1, i);
+      lua_pushvalue(L, 2);
+      lua_pushvalue(L, -2);
+      lua_call(L, 1, 1);  /* key(t[i]) */
+      lua_rawseti(L, 4, i);
+      lua_rawseti(L, 6, i);
+    }
+    lua_rotate(L, 3, -1);  /* move 3rd argument to the top... */
+    lua_pop(L, 1);  /* ...and remove it */
+    lua_pushnil(L);
+    lua_replace(L, 2);  /* keys are compared with '<' */
+    sortkeys(L, (IdxT)n);
   }
   return 0;
 }
@@ -407,6 +832,8 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"clear", tclear},
+  {"clone", tclone},
   {"concat", tconcat},
   {"create", tcreate},
   {"insert", tinsert},
@@ -415,6 +842,7 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"sortby", sortby},
   {NULL, NULL}
 };
 
@@ -37,6 +37,8 @@ static lua_State *globalL = NULL;
 
 static const char *progname = LUA_PROGNAME;
 
+static const char *profname = NULL;  /* output file for option '-P' */
+
 
 #if defined(LUA_USE_POSIX)   /* { */
 
@@ -83,7 +85,7 @@ static void laction (int i) {
 
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
-  if (badoption[1] == 'e' || badoption[1] == 'l')
+  if (badoption[1] == 'e' || badoption[1] == 'l' || badoption[1] == 'P')
     lua_writestringerror("'%s' needs argument\n", badoption);
   else
     lua_writestringerror("unrecognized option '%s'\n", badoption);
@@ -94,6 +96,7 @@ static void print_usage (const char *badoption) {
   "  -i        enter interactive mode after executing 'script'\n"
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
+  "  -P file   write a sampling profile of the run to 'file'\n"
   "  -v        show version information\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
@@ -326,7 +329,8 @@ static int collectargs (char **argv, int *first) {
         break;
       case 'e':
         args |= has_e;  /* FALLTHROUGH */
-      case 'l':  /* both options need an argument */
+      case 'l':  /* these options need an argument */
+      case 'P':
         if (argv[i][2] == '\0') {  /* no concatenated argument? */
           i++;  /* try next 'argv' */
           if (argv[i] == NULL || argv[i][0] == '-')
@@ -342,9 +346,46 @@ static int collectargs (char **argv, int *first) {
 }
 
 
+/*
+** Calls function 'fname' from the profile library, with an optional
+** string argument. A result of fail plus a message is reported as an
+** error.
+*/
+static int doprofile (lua_State *L, const char *fname, const char *arg) {
+  int status;
+  luaL_requiref(L, LUA_PROFLIBNAME, luaopen_profile, 0);
+  lua_getfield(L, -1, fname);
+  lua_remove(L, -2);  /* remove library */
+  if (arg != NULL)
+    lua_pushstring(L, arg);
+  status = docall(L, (arg != NULL), 2);
+  if (status == LUA_OK) {
+    if (!lua_toboolean(L, -2) && lua_type(L, -1) == LUA_TSTRING) {
+      lua_remove(L, -2);  /* leave only the message */
+      status = LUA_ERRRUN;
+    }
+    else lua_pop(L, 2);
+  }
+  return report(L, status);
+}
+
+
+/*
+** Stops the profiler started by option '-P' and writes its stacks in
+** folded format to the file given to that option. (Called in protected
+** mode after the main script finishes, even if it fails.)
+*/
+static int pprofile (lua_State *L) {
+  int ok = (doprofile(L, "stop", NULL) == LUA_OK) &&
+           (doprofile(L, "dump", profname) == LUA_OK);
+  lua_pushboolean(L, ok);
+  return 1;
+}
+
+
 /*
 ** Processes options 'e' and 'l', which involve running Lua code, and
-** 'W', which also affects the state.
+** 'W' and 'P', which also affect the state.
 ** Returns 0 if some code raises an error.
 */
 static int runargs (lua_State *L, char **argv, int n) {
@@ -368,6 +409,14 @@ static int runargs (lua_State *L, char **argv, int n) {
       case 'W':
         lua_warning(L, "@on", 0);  /* warnings on */
         break;
+      case 'P': {
+        char *fname = argv[i] + 2;
+        if (*fname == '\0') fname = argv[++i];
+        lua_assert(fname != NULL);
+        if (doprofile(L, "start", NULL) != LUA_OK) return 0;
+        profname = fname;  /* profile must be written at the end */
+        break;
+      }
     }
   }
   return 1;
@@ -760,6 +809,11 @@ int main (int argc, char **argv) {
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
+  if (profname != NULL) {  /* option '-P'? */
+    lua_pushcfunction(L, &pprofile);
+    if (report(L, lua_pcall(L, 0, 1, 0)) != LUA_OK || !lua_toboolean(L, -1))
+      result = 0;
+  }
   lua_close(L);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
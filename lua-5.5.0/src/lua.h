@@ -1213,6 +1213,21 @@ LUA_API int(lua_rawgetp)(lua_State *L, int idx, const void *p);
 */
 LUA_API void(lua_createtable)(lua_State *L, int narr, int nrec);
 
+/*
+** 复制表与清空表
+**
+** lua_clonetable: 压入索引 idx 处的表的浅拷贝:键和值相同(原始访问,不调用
+**   __pairs 等元方法),数组部分和哈希部分的大小也相同;元表不复制
+** lua_cleartable: 删除索引 idx 处的表的所有项,但保留已分配的数组部分和
+**   哈希部分,之后插入的新项可以直接使用;元表不变
+**
+** 说明:
+** - 两者都按整块内存复制或重置,不逐个插入键
+** - 在遍历(lua_next)过程中清空表,之后不能再继续该遍历
+*/
+LUA_API void(lua_clonetable)(lua_State *L, int idx);
+LUA_API void(lua_cleartable)(lua_State *L, int idx);
+
 /*
 ** 创建新的完整用户数据
 **
@@ -1336,6 +1351,30 @@ LUA_API void(lua_rawset)(lua_State *L, int idx);
 */
 LUA_API void(lua_rawseti)(lua_State *L, int idx, lua_Integer n);
 
+/*
+** 批量访问表的数组部分 (快速路径)
+**
+** lua_getrange: 压入 t[i], t[i+1], ..., t[e] (调用者须已用 lua_checkstack
+**   预留空间)
+** lua_moverange: 对 k = 0..e-f 执行 tt[t+k] = ft[f+k] (ft、tt 分别是索引
+**   from、to 处的表),结果如同 memmove,即两段重叠时与按合适方向逐个复制相同
+** lua_sortrange: 按默认的 '<' 顺序对 t[i..e] 排序(同 table.sort 不带比较函数),
+**   只处理全是整数、全是浮点数(不含 NaN)或全是字符串的区间。vidx 不为 0 时
+**   排序是稳定的,并且索引 vidx 处的表 v 中 v[i..e] 随之做同样的重排
+**   (v 可以就是 t;v[i..e] 也必须在数组部分内且不含 nil)
+**
+** 返回值: 1 表示已完成; 0 表示什么也没做: 值不是表、区间不全在数组部分内,
+**   或者可能触发 __index/__newindex 元方法(lua_sortrange: 区间中有空槽位或
+**   其他类型的值)。此时调用者应改用 lua_geti/lua_seti
+**
+** 用途: 表库中 insert/remove/move/concat/unpack/sort 等函数避免逐个元素调用 API
+*/
+LUA_API int(lua_getrange)(lua_State *L, int idx, lua_Integer i, lua_Integer e);
+LUA_API int(lua_moverange)(lua_State *L, int from, lua_Integer f,
+                           lua_Integer e, int to, lua_Integer t);
+LUA_API int(lua_sortrange)(lua_State *L, int idx, lua_Integer i, lua_Integer e,
+                           int vidx);
+
 /*
 ** 原始设置 (指针键)
 */
@@ -1573,6 +1612,17 @@ LUA_API int(lua_isyieldable)(lua_State *L);
 */
 LUA_API void(lua_setwarnf)(lua_State *L, lua_WarnFunction f, void *ud);
 
+/*
+** 设置原始的 'next' 函数
+**
+** 参数:
+** - lua_CFunction f: 语义与 lua_next 相同的迭代函数
+**
+** 说明: 以 f 为迭代函数遍历表的泛型 for 循环直接在虚拟机中完成
+**       每一步,不再调用 f (基础库用它注册 'next')
+*/
+LUA_API void(lua_setnextf)(lua_State *L, lua_CFunction f);
+
 /*
 ** 发出警告
 **
@@ -1648,6 +1698,74 @@ LUA_API void(lua_warning)(lua_State *L, const char *msg, int tocont);
 */
 LUA_API int(lua_gc)(lua_State *L, int what, ...);
 
+/*
+** JIT 控制
+**
+** 参数: int mode - 1 开启, 0 关闭, -1 只查询
+**
+** 返回值: 之前是否开启; Lua 未以 LUA_USE_JIT 构建时总是 0
+*/
+LUA_API int(lua_jit)(lua_State *L, int mode);
+
+/*
+** 操作码统计(需要以 LUA_USE_OPSTATS 构建)
+**
+** lua_opstat: 把操作码 op 的统计写入 stats(LUA_OPSTATSIZE 个元素):
+**   执行次数、抽样次数、样本周期总数，以及 LUA_OPSTATBUCKETS 个直方图桶
+**   (第 b 个桶计数周期数在 [2^b, 2^(b+1)) 之间的样本)
+**   返回值: 操作码名称; op 超出范围或未插桩时返回 NULL
+**
+** lua_resetopstats: 清零所有统计(包括每条指令的计数)
+**
+** lua_opcounts: 若索引处是 Lua 函数且有每条指令的计数(LUA_USE_OPSTATS 为 2),
+**   压入一个序列(第 i 项为第 i 条指令的执行次数)并返回 1; 否则返回 0
+*/
+#define LUA_OPSTATBUCKETS 16
+#define LUA_OPSTATSIZE (3 + LUA_OPSTATBUCKETS)
+
+LUA_API const char *(lua_opstat)(lua_State *L, int op, lua_Unsigned *stats);
+LUA_API void(lua_resetopstats)(lua_State *L);
+LUA_API int(lua_opcounts)(lua_State *L, int idx);
+
+/*
+** 表的内部统计
+**
+** lua_tablestats: 把索引处的表的统计写入 stats(LUA_TSSIZE 个元素),返回 1;
+**   idx 为 0 时汇总所有存活的表(遍历回收器的对象链表),返回表的个数
+**
+** 各项(除 LUA_TSMAXCHAIN 取最大值、LUA_TSFLAGS 只对单个表有意义外,汇总时都是总和):
+**   LUA_TSASIZE    数组部分的大小
+**   LUA_TSNODES    哈希部分的节点数(空哈希部分为 0)
+**   LUA_TSALIVE    数组部分中非空的项数
+**   LUA_TSHLIVE    哈希部分中存活的键数
+**   LUA_TSHDEAD    哈希部分中已删除(值为空但仍占着节点)的键数
+**   LUA_TSLENHINT  长度提示('#'的起点)
+**   LUA_TSMAXCHAIN 最长的查找链(链式版本中从主位置起经过的节点数,
+**                  开放寻址版本中探测的组数)
+**   LUA_TSCHAINS   所有存活键的查找链长度之和(除以 LUA_TSHLIVE 得平均值)
+**   LUA_TSNOTMAIN  不在主位置上的键数
+**   LUA_TSOLDNODES 渐进式重哈希中旧哈希部分的节点数(其中的键也计入上面各项)
+**   LUA_TSBYTES    表占用的内存字节数
+**   LUA_TSMETA     有元表的表的个数
+**   LUA_TSFLAGS    元表的 'flags'(第 i 位表示缓存了"没有第 i 个元方法")
+*/
+#define LUA_TSASIZE 0
+#define LUA_TSNODES 1
+#define LUA_TSALIVE 2
+#define LUA_TSHLIVE 3
+#define LUA_TSHDEAD 4
+#define LUA_TSLENHINT 5
+#define LUA_TSMAXCHAIN 6
+#define LUA_TSCHAINS 7
+#define LUA_TSNOTMAIN 8
+#define LUA_TSOLDNODES 9
+#define LUA_TSBYTES 10
+#define LUA_TSMETA 11
+#define LUA_TSFLAGS 12
+#define LUA_TSSIZE 13
+
+LUA_API int(lua_tablestats)(lua_State *L, int idx, lua_Unsigned *stats);
+
 /*
 ** ============================================================================
 ** 杂项函数
@@ -1697,6 +1815,28 @@ LUA_API int(lua_error)(lua_State *L);
 */
 LUA_API int(lua_next)(lua_State *L, int idx);
 
+/*
+** 用游标遍历表
+**
+** 参数:
+** - int idx: 表的索引
+** - lua_Unsigned *cursor: 遍历位置,开始时设为 0
+**
+** 返回值: 1 表示压入了下一个键和值,0 表示遍历结束(不压入任何值)
+**
+** 使用方法:
+** lua_Unsigned c = 0;
+** while (lua_nextat(L, t, &c)) {
+**     // 'key' 在 -2, 'value' 在 -1
+**     lua_pop(L, 2);
+** }
+**
+** 注意:
+** - 顺序与 lua_next 相同,但每一步不用再查找上一个键
+** - 遍历时不要给表添加新键
+*/
+LUA_API int(lua_nextat)(lua_State *L, int idx, lua_Unsigned *cursor);
+
 /*
 ** 连接字符串
 **
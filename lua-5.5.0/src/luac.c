@@ -17,6 +17,7 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "lualib.h"
 
 #include "lapi.h"
 #include "ldebug.h"
@@ -33,6 +34,7 @@ static void PrintFunction(const Proto* f, int full);
 #define OUTPUT		PROGNAME ".out"	/* default output file */
 
 static int listing=0;			/* list bytecodes? */
+static int counting=0;			/* run chunks and list counts? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
 static char Output[]={ OUTPUT };	/* default output file name */
@@ -61,6 +63,7 @@ static void usage(const char* message)
  fprintf(stderr,
   "usage: %s [options] [filenames]\n"
   "Available options are:\n"
+  "  -c       run chunks, then list how many times each instruction ran\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
   "  -p       parse only\n"
@@ -91,6 +94,15 @@ static int doargs(int argc, char* argv[])
   }
   else if (IS("-"))			/* end of options; use stdin */
    break;
+  else if (IS("-c"))			/* count */
+  {
+#if LUA_USE_OPSTATS >= 2
+   counting=1;
+   if (!listing) listing=1;
+#else
+   usage("'-c' needs Lua built with LUA_USE_OPSTATS=2");
+#endif
+  }
   else if (IS("-l"))			/* list */
    ++listing;
   else if (IS("-o"))			/* output file */
@@ -179,6 +191,15 @@ static int pmain(lua_State* L)
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
  }
+ if (counting)
+ {
+  luaL_openlibs(L);
+  for (i=0; i<argc; i++)
+  {
+   lua_pushvalue(L,3+i);		/* chunk (after 'argc' and 'argv') */
+   if (lua_pcall(L,0,0,0)!=LUA_OK) fatal(lua_tostring(L,-1));
+  }
+ }
  f=combine(L,argc);
  if (listing) luaU_print(f,listing>1);
  if (dumping)
@@ -339,7 +360,7 @@ static void PrintCode(const Proto* f)
  for (pc=0; pc<n; pc++)
  {
   Instruction i=code[pc];
-  OpCode o=GET_OPCODE(i);
+  OpCode o=GET_BASEOPCODE(i);	/* list quickened opcodes as original ones */
   int a=GETARG_A(i);
   int b=GETARG_B(i);
   int c=GETARG_C(i);
@@ -354,6 +375,9 @@ static void PrintCode(const Proto* f)
   int line=luaG_getfuncline(f,pc);
   printf("\t%d\t",pc+1);
   if (line>0) printf("[%d]\t",line); else printf("[-]\t");
+#if LUA_USE_OPSTATS >= 2
+  if (counting) printf("x" LUA_INTEGER_FMT "\t",(LUAI_UACINT)f->opcount[pc]);
+#endif
   printf("%-9s\t",opnames[o]);
   switch (o)
   {
@@ -661,6 +685,15 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_ADDII: case OP_ADDFF: case OP_SUBII: case OP_SUBFF:
+   case OP_MULII: case OP_MULFF: case OP_EQII: case OP_LTII:
+   case OP_LTFF: case OP_LEII: case OP_LEFF:
+   case OP_MOVE_CALL: case OP_LOADI_CALL: case OP_LOADK_CALL:
+   case OP_SELF_CALL: case OP_GETUPVAL_GETFIELD: case OP_GETTABUP_GETFIELD:
+   case OP_GETFIELD_GETFIELD: case OP_GETTABLE_GETFIELD:
+   case OP_GETTABLE_SELF: case OP_GETFIELD_RETURN1: case OP_LOADI_RETURN1:
+   case OP_SETFIELD_RETURN0:	/* not after GET_BASEOPCODE */
+	break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -426,6 +426,37 @@ LUAMOD_API int(luaopen_table)(lua_State *L);
 */
 LUAMOD_API int(luaopen_utf8)(lua_State *L);
 
+/*
+** ============================================================================
+** 采样分析器库 (Profile Library)
+** ============================================================================
+*/
+
+/*
+** 【库名称】采样分析器库的 Lua 访问名称
+*/
+#define LUA_PROFLIBNAME "profile"
+
+/*
+** 【函数声明】采样分析器库初始化函数
+**
+** 【功能】基于 SIGPROF 定时器的采样分析器(仅 POSIX 平台),包括:
+**   profile.start: 按给定间隔(微秒)开始采样
+**   profile.stop: 停止采样
+**   profile.running: 是否正在采样
+**   profile.reset: 清空已记录的调用栈
+**   profile.stacks: 返回 调用栈 -> 采样数 的表
+**   profile.dump: 以火焰图的折叠格式输出(返回字符串或写入文件)
+**
+** 【说明】信号处理函数只设置钩子,调用栈在下一个安全点由钩子记录
+**
+** 【注意】它不是 luaL_openlibs 打开的标准库之一(没有 LUA_XXXLIBK 标识位):
+**         它会接管整个进程的 SIGPROF 处理函数和定时器,沙箱宿主不应默认提供它。
+**         需要的宿主自己打开,例如 luaL_requiref(L, LUA_PROFLIBNAME, luaopen_profile, 1);
+**         独立解释器只在给出 -P 选项时才加载本库(且不设置全局变量)
+*/
+LUAMOD_API int(luaopen_profile)(lua_State *L);
+
 /*
 ** ============================================================================
 ** 库加载控制函数
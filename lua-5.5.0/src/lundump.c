@@ -15,6 +15,7 @@
 
 #include "lua.h"
 
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -195,7 +196,14 @@ static void loadCode (LoadState *S, Proto *f) {
     f->code = luaM_newvectorchecked(S->L, n, Instruction);
     f->sizecode = n;
     loadVector(S, f->code, n);
+    luaK_fuse(f->code, n);  /* fixed code is left as it is */
   }
+#if LUA_USE_ICACHE
+  luaF_initicache(S->L, f);
+#endif
+#if LUA_USE_OPSTATS >= 2
+  luaF_initopcount(S->L, f);
+#endif
 }
 
 
@@ -23,6 +23,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -96,6 +97,16 @@ static int l_strton (const TValue *obj, TValue *result) {
     TString *st = tsvalue(obj);
     size_t stlen;
     const char *s = getlstr(st, stlen);
+    if (l_unlikely(s[stlen] != '\0')) {  /* shorter view of a rope? */
+      /* end it temporarily; the numeral cannot use the following bytes */
+      char c = s[stlen];
+      size_t res;
+      lua_assert(st->shrlen == LSTRROPE);
+      st->contents[stlen] = '\0';
+      res = luaO_str2num(s, result);
+      st->contents[stlen] = c;
+      return (res == stlen + 1);
+    }
     return (luaO_str2num(s, result) == stlen + 1);
   }
 }
@@ -285,6 +296,35 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** A generic 'for' whose iterator is the raw 'next' (as registered with
+** 'lua_setnextf') over a table does each step directly, without calling
+** 'next'. The thread keeps in 'nextpos' the position of the traversal
+** after its last step (see 'luaH_nexthint'), so that, unless another
+** traversal came in between, the step does not need to find the
+** previous key again. The loop variables, including the hidden ones,
+** hold the same values as with a call to 'next'.
+*/
+#define israwnext(L,ra)  \
+  (ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->nextf &&  \
+   ttistable(s2v((ra) + 1)))
+
+
+/*
+** Execute a step of a traversal with the raw 'next' (opcode OP_TFORCALL),
+** leaving the next key and value, followed by 'nvars' - 2 nils, at
+** 'ra + 3', or nil at 'ra + 3' to end the loop.
+*/
+static void rawnext (lua_State *L, StkId ra, int nvars) {
+  if (!luaH_nexthint(L, hvalue(s2v(ra + 1)), &L->nextpos, ra + 3))
+    setnilvalue(s2v(ra + 3));  /* end of the traversal */
+  else {
+    for (; nvars > 2; nvars--)  /* extra variables get nil */
+      setnilvalue(s2v(ra + 2 + nvars));
+  }
+}
+
+
 /*
 ** Finish the table access 'val = t[key]' and return the tag of the result.
 */
@@ -386,13 +426,18 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** The code is a little tricky because it allows '\0' in the strings
 ** and it uses 'strcoll' (to respect locales) for each segment
 ** of the strings. Note that segments can compare equal but still
-** have different lengths.
+** have different lengths. (Ropes must be flattened to have their
+** ending '\0'.)
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+int luaV_strcmp (lua_State *L, TString *ts1, TString *ts2) {
   size_t rl1;  /* real length */
-  const char *s1 = getlstr(ts1, rl1);
+  const char *s1;
   size_t rl2;
-  const char *s2 = getlstr(ts2, rl2);
+  const char *s2;
+  luaS_flat(L, ts1, 0);
+  luaS_flat(L, ts2, 0);
+  s1 = getlstr(ts1, rl1);
+  s2 = getlstr(ts2, rl2);
   for (;;) {  /* for each segment */
     int temp = l_strcoll(s1, s2);
     if (temp != 0)  /* not equal? */
@@ -537,7 +582,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return luaV_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else
     return luaT_callorderTM(L, l, r, TM_LT);
 }
@@ -559,7 +604,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (lua_State *L, const TValue *l, const TValue *r) {
   lua_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return luaV_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else
     return luaT_callorderTM(L, l, r, TM_LE);
 }
@@ -713,9 +758,20 @@ void luaV_concat (lua_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = luaS_newlstr(L, buff, tl);
       }
+#if LUA_USE_ROPES
+      else if (luaS_isconcat(tsvalue(s2v(top - n)))) {  /* appending? */
+        /* result extends first string, maybe in place ('luaS_extend') */
+        size_t fl = tsvalue(s2v(top - n))->u.lnglen;
+        ts = luaS_extend(L, tsvalue(s2v(top - n)), tl);
+        copy2buff(top, n - 1, getlngstr(ts) + fl);
+      }
+#endif
       else {  /* long string; copy strings directly to final result */
         ts = luaS_createlngstrobj(L, tl);
         copy2buff(top, n, getlngstr(ts));
+#if LUA_USE_ROPES
+        ts->shrlen = LSTRCAT;  /* a later append will make a rope */
+#endif
       }
       setsvalue2s(L, top - n, ts);  /* create result */
     }
@@ -856,7 +912,7 @@ void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
-  OpCode op = GET_OPCODE(inst);
+  OpCode op = GET_BASEOPCODE(inst);  /* (it may have been quickened) */
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
       setobjs2s(L, base + GETARG_A(*(ci->u.l.savedpc - 2)), --L->top.p);
@@ -1007,6 +1063,37 @@ void luaV_finishOp (lua_State *L) {
   op_arith_aux(L, v1, v2, iop, fop); }
 
 
+/*
+** Arithmetic operations with register operands that quicken the
+** instruction into 'qi' for two integers or into 'qf' for two floats.
+*/
+#define op_arithQ(L,iop,fop,qi,qf) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (ttisinteger(v1) && ttisinteger(v2)) quicken(qi);  \
+  else if (ttisfloat(v1) && ttisfloat(v2)) quicken(qf);  \
+  op_arith_aux(L, v1, v2, iop, fop); }
+
+
+/*
+** Quickened arithmetic operations, specialized for operands whose
+** type is tested by 'tt' and whose values are read by 'get'. Other
+** operands turn the instruction back into its base opcode 'o' and
+** go through the generic code.
+*/
+#define op_arithS(L,tt,get,set,op,iop,fop,o) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(tt(v1) && tt(v2))) {  \
+    StkId ra = RA(i);  \
+    pc++; set(s2v(ra), op(L, get(v1), get(v2)));  \
+  }  \
+  else {  \
+    quicken(o);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  } }
+
+
 /*
 ** Arithmetic operations with K operands.
 */
@@ -1046,19 +1133,23 @@ void luaV_finishOp (lua_State *L) {
 /*
 ** Order operations with register operands. 'opn' actually works
 ** for all numbers, but the fast track improves performance for
-** integers.
+** integers. Quickens the instruction into 'qi' for two integers or
+** into 'qf' for two floats.
 */
-#define op_order(L,opi,opn,other) {  \
+#define op_order(L,opi,opn,other,qi,qf) {  \
   TValue *ra = vRA(i); \
   int cond;  \
   TValue *rb = vRB(i);  \
   if (ttisinteger(ra) && ttisinteger(rb)) {  \
     lua_Integer ia = ivalue(ra);  \
     lua_Integer ib = ivalue(rb);  \
+    quicken(qi);  \
     cond = opi(ia, ib);  \
   }  \
-  else if (ttisnumber(ra) && ttisnumber(rb))  \
+  else if (ttisnumber(ra) && ttisnumber(rb)) {  \
+    if (ttisfloat(ra) && ttisfloat(rb)) quicken(qf);  \
     cond = opn(ra, rb);  \
+  }  \
   else  \
     Protect(cond = other(L, ra, rb));  \
   docondjump(); }
@@ -1085,6 +1176,45 @@ void luaV_finishOp (lua_State *L) {
   }  \
   docondjump(); }
 
+
+/*
+** Quickened order operations (see 'op_arithS').
+*/
+#define op_orderS(L,tt,get,op,opn,other,o) {  \
+  TValue *ra = vRA(i); \
+  int cond;  \
+  TValue *rb = vRB(i);  \
+  if (l_likely(tt(ra) && tt(rb)))  \
+    cond = op(get(ra), get(rb));  \
+  else {  \
+    quicken(o);  \
+    if (ttisnumber(ra) && ttisnumber(rb))  \
+      cond = opn(ra, rb);  \
+    else  \
+      Protect(cond = other(L, ra, rb));  \
+  }  \
+  docondjump(); }
+
+
+#if LUA_USE_QUICKEN
+
+/*
+** Rewrite the instruction being executed with opcode 'o'. (A site
+** whose operand types keep changing keeps flipping between its base
+** opcode and a quickened one, which costs only a store each time.)
+** Code of fixed prototypes lives in memory owned by the host, maybe
+** read-only, so it is never rewritten.
+*/
+#define quicken(o)  \
+	((cl->p->flag & PF_FIXED) ? (void)0  \
+	  : (void)SET_OPCODE(cl->p->code[pcRel(pc, cl->p)], o))
+
+#else
+
+#define quicken(o)	((void)0)
+
+#endif
+
 /* }================================================================== */
 
 
@@ -1110,6 +1240,356 @@ void luaV_finishOp (lua_State *L) {
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
 
+#if LUA_USE_ICACHE
+
+/* inline cache of the instruction being executed */
+#define icache()	(cl->p->icache + pcRel(pc, cl->p))
+
+/*
+** Fast track for accessing a field 'key' (a short string) of 't'
+** through the inline cache of the current instruction. If the node
+** remembered by the cache still holds 'key', the access is one check
+** plus one load; otherwise, do a regular search, which also refreshes
+** the cache. The check is on the key itself, so table resizes or new
+** keys never leave the cache in an invalid state.
+*/
+#define fastgetfield(t,key,res,tag) {  \
+  if (!ttistable(t)) tag = LUA_VNOTABLE;  \
+  else {  \
+    Table *h_ = hvalue(t); l_uint32 *ic_ = icache();  \
+    Node *n_ = luaH_icnode(h_, *ic_);  \
+    if (l_likely(keyisshrstr(n_) && eqshrstr(keystrval(n_), key))) {  \
+      tag = ttypetag(gval(n_));  \
+      if (!tagisempty(tag)) setobj(L, res, gval(n_));  \
+    }  \
+    else tag = luaH_getshortstric(h_, key, res, ic_); } }
+
+/*
+** Same for assignments. As in 'luaH_psetshortstr', the fast track
+** applies only when the key already has a value.
+*/
+#define fastsetfield(t,key,val,hres) {  \
+  if (!ttistable(t)) hres = HNOTATABLE;  \
+  else {  \
+    Table *h_ = hvalue(t); l_uint32 *ic_ = icache();  \
+    Node *n_ = luaH_icnode(h_, *ic_);  \
+    if (l_likely(keyisshrstr(n_) && eqshrstr(keystrval(n_), key) &&  \
+                 !isempty(gval(n_)))) {  \
+      setobj(L, gval(n_), val); hres = HOK;  \
+    }  \
+    else hres = luaH_psetshortstric(h_, key, val, ic_); } }
+
+
+/*
+** Method lookup for OP_SELF when the receiver 'rb' has no value for
+** 'key' ('tag' is the result of that access). Methods usually live in
+** a table stored in the '__index' field of the receiver's metatable, so
+** look there through the inline cache before resorting to the general
+** 'luaV_finishget'. Returns true if it found the method (in 'res').
+*/
+static int selfindex (lua_State *L, const TValue *rb, TString *key,
+                      TValue *res, lu_byte tag, l_uint32 *ic) {
+  const TValue *tm;
+  if (tag == LUA_VNOTABLE)  /* receiver is not a table? (e.g., string) */
+    tm = luaT_gettmbyobj(L, rb, TM_INDEX);
+  else
+    tm = fasttm(L, hvalue(rb)->metatable, TM_INDEX);
+  if (tm != NULL && ttistable(tm)) {
+    Table *h = hvalue(tm);
+    Node *n = luaH_icnode(h, *ic);
+    if (l_likely(keyisshrstr(n) && eqshrstr(keystrval(n), key)))
+      tag = ttypetag(gval(n));
+    else {
+      const TValue *slot = luaH_Hgetshortstr(h, key);
+      tag = ttypetag(slot);
+      if (!tagisempty(tag))
+        *ic = cast(l_uint32, nodefromval(slot) - h->node);
+      n = nodefromval(slot);
+    }
+    if (!tagisempty(tag)) {
+      setobj(L, res, gval(n));
+      return 1;
+    }
+  }
+  return 0;  /* use the general case */
+}
+
+#else
+
+#define fastgetfield(t,key,res,tag)  \
+	luaV_fastget(t, key, res, luaH_getshortstr, tag)
+
+#define fastsetfield(t,key,val,hres)  \
+	luaV_fastset(t, key, val, hres, luaH_psetshortstr)
+
+#define selfindex(L,rb,key,res,tag,ic)	0
+
+#endif
+
+
+#if LUA_USE_JIT
+
+/* entry points for the native code (see ljit.c) */
+
+int luaV_forprep (lua_State *L, StkId ra) {
+  return forprep(L, ra);
+}
+
+
+int luaV_floatforloop (StkId ra) {
+  return floatforloop(ra);
+}
+
+
+#if LUA_USE_ICACHE
+int luaV_selfindex (lua_State *L, const TValue *rb, TString *key,
+                    TValue *res, lu_byte tag, l_uint32 *ic) {
+  return selfindex(L, rb, key, res, tag, ic);
+}
+#endif
+
+
+/*
+** Give the running function a chance to continue in native code (see
+** ljit.c). Called on function entry, after returns, and on backward
+** jumps, where 'jitcount' counts down to the compilation of functions
+** without native code.
+*/
+#define jitcheck()  \
+  { if (cl->p->jit != NULL || --cl->p->jitcount == 0) {  \
+      savepc(ci); pc = luaJ_enter(L, ci);  \
+      updatetrap(ci); updatebase(ci); } }
+
+#else
+
+#define jitcheck()	((void)0)
+
+#endif
+
+
+/*
+** {==================================================================
+** Instrumentation (see LUA_USE_OPSTATS)
+** ===================================================================
+*/
+
+#if LUA_USE_OPSTATS
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define l_cycles()	cast(lua_Unsigned, __rdtsc())
+#else
+#include <time.h>
+#define l_cycles()	cast(lua_Unsigned, clock())
+#endif
+
+
+/*
+** Average number of instructions between two samples. The actual
+** intervals are random, so that samples do not keep falling on the
+** same instructions of a loop.
+*/
+#if !defined(LUAI_OPSAMPLE)
+#define LUAI_OPSAMPLE	32
+#endif
+
+
+/* close the current sample, if any, charging it to its opcode */
+static void closesample (OpStats *os) {
+  if (os->pending >= 0) {
+    lua_Unsigned c = l_cycles() - os->start;
+    lua_Unsigned n = c;
+    int b = 0;
+    while ((n >>= 1) != 0 && b < LUA_OPSTATBUCKETS - 1)
+      b++;
+    os->samples[os->pending]++;
+    os->cycles[os->pending] += c;
+    os->hist[os->pending][b]++;
+    os->pending = -1;
+  }
+}
+
+
+/*
+** Account for instruction 'pc' of function 'p', which is about to
+** run: count it and, now and then, start timing it. A sample lasts
+** until the next instruction is fetched, so it includes everything
+** the instruction does (metamethods, C functions, etc.).
+*/
+static void countop (global_State *g, Proto *p, const Instruction *pc) {
+  OpStats *os = &g->opstats;
+  OpCode op = GET_OPCODE(*pc);
+  os->count[op]++;
+#if LUA_USE_OPSTATS >= 2
+  p->opcount[pc - p->code]++;
+#else
+  UNUSED(p);
+#endif
+  closesample(os);
+  if (--os->tick == 0) {
+    os->seed = os->seed * 1103515245u + 12345u;  /* next random number */
+    os->tick = 1 + (os->seed >> 16) % (2 * LUAI_OPSAMPLE - 1);
+    os->pending = op;
+    os->start = l_cycles();
+  }
+}
+
+
+/*
+** Clear all statistics, including the instruction counters of all
+** prototypes (which are all in list 'allgc').
+*/
+void luaV_resetopstats (global_State *g) {
+  OpStats *os = &g->opstats;
+  memset(os->count, 0, sizeof(os->count));
+  memset(os->samples, 0, sizeof(os->samples));
+  memset(os->cycles, 0, sizeof(os->cycles));
+  memset(os->hist, 0, sizeof(os->hist));
+  os->pending = -1;
+  os->tick = LUAI_OPSAMPLE;
+#if LUA_USE_OPSTATS >= 2
+  { GCObject *o;
+    for (o = g->allgc; o != NULL; o = o->next) {
+      if (o->tt == LUA_VPROTO) {
+        Proto *p = gco2p(o);
+        if (p->opcount != NULL)
+          memset(p->opcount, 0,
+                 cast_sizet(p->sizecode) * sizeof(p->opcount[0]));
+      }
+    }
+  }
+#endif
+}
+
+
+/* account for the instruction just fetched ('pc' already points to
+   the next one) */
+#define vmcount()	countop(G(L), cl->p, pc - 1)
+
+/* end the sample of the last instruction, when leaving the interpreter */
+#define vmcountend()	closesample(&G(L)->opstats)
+
+#else
+
+#define vmcount()	((void)0)
+#define vmcountend()	((void)0)
+
+#endif
+
+/* }================================================================== */
+
+
+/*
+** {==================================================================
+** Superinstructions
+** ===================================================================
+*/
+
+/*
+** Bodies of the instructions that can start a superinstruction (see
+** 'luaK_fuse'). Each one is used by its own opcode and by the
+** superinstructions that start with it.
+*/
+
+#define op_move() {  \
+  StkId ra = RA(i);  \
+  setobjs2s(L, ra, RB(i)); }
+
+
+#define op_loadi() {  \
+  StkId ra = RA(i);  \
+  lua_Integer b = GETARG_sBx(i);  \
+  setivalue(s2v(ra), b); }
+
+
+#define op_loadk() {  \
+  StkId ra = RA(i);  \
+  TValue *rb = k + GETARG_Bx(i);  \
+  setobj2s(L, ra, rb); }
+
+
+#define op_getupval() {  \
+  StkId ra = RA(i);  \
+  int b = GETARG_B(i);  \
+  setobj2s(L, ra, cl->upvals[b]->v.p); }
+
+
+#define op_gettabup() {  \
+  StkId ra = RA(i);  \
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  fastgetfield(upval, key, s2v(ra), tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, upval, rc, ra, tag)); }
+
+
+#define op_gettable() {  \
+  StkId ra = RA(i);  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = vRC(i);  \
+  lu_byte tag;  \
+  if (ttisinteger(rc)) {  /* fast track for integers? */  \
+    luaV_fastgeti(rb, ivalue(rc), s2v(ra), tag);  \
+  }  \
+  else  \
+    luaV_fastget(rb, rc, s2v(ra), luaH_get, tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, rb, rc, ra, tag)); }
+
+
+#define op_getfield() {  \
+  StkId ra = RA(i);  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  fastgetfield(rb, key, s2v(ra), tag);  \
+  if (tagisempty(tag))  \
+    Protect(luaV_finishget(L, rb, rc, ra, tag)); }
+
+
+#define op_setfield() {  \
+  StkId ra = RA(i);  \
+  int hres;  \
+  TValue *rb = KB(i);  \
+  TValue *rc = RKC(i);  \
+  TString *key = tsvalue(rb);  /* key must be a short string */  \
+  fastsetfield(s2v(ra), key, rc, hres);  \
+  if (hres == HOK)  \
+    luaV_finishfastset(L, s2v(ra), rc);  \
+  else  \
+    Protect(luaV_finishset(L, s2v(ra), rb, rc, hres)); }
+
+
+#define op_self() {  \
+  StkId ra = RA(i);  \
+  lu_byte tag;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  setobj2s(L, ra + 1, rb);  \
+  fastgetfield(rb, key, s2v(ra), tag);  \
+  if (tagisempty(tag) &&  \
+      !selfindex(L, rb, key, s2v(ra), tag, icache()))  \
+    Protect(luaV_finishget(L, rb, rc, ra, tag)); }
+
+
+/*
+** Finish a superinstruction: fetch its second instruction and go
+** straight to the code for it (label 'l'), without a dispatch. With
+** hooks or a moved stack ('trap'), do a regular dispatch instead, so
+** that the second instruction goes through 'luaG_traceexec'.
+*/
+#define vmfuse(l)  \
+  { if (l_unlikely(trap)) { vmbreak; }  \
+    i = *(pc++);  \
+    vmcount();  \
+    goto l; }
+
+/* }================================================================== */
+
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
 
@@ -1188,6 +1668,7 @@ void luaV_finishOp (lua_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  vmcount(); \
 }
 
 #define vmdispatch(o)	switch(o)
@@ -1213,6 +1694,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
   base = ci->func.p + 1;
+  jitcheck();
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1231,14 +1713,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
     lua_assert(luaP_isIT(i) || (cast_void(L->top.p = base), 1));
     vmdispatch (GET_OPCODE(i)) {
       vmcase(OP_MOVE) {
-        StkId ra = RA(i);
-        setobjs2s(L, ra, RB(i));
+        op_move();
         vmbreak;
       }
       vmcase(OP_LOADI) {
-        StkId ra = RA(i);
-        lua_Integer b = GETARG_sBx(i);
-        setivalue(s2v(ra), b);
+        op_loadi();
         vmbreak;
       }
       vmcase(OP_LOADF) {
@@ -1248,9 +1727,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LOADK) {
-        StkId ra = RA(i);
-        TValue *rb = k + GETARG_Bx(i);
-        setobj2s(L, ra, rb);
+        op_loadk();
         vmbreak;
       }
       vmcase(OP_LOADKX) {
@@ -1285,9 +1762,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETUPVAL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        setobj2s(L, ra, cl->upvals[b]->v.p);
+        op_getupval();
         vmbreak;
       }
       vmcase(OP_SETUPVAL) {
@@ -1298,28 +1773,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        StkId ra = RA(i);
-        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(upval, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, upval, rc, ra, tag));
+        op_gettabup();
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = vRC(i);
-        lu_byte tag;
-        if (ttisinteger(rc)) {  /* fast track for integers? */
-          luaV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
-        }
-        else
-          luaV_fastget(rb, rc, s2v(ra), luaH_get, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+        op_gettable();
         vmbreak;
       }
       vmcase(OP_GETI) {
@@ -1336,14 +1794,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETFIELD) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+       l_getfield:
+        op_getfield();
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1352,7 +1804,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = KB(i);
         TValue *rc = RKC(i);
         TString *key = tsvalue(rb);  /* key must be a short string */
-        luaV_fastset(upval, key, rc, hres, luaH_psetshortstr);
+        fastsetfield(upval, key, rc, hres);
         if (hres == HOK)
           luaV_finishfastset(L, upval, rc);
         else
@@ -1392,16 +1844,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SETFIELD) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        luaV_fastset(s2v(ra), key, rc, hres, luaH_psetshortstr);
-        if (hres == HOK)
-          luaV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(luaV_finishset(L, s2v(ra), rb, rc, hres));
+        op_setfield();
         vmbreak;
       }
       vmcase(OP_NEWTABLE) {
@@ -1426,15 +1869,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_SELF) {
-        StkId ra = RA(i);
-        lu_byte tag;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        setobj2s(L, ra + 1, rb);
-        luaV_fastget(rb, key, s2v(ra), luaH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(luaV_finishget(L, rb, rc, ra, tag));
+       l_self:
+        op_self();
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1504,15 +1940,15 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
-        op_arith(L, l_addi, luai_numadd);
+        op_arithQ(L, l_addi, luai_numadd, OP_ADDII, OP_ADDFF);
         vmbreak;
       }
       vmcase(OP_SUB) {
-        op_arith(L, l_subi, luai_numsub);
+        op_arithQ(L, l_subi, luai_numsub, OP_SUBII, OP_SUBFF);
         vmbreak;
       }
       vmcase(OP_MUL) {
-        op_arith(L, l_muli, luai_nummul);
+        op_arithQ(L, l_muli, luai_nummul, OP_MULII, OP_MULFF);
         vmbreak;
       }
       vmcase(OP_MOD) {
@@ -1559,7 +1995,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         TValue *rb = vRB(i);
         TMS tm = (TMS)GETARG_C(i);
         StkId result = RA(pi);
-        lua_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
+        lua_assert(OP_ADD <= GET_BASEOPCODE(pi) &&
+                   GET_BASEOPCODE(pi) <= OP_SHR);
         Protect(luaT_trybinTM(L, s2v(ra), rb, result, tm));
         vmbreak;
       }
@@ -1645,22 +2082,25 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       }
       vmcase(OP_JMP) {
         dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0)  /* loop? */
+          jitcheck();
         vmbreak;
       }
       vmcase(OP_EQ) {
         StkId ra = RA(i);
         int cond;
         TValue *rb = vRB(i);
+        if (ttisinteger(s2v(ra)) && ttisinteger(rb)) quicken(OP_EQII);
         Protect(cond = luaV_equalobj(L, s2v(ra), rb));
         docondjump();
         vmbreak;
       }
       vmcase(OP_LT) {
-        op_order(L, l_lti, LTnum, lessthanothers);
+        op_order(L, l_lti, LTnum, lessthanothers, OP_LTII, OP_LTFF);
         vmbreak;
       }
       vmcase(OP_LE) {
-        op_order(L, l_lei, LEnum, lessequalothers);
+        op_order(L, l_lei, LEnum, lessequalothers, OP_LEII, OP_LEFF);
         vmbreak;
       }
       vmcase(OP_EQK) {
@@ -1718,6 +2158,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_CALL) {
+       l_call: {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
@@ -1726,14 +2167,16 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(ci);  /* in case of errors */
-        if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+        if ((newci = luaD_precall(L, ra, nresults)) == NULL) {
           updatetrap(ci);  /* C call; nothing else to be done */
+          jitcheck();
+        }
         else {  /* Lua call: run function in this same C frame */
           ci = newci;
           goto startfunc;
         }
         vmbreak;
-      }
+      }}
       vmcase(OP_TAILCALL) {
         StkId ra = RA(i);
         int b = GETARG_B(i);  /* number of arguments + 1 (function) */
@@ -1783,6 +2226,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         goto ret;
       }
       vmcase(OP_RETURN0) {
+       l_return0:
         if (l_unlikely(L->hookmask)) {
           StkId ra = RA(i);
           L->top.p = ra;
@@ -1800,6 +2244,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         goto ret;
       }
       vmcase(OP_RETURN1) {
+       l_return1:
         if (l_unlikely(L->hookmask)) {
           StkId ra = RA(i);
           L->top.p = ra + 1;
@@ -1821,8 +2266,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           }
         }
        ret:  /* return from a Lua function */
-        if (ci->callstatus & CIST_FRESH)
+        if (ci->callstatus & CIST_FRESH) {
+          vmcountend();  /* do not time the C code that called us */
           return;  /* end this frame */
+        }
         else {
           ci = ci->previous;
           goto returning;  /* continue running caller in this frame */
@@ -1839,10 +2286,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             idx = intop(+, idx, step);  /* add step to index */
             chgivalue(s2v(ra + 2), idx);  /* update control variable */
             pc -= GETARG_Bx(i);  /* jump back */
+            jitcheck();
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitcheck();
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
@@ -1869,6 +2319,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         halfProtect(luaF_newtbcupval(L, ra + 2));
         pc += GETARG_Bx(i);  /* go to end of the loop */
         i = *(pc++);  /* fetch next instruction */
+        vmcount();
         lua_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
         goto l_tforcall;
       }
@@ -1881,21 +2332,28 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
            return will be the new value for the control variable.
         */
         StkId ra = RA(i);
-        setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
-        setobjs2s(L, ra + 4, ra + 1);  /* copy state */
-        setobjs2s(L, ra + 3, ra);  /* copy function */
-        L->top.p = ra + 3 + 3;
-        ProtectNT(luaD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
+        if (israwnext(L, ra))  /* iterator is the raw 'next'? */
+          halfProtect(rawnext(L, ra, GETARG_C(i)));
+        else {
+          setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
+          setobjs2s(L, ra + 4, ra + 1);  /* copy state */
+          setobjs2s(L, ra + 3, ra);  /* copy function */
+          L->top.p = ra + 3 + 3;
+          ProtectNT(luaD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
+          updatestack(ci);  /* stack may have changed */
+        }
         i = *(pc++);  /* go to next instruction */
+        vmcount();
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
         goto l_tforloop;
       }}
       vmcase(OP_TFORLOOP) {
        l_tforloop: {
         StkId ra = RA(i);
-        if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
+        if (!ttisnil(s2v(ra + 3))) {  /* continue loop? */
           pc -= GETARG_Bx(i);  /* jump back */
+          jitcheck();
+        }
         vmbreak;
       }}
       vmcase(OP_SETLIST) {
@@ -1965,6 +2423,117 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         lua_assert(0);
         vmbreak;
       }
+      vmcase(OP_ADDII) {
+        op_arithS(L, ttisinteger, ivalue, setivalue, l_addi,
+                  l_addi, luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADDFF) {
+        op_arithS(L, ttisfloat, fltvalue, setfltvalue, luai_numadd,
+                  l_addi, luai_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        op_arithS(L, ttisinteger, ivalue, setivalue, l_subi,
+                  l_subi, luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUBFF) {
+        op_arithS(L, ttisfloat, fltvalue, setfltvalue, luai_numsub,
+                  l_subi, luai_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        op_arithS(L, ttisinteger, ivalue, setivalue, l_muli,
+                  l_muli, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MULFF) {
+        op_arithS(L, ttisfloat, fltvalue, setfltvalue, luai_nummul,
+                  l_muli, luai_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_EQII) {
+        StkId ra = RA(i);
+        int cond;
+        TValue *rb = vRB(i);
+        if (l_likely(ttisinteger(s2v(ra)) && ttisinteger(rb)))
+          cond = (ivalue(s2v(ra)) == ivalue(rb));
+        else {
+          quicken(OP_EQ);
+          Protect(cond = luaV_equalobj(L, s2v(ra), rb));
+        }
+        docondjump();
+        vmbreak;
+      }
+      vmcase(OP_LTII) {
+        op_orderS(L, ttisinteger, ivalue, l_lti,
+                  LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LTFF) {
+        op_orderS(L, ttisfloat, fltvalue, luai_numlt,
+                  LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEII) {
+        op_orderS(L, ttisinteger, ivalue, l_lei,
+                  LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_LEFF) {
+        op_orderS(L, ttisfloat, fltvalue, luai_numle,
+                  LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_MOVE_CALL) {
+        op_move();
+        vmfuse(l_call);
+      }
+      vmcase(OP_LOADI_CALL) {
+        op_loadi();
+        vmfuse(l_call);
+      }
+      vmcase(OP_LOADK_CALL) {
+        op_loadk();
+        vmfuse(l_call);
+      }
+      vmcase(OP_SELF_CALL) {
+        op_self();
+        vmfuse(l_call);
+      }
+      vmcase(OP_GETUPVAL_GETFIELD) {
+        op_getupval();
+        vmfuse(l_getfield);
+      }
+      vmcase(OP_GETTABUP_GETFIELD) {
+        op_gettabup();
+        vmfuse(l_getfield);
+      }
+      vmcase(OP_GETFIELD_GETFIELD) {
+        op_getfield();
+        vmfuse(l_getfield);
+      }
+      vmcase(OP_GETTABLE_GETFIELD) {
+        op_gettable();
+        vmfuse(l_getfield);
+      }
+      vmcase(OP_GETTABLE_SELF) {
+        op_gettable();
+        vmfuse(l_self);
+      }
+      vmcase(OP_GETFIELD_RETURN1) {
+        op_getfield();
+        vmfuse(l_return1);
+      }
+      vmcase(OP_LOADI_RETURN1) {
+        op_loadi();
+        vmfuse(l_return1);
+      }
+      vmcase(OP_SETFIELD_RETURN0) {
+        op_setfield();
+        vmfuse(l_return0);
+      }
     }
   }
 }
@@ -302,6 +302,16 @@ LUAI_FUNC int luaV_lessthan(lua_State *L, const TValue *l, const TValue *r);
 ** 结合实际代码：用于<运算符，支持数字、字符串等，并处理元方法。
 */
 
+LUAI_FUNC int luaV_strcmp(lua_State *L, TString *ts1, TString *ts2);
+/*
+** 添加的说明注释：
+** 函数luaV_strcmp：按 strcoll 的顺序比较两个字符串(允许内含 '\0')。
+** 返回负数、0、正数分别表示 ts1 小于、等于、大于 ts2。
+** Rope 视图会先被展平(可能分配内存)。
+** 结合实际代码：luaV_lessthan/luaV_lessequal 比较字符串时使用；
+** ltable.c 中对数组部分的字符串排序也直接调用它。
+*/
+
 LUAI_FUNC int luaV_lessequal(lua_State *L, const TValue *l, const TValue *r);
 /*
 ** 添加的说明注释：
@@ -387,6 +397,30 @@ LUAI_FUNC void luaV_execute(lua_State *L, CallInfo *ci);
 ** 涉及的C用法：CallInfo是ldo.h中的结构，管理调用栈。
 */
 
+#if LUA_USE_JIT
+LUAI_FUNC int luaV_forprep(lua_State *L, StkId ra);
+LUAI_FUNC int luaV_floatforloop(StkId ra);
+#if LUA_USE_ICACHE
+LUAI_FUNC int luaV_selfindex(lua_State *L, const TValue *rb, TString *key,
+                             TValue *res, lu_byte tag, l_uint32 *ic);
+#endif
+/*
+** 添加的说明注释：
+** 供机器码(ljit.c)调用的OP_FORPREP、浮点OP_FORLOOP与OP_SELF方法查找的实现。
+** luaV_forprep返回真表示跳过循环；luaV_floatforloop返回真表示继续循环；
+** luaV_selfindex在接收者的元表'__index'表中经内联缓存查找方法，找到时返回真。
+*/
+#endif
+
+#if LUA_USE_OPSTATS
+LUAI_FUNC void luaV_resetopstats(global_State *g);
+/*
+** 添加的说明注释：
+** 清零操作码统计(插桩构建，见LUA_USE_OPSTATS)，包括所有函数原型中
+** 每条指令的计数。由lua_newstate初始化时和lua_resetopstats调用。
+*/
+#endif
+
 LUAI_FUNC void luaV_concat(lua_State *L, int total);
 /*
 ** 添加的说明注释：
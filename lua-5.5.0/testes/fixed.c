@@ -0,0 +1,128 @@
+/*
+** $Id: fixed.c $
+** Run a binary chunk loaded in mode "B" (fixed buffer)
+** See Copyright Notice in lua.h
+*/
+
+/*
+** The code of a fixed chunk stays in the buffer given to 'lua_load',
+** which the host may keep in read-only memory. Running it must never
+** write to that buffer (quickened opcodes, superinstructions). Where
+** it can, this test maps the buffer read-only, so a write crashes; it
+** always checks that the buffer is unchanged after the calls.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define USE_MMAP
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+
+
+static const char chunk[] =
+  "local function loop (a, b)\n"
+  "  local s = 0\n"
+  "  for i = 1, 100 do\n"
+  "    s = s + a * b - i\n"
+  "    if a < b then s = s - 1 end\n"
+  "    if a == b then s = s + 1 end\n"
+  "  end\n"
+  "  return s\n"
+  "end\n"
+  "return loop(...) + loop(2.5, 1.5) + loop(3, 3)\n";
+
+
+typedef struct Dump {
+  char *p;
+  size_t n;
+  size_t size;
+} Dump;
+
+
+static int writer (lua_State *L, const void *p, size_t sz, void *ud) {
+  Dump *d = (Dump *)ud;
+  (void)L;
+  if (d->n + sz > d->size) {
+    size_t newsize = (d->size + sz) * 2;
+    char *np = (char *)realloc(d->p, newsize);
+    if (np == NULL)
+      return 1;
+    d->p = np;
+    d->size = newsize;
+  }
+  memcpy(d->p + d->n, p, sz);
+  d->n += sz;
+  return 0;
+}
+
+
+static char *fixedcopy (const Dump *d) {
+#if defined(USE_MMAP)
+  void *p = mmap(NULL, d->n, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return NULL;
+  memcpy(p, d->p, d->n);
+  if (mprotect(p, d->n, PROT_READ) != 0)
+    return NULL;
+  return (char *)p;
+#else
+  char *p = (char *)malloc(d->n);
+  if (p != NULL)
+    memcpy(p, d->p, d->n);
+  return p;
+#endif
+}
+
+
+static int fail (lua_State *L, const char *what) {
+  fprintf(stderr, "fixed: %s: %s\n", what,
+                  L ? lua_tostring(L, -1) : "out of memory");
+  return EXIT_FAILURE;
+}
+
+
+int main (void) {
+  Dump d = {NULL, 0, 0};
+  char *fixed;
+  int i;
+  lua_State *L = luaL_newstate();
+  if (L == NULL)
+    return fail(NULL, "cannot create state");
+  if (luaL_loadstring(L, chunk) != LUA_OK)
+    return fail(L, "load");
+  if (lua_dump(L, writer, &d, 0) != 0)
+    return fail(NULL, "dump");
+  lua_pop(L, 1);
+  fixed = fixedcopy(&d);
+  if (fixed == NULL)
+    return fail(NULL, "buffer");
+  if (luaL_loadbufferx(L, fixed, d.n, "=fixed", "B") != LUA_OK)
+    return fail(L, "load fixed");
+  for (i = 0; i < 4; i++) {  /* flip operand types at each site */
+    lua_pushvalue(L, -1);
+    if (i % 2 == 0) {
+      lua_pushinteger(L, 2); lua_pushinteger(L, 3);
+    }
+    else {
+      lua_pushnumber(L, 2.5); lua_pushnumber(L, 0.5);
+    }
+    if (lua_pcall(L, 2, 1, 0) != LUA_OK)
+      return fail(L, "call");
+    lua_pop(L, 1);
+  }
+  if (memcmp(fixed, d.p, d.n) != 0) {
+    fprintf(stderr, "fixed: buffer was changed\n");
+    return EXIT_FAILURE;
+  }
+  lua_close(L);  /* a fixed buffer must outlive the state */
+  free(d.p);
+  printf("fixed: OK\n");
+  return EXIT_SUCCESS;
+}
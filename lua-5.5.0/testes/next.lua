@@ -0,0 +1,153 @@
+-- $Id: testes/next.lua $
+-- See Copyright Notice in file lua.h
+
+-- Generic 'for' loops over the raw 'next', which the VM runs without
+-- calling 'next' (see 'rawnext' in lvm.c). They must behave exactly as
+-- the calls would, whatever other traversals run in between.
+
+print("testing generic for over next")
+
+local function mktable ()
+  local t = {10, 20, 30, 40, 50}
+  for i = 1, 100 do t["k" .. i] = i end
+  for i = 1, 20 do t[i + 0.5] = i end
+  return t
+end
+
+-- reference traversal, with explicit calls to 'next'
+local function keys (t)
+  local r, k = {}, nil
+  while true do
+    k = next(t, k)
+    if k == nil then return r end
+    r[#r + 1] = k
+  end
+end
+
+local function forkeys (t)
+  local r = {}
+  for k in pairs(t) do r[#r + 1] = k end
+  return r
+end
+
+local function same (a, b)
+  assert(#a == #b)
+  for i = 1, #a do assert(a[i] == b[i]) end
+end
+
+do  -- same order as 'next', also with 'next' itself as the iterator
+  local t = mktable()
+  same(forkeys(t), keys(t))
+  local r = {}
+  for k, v in next, t do assert(t[k] == v); r[#r + 1] = k end
+  same(r, keys(t))
+  local n = 0
+  for k, v, x in pairs(t) do assert(t[k] == v and x == nil); n = n + 1 end
+  assert(n == #keys(t))
+end
+
+do  -- hidden variables hold what they hold with calls to 'next'
+  local t = mktable()
+  for k in pairs(t) do
+    local hidden = {}   -- values of the first three "(for state)"
+    local i = 1
+    while #hidden < 3 do
+      local name, v = debug.getlocal(1, i)
+      if name == "(for state)" then hidden[#hidden + 1] = {v} end
+      i = i + 1
+    end
+    assert(hidden[1][1] == next and hidden[2][1] == t)
+    assert(hidden[3][1] == nil and k ~= nil)
+    break
+  end
+  for k, v in next, t, nil do   -- starting from a given key
+    local r = {}
+    for kk in next, t, k do r[#r + 1] = kk end
+    local ref = keys(t)
+    assert(#r == #ref - 1 and r[1] == ref[2])
+    break
+  end
+end
+
+do  -- nested traversals of the same table and of other tables
+  local t = mktable()
+  local ref = keys(t)
+  local n = 0
+  for k in pairs(t) do
+    n = n + 1
+    assert(k == ref[n])
+    local m = 0
+    for _ in pairs(t) do m = m + 1 end
+    assert(m == #ref)
+    for _ in pairs({a = 1, b = 2, 3}) do end
+  end
+  assert(n == #ref)
+end
+
+do  -- interleaved traversals in coroutines
+  local t = mktable()
+  local ref = keys(t)
+  local function gen ()
+    return coroutine.wrap(function ()
+      for k in pairs(t) do coroutine.yield(k) end
+    end)
+  end
+  local g1, g2 = gen(), gen()
+  for i = 1, #ref do
+    assert(g1() == ref[i]); assert(g2() == ref[i])
+    local _ = next(t)   -- a traversal in the main thread too
+  end
+  assert(g1() == nil)
+end
+
+do  -- clearing fields during the traversal
+  local t = mktable()
+  local n = #keys(t)
+  for k in pairs(t) do t[k] = nil; n = n - 1 end
+  assert(n == 0 and next(t) == nil)
+  t = mktable()
+  for k in pairs(t) do
+    if type(k) == "string" then t[k] = nil end
+    collectgarbage()   -- keys may become dead
+  end
+  for k in pairs(t) do assert(type(k) == "number") end
+end
+
+do  -- changing the control variable through the debug library
+  local t = mktable()
+  local ref = keys(t)
+  local r = {}
+  for k in pairs(t) do
+    r[#r + 1] = k
+    if #r == 1 then
+      for i = 1, math.huge do
+        local name = debug.getlocal(1, i)
+        if name == "k" then debug.setlocal(1, i, ref[10]); break end
+      end
+    end
+  end
+  assert(r[1] == ref[1] and r[2] == ref[11] and #r == #ref - 9)
+end
+
+do  -- an invalid key gives the same error as 'next'
+  local t = {a = 1}
+  local ok, msg = pcall(function ()
+    for k in next, t, "nope" do end
+  end)
+  assert(not ok and string.find(msg, "invalid key to 'next'"))
+end
+
+do  -- '__pairs' and closing values are still honored
+  local log = {}
+  local t = setmetatable({}, {__pairs = function (t)
+    return function (_, k) if not k then return 1, 1 end end, t, nil
+  end})
+  for k in pairs(t) do log[#log + 1] = k end
+  assert(#log == 1 and log[1] == 1)
+  local closed = false
+  local cl = setmetatable({}, {__close = function () closed = true end})
+  for k in next, {1, 2, 3}, nil, cl do assert(not closed) end
+  assert(closed)
+end
+
+print("OK")
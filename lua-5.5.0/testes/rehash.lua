@@ -0,0 +1,90 @@
+-- $Id: testes/rehash.lua $
+-- See Copyright Notice in file lua.h
+
+print("testing traversals during incremental rehashes")
+
+local stats = debug.tablestats
+
+-- fill 't' with new keys 'k1', 'k2', ... until it is in the middle of
+-- an incremental rehash; returns the number of keys. (A rehash moves
+-- only a few nodes per new key, so it lasts for many keys.)
+local function midrehash (t)
+  local n = 0
+  repeat
+    n = n + 1
+    t["k" .. n] = n
+  until n % 256 == 0 and stats(t).oldsize > 0
+  return n
+end
+
+-- add new keys 'x1', 'x2', ... to 't' until its rehash is complete,
+-- then remove them
+local function finish (t)
+  local m = 0
+  repeat
+    m = m + 1
+    t["x" .. m] = m
+  until m % 256 == 0 and stats(t).oldsize == 0
+  for i = 1, m do t["x" .. i] = nil end
+end
+
+-- check that 't' has exactly keys 'k1' to 'kn' (but the ones in 'gone')
+local function check (t, n, gone)
+  local seen = {}
+  local count = 0
+  for k, v in pairs(t) do
+    assert(not seen[k] and t[k] == v and "k" .. v == k)
+    seen[k] = true
+    count = count + 1
+  end
+  for i = 1, n do
+    assert((seen["k" .. i] or false) == not (gone and gone[i]))
+  end
+  return count
+end
+
+do  -- traversals see both hash parts and move nothing
+  local t = {}
+  local n = midrehash(t)
+  local old = stats(t).oldsize
+  assert(check(t, n) == n)
+  local count, k = 0, next(t)
+  while k do count = count + 1; k = next(t, k) end
+  assert(count == n)
+  assert(stats(t).oldsize == old)   -- still rehashing
+end
+
+do  -- removing fields while traversing
+  local t = {}
+  local n = midrehash(t)
+  local gone = {}
+  for k, v in pairs(t) do
+    if v % 3 == 0 then t[k] = nil; gone[v] = true end
+  end
+  check(t, n, gone)
+  collectgarbage()
+  check(t, n, gone)
+  finish(t)
+  check(t, n, gone)
+end
+
+do  -- cloning while traversing
+  local t = {1, 2, 3}
+  local n = midrehash(t)
+  t[1], t[2], t[3] = nil
+  local old = stats(t).oldsize
+  local c
+  local count = 0
+  for k in pairs(t) do
+    count = count + 1
+    if count == n // 2 then c = table.clone(t) end
+  end
+  assert(count == n and stats(t).oldsize == old)
+  assert(stats(c).oldsize == old)
+  finish(c)
+  assert(stats(t).oldsize == old)   -- 'c' has its own old part
+  assert(check(c, n) == n)
+  assert(check(t, n) == n)
+end
+
+print("OK")
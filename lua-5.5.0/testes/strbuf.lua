@@ -0,0 +1,58 @@
+-- $Id: testes/strbuf.lua $
+-- See Copyright Notice in file lua.h
+
+print("testing string buffers")
+
+local big = string.rep("z", 1 << 20)
+
+do  -- '__tostring' changes the buffer being formatted into
+  local b = string.buffer()
+  local evil = setmetatable({}, {__tostring = function ()
+    b:put(big)
+    return "evil"
+  end})
+  b:putf("%s-%s", "x", evil)
+  assert(#b == #big + #"x-evil")
+  assert(b:tostring() == big .. "x-evil")
+
+  b:reset()
+  b:put("abc")
+  evil = setmetatable({}, {__tostring = function ()
+    b:reset()
+    return "evil"
+  end})
+  b:putf("%s-%5s|", "x", evil)
+  assert(b:tostring() == "x- evil|")
+
+  -- errors leave the buffer usable
+  evil = setmetatable({}, {__tostring = function () error("boom") end})
+  b:reset()
+  assert(not pcall(b.putf, b, "%s%s", "x", evil))
+  b:put("ok")
+  assert(b:tostring() == "ok")
+end
+
+do  -- finalizers run by conversions change the buffer
+  local b = string.buffer()
+  local n = 0
+  local args = {}
+  for i = 1, 200 do args[i] = i + 0.5 end
+  local expected = 0
+  for _ = 1, 50 do
+    for _ = 1, 20 do
+      setmetatable({}, {__gc = function () b:put(big); n = n + 1 end})
+    end
+    b:put(table.unpack(args))
+    b:pack("n" .. string.rep("s", 100), 1.5, table.unpack(args, 1, 100))
+  end
+  collectgarbage()
+  expected = #big * n
+  for _ = 1, 50 do
+    expected = expected + #table.concat(args)
+    expected = expected + string.packsize("n") + 100 * string.packsize("j")
+    for i = 1, 100 do expected = expected + #tostring(args[i]) end
+  end
+  assert(#b == expected)
+end
+
+print("OK")
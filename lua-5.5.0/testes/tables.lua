@@ -0,0 +1,99 @@
+-- $Id: testes/tables.lua $
+-- See Copyright Notice in file lua.h
+
+-- Randomized table torture test. Its digest must not depend on the
+-- hash-part engine, so this runs unchanged with LUA_USE_SWISSHASH
+-- (see target 'test-swiss' in src/Makefile).
+
+print("testing tables")
+
+local seed = 42
+local function rnd (n)
+  seed = (seed * 1103515245 + 12345) % 2147483648
+  return seed % n + 1
+end
+
+local objs = {}
+for i = 1, 50 do objs[i] = {} end
+
+local function randkey ()
+  local k = rnd(9)
+  if k == 1 then return rnd(100)
+  elseif k == 2 then return -rnd(1000)
+  elseif k == 3 then return rnd(1000) + 0.5
+  elseif k == 4 then return "s" .. rnd(500)
+  elseif k == 5 then return string.rep("L", 41) .. rnd(100)  -- long
+  elseif k == 6 then return objs[rnd(50)]
+  elseif k == 7 then return rnd(2) == 1
+  elseif k == 8 then return rnd(2^40) * 3
+  else return rnd(20) + 0.0  -- float with an integer value
+  end
+end
+
+local function keystr (k)
+  if type(k) == "table" then
+    for i = 1, 50 do
+      if objs[i] == k then return "obj" .. i end
+    end
+  end
+  return type(k) .. ":" .. tostring(k)
+end
+
+local digest = 0
+local function mix (s)
+  for i = 1, #s do digest = (digest * 31 + s:byte(i)) % 4294967296 end
+end
+
+for _ = 1, 200 do
+  local t = {}
+  for op = 1, rnd(400) do
+    local k = randkey()
+    local r = rnd(10)
+    if r <= 6 then t[k] = op
+    elseif r <= 9 then t[k] = nil
+    else  -- delete during traversal
+      for kk in pairs(t) do
+        if (#keystr(kk) + op) % 3 == 0 then t[kk] = nil end
+      end
+    end
+  end
+  -- every key from 'pairs' is found by indexing
+  local keys = {}
+  for k, v in pairs(t) do
+    assert(t[k] == v and v ~= nil)
+    keys[#keys + 1] = keystr(k) .. "=" .. v
+  end
+  table.sort(keys)
+  mix(table.concat(keys, ","))
+  local n = #t
+  assert(n == 0 or t[n] ~= nil); assert(t[n + 1] == nil)
+  for i = 1, 20 do assert(t[i + 0.0] == t[i]) end
+end
+assert(digest == 0xe12267bf, string.format("digest %08x", digest))
+
+do  -- weak keys
+  local w = setmetatable({}, {__mode = "k"})
+  for i = 1, 1000 do w[{}] = i end
+  local keep = {}
+  for i = 1, 100 do local k = {}; keep[i] = k; w[k] = i end
+  collectgarbage(); collectgarbage()
+  local c = 0
+  for _ in pairs(w) do c = c + 1 end
+  assert(c == 100)
+  for i = 1, 100 do assert(w[keep[i]] == i) end
+end
+
+do  -- big tables
+  local N = 200000
+  local big = {}
+  for i = 1, N do big["k" .. i] = i end
+  for i = 1, N, 2 do big["k" .. i] = nil end
+  for i = 1, N do assert(big["k" .. i] == ((i % 2 == 0) and i or nil)) end
+  local c = 0
+  for _ in pairs(big) do c = c + 1 end
+  assert(c == N // 2)
+  for i = 1, N // 2 do big[i] = i end
+  for i = 1, N // 2 do assert(big[i] == i) end
+end
+
+print("OK")